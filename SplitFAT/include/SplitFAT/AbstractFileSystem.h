@@ -7,10 +7,12 @@
 
 #include "SplitFAT/Common.h"
 #include "SplitFAT/FileSystemConstants.h"
+#include "SplitFAT/utils/Mutex.h"
 #include <stdio.h>
 #include <string>
 #include <memory>
 #include <functional>
+#include <atomic>
 
 namespace SFAT {
 
@@ -22,6 +24,7 @@ namespace SFAT {
 
 	class FileBase {
 		friend class FileStorageBase;
+		friend class FileHandle;
 	public:
 		FileBase(FileStorageBase& fileStorage);
 		virtual ~FileBase();
@@ -46,6 +49,11 @@ namespace SFAT {
 	protected:
 		FileStorageBase& mFileStorage;
 		uint32_t mAccessMode;
+		// Keeps the seek and the following read/write together, when the file is shared between threads.
+		SFATMutex mPositionedAccessMutex;
+
+	private:
+		std::atomic<bool> mHasUnsyncedWrites; // Written through any of the handles since the last flush
 	};
 
 	class FileHandle final {
@@ -64,6 +72,9 @@ namespace SFAT {
 		ErrorCode seek(FilePositionType offset, SeekMode mode);
 		ErrorCode getPosition(FilePositionType& position);
 		ErrorCode flush();
+		// Returns true if the file was written through any of its handles since its last flush.
+		// Used to skip the flushes, that would not sync anything.
+		bool hasUnsyncedWrites() const;
 		bool checkAccessMode(uint32_t accessModeMask) const;
 		ErrorCode reset();
 
@@ -0,0 +1,197 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <atomic>
+
+namespace SFAT {
+
+	enum class ClusterCachePriority : uint32_t {
+		CCP_FILE_DATA,
+		CCP_METADATA, /// Directory clusters. Evicted only if there are no file-data clusters to be evicted.
+		CCP_COUNT
+	};
+
+	struct ClusterCacheStats {
+		ClusterCacheStats();
+
+		uint32_t mCountHits;		/// Count of the lookups that found the cluster in the cache.
+		uint32_t mCountMisses;		/// Count of the lookups that didn't find the cluster.
+		uint32_t mCountEvictions;	/// Count of the clusters evicted to stay in the budget.
+		uint32_t mCountGhostHits;	/// Count of the clusters added again shortly after their eviction. These are treated as frequently used.
+	};
+
+	// The callback can write the cluster data on the storage and mark it in sync.
+	using DirtyClusterCallbackType = std::function<ErrorCode(ClusterIndexType clusterIndex, uint8_t* buffer, bool& isInSync)>;
+
+	/**
+	*	Hash table with open addressing and linear probing, mapping cluster indices to 32-bit values.
+	*	The slots are stored in a single array, so a lookup usually touches one cache line.
+	*	The deleted elements are removed with backward shifting, so there are no tombstones.
+	*/
+	class ClusterIndexHashTable {
+	public:
+		static const uint32_t kInvalidValue = 0xFFFFFFFF;
+
+		ClusterIndexHashTable();
+
+		// Returns kInvalidValue if the key is not found.
+		uint32_t find(ClusterIndexType key) const;
+		// Adds the key or replaces its value. The value can't be kInvalidValue.
+		void insert(ClusterIndexType key, uint32_t value);
+		bool erase(ClusterIndexType key);
+		size_t size() const;
+
+	private:
+		struct Slot {
+			ClusterIndexType mKey;
+			uint32_t mValue; // kInvalidValue for an empty slot
+		};
+
+		size_t _getIdealSlot(ClusterIndexType key) const;
+		void _grow();
+
+	private:
+		static const size_t kInitialCapacity = 64;
+
+		std::vector<Slot> mSlots;
+		size_t mMask;
+		uint32_t mShift;
+		size_t mCount;
+	};
+
+	/**
+	*	Cache of cluster data with a byte budget and 2Q replacement.
+	*
+	*	A new cluster enters a FIFO queue of the recently used clusters. The clusters evicted from it are remembered for a while,
+	*	and if any of them is added again, it goes to the LRU queue of the frequently used clusters.
+	*	This way a single scan through a large file can't flush out the hot clusters.
+	*	Every priority has its own queues. The metadata clusters are evicted only when there are no file-data clusters to be evicted.
+	*	The clusters that are not in sync with the storage are never evicted, so the budget could be exceeded by them.
+	*	The memory of the evicted clusters is reused for the next ones, and released only when the budget is reduced.
+	*
+	*	Not thread-safe. The owner has to synchronize the access.
+	*/
+	class ClusterCache {
+	public:
+		ClusterCache(size_t clusterSize, size_t maxBytes);
+
+		// Aligned for direct I/O.
+		static const size_t kSlabAlignment = 4096;
+		// The buffers of the clusters are allocated in slabs of this size, or smaller for a small budget.
+		static const size_t kSlabSize = 1024 * 1024;
+		// The budget is split in at least this many slabs, so the memory can be released gradually when the budget is reduced.
+		static const size_t kMinCountSlabs = 8;
+
+		// The memory not needed for the clusters left in the cache is released.
+		void setMaxBytes(size_t maxBytes);
+		// Returns the cached data of the cluster or nullptr. Counted as a hit or a miss.
+		// The data is valid until the next change of the cache.
+		uint8_t* find(ClusterIndexType clusterIndex);
+		// Returns the cached data of the cluster or nullptr, without changing the statistics and the replacement order.
+		uint8_t* peek(ClusterIndexType clusterIndex);
+		// Like find(), but the cluster is not evicted and its data is not changed until it is unpinned.
+		// If the cluster is written meanwhile, the new data goes in a new entry, and the pinned one is freed on unpin.
+		const uint8_t* pin(ClusterIndexType clusterIndex, uint32_t& entryIndex);
+		void unpin(uint32_t entryIndex);
+		// Adds the cluster or replaces its cached data. The least valuable clusters could be evicted.
+		void insert(ClusterIndexType clusterIndex, const uint8_t* data, ClusterCachePriority priority, bool isInSync);
+		// Replaces the data of the cluster only if it is cached. Returns false if it is not.
+		bool update(ClusterIndexType clusterIndex, const uint8_t* data, bool isInSync);
+		// Removes the cluster from the cache, even if it is not in sync with the storage.
+		void erase(ClusterIndexType clusterIndex);
+		// Calls the callback for every cluster that is not in sync with the storage, in the order of the cluster indices.
+		ErrorCode executeOnDirtyClusters(DirtyClusterCallbackType callback);
+		// Appends the indices of the clusters that are not in sync with the storage, in no particular order.
+		void getDirtyClusters(std::vector<ClusterIndexType>& clusterIndices) const;
+		// Appends up to maxCount of the evictable clusters from one queue, the most recently used first.
+		void getCachedClusters(ClusterCachePriority priority, bool isFrequentlyUsed, size_t maxCount, std::vector<ClusterIndexType>& clusterIndices) const;
+		// Calls the callback for the cluster, if it is cached and not in sync with the storage.
+		ErrorCode executeOnDirtyCluster(ClusterIndexType clusterIndex, DirtyClusterCallbackType callback);
+
+		uint32_t getCountDirtyClusters() const;
+		size_t getCountCachedClusters() const;
+		size_t getMaxCountClusters() const;
+		// The memory allocated for the buffers of the clusters.
+		size_t getAllocatedBytes() const;
+		const ClusterCacheStats& getStats() const;
+
+	private:
+		enum class QueueType : uint32_t {
+			QT_RECENT,		/// FIFO
+			QT_FREQUENT,	/// LRU
+			QT_COUNT
+		};
+
+		// The buffer of an entry is at a fixed position in the slabs, depending on the index of the entry.
+		struct Entry {
+			ClusterIndexType mClusterIndex;
+			ClusterCachePriority mPriority;
+			QueueType mQueueType;
+			bool mIsUsed;
+			bool mIsDetached; // Replaced by a newer entry of the same cluster, while pinned.
+			bool mIsInSync;
+			bool mIsLinked; // Only the linked entries can be evicted.
+			uint32_t mCountPins;
+			uint32_t mPrev;
+			uint32_t mNext;
+		};
+
+		struct Queue {
+			uint32_t mHead;
+			uint32_t mTail;
+			uint32_t mCount;
+		};
+
+		struct GhostRecord {
+			ClusterIndexType mClusterIndex;
+			uint32_t mSequence;
+		};
+
+		uint8_t* _getBuffer(uint32_t entryIndex);
+		uint32_t _allocateEntry();
+		// Adds an entry in sync with the storage, with not initialized data.
+		uint32_t _addEntry(ClusterIndexType clusterIndex, ClusterCachePriority priority, QueueType queueType);
+		void _detach(uint32_t entryIndex);
+		void _freeEntry(uint32_t entryIndex);
+		// Moves a not pinned entry and its data to a free entry.
+		void _moveEntry(uint32_t entryIndex, uint32_t newEntryIndex);
+		// Moves the entries from the last slabs to the free entries of the first ones, and releases the emptied slabs.
+		void _releaseUnusedSlabs();
+		Queue& _getQueue(const Entry& entry);
+		void _link(uint32_t entryIndex);
+		void _unlink(uint32_t entryIndex);
+		void _setInSync(uint32_t entryIndex, bool isInSync);
+		bool _evictOne();
+		void _evictIfNeeded();
+		void _addGhost(ClusterIndexType clusterIndex);
+		bool _takeGhost(ClusterIndexType clusterIndex);
+
+	private:
+		const size_t mClusterSize;
+		size_t mClustersPerSlab; // Changed only while there are no slabs.
+		size_t mMaxCountClusters;
+		size_t mMaxCountRecentClusters;
+		size_t mMaxCountGhosts;
+		std::vector<Entry> mEntries;
+		std::vector<uint32_t> mFreeEntries;
+		std::vector<std::unique_ptr<uint8_t[]>> mSlabs; // Allocated with kSlabAlignment extra bytes.
+		std::vector<uint8_t*> mAlignedSlabs;
+		ClusterIndexHashTable mEntryIndices;
+		Queue mQueues[static_cast<size_t>(ClusterCachePriority::CCP_COUNT)][static_cast<size_t>(QueueType::QT_COUNT)];
+		std::deque<GhostRecord> mGhosts;
+		ClusterIndexHashTable mGhostSequences;
+		uint32_t mGhostSequence;
+		std::atomic<uint32_t> mCountDirtyClusters; // Could be read without synchronization
+		ClusterCacheStats mStats;
+	};
+
+} // namespace SFAT
@@ -22,12 +22,27 @@ namespace SFAT {
 
 	/**
 	 * Stores parameters specific to particular FAT-data block and the corresponding Cluster-data block.
+	 * Written together with the FAT block, so the free space of the block is known without reading and scanning its table.
 	 */
 	struct BlockControlData {
-		// CRC of the FAT
-		uint32_t mCRC; //TODO: Take care to update it. Add a unit-test.
+		enum : uint32_t {
+			CURRENT_VERSION = 1,
+		};
+
+		// CRC32 of the FAT block table
+		uint32_t mCRC;
 		uint32_t mBlockIndex;
+		// Version of the structure. Zero if the control data was never written.
+		uint32_t mVersion;
+		uint32_t mCountFreeClusters;
+		// Index of the first free cluster, relative to the start of the block. Equal to the clusters per block when there is no free cluster.
+		uint32_t mFirstFreeClusterOffset;
+		uint32_t mReserved[2];
+		// CRC32 of all fields above
+		uint32_t mControlDataCRC;
 	};
 
+	static_assert(sizeof(BlockControlData) == 32, "The size of the BlockControlData is part of the FAT file layout!");
+
 } // namespace SFAT
 
@@ -6,9 +6,17 @@
 #pragma once
 
 #include "SplitFAT/Common.h"
+#include "SplitFAT/LowLevelAccess.h"
+#include "SplitFAT/ClusterCache.h"
 #include "SplitFAT/utils/Mutex.h"
 #include <vector>
-#include <map>
+#include <memory>
+#include <unordered_map>
+#include <condition_variable>
+#include <atomic>
+
+// The cluster cache is split in shards with separate locks, and the clusters are read from the storage outside of the locks.
+#define SPLIT_FAT__ENABLE_SHARDED_CLUSTER_CACHE	1
 
 //Forward declaration of the UnitTest class
 #if !defined(MCPE_PUBLISH)
@@ -18,14 +26,42 @@ class LowLevelUnitTest;
 namespace SFAT {
 
 	class VolumeManager;
+	class DataBlockManager;
+	struct ClusterCacheSettings;
+
+	/**
+	*	Read-only access to the data of a cluster, without copying it.
+	*	The cached cluster is pinned while the view exists, so it is not evicted, and its data is not changed even if the cluster is written meanwhile.
+	*	If the cluster is not cached, the view holds a copy of its data.
+	*	The view should not outlive the DataBlockManager.
+	*/
+	class ClusterView {
+		friend class DataBlockManager;
+
+	public:
+		ClusterView();
+		ClusterView(ClusterView&& other);
+		ClusterView& operator=(ClusterView&& other);
+		ClusterView(const ClusterView&) = delete;
+		ClusterView& operator=(const ClusterView&) = delete;
+		~ClusterView();
+
+		// Unpins the cluster. The view is invalid after that.
+		void release();
+		bool isValid() const { return mData != nullptr; }
+		const uint8_t* data() const { return mData; }
+		ClusterIndexType getClusterIndex() const { return mClusterIndex; }
 
-	struct ClusterDataCache {
+	private:
+		DataBlockManager* mDataBlockManager; // Set only if the cluster is pinned.
 		ClusterIndexType mClusterIndex;
-		std::vector<uint8_t> mBuffer;
-		bool mIsCacheInSync;
+		uint32_t mEntryIndex;
+		const uint8_t* mData;
+		std::vector<uint8_t> mBuffer; // The copy of the data, if the cluster is not cached.
 	};
 
 	class DataBlockManager {
+		friend class ClusterView;
 
 #if !defined(MCPE_PUBLISH)
 		friend class LowLevelUnitTest;
@@ -36,9 +72,28 @@ namespace SFAT {
 		~DataBlockManager();
 		bool canExpand() const;
 		ErrorCode flush();
+		void setCacheSettings(const ClusterCacheSettings& settings);
+		// Changes only the budget of the cache. Set by the memory budget of the volume, if it is enabled.
+		void setCacheMaxBytes(size_t maxBytes);
+		// The memory allocated for the cached clusters of all shards.
+		size_t getCacheAllocatedBytes() const;
+		// The statistics of all shards together.
+		ClusterCacheStats getCacheStats() const;
+		size_t getCountCachedClusters() const;
+		// Count of the clusters read from the storage.
+		uint32_t getCountStorageReads() const;
+		// The cached clusters most valuable to be cached again after a restart - the directory clusters first, then the frequently used file data.
+		void getHotClusters(size_t maxCountClusters, std::vector<ClusterIndexType>& clusterIndices) const;
+		FilePositionType getClusterPosition(ClusterIndexType clusterIndex) const;
 
 		ErrorCode readCluster(std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex, bool isDirectoryData);
 		ErrorCode writeCluster(const std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex, bool isDirectoryData);
+		// Like readCluster(), but a cached cluster is not copied. See ClusterView.
+		ErrorCode acquireClusterView(ClusterIndexType clusterIndex, bool isDirectoryData, ClusterView& view);
+		// Calls the callback for every cached cluster that is still not written on the storage.
+		ErrorCode executeOnDirtyClusters(ClusterDataCallbackType callback);
+		// Returns the size of the cached directory data, that is still not written on the storage.
+		size_t getDirtyBytes() const;
 
 		//For testing purposes only
 #if !defined(MCPE_PUBLISH)
@@ -46,16 +101,46 @@ namespace SFAT {
 #endif //!defined(MCPE_PUBLISH)
 
 	private:
+		// A cluster being read from the storage. The other threads reading the same cluster wait for it, instead of reading it again.
+		struct InFlightRead {
+			InFlightRead();
+
+			std::vector<uint8_t> mBuffer; // Filled only if there are waiting threads.
+			ErrorCode mResult;
+			uint32_t mCountWaitingThreads;
+			bool mIsCompleted;
+			bool mIsInvalidated; // The cluster was written while being read. The data read could be outdated.
+		};
+
+		struct CacheShard {
+			CacheShard(size_t clusterSize, size_t maxBytes);
+
+			SFATMutex mMutex;
+			std::condition_variable_any mReadCompleted;
+			ClusterCache mClusterCache; // Guarded by mMutex
+			std::unordered_map<ClusterIndexType, std::shared_ptr<InFlightRead>> mInFlightReads; // Guarded by mMutex
+		};
+
 		FilePositionType _getPosition(ClusterIndexType clusterIndex) const;
-		ErrorCode _writeCluster(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex);
+		CacheShard& _getShard(ClusterIndexType clusterIndex) const;
+		// Reads the cluster in the buffer, or pins it in the view if it is cached and a view is given.
+		ErrorCode _readCluster(std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex, bool isDirectoryData, ClusterView* view);
+		void _releaseClusterView(ClusterView& view);
+		ErrorCode _readClusterFromStorage(std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex);
+		ErrorCode _writeCluster(const uint8_t* buffer, ClusterIndexType clusterIndex);
+		// Calls the callback for the dirty clusters of all shards, in the order of the cluster indices. All shards are locked meanwhile.
+		ErrorCode _executeOnAllDirtyClusters(DirtyClusterCallbackType callback);
 
 	private:
+		static const uint32_t kCountCacheShards = (SPLIT_FAT__ENABLE_SHARDED_CLUSTER_CACHE == 1) ? 16 : 1;
+
 		VolumeManager& mVolumeManager;
 		uint32_t	mClustersPerFATBlock;
 		uint32_t	mMaxPossibleBlocksCount;
 		size_t		mClusterSize;
 		size_t		mDataBlockSize;
-		std::map<ClusterIndexType, ClusterDataCache> mCachedClusters;
-		SFATMutex		mClusterReadWriteMutex;
+		std::atomic<bool>	mIsFileDataCached;
+		std::atomic<uint32_t>	mCountStorageReads;
+		std::vector<std::unique_ptr<CacheShard>>	mCacheShards;
 	};
 } // namespace SFAT
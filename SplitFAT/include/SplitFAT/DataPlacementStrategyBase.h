@@ -7,7 +7,14 @@
 
 #include <stdint.h>
 #include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
 #include "Common.h"
+#include "SplitFAT/utils/Mutex.h"
+
+// The clusters of a growing file are allocated next to its last cluster, and sequential writers reserve a window of free clusters.
+#define SPLIT_FAT__ENABLE_LOCALITY_AWARE_ALLOCATION	1
 
 ///Unit-test classes forward declaration
 
@@ -17,6 +24,28 @@ namespace SFAT {
 	class VirtualFileSystem;
 	class BitSet;
 
+	enum class AllocationPattern : uint32_t {
+		AP_UNKNOWN,
+		AP_SEQUENTIAL,	/// The file is written at its end, so it is expected to keep growing.
+		AP_RANDOM,		/// The position of the new clusters doesn't matter. No locality is applied.
+	};
+
+	/**
+	 *  Describes the file that needs a new cluster.
+	 */
+	struct AllocationContext {
+		AllocationContext();
+		AllocationContext(ClusterIndexType lastCluster, bool useFileDataStorage);
+
+		ClusterIndexType	mLastCluster;				/// The last cluster of the chain, or ClusterValues::INVALID_VALUE for a new chain.
+		ClusterIndexType	mDescriptorClusterIndex;	/// Together with mRecordIndex identifies the file.
+		uint32_t			mRecordIndex;
+		uint32_t			mCountClustersToAllocate;	/// Including the one being allocated now.
+		FileSizeType		mExpectedFileSize;
+		AllocationPattern	mPattern;
+		bool				mUseFileDataStorage;
+	};
+
 	class DataPlacementStrategyBase {
 	public:
 		DataPlacementStrategyBase(VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem);
@@ -33,11 +62,55 @@ namespace SFAT {
 		virtual ErrorCode prepareForWriteTransaction() = 0;
 		virtual ErrorCode performDefragmentaionOnTransactionEnd() = 0;
 		virtual ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage) = 0;
+		/**
+		 *  Finds a free cluster for the file described by the context.
+		 *  The default implementation tries to continue the chain right after its last cluster, and reserves a window of clusters for sequential writers,
+		 *  so files written at the same time don't fragment each other. The block of every new window is selected by findFreeCluster(newClusterIndex, useFileDataStorage).
+		 *  The clusters in the windows of the other files are skipped. One of them is taken only when the selected block has no other free clusters.
+		 */
+		virtual ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& context);
+		// Drops all reserved allocation windows. The not used clusters from the windows become available for all files.
+		void releaseAllocationWindows();
 
 	protected:
+		// Finds a free cluster in a block selected by the strategy.
+		using FreeClusterSelector = std::function<ErrorCode(ClusterIndexType& newClusterIndex)>;
+
+		struct AllocationWindow {
+			uint64_t			mFileKey;
+			ClusterIndexType	mStartClusterIndex;
+			ClusterIndexType	mEndClusterIndex; /// One after the last cluster of the window
+			uint32_t			mLastUse;
+		};
+		using AllocationWindowsMap = std::map<ClusterIndexType, AllocationWindow>;
+
+		// Strategies writing only into blocks of their own choice return false for the other blocks, so the new clusters go through findFreeCluster(newClusterIndex, useFileDataStorage).
+		virtual bool _canContinueChainInBlock(uint32_t blockIndex) const;
+		// The implementation of findFreeCluster(newClusterIndex, context). The blocks of the new windows are selected by selectFreeCluster.
+		ErrorCode _findFreeClusterNearChain(ClusterIndexType& newClusterIndex, const AllocationContext& context, const FreeClusterSelector& selectFreeCluster);
+		bool _isFreeClusterAvailable(ClusterIndexType clusterIndex, uint64_t fileKey);
+		ErrorCode _findClusterForNewWindow(ClusterIndexType& newClusterIndex, const AllocationContext& context, uint32_t windowLength, const FreeClusterSelector& selectFreeCluster);
+		AllocationWindow* _findAllocationWindow(uint64_t fileKey);
+		const AllocationWindow* _findAllocationWindowContaining(ClusterIndexType clusterIndex) const;
+		void _addAllocationWindow(uint64_t fileKey, ClusterIndexType startClusterIndex, uint32_t windowLength);
+		void _removeAllocationWindow(uint64_t fileKey);
+		// Called when the cluster is taken by another file. The window containing it is shortened to the clusters before or after it.
+		void _releaseWindowCluster(ClusterIndexType clusterIndex);
+		static uint64_t _getFileKey(const AllocationContext& context);
+
+	protected:
+		static const uint32_t kMaxAllocationWindowsCount = 64;
+		static const uint32_t kMaxAllocationWindowClusters = 64;
+		static const uint32_t kSequentialAllocationWindowClusters = 16;
+
 		VolumeManager& mVolumeManager;
 		VirtualFileSystem& mVirtualFileSystem;
 		bool mIsActive;
+
+		SFATMutex mAllocationWindowsMutex;
+		AllocationWindowsMap mAllocationWindows; // By start cluster. Guarded by mAllocationWindowsMutex
+		std::unordered_map<uint64_t, ClusterIndexType> mAllocationWindowStarts; // The start of the window of every file. Guarded by mAllocationWindowsMutex
+		uint32_t mAllocationWindowsUseCounter; // Guarded by mAllocationWindowsMutex
 	};
 
 } // namespace SFAT
@@ -10,13 +10,23 @@
 #include <vector>
 #include <set>
 #include <memory>
+#include <atomic>
+#include <future>
+#include <condition_variable>
 
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/utils/Mutex.h"
 #include "SplitFAT/utils/BitSet.h"
 
-#define SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED	0
+// The BlockControlData keeps the CRC and the free space of the FAT block, so it can be used before the block is loaded.
+#define SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED	1
 #define SPLIT_FAT__USE_BITSET	1
+// The FAT blocks are loaded on mount by a few worker threads, instead of one by one.
+#define SPLIT_FAT__ENABLE_PARALLEL_FAT_PRELOAD	1
+
+#if !defined(MCPE_PUBLISH)
+class LowLevelUnitTest_BlockControlData_Test;
+#endif //!defined(MCPE_PUBLISH)
 
 namespace SFAT {
 
@@ -33,6 +43,9 @@ namespace SFAT {
 
 		// Reads from specific place
 		ErrorCode read(FileHandle& file, FilePositionType filePosition);
+		// Reads only the block control data and the table. The free-clusters set has to be updated with updateFreeClustersSet() after that.
+		ErrorCode readTable(FileHandle& file, FilePositionType filePosition);
+		void updateFreeClustersSet();
 		// Writes to specific place
 		ErrorCode write(FileHandle& file, FilePositionType filePosition) const;
 
@@ -40,6 +53,14 @@ namespace SFAT {
 		bool tryToFindFreeCluster(ClusterIndexType& newClusterIndex) const;
 #if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
 		BlockControlData& getBlockControlData();
+		// Creates control data that describes the current state of the table.
+		BlockControlData makeBlockControlData() const;
+		// Returns false if the control data read with the table doesn't match it. It will be rewritten on the next flush.
+		bool isBlockControlDataValid() const;
+
+		static uint32_t calculateControlDataCRC(const BlockControlData& controlData);
+		// Checks the version and the CRC of the control data itself. The CRC of the table can't be checked without reading it.
+		static bool verifyBlockControlData(const BlockControlData& controlData, uint32_t blockIndex, uint32_t clustersPerBlock);
 #endif
 		uint32_t getCountFreeClusters() const;
 		bool getFirstFreeClusterIndex(ClusterIndexType& clusterIndex) const;
@@ -54,6 +75,12 @@ namespace SFAT {
 
 	private:
 		const VolumeDescriptor& getVolumeDescriptor() const;
+		// Writes the table, preceded by the control data if it is not nullptr.
+		ErrorCode _write(FileHandle& file, FilePositionType filePosition, const BlockControlData* controlData) const;
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		ErrorCode _writeBlockControlData(FileHandle& file, FilePositionType filePosition, const BlockControlData& controlData) const;
+		void _validateBlockControlData();
+#endif
 
 	private:
 		const VolumeDescriptor&	mVolumeDescriptor;
@@ -63,6 +90,7 @@ namespace SFAT {
 		FATBlockTableType	mTable;
 #if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
 		BlockControlData	mBlockControlData;
+		bool				mIsBlockControlDataStale;
 #endif
 #if (SPLIT_FAT__USE_BITSET == 1)
 		BitSet	mFreeClustersBitSet;
@@ -70,19 +98,35 @@ namespace SFAT {
 		std::set<ClusterIndexType> mFreeClustersSet;
 #endif
 		bool				mIsCacheInSync;
+		MemoryCharge		mMemoryCharge;
 	};
 
 	class FATDataManager
 	{
+#if !defined(MCPE_PUBLISH)
+		friend class ::LowLevelUnitTest_BlockControlData_Test;
+#endif //!defined(MCPE_PUBLISH)
 	public:
 		FATDataManager(VolumeManager& volumeManager);
+		~FATDataManager();
 
 		ErrorCode getValue(ClusterIndexType index, FATCellValueType& value);
 		ErrorCode setValue(ClusterIndexType index, FATCellValueType value);
+		// Encodes the CRC of the cluster data in the cell, keeping the rest of its value.
+		ErrorCode setCRC(ClusterIndexType index, uint16_t crc);
+		// Frees all clusters from the list. The list gets sorted, so every FAT block is prepared and logged only once.
+		ErrorCode freeClusters(std::vector<ClusterIndexType>& clusterIndices);
 		
 		ErrorCode allocateFATBlock(uint32_t blockIndex);
 		ErrorCode preallocateAllFATDataBlocks();
 		ErrorCode preloadAllFATDataBlocks();
+		// Starts loading all not yet cached FAT blocks in background. The blocks that are already loaded can be used meanwhile.
+		ErrorCode startPreloadingAllFATDataBlocks();
+		// Waits for the background loading to finish. Returns the first error from the loading, if any.
+		ErrorCode waitForPreloadCompletion();
+		// Reads the control data of all allocated FAT blocks.
+		// Until a block is loaded, its free space is taken from the control data, if it is valid.
+		ErrorCode readAllBlockControlData();
 		bool canExpand() const;
 
 		ErrorCode flush();
@@ -106,12 +150,35 @@ namespace SFAT {
 	private:
 		ErrorCode _prepareBlock(uint32_t blockIndex);
 		ErrorCode _updateCache(uint32_t blockIndex);
+		bool _isBlockCached(uint32_t blockIndex) const;
+		ErrorCode _loadBlock(uint32_t blockIndex, std::unique_ptr<FATBlock>& fatBlockPtr);
+		// Logs the change in transaction and sets the cell. mFATCellsMutex should be held.
+		void _setCellValue(FATBlock& block, ClusterIndexType index, FATCellValueType value);
+		void _preloadWorker();
+		// Returns true only if the block is not cached yet and its control data is valid.
+		bool _tryGetBlockControlData(uint32_t blockIndex, BlockControlData& controlData);
 
 	private:
+		static const uint32_t kMaxPreloadWorkersCount = 4; // Preloading requests executed in parallel by the IOScheduler
+
 		const VolumeDescriptor& mVolumeDescriptor;
 		std::vector<std::unique_ptr<FATBlock>>	mFATBlocksCache;
 		VolumeManager& mVolumeManager;
+		// Serializes the changes of the cached cells. The allocations hold the allocation lock of the VirtualFileSystem too,
+		// but the CRC of a cluster is set while the cluster is written, without it. Taken before mFATBlockReadWriteMutex.
+		SFATMutex	mFATCellsMutex;
 		SFATMutex	mFATBlockReadWriteMutex;
+		std::vector<BlockControlData>	mBlocksControlData; // Guarded by mFATBlockReadWriteMutex
+
+		// Background preloading
+		SFATMutex	mPreloadMutex;
+		std::vector<std::shared_future<ErrorCode>>	mPreloadCompletions; // Guarded by mPreloadMutex
+		std::atomic<uint32_t>	mCountActivePreloadWorkers;
+		std::condition_variable_any	mBlockLoadedCondition;
+		BitSet		mBlocksBeingLoaded; // Guarded by mFATBlockReadWriteMutex
+		std::atomic<uint32_t>	mPreloadNextBlockIndex;
+		uint32_t	mPreloadEndBlockIndex;
+		ErrorCode	mPreloadError; // Guarded by mFATBlockReadWriteMutex
 	};
 
 } // namespace SFAT
@@ -0,0 +1,52 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "SplitFAT/LowLevelAccess.h"
+#include "SplitFAT/utils/BitSet.h"
+
+// Enables the SSE2/AVX2 kernels for the bulk classification of the FAT cells.
+// When disabled, or when the target doesn't support the instruction sets, a scalar version is used.
+#define SPLIT_FAT__ENABLE_SIMD_FAT_DECODE	1
+
+namespace SFAT {
+
+	/// Bulk classification of FAT cells.
+	/// Every cell is tested for being free, start of chain, end of chain and with initialized CRC,
+	/// and the results are written as bitmaps with the layout of the BitSet words -
+	/// bit (i % 64) of word (i / 64) corresponds to the cell with index i.
+	class FATCellDecoder {
+	public:
+		typedef BitSet::ElementType WordType;
+
+		/// Classifies countCells cells. Any of the output pointers could be nullptr, if the corresponding bitmap is not needed.
+		/// Every non-null output should have space for at least getCountWords(countCells) words.
+		/// The bits after countCells in the last word are set to 0.
+		static void classify(const FATCellValueType* cells, size_t countCells,
+			WordType* freeBits, WordType* startOfChainBits, WordType* endOfChainBits, WordType* crcInitializedBits);
+
+		/// Rebuilds the set of the free clusters from the FAT table. The BitSet is resized to the table size.
+		static void decodeFreeClusters(const FATBlockTableType& table, BitSet& freeClustersSet);
+
+		/// Scalar implementation. Used for the tail cells and for verification.
+		static void classifyScalar(const FATCellValueType* cells, size_t countCells,
+			WordType* freeBits, WordType* startOfChainBits, WordType* endOfChainBits, WordType* crcInitializedBits);
+
+		/// Returns the name of the kernel selected at compile time - "AVX2", "SSE2" or "Scalar".
+		static const char* getKernelName();
+
+		static size_t getCountWords(size_t countCells) {
+			return (countCells + kBitsPerWord - 1) / kBitsPerWord;
+		}
+
+	public:
+		static const size_t kBitsPerWord = sizeof(WordType) * 8;
+	};
+
+} // namespace SFAT
@@ -8,11 +8,15 @@
 #include "SplitFAT/Common.h"
 #include "SplitFAT/FileDescriptorRecord.h"
 #include "SplitFAT/FileSystemConstants.h"
+#include "SplitFAT/MemoryBudget.h"
 #include "SplitFAT/utils/PathString.h"
+#include <memory>
 #include <vector>
 
 namespace SFAT {
 
+	class OpenFileState;
+
 	class FileManipulator {
 	public:
 		FileManipulator();
@@ -26,7 +30,8 @@ namespace SFAT {
 		const size_t getFileSize() const { return mFileDescriptorRecord.mFileSize; }
 		const ClusterIndexType getStartCluster() const { return mFileDescriptorRecord.mStartCluster; }
 		const ClusterIndexType getLastCluster() const { return mFileDescriptorRecord.mLastCluster; }
-		std::vector<uint8_t>& getBuffer(size_t requiredMinSize);
+		// The memory of the buffer is added to the budget.
+		std::vector<uint8_t>& getBuffer(size_t requiredMinSize, const std::shared_ptr<MemoryBudget>& memoryBudget);
 		bool hasAccessMode(AccessMode mode) const;
 		FilePositionType getPosition() const { return mNextPosition; }
 		bool isRootDirectory() const;
@@ -41,10 +46,16 @@ namespace SFAT {
 		FilePositionType		mPosition;
 		ClusterIndexType		mPositionClusterIndex;
 		FilePositionType		mNextPosition;
+		FileSizeType			mExpectedFileSize;			/// Hint for the placement of the new clusters. 0 if not known.
+
+		// Shared with the other FileManipulators of the same file, while any of them reads or writes it.
+		std::shared_ptr<OpenFileState>	mOpenFileState;
+		uint32_t				mOpenFileStateGeneration;
 
 		bool					mIsValid;
 	private:
 		std::vector<uint8_t>	mBuffer;
+		MemoryCharge			mBufferCharge;
 	};
 
 } // namespace SFAT
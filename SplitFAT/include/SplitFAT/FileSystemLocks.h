@@ -0,0 +1,112 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include "SplitFAT/utils/Mutex.h"
+#include <memory>
+#include <unordered_map>
+
+// Every thread keeps track of the locks it holds, and the order of locking is verified on every acquisition.
+#if !defined(NDEBUG)
+#	define SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION	1
+#endif
+
+namespace SFAT {
+
+	class FileSystemLocks;
+
+	enum class LockMode : uint32_t {
+		LM_SHARED,
+		LM_EXCLUSIVE
+	};
+
+	enum class LockLevel : uint32_t {
+		LL_VOLUME,
+		LL_ENTITY,
+		LL_ALLOCATION,
+		LL_DESCRIPTOR_CLUSTER
+	};
+
+	/**
+	*	A lock taken from FileSystemLocks. Released on destruction.
+	*/
+	class FileSystemLock {
+		friend class FileSystemLocks;
+
+	public:
+		FileSystemLock();
+		FileSystemLock(FileSystemLock&& other);
+		FileSystemLock& operator=(FileSystemLock&& other);
+		FileSystemLock(const FileSystemLock&) = delete;
+		FileSystemLock& operator=(const FileSystemLock&) = delete;
+		~FileSystemLock();
+
+		void release();
+		bool isLocked() const { return mLocks != nullptr; }
+
+	private:
+		FileSystemLocks* mLocks; // Set only while locked.
+		LockLevel mLevel;
+		LockMode mMode;
+		uint64_t mKey;
+	};
+
+	/**
+	*	The locks of a VirtualFileSystem. They have to be taken in this order:
+	*	1. The volume lock - shared by every operation. It is exclusive only while:
+	*	   - a transaction is started, or ended synchronously or asynchronously, including the relocation of clusters by the defragmentation at its end;
+	*	   - the automatic checkpoint requested by a previous change is made;
+	*	   - the volume is restored from the transaction file.
+	*	2. The entity locks - one per file or directory, identified by the location of its FileDescriptorRecord.
+	*	   Shared for lookup, iteration and reading, and exclusive for changes. The directories are locked before their entities.
+	*	3. The allocation lock - volume-wide, and held only while clusters are allocated, linked in a chain or freed.
+	*	4. The descriptor-cluster locks - held while a FileDescriptorRecord is written in the cluster of its directory.
+	*	The last two are leaves - no other lock of the file system is taken while any of them is held.
+	*	Only the internal mutexes of the volume are taken after them - the one of the FAT cells, and the one of the transaction log last.
+	*	The entity locks are created on demand and removed when not used.
+	*/
+	class FileSystemLocks {
+		friend class FileSystemLock;
+
+	public:
+		FileSystemLocks();
+
+		FileSystemLock lockVolume(LockMode mode);
+		FileSystemLock lockEntity(ClusterIndexType descriptorClusterIndex, uint32_t relativeRecordIndex, LockMode mode);
+		FileSystemLock lockAllocation();
+		FileSystemLock lockDescriptorCluster(ClusterIndexType descriptorClusterIndex);
+
+		// Count of the entities currently locked, or waited for.
+		size_t getCountLockedEntities() const;
+
+	private:
+		struct EntityEntry {
+			EntityEntry();
+
+			SFATSharedMutex mMutex;
+			uint32_t mCountUsers; // Guarded by FileSystemLocks::mEntitiesMutex
+		};
+
+		void _unlock(FileSystemLock& lock);
+		SFATMutex& _getDescriptorClusterMutex(uint64_t key);
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		void _verifyLockOrder(LockLevel level, uint64_t key) const;
+		void _onLocked(LockLevel level, uint64_t key);
+		void _onUnlocked(LockLevel level, uint64_t key);
+#endif
+
+	private:
+		static const uint32_t kCountDescriptorClusterMutexes = 16;
+
+		SFATSharedMutex mVolumeMutex;
+		mutable SFATMutex mEntitiesMutex;
+		std::unordered_map<uint64_t, std::unique_ptr<EntityEntry>> mEntities; // Guarded by mEntitiesMutex
+		SFATMutex mAllocationMutex;
+		SFATMutex mDescriptorClusterMutexes[kCountDescriptorClusterMutexes];
+	};
+
+} // namespace SFAT
@@ -13,5 +13,6 @@ namespace SFAT {
 
 	using FATBlockTableType = std::vector<FATCellValueType>;
 	using FATBlockCallbackType = std::function<ErrorCode(uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)>;
+	using ClusterDataCallbackType = std::function<ErrorCode(ClusterIndexType clusterIndex, const uint8_t* buffer)>;
 
 } // namespace SFAT
@@ -0,0 +1,104 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include "SplitFAT/SplitFATConfigurationBase.h"
+#include "SplitFAT/utils/Mutex.h"
+#include <functional>
+#include <memory>
+#include <atomic>
+
+namespace SFAT {
+
+	enum class MemoryComponent : uint32_t {
+		MC_FAT_CACHE,		/// The FAT blocks. Can't be shrunk.
+		MC_CLUSTER_CACHE,	/// The cached cluster data. Gets the budget left by the rest of the components.
+		MC_BUFFER_POOL,		/// The cluster buffers kept for reuse.
+		MC_FILE_BUFFERS,	/// The buffers of the open files. Can't be shrunk.
+		MC_COUNT
+	};
+
+	/**
+	*	Accounts the memory used by the components of a volume and divides the budget among them.
+	*
+	*	The components that can be shrunk are registered with functions reporting their usage and applying their limit.
+	*	The rest of the components only add and remove their usage. When it changes significantly, the limits are recalculated
+	*	on the next call of rebalanceIfNeeded(), so the cluster cache gives up the memory taken by the FAT and the open files.
+	*
+	*	Thread-safe. The rebalancing calls the registered functions, so it should not be done while holding the locks of the components.
+	*/
+	class MemoryBudget {
+	public:
+		using UsageFunction = std::function<size_t()>;
+		using LimitFunction = std::function<void(size_t maxBytes)>;
+
+		MemoryBudget();
+
+		void setup(const MemoryBudgetSettings& settings);
+		bool isEnabled() const;
+		void registerComponent(MemoryComponent component, UsageFunction getUsage, LimitFunction setLimit);
+		// When it returns, the functions of the component are not used any more.
+		void unregisterComponent(MemoryComponent component);
+		// For the components that are not registered.
+		void addUsage(MemoryComponent component, size_t bytes);
+		void removeUsage(MemoryComponent component, size_t bytes);
+
+		size_t getUsage(MemoryComponent component) const;
+		size_t getTotalUsage() const;
+		// The limit applied on the component by the last rebalancing. Zero if the budget is disabled.
+		size_t getLimit(MemoryComponent component) const;
+
+		void rebalance();
+		void rebalanceIfNeeded();
+
+	private:
+		struct Component {
+			Component();
+
+			UsageFunction mGetUsage;
+			LimitFunction mSetLimit;
+			std::atomic<size_t> mUsage; // Only for the components that are not registered
+			size_t mLimit;
+		};
+
+		size_t _getUsage(const Component& component) const;
+		void _markChanged(size_t bytes);
+
+	private:
+		// The usage change that triggers rebalancing.
+		static const size_t kRebalanceGranularity = 64 * 1024;
+
+		mutable SFATMutex mMutex; // Guards the settings, the registered functions and the limits.
+		MemoryBudgetSettings mSettings;
+		Component mComponents[static_cast<size_t>(MemoryComponent::MC_COUNT)];
+		std::atomic<size_t> mChangedBytes; // Usage added or removed since the last rebalancing
+		std::atomic<bool> mIsRebalanceNeeded;
+	};
+
+	/**
+	*	Usage of memory added to a budget for the lifetime of the object.
+	*	Doesn't keep the budget alive, so it can outlive the volume.
+	*/
+	class MemoryCharge {
+	public:
+		MemoryCharge();
+		MemoryCharge(MemoryCharge&& other);
+		MemoryCharge& operator=(MemoryCharge&& other);
+		MemoryCharge(const MemoryCharge&) = delete;
+		MemoryCharge& operator=(const MemoryCharge&) = delete;
+		~MemoryCharge();
+
+		void set(const std::shared_ptr<MemoryBudget>& memoryBudget, MemoryComponent component, size_t bytes);
+		void release();
+
+	private:
+		std::weak_ptr<MemoryBudget> mMemoryBudget;
+		MemoryComponent mComponent;
+		size_t mBytes;
+	};
+
+} // namespace SFAT
@@ -0,0 +1,59 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include "SplitFAT/utils/Mutex.h"
+#include <string>
+#include <deque>
+#include <unordered_set>
+
+namespace SFAT {
+
+	/**
+	*	Bounded cache of the names known to be missing in a directory, so the repeated lookups of missing files don't scan the directory.
+	*	The directories are identified by their start cluster. The names are compared case-insensitively, as in the FileDescriptorRecord.
+	*	When the cache is full, the oldest names are forgotten first.
+	*/
+	class NegativeLookupCache {
+	public:
+		NegativeLookupCache(size_t maxCountEntries);
+
+		bool contains(ClusterIndexType directoryStartCluster, const std::string& name);
+		// To be read before the directory is scanned. The name is not added if anything was invalidated since then.
+		uint32_t getGeneration() const;
+		void add(ClusterIndexType directoryStartCluster, const std::string& name, uint32_t generation);
+		// Should be called when the name is added to the directory.
+		void invalidate(ClusterIndexType directoryStartCluster, const std::string& name);
+		void clear();
+
+		size_t getCountEntries() const;
+		uint32_t getCountHits() const;
+
+	private:
+		struct Key {
+			bool operator==(const Key& other) const;
+
+			ClusterIndexType mDirectoryStartCluster;
+			std::string mName; // Lower case, and not longer than the name in the FileDescriptorRecord.
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key& key) const;
+		};
+
+		static Key _makeKey(ClusterIndexType directoryStartCluster, const std::string& name);
+
+	private:
+		mutable SFATMutex mMutex;
+		const size_t mMaxCountEntries;
+		std::unordered_set<Key, KeyHash> mEntries;
+		std::deque<Key> mInsertionOrder;
+		uint32_t mGeneration;
+		uint32_t mCountHits;
+	};
+
+} // namespace SFAT
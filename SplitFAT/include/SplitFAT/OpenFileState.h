@@ -0,0 +1,81 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include "SplitFAT/FileDescriptorRecord.h"
+#include "SplitFAT/utils/Mutex.h"
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+namespace SFAT {
+
+	/**
+	*	The state shared by all FileManipulators of the same open file.
+	*	Every FileManipulator keeps its own position, but takes the FileDescriptorRecord from here, if it was changed through another FileManipulator.
+	*	The record and the position cache are guarded by the mutex of the state.
+	*	The clusters kept for the next allocations of a growing file are in the allocation windows of the DataPlacementStrategyBase.
+	*/
+	class OpenFileState {
+	public:
+		OpenFileState(uint64_t fileKey, const FileDescriptorRecord& record);
+		OpenFileState(const OpenFileState&) = delete;
+		OpenFileState& operator=(const OpenFileState&) = delete;
+
+		uint64_t getFileKey() const { return mFileKey; }
+		// Removed from the OpenFileTable. The FileManipulators should get the state of the file again.
+		bool isRemoved() const { return mIsRemoved; }
+		void markRemoved() { mIsRemoved = true; }
+
+		// Copies the shared record, if it is different. Returns true if the cached cluster index of the position is not valid anymore.
+		bool syncRecord(FileDescriptorRecord& record, uint32_t& generation) const;
+		void updateRecord(const FileDescriptorRecord& record);
+		// Called when clusters were moved, so the cached cluster indices of all FileManipulators are wrong.
+		void invalidateClusterIndices();
+
+		// Gets the nearest cached cluster of the chain, which is not after the relative cluster index.
+		bool getCachedCluster(uint32_t maxRelativeClusterIndex, uint32_t& relativeClusterIndex, ClusterIndexType& clusterIndex) const;
+		void setCachedCluster(uint32_t relativeClusterIndex, ClusterIndexType clusterIndex);
+
+	private:
+		const uint64_t mFileKey;
+		std::atomic<bool> mIsRemoved;
+		mutable SFATMutex mMutex;
+		FileDescriptorRecord mRecord; // Guarded by mMutex
+		uint32_t mGeneration; // Guarded by mMutex
+		uint32_t mCachedRelativeClusterIndex; // Guarded by mMutex
+		ClusterIndexType mCachedClusterIndex; // Guarded by mMutex
+	};
+
+	/**
+	*	The states of the open files, by the location of their FileDescriptorRecord.
+	*	A state is kept while there are FileManipulators referring to it.
+	*/
+	class OpenFileTable {
+	public:
+		OpenFileTable();
+
+		std::shared_ptr<OpenFileState> find(uint64_t fileKey) const;
+		// Returns the registered state, or registers a new one with the given record.
+		std::shared_ptr<OpenFileState> acquire(uint64_t fileKey, const FileDescriptorRecord& record);
+		// A new file at the same location gets a new state.
+		void remove(uint64_t fileKey);
+		// Called when the stored records could be different, e.g. restored from the transaction file.
+		void clear();
+		void invalidateClusterIndices();
+		size_t getCountOpenFiles() const;
+
+	private:
+		void _removeExpired();
+
+	private:
+		mutable SFATMutex mMutex;
+		std::unordered_map<uint64_t, std::weak_ptr<OpenFileState>> mStates; // Guarded by mMutex
+		size_t mCountStatesForCleanup; // Guarded by mMutex
+	};
+
+} // namespace SFAT
@@ -8,6 +8,7 @@
 #include "SplitFAT/Common.h"
 #include "SplitFAT/FileDescriptorRecord.h"
 #include <string>
+#include <functional>
 
 namespace SFAT {
 
@@ -71,7 +72,11 @@ namespace SFAT {
 		}
 
 	private:
+		using AllocatedClusterCallback = std::function<ErrorCode(bool& doQuit, ClusterIndexType clusterIndex, FATCellValueType cellValue)>;
+
 		void _registerError(IntegrityStatus status, ClusterIndexType clusterIndex);
+		// Calls the callback for every allocated cluster, skipping the free ones by using the free-clusters set of the FAT blocks.
+		ErrorCode _iterateThroughAllocatedClusters(AllocatedClusterCallback callback);
 		ErrorCode verifyFileDescriptorClusterIndex(const FATCellValueType& cellValue, ClusterIndexType sourceClusterIndex, bool startCluster, CellTestResult& result);
 		ErrorCode testSingleFileIntegrity(const FileDescriptorRecord& record, const std::string& fullPath, ClusterChainTestResult& result);
 
@@ -0,0 +1,99 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "SplitFAT/DataPlacementStrategyBase.h"
+#include "SplitFAT/utils/Mutex.h"
+
+///Unit-test classes forward declaration
+
+namespace SFAT {
+
+	class VolumeManager;
+
+	enum class SizeClass : uint32_t {
+		SC_SMALL,
+		SC_MEDIUM,
+		SC_LARGE,
+		SC_COUNT,
+	};
+
+	struct SizeClassPlacementSettings {
+		SizeClassPlacementSettings();
+
+		FileSizeType mSmallFileMaxSize; /// Files with expected size up to this go to the blocks reserved for small files.
+		FileSizeType mLargeFileMinSize; /// Files with expected size from this up go to the blocks reserved for large files.
+	};
+
+	struct SizeClassPlacementStats {
+		SizeClassPlacementStats();
+
+		uint32_t mCountAllocations[static_cast<uint32_t>(SizeClass::SC_COUNT)];
+		uint32_t mCountBlocks[static_cast<uint32_t>(SizeClass::SC_COUNT)]; /// The medium files use all blocks that are not reserved.
+		uint32_t mCountContiguousAllocations;		/// A cluster allocated right after the last cluster of the file.
+		uint32_t mCountNonContiguousAllocations;	/// A cluster allocated for existing file, but not after its last cluster.
+		uint32_t mCountSizeClassChanges;			/// The file grew out of its size class, so its chain continues in another block.
+		uint32_t mCountFallbackAllocations;			/// There was no free space in a block of the requested class.
+	};
+
+	struct FragmentationStats {
+		FragmentationStats();
+
+		uint32_t mCountBlocks;
+		uint32_t mCountFreeClusters;
+		uint32_t mCountFreeRuns;	/// Count of the intervals of consecutive free clusters.
+		uint32_t mLongestFreeRun;
+	};
+
+	/**
+	 *  Keeps the small files in their own data blocks, and the large files in other data blocks, so the large files stay contiguous.
+	 *  The size class is selected by the expected file size from the allocation context. A growing file never gets a smaller class than the block of its last cluster.
+	 *  The reservation of the blocks is not persisted. After the volume is opened again, only completely free blocks get reserved.
+	 *  The clusters are allocated from all writing threads, so the state of the strategy is guarded by its own mutex.
+	 */
+	class SizeClassDataPlacementStrategy : public DataPlacementStrategyBase {
+	public:
+		SizeClassDataPlacementStrategy(VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem, const SizeClassPlacementSettings& settings = SizeClassPlacementSettings());
+		virtual ErrorCode prepareForWriteTransaction() override;
+		virtual ErrorCode performDefragmentaionOnTransactionEnd() override;
+		virtual ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage) override;
+		virtual ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& context) override;
+
+		SizeClassPlacementSettings getSettings() const;
+		void setSettings(const SizeClassPlacementSettings& settings);
+		SizeClass getSizeClass(FileSizeType expectedFileSize) const;
+		// Returns the size class the block is reserved for. SizeClass::SC_MEDIUM for not reserved blocks.
+		SizeClass getBlockSizeClass(uint32_t blockIndex) const;
+
+		SizeClassPlacementStats getPlacementStats() const;
+		void resetPlacementStats();
+		// Calculates the free space fragmentation of the file-data blocks used for the specified size class.
+		ErrorCode getFragmentationStats(FragmentationStats& stats, SizeClass sizeClass);
+
+	private:
+		// The private functions should be called with mPlacementMutex locked.
+		SizeClass _getSizeClass(FileSizeType expectedFileSize) const;
+		SizeClass _getBlockSizeClass(uint32_t blockIndex) const;
+		// Falls back to any free cluster if there is no space for the size class.
+		ErrorCode _findFreeCluster(ClusterIndexType& newClusterIndex, SizeClass sizeClass);
+		ErrorCode _findFreeClusterInSizeClass(ClusterIndexType& newClusterIndex, SizeClass sizeClass);
+		ErrorCode _reserveBlock(uint32_t& blockIndex, SizeClass sizeClass);
+		void _updateBlockClasses();
+		static void _addFragmentationStats(FragmentationStats& stats, const BitSet& freeClustersSet);
+
+	private:
+		mutable SFATMutex mPlacementMutex;
+		// Guarded by mPlacementMutex
+		SizeClassPlacementSettings mSettings;
+		SizeClassPlacementStats mStats;
+		std::vector<SizeClass> mBlockClasses;
+		uint32_t mCurrentBlockIndex[static_cast<uint32_t>(SizeClass::SC_COUNT)];
+	};
+
+} // namespace SFAT
@@ -17,6 +17,51 @@ namespace SFAT {
 	class VirtualFileSystem;
 	class DataPlacementStrategyBase;
 
+	enum class TransactionLogMode : uint32_t {
+		TLM_UNDO,	/// The original data is logged before the first change. The changes are written in place on commit.
+		TLM_REDO,	/// The changed data is logged on commit. It is written in place later, on checkpoint.
+	};
+
+	/**
+	*	Limits of the changes collected in an open transaction, before they are written in place by an automatic checkpoint.
+	*	Used only in undo mode. Zero disables the corresponding limit.
+	*/
+	struct TransactionCheckpointThresholds {
+		size_t mMaxDirtyBytes = 16 * 1024 * 1024;	/// Directory data changed, but still not written in place.
+		uint32_t mMaxLoggedFATPages = 4096;			/// FAT pages logged since the last checkpoint.
+		uint32_t mMaxDurationMs = 0;				/// Time since the start of the transaction or the last checkpoint.
+	};
+
+	/**
+	*	Settings of the cluster cache. The directory clusters are always cached, the file-data clusters optionally.
+	*	The clusters changed in a transaction stay cached until they are written, even if the budget is exceeded.
+	*/
+	struct ClusterCacheSettings {
+		size_t mMaxBytes = 8 * 1024 * 1024;	/// Budget of the cached cluster data.
+		bool mIsFileDataCached = true;		/// The file-data clusters are cached on read.
+		size_t mMaxPrefetchBytes = 4 * 1024 * 1024;	/// Budget of the clusters recorded in the warm-cache manifest on clean shutdown and prefetched on the next mount. Zero disables it.
+	};
+
+	/**
+	*	Memory budget of the volume, divided among the FAT cache, the cluster cache, the buffer pools and the buffers of the open files.
+	*	The FAT cache and the file buffers can't be shrunk. The buffer pools get a fixed share, and the cluster cache gets the rest,
+	*	instead of ClusterCacheSettings::mMaxBytes.
+	*/
+	struct MemoryBudgetSettings {
+		size_t mMaxBytes = 0;					/// Budget of the volume. Zero disables it, and every component uses its own settings.
+		uint32_t mBufferPoolPercent = 5;		/// Share of the budget for the free buffers kept in the buffer pools for reuse.
+		uint32_t mMinClusterCachePercent = 10;	/// Share of the budget left to the cluster cache, even if the rest of the components exceed the budget.
+	};
+
+	/**
+	*	Settings of the worker threads of the volume, executing the FAT preloading, the overlapped flushes, the background checkpoints
+	*	and the warm-cache prefetching.
+	*/
+	struct IOSchedulerSettings {
+		uint32_t mCountThreads = 0;		/// Zero uses one thread per hardware thread, but at least two.
+		uint32_t mMaxQueueDepth = 256;	/// Pending requests, before the submitting threads have to wait.
+	};
+
 	/**
 	*	Access to the lower level file storage for both FAT-data and cluster-data.
 	*/
@@ -52,6 +97,8 @@ namespace SFAT {
 		// Transaction
 		////////////////////////////////////////////////////////////////////////////////////////////////////
 		virtual bool isTransactionSupported() const { return false; }
+		virtual TransactionLogMode getTransactionLogMode() const { return TransactionLogMode::TLM_UNDO; }
+		virtual TransactionCheckpointThresholds getTransactionCheckpointThresholds() const { return TransactionCheckpointThresholds(); }
 		virtual ErrorCode createTempTransactionFile() {
 			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
 		}
@@ -68,6 +115,10 @@ namespace SFAT {
 		virtual ErrorCode finalizeTransactionFile() {
 			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
 		}
+		// Opens the finalized transaction file for writing the next segment of the log. The next finalizing only closes it.
+		virtual ErrorCode reopenFinalTransactionFileForAppend() {
+			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
+		}
 		virtual ErrorCode closeReadOnlyTransactionFile() {
 			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
 		}
@@ -75,6 +126,25 @@ namespace SFAT {
 			(void)fileHandle;
 		}
 
+		////////////////////////////////////////////////////////////////////////////////////////////////////
+		// Caching
+		////////////////////////////////////////////////////////////////////////////////////////////////////
+		virtual ClusterCacheSettings getClusterCacheSettings() const { return ClusterCacheSettings(); }
+		virtual MemoryBudgetSettings getMemoryBudgetSettings() const { return MemoryBudgetSettings(); }
+		virtual IOSchedulerSettings getIOSchedulerSettings() const { return IOSchedulerSettings(); }
+		// Opens the warm-cache manifest for reading. Returns RESULT_OK with a closed file handle if there is no manifest.
+		virtual ErrorCode tryOpenWarmCacheManifest(FileHandle& fileHandle) {
+			(void)fileHandle;
+			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
+		}
+		virtual ErrorCode createWarmCacheManifest(FileHandle& fileHandle) {
+			(void)fileHandle;
+			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
+		}
+		virtual ErrorCode removeWarmCacheManifest() {
+			return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
+		}
+
 	protected:
 
 		volatile bool mIsReady = false; //TODO: Consider for thread-safe implementation. It is not currently!
@@ -7,6 +7,7 @@
 
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/utils/Mutex.h"
+#include <future>
 
 //Define to 1 to enable the performance counters and print the result in the output console.
 #define SPLIT_FAT_ENABLE_PERFORMANCE_COUNTERS	0
@@ -84,6 +85,10 @@ namespace SFAT {
 		bool isInTransaction() const;
 		ErrorCode tryStartTransaction(bool &started);
 		ErrorCode endTransaction();
+		// In redo mode returns when the transaction is durable, leaving the writing of the changes in place to a background thread.
+		// The completion is set when the background work is done. The next transaction waits for it only if it is still running.
+		// In undo mode, the default, the transaction is committed synchronously, same as with endTransaction().
+		ErrorCode endTransactionAsync(std::shared_future<ErrorCode>& completion);
 		ErrorCode tryRestoreFromTransactionFile();
 
 		ErrorCode executeDebugCommand(const std::string& path, const std::string& command);
@@ -24,6 +24,7 @@ namespace SFAT {
 		virtual ErrorCode cleanupTransactionFinalFile() override;
 		virtual ErrorCode cleanupTransactionTempFile() override;
 		virtual ErrorCode finalizeTransactionFile() override;
+		virtual ErrorCode reopenFinalTransactionFileForAppend() override;
 		virtual ErrorCode closeReadOnlyTransactionFile() override;
 		virtual void getTempTransactionFile(FileHandle& fileHandle) const override;
 
@@ -39,6 +40,7 @@ namespace SFAT {
 		// Transaction
 		FileHandle	mTempTransactionFile;
 		FileHandle	mTransactionFile;
+		bool		mIsAppendingToFinalFile = false; // The temp file handle is used for the final transaction file.
 		std::shared_ptr<FileStorageBase>	mTransactionFileStorage;
 	};
 
@@ -10,15 +10,47 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <functional>
 
 #include "FileDescriptorRecord.h"
 #include "AbstractFileSystem.h"
 #include "LowLevelAccess.h"
+#include "SplitFATConfigurationBase.h"
 #include "SplitFAT/utils/Mutex.h"
 
+// The clusters freed during a transaction are released at the commit, in one batch per FAT block.
+#define SPLIT_FAT__ENABLE_DEFERRED_CLUSTER_FREE	1
+// The original FAT data is logged in pages on their first change, instead of entire FAT blocks.
+#define SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO	1
+// The logged events are collected in memory and written into the transaction file in large batches.
+#define SPLIT_FAT__ENABLE_BUFFERED_TRANSACTION_LOG	1
+// The payloads of the logged events are compressed - zero-run elision for the FAT data and LZ for the directory clusters.
+#define SPLIT_FAT__ENABLE_TRANSACTION_LOG_COMPRESSION	1
+// In undo mode the changes of a large transaction are written in place before the commit, when the checkpoint thresholds are exceeded.
+#define SPLIT_FAT__ENABLE_AUTOMATIC_CHECKPOINTS	1
+// The payloads of the restored events are decompressed and verified on more threads.
+#define SPLIT_FAT__ENABLE_PARALLEL_TRANSACTION_RESTORE	1
+
 ///Unit-test classes forward declaration
 #if !defined(MCPE_PUBLISH)
 class TransactionUnitTest_RestoreFromTransaction_Test;
+class TransactionUnitTest_FATChangesAreLoggedByPages_Test;
+class TransactionUnitTest_LogIsWrittenInBatches_Test;
+class TransactionUnitTest_LogPayloadsAreCompressed_Test;
+class TransactionUnitTest_RedoLogIsReplayedAfterCommit_Test;
+class TransactionUnitTest_AsyncCommitCompletesInBackground_Test;
+class TransactionUnitTest_AsyncCommitIsDurableBeforeCheckpoint_Test;
+class TransactionUnitTest_LargeTransactionIsCheckpointed_Test;
+class TransactionUnitTest_RestoreReadsLogInChunks_Test;
+class TransactionUnitTest_OldTransactionFileIsRejected_Test;
+class TransactionUnitTest_DamagedLastEventIsIgnored_Test;
+class TransactionUnitTest_CommitSyncsEveryFileOnce_Test;
+class DefragmentationUnitTest_ClustersFreedInTransactionAreNotMoved_Test;
+class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
 #endif //!defined(MCPE_PUBLISH)
 
 namespace SFAT {
@@ -30,6 +62,15 @@ namespace SFAT {
 		DIRECTORY_CLUSTER_CHANGED,
 		FILE_CLUSTER_CHANGED,
 		BLOCK_VIRTUALIZATION_TABLE_CHANGED,
+		FAT_PAGE_CHANGED, /// mClusterIndex is the index of the first FAT cell in the page.
+		REDO_LOG_STARTED, /// The first event of a redo log. No payload.
+		TRANSACTION_COMMITTED, /// The last event of a redo log. No payload. The redo log is ignored without it.
+	};
+
+	enum class TransactionPayloadCodec : uint32_t {
+		TPC_RAW,
+		TPC_ZERO_RUN,
+		TPC_LZ,
 	};
 
 	struct TransactionEvent {
@@ -39,38 +80,187 @@ namespace SFAT {
 			uint32_t mBlockIndex;
 			uint32_t mActiveDescriptorIndex;
 		};
-		uint32_t mCRC; // CRC before the any of the changes
+		uint32_t mCRC; // CRC32 of the payload before the any of the changes. Calculated on the uncompressed data.
+		TransactionPayloadCodec mCodec = TransactionPayloadCodec::TPC_RAW;
+		uint32_t mPayloadSize = 0; // Size of the payload, as stored in the transaction file.
+	};
+
+	// Written at the start of the transaction file, before the first event.
+	struct TransactionFileHeader {
+		enum : uint32_t {
+			SIGNATURE = 0x4C544653, // "SFTL"
+			// Version 1 had no header, and its events had neither codec nor payload size.
+			CURRENT_VERSION = 2,
+		};
+
+		uint32_t mSignature;
+		uint32_t mVersion;
+		// sizeof(TransactionEvent) of the writer
+		uint32_t mEventSize;
+		uint32_t mReserved;
+	};
+
+	static_assert(sizeof(TransactionFileHeader) == 16, "The size of the TransactionFileHeader is part of the transaction file layout!");
+
+	// An event read from the transaction file. The payload is as stored in the file and points in the read buffer.
+	struct TransactionEventView {
+		TransactionEvent mEvent;
+		const uint8_t* mPayload;
+	};
+
+	struct TransactionLogStats {
+		TransactionLogStats();
+
+		uint32_t mCountEvents;		/// Count of the events logged in the current transaction.
+		uint32_t mCountWrites;		/// Count of the writes into the transaction file.
+		FileSizeType mCountBytes;	/// Count of the bytes written into the transaction file.
+		FileSizeType mCountPayloadBytes;	/// Count of the bytes of the logged payloads, before the compression.
+		uint32_t mCountCheckpoints;	/// Count of the automatic checkpoints made in the current transaction.
 	};
 
 	class TransactionEventsLog {
 #if !defined(MCPE_PUBLISH)
 		friend class TransactionUnitTest_RestoreFromTransaction_Test;
+		friend class TransactionUnitTest_FATChangesAreLoggedByPages_Test;
+		friend class TransactionUnitTest_LogIsWrittenInBatches_Test;
+		friend class TransactionUnitTest_LogPayloadsAreCompressed_Test;
+		friend class TransactionUnitTest_RedoLogIsReplayedAfterCommit_Test;
+		friend class TransactionUnitTest_AsyncCommitCompletesInBackground_Test;
+		friend class TransactionUnitTest_AsyncCommitIsDurableBeforeCheckpoint_Test;
+		friend class TransactionUnitTest_LargeTransactionIsCheckpointed_Test;
+		friend class TransactionUnitTest_RestoreReadsLogInChunks_Test;
+		friend class TransactionUnitTest_OldTransactionFileIsRejected_Test;
+		friend class TransactionUnitTest_DamagedLastEventIsIgnored_Test;
+		friend class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
+		friend class DefragmentationUnitTest_ClustersFreedInTransactionAreNotMoved_Test;
 #endif //!defined(MCPE_PUBLISH)
 
 	public:
+		static const uint32_t kFATPageSize = 4096;
+		// When the buffered events reach this size, they are written into the transaction file.
+		static const uint32_t kLogBufferFlushThreshold = 1024 * 1024;
+		// The transaction file is read in chunks of this size on restore.
+		static const uint32_t kRestoreReadChunkSize = 4 * 1024 * 1024;
+		// The maximal count of chunks the events are split to for decoding on restore.
+		static const uint32_t kMaxRestoreChunksCount = 4;
+		// Fewer events are decoded on the calling thread only.
+		static const uint32_t kMinEventsForParallelRestore = 16;
+
+		// Called before the volume content is changed by a restore from the transaction file.
+		using RestoreCallback = std::function<void()>;
+
 		TransactionEventsLog(VolumeManager& volumeManager);
+		~TransactionEventsLog();
 		ErrorCode logFATCellChange(ClusterIndexType cellIndex, const FATBlockTableType& buffer);
 		ErrorCode logFileDescriptorChange(ClusterIndexType descriptorClusterIndex, const FileDescriptorRecord& oldRecord, const FileDescriptorRecord& newRecord);
 		ErrorCode logBlockVirtualizationChange();
 		ErrorCode logFileClusterChange(ClusterIndexType clusterIndex/*,  const void* oldClusterData, const void* newLusterData*/);
+		// Records a cluster to be freed at the commit. Until then the cluster stays allocated and can't be reused.
+		void deferClusterFree(ClusterIndexType clusterIndex);
+		// The cluster is released in the transaction, but stays allocated until the commit.
+		bool isClusterFreePending(ClusterIndexType clusterIndex);
+#if !defined(MCPE_PUBLISH)
+		// Simulates losing the FAT changes, that were still not applied.
+		void discardPendingClusterFrees();
+#endif //!defined(MCPE_PUBLISH)
 
 		ErrorCode start();
 		ErrorCode commit();
+		// In redo mode returns when the redo log is finalized, so the transaction can't be lost any more.
+		// The changes are written in place and the redo log is deleted by a checkpoint on a background thread.
+		// In undo mode a crash before the changes are written in place would revert the transaction, so it is committed synchronously,
+		// and commitAsync() takes as long as commit().
+		// The completion receives the result of the checkpoint, or of the commit if there is no checkpoint.
+		ErrorCode commitAsync(std::shared_future<ErrorCode>& completion);
 		ErrorCode tryRestoreFromTransactionFile();
+		// Every restore calls it, including the revert of a failed commit.
+		void setRestoreCallback(RestoreCallback callback);
 		bool isInTransaction() const;
+		// Writes the buffered events into the transaction file.
+		ErrorCode flushLog();
+		// Flush barrier "log durable" - writes the buffered events and syncs the transaction file, if it was written since its last sync.
+		// Has to be called before any of the logged data gets overwritten on the storage.
+		ErrorCode makeLogDurable();
+		const TransactionLogStats& getLogStats() const;
+		TransactionLogMode getLogMode() const;
+		// In redo mode the committed changes stay in the caches. The checkpoint writes them in place and deletes the redo log.
+		ErrorCode checkpoint();
+		bool isCheckpointPending() const;
+		// Waits for the background checkpoint started by commitAsync(), if it is still running.
+		// Should be called before anything that could overlap with the state being written in place.
+		ErrorCode waitForCheckpoint();
+		// Requests an automatic checkpoint, if any of the checkpoint thresholds is exceeded.
+		// Called while a cluster is written, so it doesn't make the checkpoint itself.
+		void requestCheckpointIfNeeded();
+		bool isCheckpointRequested() const;
+		// Writes the changes of the open transaction in place, if an automatic checkpoint was requested.
+		// The original data stays in the transaction file, so the whole transaction can still be reverted.
+		// Should be called with the volume locked exclusively, so nothing is logged or changed during the checkpoint.
+		ErrorCode checkpointIfNeeded();
 
 	private:
+		// Should be called with mLogMutex locked, before any event is written.
+		ErrorCode _writeFileHeader();
+		// Should be called with mLogMutex locked.
 		ErrorCode _writeIntoTransactionFile(const TransactionEvent& transactionEvent, const void* pBuffer);
+		// Returns the count of bytes of the event payload, before the compression.
+		ErrorCode _getPayloadByteSize(const TransactionEvent& transactionEvent, size_t& countBytes) const;
+		// Returns the size of the largest payload that could be logged for the volume.
+		size_t _getMaxPayloadSize() const;
+		// Decompresses the payload into the buffer and verifies its CRC.
+		// Doesn't use the buffers of the log, so it can be called from more threads.
+		static ErrorCode _decodePayload(const TransactionEvent& transactionEvent, const uint8_t* pPayload, void* pBuffer, size_t countBytes);
+		// Decodes the payloads of the events in parallel on the IOScheduler. The payloads of the not supported events are left empty.
+		// On failure failedEventIndex is the index of the first event that couldn't be decoded.
+		ErrorCode _decodeEvents(const std::vector<TransactionEventView>& events, std::vector<std::vector<uint8_t>>& decodedPayloads, size_t& failedEventIndex);
+		ErrorCode _restoreEvent(const TransactionEvent& transactionEvent, std::vector<uint8_t>& data);
+		// Selects the codec for the payload. The compressed payload, if any, is left in mCompressionBuffer.
+		TransactionPayloadCodec _compressPayload(TransactionEventType eventType, const void* pBuffer, size_t countBytes);
+		// Logs the new content of the FAT pages and the directory clusters changed in the transaction.
+		ErrorCode _logRedoImages();
+		// Reads the redo log to find out if its transaction was committed.
+		ErrorCode _scanTransactionFile(FileHandle& fileHandle, bool& isCommitted);
+		// Fails for the files of older or unknown versions, as their events can't be read.
+		static ErrorCode _verifyFileHeader(const TransactionFileHeader& header);
 		ErrorCode _restoreFromTransactionFile();
 		ErrorCode _finalizeTransacion();
+		ErrorCode _commit();
+		ErrorCode _backgroundCheckpoint();
+		ErrorCode _makeAutomaticCheckpoint();
+		ErrorCode _freePendingClusters();
+		// Returns the count of bytes logged for the FAT page starting with the specified cell. The last page of a block could be shorter.
+		size_t _getFATPageByteSize(ClusterIndexType pageStartCellIndex) const;
+		// The same as flushLog() and makeLogDurable(), but should be called with mLogMutex locked.
+		ErrorCode _flushLog();
+		ErrorCode _makeLogDurable();
 
 	private:
 		VolumeManager& mVolumeManager;
+		// The changes are logged from all writing threads, under the locks of the file system.
+		// It is taken last, after the locks of the file system and the mutex of the FAT cells.
+		SFATMutex mLogMutex;
+		// The changes, the buffers and the stats of the log are guarded by mLogMutex.
 		std::unordered_map<uint32_t, TransactionEvent> mFATBlockChanges;
+		std::unordered_map<ClusterIndexType, TransactionEvent> mFATPageChanges;
 		std::unordered_map<ClusterIndexType, TransactionEvent> mFileClusterChanges;
 		std::unordered_map<ClusterIndexType, TransactionEvent> mDirectoryClusterChanges;
+		std::vector<ClusterIndexType> mPendingFreeClusters;
 		bool mIsInTransaction;
-		std::vector<uint8_t> mClusterDataBuffer;
+		TransactionLogMode mLogMode;
+		std::atomic<bool> mIsCheckpointPending; // Changed by the background checkpoint
+		SFATMutex mCheckpointResultMutex;
+		std::shared_future<ErrorCode> mCheckpointResult; // Valid until the background checkpoint is waited for. Guarded by mCheckpointResultMutex
+		TransactionCheckpointThresholds mCheckpointThresholds;
+		bool mAreAutomaticCheckpointsEnabled;
+		std::atomic<bool> mIsCheckpointRequested;
+		std::atomic<uint32_t> mCountFATPagesSinceCheckpoint;
+		std::chrono::steady_clock::time_point mLastCheckpointTime;
+		size_t mRestoreReadChunkSize; // kRestoreReadChunkSize, could be changed by the tests.
+		std::vector<uint8_t> mLogBuffer;
+		std::vector<uint8_t> mCompressionBuffer;
+		FilePositionType mLogFilePosition;
+		TransactionLogStats mLogStats;
+		RestoreCallback mRestoreCallback;
 	};
 
 } // namespace SFAT
@@ -8,8 +8,10 @@
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/RecoveryManager.h"
 #include "SplitFAT/DataPlacementStrategyBase.h"
+#include "SplitFAT/NegativeLookupCache.h"
+#include "SplitFAT/FileSystemLocks.h"
+#include "SplitFAT/OpenFileState.h"
 #include "SplitFAT/utils/MemoryBufferPool.h"
-#include <stack>
 
 #if !defined(MCPE_PUBLISH)
 class VirtualFileSystemTests;
@@ -28,16 +30,34 @@ class VirtualFileSystemTests_ForwardAndBackwardClusterChainPropagation_Test;
 class VirtualFileSystemTests_LastClusterUpdateCreatingSeveralClustersBigFile_Test;
 class VirtualFileSystemTests_TruncatingFile_Test;
 class VirtualFileSystemTests_MoveClusterNoTransaction_Test;
+class VirtualFileSystemTests_InterleavedWritersKeepClustersContiguous_Test;
+class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
+class VirtualFileSystemTests_WarmCacheIsPrefetchedOnMount_Test;
+class VirtualFileSystemTests_HandlesOfSameFileShareState_Test;
+class MemoryBudget_VolumeStaysInBudget_Test;
+class IOScheduler_VolumeUsesConfiguredScheduler_Test;
+class SizeClassPlacement_SmallAndLargeFilesUseSeparateBlocks_Test;
+class SizeClassPlacement_ConcurrentAllocations_Test;
+class MultithreadingTest_ConcurrentReadsShareStorageReads_Test;
+class MultithreadingTest_ReadsProceedWhileFileIsWritten_Test;
+class MultithreadingTest_WritersOfDifferentFilesUseAllocationWindows_Test;
+class VirtualFileSystemTests_AllocationsSkipWindowsOfOtherFiles_Test;
 class BlockVirtualizationUnitTest;
 #endif //!defined(MCPE_PUBLISH)
 
 #define SPLIT_FAT_ENABLE_DEFRAGMENTATION	1
+// The names not found in a directory are remembered, so looking for them again doesn't scan the directory.
+#define SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE	1
+// The FileManipulators of the same file share its size, chain and position cache.
+#define SPLIT_FAT_ENABLE_OPEN_FILE_STATE	1
 
 namespace SFAT {
 
 	const size_t kMaxFileSize = 2 ^ 30; /// 1GB, where having cluster size of 8192 makes max 131072 clusters per file (cluster chain). 
 	const uint32_t kMaxCountNestedDirectories = 32;
 	const uint32_t kMaxCountEntitiesInDirectory = 65536; //Big enough number
+	const size_t kMaxCountNegativeLookups = 4096; /// Names remembered as missing in their directories.
+	const size_t kMaxCountFreeBuffers = 10; /// Cluster buffers kept for reuse, if the memory budget allows.
 	const uint32_t kInvalidDirectoryEntityIndex = static_cast<uint32_t>(-1);
 	static_assert(kInvalidDirectoryEntityIndex >= kMaxCountEntitiesInDirectory, "The index kInvalidDirectoryEntityIndex shouldn't be allowed");
 
@@ -47,20 +67,6 @@ namespace SFAT {
 	class PathString;
 	class FileStorageBase;
 
-	using FileManipulatorStack = std::stack<FileManipulator>;
-
-	class StackAutoElement {
-	public:
-		StackAutoElement(FileManipulatorStack& stack);
-
-		~StackAutoElement();
-
-		FileManipulator& getTop();
-
-	private:
-		FileManipulatorStack& mStackRef;
-	};
-
 #if !defined(MCPE_PUBLISH)
 	/**
 	 *  Used only for functionality related to the unit-tests.
@@ -88,6 +94,31 @@ namespace SFAT {
 		uint32_t		 mRecordIndex;
 	};
 
+	/**
+	*	Concurrency model
+	*
+	*	Every public operation takes the volume lock shared. It is taken exclusively only to start and end a transaction,
+	*	so no operation is split between two transactions, and while the volume is restored from the transaction file.
+	*	The defragmentation moves clusters at the end of the transaction, so it doesn't need other locks.
+	*	Every file and directory has its own lock, identified by the location of its FileDescriptorRecord.
+	*	The paths are resolved from the Root, locking every directory shared, and keeping it locked until its subdirectory is locked.
+	*	- Looking up, reading and iterating lock the entities shared. The iteration copies the records of a directory and releases its lock
+	*	  before calling the callback, so the callback can change the directory.
+	*	- Writing and truncating lock the file exclusively.
+	*	- Creating an entity locks its parent directory exclusively. Deleting, renaming and removing a directory lock exclusively
+	*	  both the entity and its parent directory.
+	*	The automatic checkpoints of a large transaction are only requested while a cluster is written. The next change takes the volume lock
+	*	exclusively to make the requested checkpoint, before it takes any other lock.
+	*	The volume-wide allocation lock is held only while clusters are allocated, linked in a chain or freed,
+	*	and the descriptor-cluster locks only while a FileDescriptorRecord is written. See FileSystemLocks for the order of the locks.
+	*	Every change of a FAT cell should be made under the allocation lock, except the CRC of a cluster, which is set while the cluster
+	*	is written. The FATDataManager serializes all changes of the cells with its own mutex, taken after all of these locks.
+	*	The transaction log is changed by all writers as well, so it is guarded by a mutex taken after the one of the cells.
+	*	Every growing file gets a window of clusters reserved by the DataPlacementStrategyBase, so its next clusters are allocated
+	*	next to each other, without searching. The FileManipulators of the same file share an OpenFileState.
+	*	A FileManipulator is not synchronized - it should be used by one thread at a time.
+	*	The functions with leading underscore don't take the volume and the entity locks. The caller should hold them.
+	*/
 	class VirtualFileSystem {
 #if !defined(MCPE_PUBLISH)
 		friend class VirtualFileSystemTests;
@@ -102,11 +133,32 @@ namespace SFAT {
 		friend class VirtualFileSystemTests_CreateSubdirectory_Test;
 		friend class VirtualFileSystemTests_isDirectoryEmpty_Test;
 		friend class TransactionUnitTest_RestoreFromTransaction_Test;
+		friend class TransactionUnitTest_FATChangesAreLoggedByPages_Test;
+		friend class TransactionUnitTest_LogIsWrittenInBatches_Test;
+		friend class TransactionUnitTest_LogPayloadsAreCompressed_Test;
+		friend class TransactionUnitTest_RedoLogIsReplayedAfterCommit_Test;
+		friend class TransactionUnitTest_AsyncCommitCompletesInBackground_Test;
+		friend class TransactionUnitTest_AsyncCommitIsDurableBeforeCheckpoint_Test;
+		friend class TransactionUnitTest_RestoreReadsLogInChunks_Test;
+		friend class TransactionUnitTest_CommitSyncsEveryFileOnce_Test;
+		friend class DefragmentationUnitTest_ClustersFreedInTransactionAreNotMoved_Test;
+		friend class MultithreadingTest_ConcurrentReadsShareStorageReads_Test;
+		friend class MultithreadingTest_ReadsProceedWhileFileIsWritten_Test;
+		friend class MultithreadingTest_WritersOfDifferentFilesUseAllocationWindows_Test;
+		friend class VirtualFileSystemTests_AllocationsSkipWindowsOfOtherFiles_Test;
 		friend class VirtualFileSystemTests_FileDescriptorRecordFromFirstFileClusterIndex_Test;
 		friend class VirtualFileSystemTests_ForwardAndBackwardClusterChainPropagation_Test;
 		friend class VirtualFileSystemTests_LastClusterUpdateCreatingSeveralClustersBigFile_Test;
 		friend class VirtualFileSystemTests_TruncatingFile_Test;
 		friend class VirtualFileSystemTests_MoveClusterNoTransaction_Test;
+		friend class VirtualFileSystemTests_InterleavedWritersKeepClustersContiguous_Test;
+		friend class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
+		friend class VirtualFileSystemTests_WarmCacheIsPrefetchedOnMount_Test;
+		friend class VirtualFileSystemTests_HandlesOfSameFileShareState_Test;
+		friend class MemoryBudget_VolumeStaysInBudget_Test;
+		friend class IOScheduler_VolumeUsesConfiguredScheduler_Test;
+		friend class SizeClassPlacement_SmallAndLargeFilesUseSeparateBlocks_Test;
+		friend class SizeClassPlacement_ConcurrentAllocations_Test;
 		friend class BlockVirtualizationUnitTest;
 #endif //!defined(MCPE_PUBLISH)
 
@@ -132,6 +184,11 @@ namespace SFAT {
 		ErrorCode createGenericFileManipulatorForExistingEntity(PathString entiryPath, FileManipulator& fileManipulator);
 		ErrorCode seek(FileManipulator& fileManipulator, FilePositionType offset, SeekMode mode);
 		ErrorCode truncateFile(FileManipulator& fileManipulator, size_t newSize);
+		/**
+		 * Sets the size the file is expected to reach, so a file written in small pieces gets its clusters placed as for its final size.
+		 * Only a hint for the data placement. The file itself is not changed.
+		 */
+		ErrorCode setExpectedFileSize(FileManipulator& fileManipulator, FileSizeType expectedFileSize);
 		ErrorCode deleteFile(const PathString& filePath);
 		ErrorCode removeDirectory(const PathString& directoryPath);
 		ErrorCode flush(FileManipulator& fileManipulator);
@@ -153,11 +210,13 @@ namespace SFAT {
 		bool isInTransaction() const;
 		ErrorCode startTransaction();
 		ErrorCode endTransaction();
+		ErrorCode endTransactionAsync(std::shared_future<ErrorCode>& completion);
 		ErrorCode tryRestoreFromTransactionFile();
 
 		//
 		// Defragmentation and DataPlacementStrategy
 		//
+		// Doesn't take any lock. Requires the volume lock held exclusively, or no other thread using the volume.
 		ErrorCode moveCluster(ClusterIndexType sourceClusterIndex, ClusterIndexType destClusterIndex);
 
 		//
@@ -173,10 +232,20 @@ namespace SFAT {
 		ErrorCode createFullFilePathFromFileManipulator(const FileManipulator& fileManipulator, std::string& fullFilePath);
 
 	private:
+		struct LockedPath;
+
 		//
 		// Functions that work directly with PathString and FileManipulator
 		//
 
+		/**
+		 * Finds the entity of the path, locking its parent directories one after another, starting from the Root.
+		 * The entity and its parent directory are left locked in the requested modes. The file-manipulators are invalid for the entities not found.
+		 */
+		ErrorCode _lockPath(const PathString& path, LockMode parentMode, LockMode entityMode, LockedPath& lockedPath);
+		// Creates file-manipulator for an existing file or directory, holding its lock only during the lookup.
+		ErrorCode _findEntity(const PathString& entityPath, FileManipulator& fileManipulator);
+
 		// Creates a file-manipulator for an existing directory
 		ErrorCode _createFileManipulatorForDirectoryPath(PathString directoryPath, FileManipulator& fileManipulator);
 		// Creates file or directory
@@ -185,6 +254,7 @@ namespace SFAT {
 		/**
 		 * Performs recursive iteration through all records that satisfy the filter flags.
 		 * Skips the hidden, deleted records. Stops the iteration not later than the first empty record.
+		 * Takes the locks of the directories only while their records are copied, so the callback is called without any lock held.
 		 */
 		ErrorCode _iterateThroughDirectoryRecursively(const PathString& directoryPath, uint32_t flags, DirectoryIterationCallbackInternal callback);
 
@@ -198,11 +268,8 @@ namespace SFAT {
 		 * Will only skip hidden records, but go through everything else, even deleted or empty ones.
 		 */
 		ErrorCode _iterateThroughDirectory(FileManipulator& parentDirFM, DirectoryIterationCallbackInternal callback);
-		/**
-		 * Performs recursive iteration through all records that satisfy the filter flags.
-		 * Skips the hidden, deleted records. Stops the iteration not later than the first empty record.
-		 */
-		ErrorCode _iterateThroughDirectoryRecursively(FileManipulatorStack& fwStack, uint32_t flags, DirectoryIterationCallbackInternal callback);
+		ErrorCode _read(FileManipulator& fileManipulator, void* buffer, size_t sizeToRead, size_t& sizeRead);
+		ErrorCode _write(FileManipulator& fileManipulator, const void* buffer, size_t sizeToWrite, size_t& sizeWritten);
 		ErrorCode _isDirectoryEmpty(FileManipulator& parentDirFM, bool& result);
 		ErrorCode _getFileSize(const FileManipulator& fileManipulator, size_t& fileSize) const;
 		ErrorCode _createEntity(FileManipulator& parentDirFM, const std::string& entityName, uint32_t accessMode, uint32_t attributes, FileManipulator& outputFileManipulator);
@@ -221,6 +288,19 @@ namespace SFAT {
 		 */
 		ErrorCode _updatePosition(FileManipulator& fileManipulator);
 		ErrorCode _writeFileDescriptor(const FileManipulator& fileManipulator);
+		// Reads again the FileDescriptorRecord of the file-manipulator. It could have been changed before the entity was locked.
+		ErrorCode _reloadFileDescriptor(FileManipulator& fileManipulator);
+		FileSystemLock _lockEntity(const DescriptorLocation& location, LockMode mode);
+		// Makes the automatic checkpoint requested by a previous change. Takes the volume lock exclusively.
+		// Called at the start of the public functions changing the volume, before any lock is taken.
+		ErrorCode makeRequestedCheckpoint();
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		// Takes the FileDescriptorRecord changed through another FileManipulator of the same file. The entity should be locked.
+		ErrorCode _syncOpenFileState(FileManipulator& fileManipulator);
+		// Shares the written FileDescriptorRecord with the other FileManipulators of the same file.
+		void _publishFileDescriptor(const FileManipulator& fileManipulator);
+		uint64_t _getFileKey(const DescriptorLocation& location) const;
+#endif
 		ErrorCode _expandFile(FileManipulator& fileManipulator, size_t newSize);
 		
 		//
@@ -240,11 +320,21 @@ namespace SFAT {
 		 *	@returns Corresponding error code. On error the output parameter clusterIndex is not modified.
 		 */
 		ErrorCode _getClusterForPosition(const FileDescriptorRecord& record, size_t position, ClusterIndexType& clusterIndex);
+		/**
+		 *	Same as above, but starts from the nearest known cluster before the position - the current one of the file-manipulator,
+		 *	or the one cached in its OpenFileState.
+		 */
+		ErrorCode _getClusterForPosition(const FileManipulator& fileManipulator, size_t position, ClusterIndexType& clusterIndex);
 
 		/**
 		 *  Appends a new allocated cluster to the end of the chain. Requires the end-of-chain cluster index.
 		 */
 		ErrorCode _appendClusterToEndOfChain(const DescriptorLocation& location, ClusterIndexType endOfChainClusterIndex, ClusterIndexType& allocatedClusterIndex, bool useFileDataStorage);
+		/**
+		 *  Same as above, but the placement of the new cluster is selected using the allocation context.
+		 *  The last cluster and the file identification in the context should correspond to endOfChainClusterIndex and location.
+		 */
+		ErrorCode _appendClusterToEndOfChain(const DescriptorLocation& location, ClusterIndexType endOfChainClusterIndex, ClusterIndexType& allocatedClusterIndex, const AllocationContext& allocationContext);
 
 		/**
 		 * Iterates through a chain of clusters
@@ -258,13 +348,14 @@ namespace SFAT {
 			std::function<ErrorCode(bool& doQuit, ClusterIndexType currentCluster, FATCellValueType cellValue)> callback, 
 									bool iterateForward = true, uint32_t maxClusterCount = 0);
 		
-		ErrorCode _findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage);
+		ErrorCode _findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& allocationContext);
 
 		/**
 		 *  Expands cluster chain with multiple clusters added at the end. Returns the index of the last cluster.
 		 *  The location of the FileDescriptorRecord is encoded into the cell-values corresponding to the first and last clusters of the chain.
+		 *  The allocationContext should have the pattern, the expected file size and the type of storage set. The rest is filled for every allocated cluster.
 		 */
-		ErrorCode _expandClusterChain(const FileManipulator& fileManipulator, uint32_t countClusters, ClusterIndexType& resultStartClusterIndex, ClusterIndexType& resultEndClusterIndex, bool useFileDataStorage);
+		ErrorCode _expandClusterChain(const FileManipulator& fileManipulator, uint32_t countClusters, ClusterIndexType& resultStartClusterIndex, ClusterIndexType& resultEndClusterIndex, const AllocationContext& allocationContext);
 		ErrorCode _getCountClusters(ClusterIndexType startClusterIndex, uint32_t& countClusters, ClusterIndexType& lastClusterIndex);
 
 		FileDescriptorRecord *_getFileDescriptorRecordInCluster(uint8_t *clusterData, uint32_t relativeClusterIndex);
@@ -272,6 +363,8 @@ namespace SFAT {
 		uint32_t _getRecordsPerCluster() const;
 
 		void _logReadingError(ErrorCode err, const FileManipulator& fileManipulator);
+		// Completes the defragmentation work that has to be part of the transaction being committed.
+		void _prepareForTransactionEnd();
 
 #if !defined(MCPE_PUBLISH)
 		//
@@ -302,6 +395,9 @@ namespace SFAT {
 		uint32_t getCountClustersForSize(size_t size) const;
 
 		std::unique_ptr<MemoryBufferPool> mMemoryBufferPool;
+		NegativeLookupCache mNegativeLookupCache;
+		FileSystemLocks mLocks;
+		OpenFileTable mOpenFiles;
 #if (SPLIT_FAT_ENABLE_DEFRAGMENTATION == 1)
 		std::shared_ptr<DataPlacementStrategyBase>	mDefragmentation;
 #endif
@@ -50,6 +50,10 @@ namespace SFAT {
 		uint32_t getFATOffset() const;
 		uint32_t getClusterIndexSize() const;
 		uint32_t getByteSizeOfFATBlock() const;
+		// The size of the BlockControlData as stored on the disk. It is the gap in front of every FAT block.
+		uint32_t getBlockControlDataSize() const;
+		// The block control data can be read and written only if it has the layout of the current BlockControlData.
+		bool isBlockControlDataSupported() const;
 		uint32_t getMaxBlocksCount() const;
 		uint32_t getFirstFileDataBlocksIndex() const;
 		uint32_t getVerificationCode() const;
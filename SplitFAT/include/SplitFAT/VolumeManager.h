@@ -8,20 +8,31 @@
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <atomic>
 #include "SplitFAT/Common.h"
 #include "SplitFAT/utils/Mutex.h"
+#include "SplitFAT/utils/IOScheduler.h"
 #include "SplitFAT/VolumeDescriptor.h"
 #include "SplitFAT/ControlStructures.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/SplitFATConfigurationBase.h"
 #include "SplitFAT/Transaction.h"
 #include "SplitFAT/BlockVirtualization.h"
+#include "SplitFAT/WarmCacheManifest.h"
+#include "SplitFAT/MemoryBudget.h"
+
+// The FAT-data and the cluster-data are flushed on separate threads, when they are in different physical files.
+#define SPLIT_FAT__ENABLE_OVERLAPPED_FLUSH	1
+
+// The hottest cached clusters are recorded on clean shutdown and prefetched in the background on the next mount.
+#define SPLIT_FAT__ENABLE_WARM_CACHE_MANIFEST	1
 
 ///Unit-test classes forward declaration
 #if !defined(MCPE_PUBLISH)
 class LowLevelUnitTest_VolumeDescriptorReadWrite_Test;
 class LowLevelUnitTest_ClusterWriteRead_Test;
 class VirtualFileSystemTests_ExpandFile_Test;
+class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
 class LowLevelUnitTest_BlockAllocation_Test;
 class BlockVirtualizationUnitTest; 
 #endif //!defined(MCPE_PUBLISH)
@@ -30,6 +41,7 @@ namespace SFAT {
 
 	class FATDataManager;
 	class DataBlockManager;
+	class ClusterView;
 	class VolumeDescriptor;
 	class FileStorageBase;
 
@@ -50,6 +62,25 @@ namespace SFAT {
 		std::string		mDescription;
 	};
 
+	/*
+		Counts of the syncs of the physical files.
+		The changes reach the storage through ordered flush barriers:
+		- log durable - the transaction file is written and synced, before any of the data logged in it is overwritten in place;
+		- data durable - the cached FAT-data and cluster-data are written in place and their files are synced;
+		- log cleanup - the transaction file is deleted, only after the data it protects is durable.
+		Every barrier syncs only the files written since their last sync.
+	*/
+	struct FlushStats {
+		FlushStats();
+		void reset();
+		uint32_t getCountSyncs() const;
+
+		std::atomic<uint32_t> mCountLogSyncs;			/// Count of the syncs of the transaction file.
+		std::atomic<uint32_t> mCountFATDataSyncs;		/// Count of the syncs of the FAT physical file.
+		std::atomic<uint32_t> mCountClusterDataSyncs;	/// Count of the syncs of the cluster-data physical file.
+		std::atomic<uint32_t> mCountSkippedSyncs;		/// Count of the syncs skipped, as the file wasn't written since its last sync.
+	};
+
 
 	/**
 	 *  Management of the low-level volume specific data and tasks.
@@ -73,8 +104,17 @@ namespace SFAT {
 		friend class LowLevelUnitTest_VolumeDescriptorReadWrite_Test;
 		friend class LowLevelUnitTest_ClusterWriteRead_Test;
 		friend class VirtualFileSystemTests_ExpandFile_Test;
+		friend class VirtualFileSystemTests_NegativeLookupsAreCached_Test;
 		friend class LowLevelUnitTest_BlockAllocation_Test;
 		friend class TransactionUnitTest_RestoreFromTransaction_Test;
+		friend class TransactionUnitTest_FATChangesAreLoggedByPages_Test;
+		friend class TransactionUnitTest_LogIsWrittenInBatches_Test;
+		friend class TransactionUnitTest_LogPayloadsAreCompressed_Test;
+		friend class TransactionUnitTest_RedoLogIsReplayedAfterCommit_Test;
+		friend class TransactionUnitTest_AsyncCommitCompletesInBackground_Test;
+		friend class TransactionUnitTest_AsyncCommitIsDurableBeforeCheckpoint_Test;
+		friend class TransactionUnitTest_RestoreReadsLogInChunks_Test;
+		friend class DefragmentationUnitTest_ClustersFreedInTransactionAreNotMoved_Test;
 		friend class BlockVirtualizationUnitTest;
 #endif //!defined(MCPE_PUBLISH)
 
@@ -100,6 +140,15 @@ namespace SFAT {
 		ErrorCode allocateBlockByIndex(uint32_t blockIndexToAllocate);
 		ErrorCode preallocateAllFATDataBlocks();
 		ErrorCode preloadAllFATDataBlocks();
+		ErrorCode startPreloadingAllFATDataBlocks();
+		ErrorCode waitForFATPreloadCompletion();
+		// Records the hottest cached clusters in the warm-cache manifest. Called on clean shutdown.
+		ErrorCode writeWarmCacheManifest();
+		// Consumes the warm-cache manifest and starts reading its clusters in the cache in the background.
+		ErrorCode startWarmCachePrefetch();
+		// Returns the count of the clusters prefetched.
+		uint32_t waitForWarmCachePrefetch();
+		void cancelWarmCachePrefetch();
 		ErrorCode blockSwitch();
 
 		const VolumeDescriptor& getVolumeDescriptor() const;
@@ -133,16 +182,32 @@ namespace SFAT {
 		bool isInTransaction() const;
 		ErrorCode startTransaction();
 		ErrorCode endTransaction();
+		// Returns when the transaction is durable. The completion is set when its changes are written in place.
+		// Only the redo mode leaves the writing in place to a background thread.
+		ErrorCode endTransactionAsync(std::shared_future<ErrorCode>& completion);
+		// The clusters released in a transaction stay allocated until the commit.
+		bool isClusterFreePending(ClusterIndexType clusterIndex);
+		ErrorCode waitForCheckpoint();
+		// An automatic checkpoint of the open transaction is requested when a cluster is written over a threshold.
+		bool isCheckpointRequested() const;
+		// Should be called with the volume locked exclusively.
+		ErrorCode checkpointIfNeeded();
 		ErrorCode logFileDescriptorChange(ClusterIndexType descriptorClusterIndex, const FileDescriptorRecord& oldRecord, const FileDescriptorRecord& newRecord);
 		ErrorCode logFATCellChange(ClusterIndexType cellIndex, const FATBlockTableType& buffer);
 		ErrorCode executeOnFATBlock(uint32_t blockIndex, FATBlockCallbackType callback);
 		ErrorCode tryRestoreFromTransactionFile();
+		// Called before the volume content is changed by any restore from the transaction file.
+		void setRestoreCallback(TransactionEventsLog::RestoreCallback callback);
 
 		// Low level storage access functions
 		ErrorCode setFATCell(ClusterIndexType cellIndex, FATCellValueType value);
 		ErrorCode getFATCell(ClusterIndexType cellIndex, FATCellValueType& value);
+		// Frees the cluster. In a transaction the FAT cell is changed at the commit.
+		ErrorCode freeCluster(ClusterIndexType clusterIndex);
 		ErrorCode readCluster(std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex);
 		ErrorCode writeCluster(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex);
+		// Read-only access to the cluster data, without copying it if it is cached.
+		ErrorCode acquireClusterView(ClusterIndexType clusterIndex, ClusterView& view);
 		ErrorCode verifyCRCOnRead(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex); // Should be called from the DataBlockManager inside the multi-thread synchronization block.
 		ErrorCode updateCRCOnWrite(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex); // Should be called from the DataBlockManager inside the multi-thread synchronization block.
 		ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage);
@@ -151,7 +216,13 @@ namespace SFAT {
 		uint32_t  getChunkSize() const;
 		FileSizeType getDataBlockSize() const;
 		ErrorCode flush();
+		// Flush barrier "data durable". In transaction the "log durable" barrier is passed first.
 		ErrorCode immediateFlush();
+		FlushStats& getFlushStats();
+		// The memory used by the components of the volume, and their limits.
+		const std::shared_ptr<MemoryBudget>& getMemoryBudget() const;
+		// Executes the asynchronous requests of the volume's components.
+		IOScheduler& getIOScheduler();
 
 		// Low level storage access for the defragmentation
 		FATDataManager& getFATDataManager();
@@ -189,9 +260,22 @@ namespace SFAT {
 		ErrorCode _writeVolumeControlData() const;
 
 		ErrorCode _getCountFreeClusters(uint32_t& countFreeClusters);
+		// Writes the cached FAT-data and flushes the FAT physical file.
+		ErrorCode _flushFATData();
+		// Writes the cached cluster-data and flushes the cluster-data physical file.
+		ErrorCode _flushClusterData();
+		// Flushes the physical file only if it was written since its last flush.
+		ErrorCode _syncFile(FileHandle file, std::function<ErrorCode()> flushFunction, std::atomic<uint32_t>& countSyncs);
+		// Identifies the state of the volume the warm-cache manifest was written for.
+		uint32_t _calculateVolumeStamp() const;
+		// CRC32 of the FAT cells of the range. Changes if any of the clusters is freed, reallocated, or written with CRC per cluster.
+		ErrorCode _calculateFATChecksum(ClusterIndexType startCluster, uint32_t countClusters, uint32_t& checksum);
+		void _prefetchWarmClusters(const std::vector<WarmCacheRange>& ranges, size_t maxCountClusters);
 
 	private:
 		VolumeDescriptor	mVolumeDescriptor;
+		std::shared_ptr<MemoryBudget>	mMemoryBudget; // Should outlive the components using it.
+		IOScheduler	mIOScheduler; // Should outlive the components submitting requests to it.
 		std::unique_ptr<FATDataManager>	mFATDataManager;
 		std::unique_ptr<DataBlockManager>	mDataBlockManager;
 		SFATMutex				mVolumeExpansionMutex;
@@ -199,6 +283,10 @@ namespace SFAT {
 		std::shared_ptr<SplitFATConfigurationBase>	mLowLevelAccess;
 		TransactionEventsLog mTransaction;
 		BlockVirtualization mBlockVirtualization;
+		FlushStats mFlushStats;
+		std::shared_future<ErrorCode> mWarmCachePrefetchCompletion;
+		std::atomic<bool> mIsWarmCachePrefetchCancelled;
+		std::atomic<uint32_t> mCountPrefetchedClusters;
 
 		FileSystemState	mState;
 	};
@@ -0,0 +1,48 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include <vector>
+
+namespace SFAT {
+
+	class FileHandle;
+
+	/**
+	*	Range of consecutive clusters recorded in the warm-cache manifest.
+	*	The checksum of their FAT cells changes if any of the clusters is written or reallocated.
+	*/
+	struct WarmCacheRange {
+		ClusterIndexType mStartCluster;
+		uint32_t mCountClusters;
+		uint32_t mFATChecksum;
+	};
+
+	/**
+	*	The clusters cached at the last clean shutdown, to be prefetched on the next mount.
+	*	Stored in a small file next to the FAT data, with a stamp of the volume it was written for.
+	*/
+	class WarmCacheManifest {
+	public:
+		WarmCacheManifest();
+
+		// Makes the ranges from the cluster indices. The checksums are not set.
+		void setClusters(std::vector<ClusterIndexType> clusterIndices);
+		std::vector<WarmCacheRange>& getRanges() { return mRanges; }
+		const std::vector<WarmCacheRange>& getRanges() const { return mRanges; }
+		uint32_t getVolumeStamp() const { return mVolumeStamp; }
+		void setVolumeStamp(uint32_t volumeStamp) { mVolumeStamp = volumeStamp; }
+
+		ErrorCode write(FileHandle& file) const;
+		ErrorCode read(FileHandle& file);
+
+	private:
+		uint32_t mVolumeStamp;
+		std::vector<WarmCacheRange> mRanges;
+	};
+
+} // namespace SFAT
@@ -7,6 +7,14 @@
 
 #include <vector>
 #include <stdint.h>
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Enables the AVX2 skipping over the elements of the set, when the target supports it.
+#define SPLIT_FAT__ENABLE_SIMD_BITSET_SCAN	1
 
 #if !defined(MCPE_PUBLISH)
 class BitSet_Constructor_Test;
@@ -44,6 +52,12 @@ namespace SFAT {
 		bool findLast(size_t& bitIndexFound, bool valueToLookFor, size_t endIndex) const;
 		bool findFirstZero(size_t& bitIndexFound, size_t startIndex = 0) const;
 		bool findFirstOne(size_t& bitIndexFound, size_t startIndex = 0) const;
+		// Returns the start of the first run of at least "length" consecutive bits with value equal to the specified. The search range is [startIndex, mSize)
+		bool findFirstRun(size_t& startIndexFound, bool valueToLookFor, size_t length, size_t startIndex = 0) const;
+		// Returns the start and the length of the longest run of consecutive bits with value equal to the specified. The first one is returned on equal length.
+		bool findLongestRun(size_t& startIndexFound, size_t& lengthFound, bool valueToLookFor) const;
+		// Sets the values in the range [startIndex, startIndex + countElements). The range is clipped to the size of the set.
+		void setRange(size_t startIndex, size_t countElements, bool value);
 		size_t getSize() const;
 		size_t getCountZeros() const;
 		size_t getCountOnes() const;
@@ -57,8 +71,74 @@ namespace SFAT {
 		// To be used for verification.
 		bool slowAnyInRange(size_t startIndex, size_t countElements) const;
 
+		// Direct access to the words of the set, for bulk updates. Bit (i % 64) of word (i / 64) represents the element i.
+		// Bits in the last word that are after the size of the set have undefined value.
+		ElementType* getElementsData();
+		const ElementType* getElementsData() const;
+		size_t getElementsCount() const;
+
+		// Returns the index of the lowest bit set to 1. The value should not be 0.
+		static inline uint32_t countTrailingZeros(ElementType value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanForward64(&index, value);
+			return static_cast<uint32_t>(index);
+#elif defined(_MSC_VER)
+			unsigned long index;
+			if (_BitScanForward(&index, static_cast<unsigned long>(value))) {
+				return static_cast<uint32_t>(index);
+			}
+			_BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+			return static_cast<uint32_t>(index) + 32;
+#else
+			return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+		}
+
+		// Returns the count of the zero bits above the highest bit set to 1. The value should not be 0.
+		static inline uint32_t countLeadingZeros(ElementType value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanReverse64(&index, value);
+			return 63 - static_cast<uint32_t>(index);
+#elif defined(_MSC_VER)
+			unsigned long index;
+			if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32))) {
+				return 31 - static_cast<uint32_t>(index);
+			}
+			_BitScanReverse(&index, static_cast<unsigned long>(value));
+			return 63 - static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+		}
+
+		static inline uint32_t popCount(ElementType value) {
+#if defined(_MSC_VER) && defined(_M_X64) && (defined(__AVX2__) || defined(__POPCNT__))
+			return static_cast<uint32_t>(__popcnt64(value));
+#elif defined(_MSC_VER)
+			// The POPCNT instruction is not guaranteed to be available.
+			value = value - ((value >> 1) & 0x5555555555555555ULL);
+			value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+			value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+			return static_cast<uint32_t>((value * 0x0101010101010101ULL) >> 56);
+#else
+			return static_cast<uint32_t>(__builtin_popcountll(value));
+#endif
+		}
+
 	public:
 		static const size_t npos = (size_t)(-1); // bad/missing position
+	private:
+		static ElementType _getStartMask(size_t bitIndex);
+		static ElementType _getEndMask(size_t bitIndex);
+		// Returns the element with the bits equal to valueToLookFor set to 1. The bits after mSize are always 0.
+		ElementType _getSearchElement(size_t elementIndex, bool valueToLookFor) const;
+		// Returns the index of the first element in [startElementIndex, count) with a bit equal to valueToLookFor, or the count of the elements.
+		size_t _findFirstNonEmptyElement(size_t startElementIndex, bool valueToLookFor) const;
+		// Returns the index of the last element in [0, endElementIndex] with a bit equal to valueToLookFor, or npos.
+		size_t _findLastNonEmptyElement(size_t endElementIndex, bool valueToLookFor) const;
+
 	private:
 		size_t mSize;
 		std::vector<ElementType> mElements;
@@ -0,0 +1,41 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace SFAT {
+
+	// Elides the runs of zero bytes. Suitable for data with long runs of zeros, like the FAT tables.
+	// The data is stored as a sequence of records - count of zero bytes (uint32_t), count of literal bytes (uint32_t), literal bytes.
+	class ZeroRunCodec {
+	public:
+		// Returns false if the compressed data is not smaller than the source. The content of dest is not defined in this case.
+		static bool compress(const void* source, size_t sourceSize, std::vector<uint8_t>& dest);
+		// Returns false if the compressed data is corrupted, or doesn't decompress to exactly destSize bytes.
+		static bool decompress(const void* source, size_t sourceSize, void* dest, size_t destSize);
+	}; //ZeroRunCodec
+
+	// Fast LZ77 codec for general data, with 64KB window.
+	// Every sequence starts with a token - the count of literals in the high 4 bits and the match length in the low 4 bits.
+	// Longer counts are extended with additional bytes. The literals are followed by the offset of the match (uint16_t).
+	// The last sequence contains only literals.
+	class LZCodec {
+	public:
+		// Returns false if the compressed data is not smaller than the source. The content of dest is not defined in this case.
+		static bool compress(const void* source, size_t sourceSize, std::vector<uint8_t>& dest);
+		// Returns false if the compressed data is corrupted, or doesn't decompress to exactly destSize bytes.
+		static bool decompress(const void* source, size_t sourceSize, void* dest, size_t destSize);
+
+	private:
+		static const uint32_t kMinMatchLength = 4;
+		static const uint32_t kMaxOffset = 0xFFFF;
+		static const uint32_t kHashBits = 12;
+	}; //LZCodec
+
+} // namespace SFAT
@@ -0,0 +1,87 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "SplitFAT/Common.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <future>
+
+namespace SFAT {
+
+	/// The pending requests are executed in this order.
+	enum class IOPriority : uint32_t {
+		IOP_FOREGROUND_READ,	/// Waited for by the reading threads, e.g. the FAT preloading.
+		IOP_FOREGROUND_WRITE,	/// Waited for by the writing threads, e.g. the overlapped flush.
+		IOP_BACKGROUND,			/// Maintenance nobody waits for, e.g. the checkpoints and the warm-cache prefetching.
+		IOP_COUNT
+	};
+
+	using IORequestTask = std::function<ErrorCode()>;
+
+	struct IOSchedulerStats {
+		uint32_t mQueueDepth = 0;				/// Requests waiting to be executed.
+		uint32_t mMaxQueueDepth = 0;
+		uint64_t mCountCompleted = 0;
+		uint64_t mCountFailed = 0;				/// Completed with an error.
+		uint64_t mTotalWaitMicroseconds = 0;	/// From the submitting to the start of the execution.
+		uint64_t mMaxWaitMicroseconds = 0;
+		uint64_t mTotalExecutionMicroseconds = 0;
+
+		uint64_t getAverageLatencyMicroseconds() const;
+	};
+
+	/**
+	*	Executes the I/O requests of the volume on the threads of a ThreadPool.
+	*	The pending requests are executed by priority, and in the order of submitting within the same priority.
+	*	The count of pending requests is limited. The submitting threads wait while the queue is full, except the workers,
+	*	as they have to execute the queued requests.
+	*/
+	class IOScheduler {
+	public:
+		IOScheduler();
+		~IOScheduler();
+		IOScheduler(const IOScheduler&) = delete;
+		IOScheduler& operator=(const IOScheduler&) = delete;
+
+		// Zero starts one worker per hardware thread, but at least two, so a long background request doesn't block the foreground ones.
+		void start(uint32_t countThreads, uint32_t maxQueueDepth);
+		// The pending requests are executed before the workers stop.
+		void stop();
+		bool isStarted() const;
+		uint32_t getCountThreads() const;
+
+		// Executed on the calling thread, if the scheduler is not started.
+		void submit(IOPriority priority, IORequestTask task);
+		void submit(IOPriority priority, IORequestTask task, std::shared_future<ErrorCode>& completion);
+		// Called from a worker, executes other pending requests while waiting.
+		ErrorCode wait(const std::shared_future<ErrorCode>& completion);
+
+		IOSchedulerStats getStats(IOPriority priority) const;
+		uint32_t getQueueDepth() const;
+
+	private:
+		struct IORequest {
+			IORequestTask mTask;
+			std::promise<ErrorCode> mCompletion;
+			std::chrono::steady_clock::time_point mSubmitTime;
+		};
+
+		void _enqueue(IOPriority priority, IORequest&& request);
+		// Executes the pending request with the highest priority.
+		void _executeNext();
+
+	private:
+		ThreadPool mThreadPool;
+		mutable SFATMutex mMutex;
+		std::condition_variable_any mQueueSpaceCondition;
+		std::deque<IORequest> mPendingRequests[static_cast<uint32_t>(IOPriority::IOP_COUNT)]; // Guarded by mMutex
+		IOSchedulerStats mStats[static_cast<uint32_t>(IOPriority::IOP_COUNT)]; // Guarded by mMutex
+		uint32_t mQueueDepth; // Guarded by mMutex
+		uint32_t mMaxQueueDepth;
+	};
+
+} // namespace SFAT
@@ -80,6 +80,20 @@ namespace SFAT {
 			return mTotalCountUsed;
 		}
 
+		size_t getAllocatedBytes() {
+			SFATLockGuard guard(mBufferUpdates);
+			return (mFreeResourceBlocks.size() + mTotalCountUsed) * mBufferSize;
+		}
+
+		// The free buffers over the count are released.
+		void setMaxCountFree(size_t maxCount) {
+			SFATLockGuard guard(mBufferUpdates);
+			mRecommendedReourceMaxCount = maxCount;
+			if (mFreeResourceBlocks.size() > mRecommendedReourceMaxCount) {
+				mFreeResourceBlocks.resize(mRecommendedReourceMaxCount);
+			}
+		}
+
 	private:
 		void recicleBuffer(MemoryBufferHandle& handle) {
 			SFATLockGuard guard(mBufferUpdates);
@@ -94,7 +108,7 @@ namespace SFAT {
 		std::vector<std::unique_ptr<ResourceItem>> mFreeResourceBlocks;
 		const size_t mBufferSize;
 		SFATMutex mBufferUpdates;
-		const size_t mRecommendedReourceMaxCount;
+		size_t mRecommendedReourceMaxCount;
 		volatile int mTotalCountUsed;
 	};
 
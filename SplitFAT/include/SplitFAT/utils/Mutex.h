@@ -15,6 +15,7 @@
 #	include <mutex>
 #	include <thread>
 #endif
+#include <shared_mutex>
 #include <atomic>
 
 namespace SFAT {
@@ -92,4 +93,41 @@ namespace SFAT {
 		std::thread::id mThreadId;
 	};
 
+	// Many threads can hold it shared, or a single thread exclusively. Not recursive in any of the modes.
+	class SFATSharedMutex {
+	public:
+
+		void lock();
+
+		void unlock();
+
+		void lockShared();
+
+		void unlockShared();
+
+	private:
+
+		std::shared_timed_mutex mMutex;
+	};
+
+	class SFATSharedLockGuard {
+	public:
+		SFATSharedLockGuard(SFATSharedMutex& mutex);
+		SFATSharedLockGuard(const SFATSharedLockGuard&) = delete;
+		~SFATSharedLockGuard();
+
+	private:
+		SFATSharedMutex& mMutex;
+	};
+
+	class SFATExclusiveLockGuard {
+	public:
+		SFATExclusiveLockGuard(SFATSharedMutex& mutex);
+		SFATExclusiveLockGuard(const SFATExclusiveLockGuard&) = delete;
+		~SFATExclusiveLockGuard();
+
+	private:
+		SFATSharedMutex& mMutex;
+	};
+
 } // namespace SFAT
\ No newline at end of file
@@ -0,0 +1,67 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#pragma once
+
+#include "Mutex.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace SFAT {
+
+	using ThreadPoolTask = std::function<void()>;
+
+	/**
+	*	Worker threads with a queue of tasks per worker.
+	*	A task submitted from a worker is queued to the same worker, the rest are distributed round-robin.
+	*	Every worker executes the most recently queued of its own tasks first. When it has none, it steals the oldest task of another worker.
+	*	The start and stop are not thread-safe with the rest of the functions.
+	*/
+	class ThreadPool {
+	public:
+		ThreadPool();
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Zero starts one worker per hardware thread.
+		void start(uint32_t countThreads);
+		// The queued tasks are executed before the workers stop.
+		void stop();
+		bool isStarted() const;
+		uint32_t getCountThreads() const;
+
+		// Executed on the calling thread, if the pool is not started.
+		void submit(ThreadPoolTask task);
+		// Executes one of the queued tasks on the calling thread. Returns false if there is none.
+		bool tryRunPendingTask();
+		bool isWorkerThread() const;
+		uint32_t getCountStolenTasks() const;
+
+	private:
+		struct WorkerQueue {
+			SFATMutex mMutex;
+			std::deque<ThreadPoolTask> mTasks; // Guarded by mMutex
+		};
+
+		void _workerLoop(uint32_t workerIndex);
+		bool _tryPopTask(uint32_t workerIndex, ThreadPoolTask& task);
+
+	private:
+		std::vector<std::unique_ptr<WorkerQueue>> mQueues;
+		std::vector<std::thread> mThreads;
+		std::atomic<uint32_t> mCountThreads;
+		std::atomic<uint32_t> mCountQueuedTasks;
+		std::atomic<uint32_t> mNextQueueIndex;
+		std::atomic<uint32_t> mCountStolenTasks;
+		SFATMutex mWakeMutex;
+		std::condition_variable_any mWakeCondition;
+		bool mIsStopping; // Guarded by mWakeMutex
+	};
+
+} // namespace SFAT
@@ -16,7 +16,8 @@ namespace SFAT {
 
 	FileBase::FileBase(FileStorageBase& fileStorage)
 		: mFileStorage(fileStorage)
-		, mAccessMode(AccessMode::AM_UNSPECIFIED) {
+		, mAccessMode(AccessMode::AM_UNSPECIFIED)
+		, mHasUnsyncedWrites(false) {
 	}
 
 	FileBase::~FileBase() {
@@ -94,6 +95,7 @@ namespace SFAT {
 	}
 
 	ErrorCode FileBase::readAtPosition(void* buffer, size_t sizeInBytes, FilePositionType position, size_t& sizeRead) {
+		SFATLockGuard lockGuard(mPositionedAccessMutex);
 		ErrorCode err = seek(position, SeekMode::SM_SET);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
@@ -103,6 +105,7 @@ namespace SFAT {
 	}
 
 	ErrorCode FileBase::writeAtPosition(const void* buffer, size_t sizeInBytes, FilePositionType position, size_t& sizeWritten) {
+		SFATLockGuard lockGuard(mPositionedAccessMutex);
 		ErrorCode err = seek(position, SeekMode::SM_SET);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
@@ -168,7 +171,9 @@ namespace SFAT {
 
 	ErrorCode FileHandle::write(const void* buffer, size_t sizeInBytes, size_t& sizeWritten) {
 		SFAT_ASSERT(isValid(), "The file-handle is invalid!");
-		return mFileImpl->write(buffer, sizeInBytes, sizeWritten);
+		ErrorCode err = mFileImpl->write(buffer, sizeInBytes, sizeWritten);
+		mFileImpl->mHasUnsyncedWrites = true;
+		return err;
 	}
 
 	ErrorCode FileHandle::readAtPosition(void* buffer, size_t sizeInBytes, FilePositionType position, size_t& sizeRead) {
@@ -178,7 +183,9 @@ namespace SFAT {
 
 	ErrorCode FileHandle::writeAtPosition(const void* buffer, size_t sizeInBytes, FilePositionType position, size_t& sizeWritten) {
 		SFAT_ASSERT(isValid(), "The file-handle is invalid!");
-		return mFileImpl->writeAtPosition(buffer, sizeInBytes, position, sizeWritten);
+		ErrorCode err = mFileImpl->writeAtPosition(buffer, sizeInBytes, position, sizeWritten);
+		mFileImpl->mHasUnsyncedWrites = true;
+		return err;
 	}
 
 	ErrorCode FileHandle::seek(FilePositionType offset, SeekMode mode) {
@@ -188,11 +195,21 @@ namespace SFAT {
 
 	ErrorCode FileHandle::flush() {
 		if (isOpen()) {
-			return mFileImpl->flush();
+			// Cleared before the flush, so a write made during the flush is synced by the next one.
+			mFileImpl->mHasUnsyncedWrites = false;
+			ErrorCode err = mFileImpl->flush();
+			if (err != ErrorCode::RESULT_OK) {
+				mFileImpl->mHasUnsyncedWrites = true;
+			}
+			return err;
 		}
 		return ErrorCode::RESULT_OK;
 	}
 
+	bool FileHandle::hasUnsyncedWrites() const {
+		return isOpen() && mFileImpl->mHasUnsyncedWrites;
+	}
+
 	ErrorCode FileHandle::getPosition(FilePositionType& position) {
 		SFAT_ASSERT(isValid(), "The file-handle is invalid!");
 		return mFileImpl->getPosition(position);
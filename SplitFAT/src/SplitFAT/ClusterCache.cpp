@@ -0,0 +1,568 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/ClusterCache.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include <algorithm>
+#include <string.h>
+
+namespace SFAT {
+
+	namespace {
+		const uint32_t kInvalidEntryIndex = ClusterIndexHashTable::kInvalidValue;
+	} // namespace
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	// ClusterIndexHashTable Implementation
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ClusterIndexHashTable::ClusterIndexHashTable()
+		: mSlots(kInitialCapacity, Slot{ 0, kInvalidValue })
+		, mMask(kInitialCapacity - 1)
+		, mShift(32 - 6) // log2(kInitialCapacity) bits of the hash are used
+		, mCount(0) {
+	}
+
+	size_t ClusterIndexHashTable::_getIdealSlot(ClusterIndexType key) const {
+		// Fibonacci hashing - the consecutive cluster indices are spread over the whole table.
+		return static_cast<size_t>((key * 2654435769U) >> mShift);
+	}
+
+	uint32_t ClusterIndexHashTable::find(ClusterIndexType key) const {
+		size_t slotIndex = _getIdealSlot(key);
+		while (true) {
+			const Slot& slot = mSlots[slotIndex];
+			if (slot.mValue == kInvalidValue) {
+				return kInvalidValue;
+			}
+			if (slot.mKey == key) {
+				return slot.mValue;
+			}
+			slotIndex = (slotIndex + 1) & mMask;
+		}
+	}
+
+	void ClusterIndexHashTable::insert(ClusterIndexType key, uint32_t value) {
+		SFAT_ASSERT(value != kInvalidValue, "The value is reserved for the empty slots!");
+		// Keeps the load factor up to 1/2, so the probe sequences stay short.
+		if (2 * (mCount + 1) > mSlots.size()) {
+			_grow();
+		}
+
+		size_t slotIndex = _getIdealSlot(key);
+		while (true) {
+			Slot& slot = mSlots[slotIndex];
+			if (slot.mValue == kInvalidValue) {
+				slot.mKey = key;
+				slot.mValue = value;
+				++mCount;
+				return;
+			}
+			if (slot.mKey == key) {
+				slot.mValue = value;
+				return;
+			}
+			slotIndex = (slotIndex + 1) & mMask;
+		}
+	}
+
+	bool ClusterIndexHashTable::erase(ClusterIndexType key) {
+		size_t slotIndex = _getIdealSlot(key);
+		while (true) {
+			const Slot& slot = mSlots[slotIndex];
+			if (slot.mValue == kInvalidValue) {
+				return false;
+			}
+			if (slot.mKey == key) {
+				break;
+			}
+			slotIndex = (slotIndex + 1) & mMask;
+		}
+
+		// Moves back the following elements of the probe sequence, that can't be found any more after the removal.
+		size_t emptySlotIndex = slotIndex;
+		size_t nextSlotIndex = slotIndex;
+		while (true) {
+			nextSlotIndex = (nextSlotIndex + 1) & mMask;
+			const Slot& slot = mSlots[nextSlotIndex];
+			if (slot.mValue == kInvalidValue) {
+				break;
+			}
+			// The distance from the ideal slot, with wrapping around the end of the table.
+			const size_t idealSlotIndex = _getIdealSlot(slot.mKey);
+			if (((nextSlotIndex - idealSlotIndex) & mMask) >= ((nextSlotIndex - emptySlotIndex) & mMask)) {
+				mSlots[emptySlotIndex] = slot;
+				emptySlotIndex = nextSlotIndex;
+			}
+		}
+		mSlots[emptySlotIndex].mValue = kInvalidValue;
+		--mCount;
+		return true;
+	}
+
+	size_t ClusterIndexHashTable::size() const {
+		return mCount;
+	}
+
+	void ClusterIndexHashTable::_grow() {
+		std::vector<Slot> oldSlots(mSlots.size() * 2, Slot{ 0, kInvalidValue });
+		oldSlots.swap(mSlots);
+		mMask = mSlots.size() - 1;
+		--mShift;
+		mCount = 0;
+		for (const auto& slot : oldSlots) {
+			if (slot.mValue != kInvalidValue) {
+				insert(slot.mKey, slot.mValue);
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	// ClusterCache Implementation
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	ClusterCacheStats::ClusterCacheStats()
+		: mCountHits(0)
+		, mCountMisses(0)
+		, mCountEvictions(0)
+		, mCountGhostHits(0) {
+	}
+
+	ClusterCache::ClusterCache(size_t clusterSize, size_t maxBytes)
+		: mClusterSize(clusterSize)
+		, mClustersPerSlab(1)
+		, mGhostSequence(0)
+		, mCountDirtyClusters(0) {
+		for (auto& priorityQueues : mQueues) {
+			for (auto& queue : priorityQueues) {
+				queue.mHead = kInvalidEntryIndex;
+				queue.mTail = kInvalidEntryIndex;
+				queue.mCount = 0;
+			}
+		}
+		setMaxBytes(maxBytes);
+	}
+
+	void ClusterCache::setMaxBytes(size_t maxBytes) {
+		mMaxCountClusters = std::max<size_t>(maxBytes / mClusterSize, 1);
+		// The proportions recommended for 2Q - a quarter of the cache for the recently used clusters,
+		// and ghosts for half of the cache capacity.
+		mMaxCountRecentClusters = std::max<size_t>(mMaxCountClusters / 4, 1);
+		mMaxCountGhosts = std::max<size_t>(mMaxCountClusters / 2, 1);
+		_evictIfNeeded();
+		_releaseUnusedSlabs();
+		if (mSlabs.empty()) {
+			// A small cache doesn't allocate much more than its budget.
+			mClustersPerSlab = std::max<size_t>(std::min(kSlabSize, maxBytes / kMinCountSlabs) / mClusterSize, 1);
+		}
+	}
+
+	uint8_t* ClusterCache::find(ClusterIndexType clusterIndex) {
+		const uint32_t entryIndex = mEntryIndices.find(clusterIndex);
+		if (entryIndex == kInvalidEntryIndex) {
+			++mStats.mCountMisses;
+			return nullptr;
+		}
+
+		++mStats.mCountHits;
+		Entry& entry = mEntries[entryIndex];
+		if (entry.mIsLinked && (entry.mQueueType == QueueType::QT_FREQUENT)) {
+			// Moves it to the head of the LRU queue. The FIFO queue keeps the order of insertion.
+			_unlink(entryIndex);
+			_link(entryIndex);
+		}
+		return _getBuffer(entryIndex);
+	}
+
+	const uint8_t* ClusterCache::pin(ClusterIndexType clusterIndex, uint32_t& entryIndex) {
+		if (find(clusterIndex) == nullptr) {
+			entryIndex = kInvalidEntryIndex;
+			return nullptr;
+		}
+
+		entryIndex = mEntryIndices.find(clusterIndex);
+		// The pinned clusters are kept out of the queues, so they can't be evicted.
+		++mEntries[entryIndex].mCountPins;
+		_unlink(entryIndex);
+		return _getBuffer(entryIndex);
+	}
+
+	void ClusterCache::unpin(uint32_t entryIndex) {
+		Entry& entry = mEntries[entryIndex];
+		SFAT_ASSERT(entry.mIsUsed && (entry.mCountPins > 0), "The cache entry is not pinned!");
+		--entry.mCountPins;
+		if (entry.mCountPins > 0) {
+			return;
+		}
+
+		if (entry.mIsDetached) {
+			_freeEntry(entryIndex);
+		}
+		else if (entry.mIsInSync) {
+			_link(entryIndex);
+			_evictIfNeeded();
+		}
+	}
+
+	uint8_t* ClusterCache::peek(ClusterIndexType clusterIndex) {
+		const uint32_t entryIndex = mEntryIndices.find(clusterIndex);
+		if (entryIndex == kInvalidEntryIndex) {
+			return nullptr;
+		}
+		return _getBuffer(entryIndex);
+	}
+
+	void ClusterCache::insert(ClusterIndexType clusterIndex, const uint8_t* data, ClusterCachePriority priority, bool isInSync) {
+		if (update(clusterIndex, data, isInSync)) {
+			return;
+		}
+
+		QueueType queueType = QueueType::QT_RECENT;
+		if (_takeGhost(clusterIndex)) {
+			// Evicted not long ago and needed again.
+			queueType = QueueType::QT_FREQUENT;
+			++mStats.mCountGhostHits;
+		}
+		// Makes room first, so a full cache reuses the buffer of the evicted cluster instead of allocating a new slab.
+		while ((mEntryIndices.size() >= mMaxCountClusters) && _evictOne()) {
+		}
+		const uint32_t entryIndex = _addEntry(clusterIndex, priority, queueType);
+		memcpy(_getBuffer(entryIndex), data, mClusterSize);
+		_setInSync(entryIndex, isInSync);
+		_evictIfNeeded();
+	}
+
+	bool ClusterCache::update(ClusterIndexType clusterIndex, const uint8_t* data, bool isInSync) {
+		uint32_t entryIndex = mEntryIndices.find(clusterIndex);
+		if (entryIndex == kInvalidEntryIndex) {
+			return false;
+		}
+
+		if (mEntries[entryIndex].mCountPins > 0) {
+			// The pinned data has to stay unchanged, so the new data goes in a new entry.
+			const ClusterCachePriority priority = mEntries[entryIndex].mPriority;
+			const QueueType queueType = mEntries[entryIndex].mQueueType;
+			_detach(entryIndex);
+			entryIndex = _addEntry(clusterIndex, priority, queueType);
+		}
+
+		memcpy(_getBuffer(entryIndex), data, mClusterSize);
+		_setInSync(entryIndex, isInSync);
+		_evictIfNeeded();
+		return true;
+	}
+
+	void ClusterCache::erase(ClusterIndexType clusterIndex) {
+		const uint32_t entryIndex = mEntryIndices.find(clusterIndex);
+		if (entryIndex == kInvalidEntryIndex) {
+			return;
+		}
+
+		if (mEntries[entryIndex].mCountPins > 0) {
+			// Freed on the last unpin.
+			_detach(entryIndex);
+			return;
+		}
+
+		_setInSync(entryIndex, true);
+		_unlink(entryIndex);
+		mEntryIndices.erase(clusterIndex);
+		_freeEntry(entryIndex);
+	}
+
+	ErrorCode ClusterCache::executeOnDirtyClusters(DirtyClusterCallbackType callback) {
+		std::vector<ClusterIndexType> clusterIndices;
+		getDirtyClusters(clusterIndices);
+		// Keeps the clusters in the order of their position on the storage.
+		std::sort(clusterIndices.begin(), clusterIndices.end());
+
+		for (ClusterIndexType clusterIndex : clusterIndices) {
+			ErrorCode err = executeOnDirtyCluster(clusterIndex, callback);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
+	void ClusterCache::getDirtyClusters(std::vector<ClusterIndexType>& clusterIndices) const {
+		clusterIndices.reserve(clusterIndices.size() + mCountDirtyClusters);
+		for (const auto& entry : mEntries) {
+			if (entry.mIsUsed && !entry.mIsInSync) {
+				clusterIndices.push_back(entry.mClusterIndex);
+			}
+		}
+	}
+
+	void ClusterCache::getCachedClusters(ClusterCachePriority priority, bool isFrequentlyUsed, size_t maxCount, std::vector<ClusterIndexType>& clusterIndices) const {
+		const Queue& queue = mQueues[static_cast<size_t>(priority)][static_cast<size_t>(isFrequentlyUsed ? QueueType::QT_FREQUENT : QueueType::QT_RECENT)];
+		size_t count = 0;
+		for (uint32_t entryIndex = queue.mHead; (entryIndex != kInvalidEntryIndex) && (count < maxCount); entryIndex = mEntries[entryIndex].mNext, ++count) {
+			clusterIndices.push_back(mEntries[entryIndex].mClusterIndex);
+		}
+	}
+
+	ErrorCode ClusterCache::executeOnDirtyCluster(ClusterIndexType clusterIndex, DirtyClusterCallbackType callback) {
+		const uint32_t entryIndex = mEntryIndices.find(clusterIndex);
+		if ((entryIndex == kInvalidEntryIndex) || mEntries[entryIndex].mIsInSync) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		bool isInSync = false;
+		ErrorCode err = callback(clusterIndex, _getBuffer(entryIndex), isInSync);
+		if ((err == ErrorCode::RESULT_OK) && isInSync) {
+			_setInSync(entryIndex, true);
+			_evictIfNeeded();
+		}
+		return err;
+	}
+
+	uint32_t ClusterCache::getCountDirtyClusters() const {
+		return mCountDirtyClusters;
+	}
+
+	size_t ClusterCache::getCountCachedClusters() const {
+		return mEntryIndices.size();
+	}
+
+	size_t ClusterCache::getMaxCountClusters() const {
+		return mMaxCountClusters;
+	}
+
+	size_t ClusterCache::getAllocatedBytes() const {
+		return mSlabs.size() * (mClustersPerSlab * mClusterSize + kSlabAlignment);
+	}
+
+	const ClusterCacheStats& ClusterCache::getStats() const {
+		return mStats;
+	}
+
+	uint8_t* ClusterCache::_getBuffer(uint32_t entryIndex) {
+		return mAlignedSlabs[entryIndex / mClustersPerSlab] + (entryIndex % mClustersPerSlab) * mClusterSize;
+	}
+
+	uint32_t ClusterCache::_addEntry(ClusterIndexType clusterIndex, ClusterCachePriority priority, QueueType queueType) {
+		const uint32_t entryIndex = _allocateEntry();
+		Entry& entry = mEntries[entryIndex];
+		entry.mClusterIndex = clusterIndex;
+		entry.mPriority = priority;
+		entry.mQueueType = queueType;
+		entry.mIsUsed = true;
+		entry.mIsDetached = false;
+		entry.mIsInSync = true;
+		entry.mIsLinked = false;
+		entry.mCountPins = 0;
+		entry.mPrev = kInvalidEntryIndex;
+		entry.mNext = kInvalidEntryIndex;
+		mEntryIndices.insert(clusterIndex, entryIndex);
+		_link(entryIndex);
+		return entryIndex;
+	}
+
+	void ClusterCache::_detach(uint32_t entryIndex) {
+		Entry& entry = mEntries[entryIndex];
+		SFAT_ASSERT(entry.mCountPins > 0, "Only the pinned entries are detached!");
+		// The pinned data is outdated, so it can't be written any more.
+		_setInSync(entryIndex, true);
+		_unlink(entryIndex);
+		mEntryIndices.erase(entry.mClusterIndex);
+		entry.mIsDetached = true;
+	}
+
+	void ClusterCache::_freeEntry(uint32_t entryIndex) {
+		mEntries[entryIndex].mIsUsed = false;
+		mFreeEntries.push_back(entryIndex);
+	}
+
+	uint32_t ClusterCache::_allocateEntry() {
+		if (!mFreeEntries.empty()) {
+			const uint32_t entryIndex = mFreeEntries.back();
+			mFreeEntries.pop_back();
+			return entryIndex;
+		}
+
+		const uint32_t entryIndex = static_cast<uint32_t>(mEntries.size());
+		if (entryIndex == mAlignedSlabs.size() * mClustersPerSlab) {
+			// The slabs are kept until the budget is reduced, the freed buffers are reused for the next clusters.
+			std::unique_ptr<uint8_t[]> slab(new uint8_t[mClustersPerSlab * mClusterSize + kSlabAlignment]);
+			const uintptr_t slabAddress = reinterpret_cast<uintptr_t>(slab.get());
+			const uintptr_t alignedSlabAddress = (slabAddress + kSlabAlignment - 1) & ~static_cast<uintptr_t>(kSlabAlignment - 1);
+			mAlignedSlabs.push_back(reinterpret_cast<uint8_t*>(alignedSlabAddress));
+			mSlabs.push_back(std::move(slab));
+		}
+		mEntries.emplace_back();
+		return entryIndex;
+	}
+
+	void ClusterCache::_moveEntry(uint32_t entryIndex, uint32_t newEntryIndex) {
+		SFAT_ASSERT(mEntries[entryIndex].mIsUsed && (mEntries[entryIndex].mCountPins == 0), "Only the not pinned entries can be moved!");
+		SFAT_ASSERT(!mEntries[newEntryIndex].mIsUsed, "The entry should be moved to a free one!");
+		Entry& entry = mEntries[newEntryIndex];
+		entry = mEntries[entryIndex];
+		memcpy(_getBuffer(newEntryIndex), _getBuffer(entryIndex), mClusterSize);
+		if (entry.mIsLinked) {
+			Queue& queue = _getQueue(entry);
+			if (entry.mPrev != kInvalidEntryIndex) {
+				mEntries[entry.mPrev].mNext = newEntryIndex;
+			}
+			else {
+				queue.mHead = newEntryIndex;
+			}
+			if (entry.mNext != kInvalidEntryIndex) {
+				mEntries[entry.mNext].mPrev = newEntryIndex;
+			}
+			else {
+				queue.mTail = newEntryIndex;
+			}
+		}
+		mEntryIndices.insert(entry.mClusterIndex, newEntryIndex);
+		mEntries[entryIndex].mIsUsed = false;
+	}
+
+	void ClusterCache::_releaseUnusedSlabs() {
+		// The pinned entries can't be moved, so their slabs are kept.
+		size_t countEntriesToKeep = mEntries.size() - mFreeEntries.size();
+		for (size_t entryIndex = 0; entryIndex < mEntries.size(); ++entryIndex) {
+			if (mEntries[entryIndex].mIsUsed && (mEntries[entryIndex].mCountPins > 0)) {
+				countEntriesToKeep = std::max(countEntriesToKeep, entryIndex + 1);
+			}
+		}
+		const size_t countSlabsToKeep = (countEntriesToKeep + mClustersPerSlab - 1) / mClustersPerSlab;
+		if (countSlabsToKeep >= mSlabs.size()) {
+			return;
+		}
+
+		const uint32_t countEntries = static_cast<uint32_t>(countSlabsToKeep * mClustersPerSlab);
+		std::vector<uint32_t> freeEntries;
+		for (uint32_t entryIndex : mFreeEntries) {
+			if (entryIndex < countEntries) {
+				freeEntries.push_back(entryIndex);
+			}
+		}
+		for (uint32_t entryIndex = countEntries; entryIndex < static_cast<uint32_t>(mEntries.size()); ++entryIndex) {
+			if (mEntries[entryIndex].mIsUsed) {
+				SFAT_ASSERT(!freeEntries.empty(), "There should be a free entry for every moved one!");
+				_moveEntry(entryIndex, freeEntries.back());
+				freeEntries.pop_back();
+			}
+		}
+
+		mEntries.resize(countEntries);
+		mFreeEntries = std::move(freeEntries);
+		mSlabs.resize(countSlabsToKeep);
+		mAlignedSlabs.resize(countSlabsToKeep);
+	}
+
+	ClusterCache::Queue& ClusterCache::_getQueue(const Entry& entry) {
+		return mQueues[static_cast<size_t>(entry.mPriority)][static_cast<size_t>(entry.mQueueType)];
+	}
+
+	void ClusterCache::_link(uint32_t entryIndex) {
+		Entry& entry = mEntries[entryIndex];
+		SFAT_ASSERT(!entry.mIsLinked, "The cache entry is already in a queue!");
+		Queue& queue = _getQueue(entry);
+		entry.mPrev = kInvalidEntryIndex;
+		entry.mNext = queue.mHead;
+		if (queue.mHead != kInvalidEntryIndex) {
+			mEntries[queue.mHead].mPrev = entryIndex;
+		}
+		else {
+			queue.mTail = entryIndex;
+		}
+		queue.mHead = entryIndex;
+		++queue.mCount;
+		entry.mIsLinked = true;
+	}
+
+	void ClusterCache::_unlink(uint32_t entryIndex) {
+		Entry& entry = mEntries[entryIndex];
+		if (!entry.mIsLinked) {
+			return;
+		}
+		Queue& queue = _getQueue(entry);
+		if (entry.mPrev != kInvalidEntryIndex) {
+			mEntries[entry.mPrev].mNext = entry.mNext;
+		}
+		else {
+			queue.mHead = entry.mNext;
+		}
+		if (entry.mNext != kInvalidEntryIndex) {
+			mEntries[entry.mNext].mPrev = entry.mPrev;
+		}
+		else {
+			queue.mTail = entry.mPrev;
+		}
+		entry.mPrev = kInvalidEntryIndex;
+		entry.mNext = kInvalidEntryIndex;
+		--queue.mCount;
+		entry.mIsLinked = false;
+	}
+
+	void ClusterCache::_setInSync(uint32_t entryIndex, bool isInSync) {
+		Entry& entry = mEntries[entryIndex];
+		if (entry.mIsInSync == isInSync) {
+			return;
+		}
+		entry.mIsInSync = isInSync;
+		if (isInSync) {
+			--mCountDirtyClusters;
+			if (entry.mCountPins == 0) {
+				_link(entryIndex);
+			}
+		}
+		else {
+			// The dirty clusters are kept out of the queues, so they can't be evicted.
+			++mCountDirtyClusters;
+			_unlink(entryIndex);
+		}
+	}
+
+	bool ClusterCache::_evictOne() {
+		for (size_t priority = 0; priority < static_cast<size_t>(ClusterCachePriority::CCP_COUNT); ++priority) {
+			Queue& recentQueue = mQueues[priority][static_cast<size_t>(QueueType::QT_RECENT)];
+			Queue& frequentQueue = mQueues[priority][static_cast<size_t>(QueueType::QT_FREQUENT)];
+			if ((recentQueue.mCount == 0) && (frequentQueue.mCount == 0)) {
+				continue;
+			}
+
+			// The recently used clusters are evicted first, until they fit in their share of the cache.
+			const bool evictRecent = (recentQueue.mCount > mMaxCountRecentClusters) || (frequentQueue.mCount == 0);
+			const uint32_t entryIndex = evictRecent ? recentQueue.mTail : frequentQueue.mTail;
+			const ClusterIndexType clusterIndex = mEntries[entryIndex].mClusterIndex;
+			erase(clusterIndex);
+			if (evictRecent) {
+				_addGhost(clusterIndex);
+			}
+			++mStats.mCountEvictions;
+			return true;
+		}
+		return false;
+	}
+
+	void ClusterCache::_evictIfNeeded() {
+		while ((mEntryIndices.size() > mMaxCountClusters) && _evictOne()) {
+		}
+	}
+
+	void ClusterCache::_addGhost(ClusterIndexType clusterIndex) {
+		mGhostSequence = (mGhostSequence + 1) % kInvalidEntryIndex;
+		const uint32_t sequence = mGhostSequence;
+		mGhostSequences.insert(clusterIndex, sequence);
+		mGhosts.push_back({ clusterIndex, sequence });
+		while (mGhosts.size() > mMaxCountGhosts) {
+			const GhostRecord& record = mGhosts.front();
+			// The record is outdated if the cluster became a ghost again later, or was taken back in the cache.
+			if (mGhostSequences.find(record.mClusterIndex) == record.mSequence) {
+				mGhostSequences.erase(record.mClusterIndex);
+			}
+			mGhosts.pop_front();
+		}
+	}
+
+	bool ClusterCache::_takeGhost(ClusterIndexType clusterIndex) {
+		return mGhostSequences.erase(clusterIndex);
+	}
+
+} // namespace SFAT
@@ -5,6 +5,7 @@
 
 #include "SplitFAT/DataBlockManager.h"
 #include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/SplitFATConfigurationBase.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/utils/SFATAssert.h"
 #include "SplitFAT/utils/Logger.h"
@@ -19,13 +20,69 @@
 
 namespace SFAT {
 
+	ClusterView::ClusterView()
+		: mDataBlockManager(nullptr)
+		, mClusterIndex(0)
+		, mEntryIndex(ClusterIndexHashTable::kInvalidValue)
+		, mData(nullptr) {
+	}
+
+	ClusterView::ClusterView(ClusterView&& other)
+		: ClusterView() {
+		*this = std::move(other);
+	}
+
+	ClusterView& ClusterView::operator=(ClusterView&& other) {
+		if (this != &other) {
+			release();
+			mDataBlockManager = other.mDataBlockManager;
+			mClusterIndex = other.mClusterIndex;
+			mEntryIndex = other.mEntryIndex;
+			mData = other.mData;
+			// The data of the moved vector stays at the same address.
+			mBuffer = std::move(other.mBuffer);
+			other.mDataBlockManager = nullptr;
+			other.mEntryIndex = ClusterIndexHashTable::kInvalidValue;
+			other.mData = nullptr;
+		}
+		return *this;
+	}
+
+	ClusterView::~ClusterView() {
+		release();
+	}
+
+	void ClusterView::release() {
+		if (mDataBlockManager != nullptr) {
+			mDataBlockManager->_releaseClusterView(*this);
+			mDataBlockManager = nullptr;
+		}
+		mEntryIndex = ClusterIndexHashTable::kInvalidValue;
+		mData = nullptr;
+	}
+
+	DataBlockManager::InFlightRead::InFlightRead()
+		: mResult(ErrorCode::RESULT_OK)
+		, mCountWaitingThreads(0)
+		, mIsCompleted(false)
+		, mIsInvalidated(false) {
+	}
+
+	DataBlockManager::CacheShard::CacheShard(size_t clusterSize, size_t maxBytes)
+		: mClusterCache(clusterSize, maxBytes) {
+	}
 
 	DataBlockManager::DataBlockManager(VolumeManager& volumeManager)
-		: mVolumeManager(volumeManager) {
+		: mVolumeManager(volumeManager)
+		, mIsFileDataCached(ClusterCacheSettings().mIsFileDataCached)
+		, mCountStorageReads(0) {
 		mClustersPerFATBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
 		mMaxPossibleBlocksCount = mVolumeManager.getMaxPossibleBlocksCount();
 		mDataBlockSize = static_cast<size_t>(mVolumeManager.getVolumeDescriptor().getDataBlockSize());
 		mClusterSize = mVolumeManager.getClusterSize();
+		for (uint32_t i = 0; i < kCountCacheShards; ++i) {
+			mCacheShards.push_back(std::make_unique<CacheShard>(mClusterSize, ClusterCacheSettings().mMaxBytes / kCountCacheShards));
+		}
 	}
 
 	DataBlockManager::~DataBlockManager() {
@@ -41,6 +98,84 @@ namespace SFAT {
 		return true;
 	}
 
+	void DataBlockManager::setCacheSettings(const ClusterCacheSettings& settings) {
+		mIsFileDataCached = settings.mIsFileDataCached;
+		setCacheMaxBytes(settings.mMaxBytes);
+	}
+
+	void DataBlockManager::setCacheMaxBytes(size_t maxBytes) {
+		for (auto& shard : mCacheShards) {
+			SFATLockGuard guard(shard->mMutex);
+			shard->mClusterCache.setMaxBytes(maxBytes / kCountCacheShards);
+		}
+	}
+
+	size_t DataBlockManager::getCacheAllocatedBytes() const {
+		size_t allocatedBytes = 0;
+		for (auto& shard : mCacheShards) {
+			SFATLockGuard guard(shard->mMutex);
+			allocatedBytes += shard->mClusterCache.getAllocatedBytes();
+		}
+		return allocatedBytes;
+	}
+
+	ClusterCacheStats DataBlockManager::getCacheStats() const {
+		ClusterCacheStats stats;
+		for (auto& shard : mCacheShards) {
+			SFATLockGuard guard(shard->mMutex);
+			const ClusterCacheStats& shardStats = shard->mClusterCache.getStats();
+			stats.mCountHits += shardStats.mCountHits;
+			stats.mCountMisses += shardStats.mCountMisses;
+			stats.mCountEvictions += shardStats.mCountEvictions;
+			stats.mCountGhostHits += shardStats.mCountGhostHits;
+		}
+		return stats;
+	}
+
+	size_t DataBlockManager::getCountCachedClusters() const {
+		size_t countClusters = 0;
+		for (auto& shard : mCacheShards) {
+			SFATLockGuard guard(shard->mMutex);
+			countClusters += shard->mClusterCache.getCountCachedClusters();
+		}
+		return countClusters;
+	}
+
+	uint32_t DataBlockManager::getCountStorageReads() const {
+		return mCountStorageReads;
+	}
+
+	void DataBlockManager::getHotClusters(size_t maxCountClusters, std::vector<ClusterIndexType>& clusterIndices) const {
+		static const struct {
+			ClusterCachePriority mPriority;
+			bool mIsFrequentlyUsed;
+		} kOrder[] = {
+			{ ClusterCachePriority::CCP_METADATA, true },
+			{ ClusterCachePriority::CCP_METADATA, false },
+			{ ClusterCachePriority::CCP_FILE_DATA, true },
+			{ ClusterCachePriority::CCP_FILE_DATA, false },
+		};
+
+		for (const auto& queue : kOrder) {
+			for (auto& shard : mCacheShards) {
+				if (clusterIndices.size() >= maxCountClusters) {
+					return;
+				}
+				SFATLockGuard guard(shard->mMutex);
+				shard->mClusterCache.getCachedClusters(queue.mPriority, queue.mIsFrequentlyUsed, maxCountClusters - clusterIndices.size(), clusterIndices);
+			}
+		}
+	}
+
+	FilePositionType DataBlockManager::getClusterPosition(ClusterIndexType clusterIndex) const {
+		return _getPosition(clusterIndex);
+	}
+
+	DataBlockManager::CacheShard& DataBlockManager::_getShard(ClusterIndexType clusterIndex) const {
+		// Fibonacci hashing, so the consecutive clusters of a file are spread over all shards.
+		return *mCacheShards[((clusterIndex * 2654435769U) >> 16) % kCountCacheShards];
+	}
+
 	FilePositionType DataBlockManager::_getPosition(ClusterIndexType clusterIndex) const {
 		// The calculations here consider that the cluster-data-blocks may not be sequential.
 		// This may happen if both - the FAT-data and the cluster-data are interleaved in a single expandable file.
@@ -52,51 +187,133 @@ namespace SFAT {
 	}
 
 	ErrorCode DataBlockManager::readCluster(std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex, bool isDirectoryData) {
-		SFATLockGuard guard(mClusterReadWriteMutex);
-		
-		if (buffer.size() < mClusterSize) {
-			buffer.resize(mClusterSize);
+		return _readCluster(buffer, clusterIndex, isDirectoryData, nullptr);
+	}
+
+	ErrorCode DataBlockManager::acquireClusterView(ClusterIndexType clusterIndex, bool isDirectoryData, ClusterView& view) {
+		view.release();
+		view.mClusterIndex = clusterIndex;
+		ErrorCode err = _readCluster(view.mBuffer, clusterIndex, isDirectoryData, &view);
+		if ((err == ErrorCode::RESULT_OK) && (view.mData == nullptr)) {
+			// Not cached, so the view keeps the copy read from the storage.
+			view.mData = view.mBuffer.data();
 		}
+		return err;
+	}
 
-		if (isDirectoryData) {
-			// Check first if we have the cluster data cached
-			auto it = mCachedClusters.find(clusterIndex);
-			if (it != mCachedClusters.end()) {
-				// We have it cached.
-				SFAT_ASSERT(it->second.mBuffer.size() == mClusterSize, "The cached cluster data buffer should have correct size!");
-				memcpy(buffer.data(), it->second.mBuffer.data(), mClusterSize);
+	void DataBlockManager::_releaseClusterView(ClusterView& view) {
+		CacheShard& shard = _getShard(view.mClusterIndex);
+		SFATLockGuard guard(shard.mMutex);
+		shard.mClusterCache.unpin(view.mEntryIndex);
+	}
+
+	ErrorCode DataBlockManager::_readCluster(std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex, bool isDirectoryData, ClusterView* view) {
+		const bool isCacheable = isDirectoryData || mIsFileDataCached;
+		CacheShard& shard = _getShard(clusterIndex);
+		while (true) {
+			std::shared_ptr<InFlightRead> inFlightRead;
+			{
+				SFATLockGuard guard(shard.mMutex);
+
+				if (isCacheable) {
+					// Check first if we have the cluster data cached
+					uint32_t entryIndex = 0;
+					const uint8_t* cachedBuffer = (view != nullptr) ? shard.mClusterCache.pin(clusterIndex, entryIndex) : shard.mClusterCache.find(clusterIndex);
+					if ((cachedBuffer != nullptr) && (view != nullptr)) {
+						// Pinned, instead of copied.
+						view->mDataBlockManager = this;
+						view->mEntryIndex = entryIndex;
+						view->mData = cachedBuffer;
+						return ErrorCode::RESULT_OK;
+					}
+					if (cachedBuffer != nullptr) {
+						if (buffer.size() < mClusterSize) {
+							buffer.resize(mClusterSize);
+						}
+						// We have it cached.
+						memcpy(buffer.data(), cachedBuffer, mClusterSize);
 #if defined(_DEBUG) && (SPLITFAT_VIRIFY_CONSISTENCY == 1)
-				FilePositionType position = _getPosition(clusterIndex);
-				std::vector<uint8_t> localBuffer(mClusterSize);
-				FileHandle file = mVolumeManager.getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_READ);
-				SFAT_ASSERT(file.isOpen(), "The cluster/directory data file should be open!");
-
-				size_t bytesRead = 0;
-				ErrorCode err = file.readAtPosition(localBuffer.data(), mClusterSize, position, bytesRead);
-				if (err != ErrorCode::RESULT_OK) {
-					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Error #%08X reading cluster!", err);
-				}
-				else if (localBuffer != it->second.mBuffer) {
-					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Inconsistent cached directory data!");
-				}
+						FilePositionType position = _getPosition(clusterIndex);
+						std::vector<uint8_t> localBuffer(mClusterSize);
+						FileHandle file = mVolumeManager.getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_READ);
+						SFAT_ASSERT(file.isOpen(), "The cluster/directory data file should be open!");
+
+						size_t bytesRead = 0;
+						ErrorCode err = file.readAtPosition(localBuffer.data(), mClusterSize, position, bytesRead);
+						if (err != ErrorCode::RESULT_OK) {
+							SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Error #%08X reading cluster!", err);
+						}
+						else if (memcmp(localBuffer.data(), cachedBuffer, mClusterSize) != 0) {
+							SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Inconsistent cached cluster data!");
+						}
 #endif
 
 #if (SPLITFAT_FORCE_CRC_VERIFICATION_ON_MEMORY_DATA == 1)
-				return mVolumeManager.verifyCRCOnRead(buffer, clusterIndex);
+						return mVolumeManager.verifyCRCOnRead(buffer, clusterIndex);
 #else 
-				return ErrorCode::RESULT_OK;
+						return ErrorCode::RESULT_OK;
 #endif //(SPLITFAT_FORCE_CRC_VERIFICATION_ON_MEMORY_CACHED_DATA == 1)
+					}
+				}
+
+				if (buffer.size() < mClusterSize) {
+					buffer.resize(mClusterSize);
+				}
+
+				auto it = shard.mInFlightReads.find(clusterIndex);
+				if (it != shard.mInFlightReads.end()) {
+					// Another thread is reading the same cluster. Wait for its data, instead of reading it again.
+					std::shared_ptr<InFlightRead> otherRead = it->second;
+					++otherRead->mCountWaitingThreads;
+					shard.mReadCompleted.wait(shard.mMutex, [&otherRead]() { return otherRead->mIsCompleted; });
+					if (otherRead->mIsInvalidated) {
+						// The cluster was written meanwhile, so start over.
+						continue;
+					}
+					if (otherRead->mResult == ErrorCode::RESULT_OK) {
+						memcpy(buffer.data(), otherRead->mBuffer.data(), mClusterSize);
+					}
+					return otherRead->mResult;
+				}
+
+				inFlightRead = std::make_shared<InFlightRead>();
+				shard.mInFlightReads[clusterIndex] = inFlightRead;
+			}
+
+			// The data is not cached, so read it from the storage.
+			// The shard is not locked meanwhile, so the other clusters of the shard can be accessed.
+			ErrorCode err = _readClusterFromStorage(buffer, clusterIndex);
+
+			SFATLockGuard guard(shard.mMutex);
+			inFlightRead->mResult = err;
+			inFlightRead->mIsCompleted = true;
+			if (inFlightRead->mCountWaitingThreads > 0) {
+				if ((err == ErrorCode::RESULT_OK) && !inFlightRead->mIsInvalidated) {
+					inFlightRead->mBuffer.assign(buffer.begin(), buffer.begin() + mClusterSize);
+				}
+				shard.mReadCompleted.notify_all();
 			}
+			if (inFlightRead->mIsInvalidated) {
+				// The cluster was written while being read, so the data could be outdated or even inconsistent with its CRC. Start over.
+				continue;
+			}
+
+			shard.mInFlightReads.erase(clusterIndex);
+			if ((err == ErrorCode::RESULT_OK) && isCacheable) {
+				// We need to add this data to the cache now
+				shard.mClusterCache.insert(clusterIndex, buffer.data(), isDirectoryData ? ClusterCachePriority::CCP_METADATA : ClusterCachePriority::CCP_FILE_DATA, true);
+			}
+			return err;
 		}
-		
-		// The data is not cached, so read it from the storage
-		//
+	}
 
+	ErrorCode DataBlockManager::_readClusterFromStorage(std::vector<uint8_t>& buffer, ClusterIndexType clusterIndex) {
 		FilePositionType position = _getPosition(clusterIndex);
 
 		FileHandle file = mVolumeManager.getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_READ);
 		SFAT_ASSERT(file.isOpen(), "The cluster/directory data file should be open!");
 
+		++mCountStorageReads;
 		size_t bytesRead = 0;
 		ErrorCode err = file.readAtPosition(buffer.data(), mClusterSize, position, bytesRead);
 		if (err != ErrorCode::RESULT_OK) {
@@ -107,49 +324,42 @@ namespace SFAT {
 			return ErrorCode::ERROR_READING_CLUSTER_DATA;
 		}
 
-		err = mVolumeManager.verifyCRCOnRead(buffer, clusterIndex);
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
-		}
-
-		if (isDirectoryData) {
-			// We need to add this data to the cache now
-			ClusterDataCache clusterCache;
-			clusterCache.mClusterIndex = clusterIndex;
-			clusterCache.mIsCacheInSync = true;
-			clusterCache.mBuffer.resize(mClusterSize);
-			memcpy(clusterCache.mBuffer.data(), buffer.data(), mClusterSize);
-			mCachedClusters.insert(std::pair<ClusterIndexType, ClusterDataCache>(clusterIndex, std::move(clusterCache)));
-		}
-
-		return ErrorCode::RESULT_OK;
+		return mVolumeManager.verifyCRCOnRead(buffer, clusterIndex);
 	}
 
 	ErrorCode DataBlockManager::writeCluster(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex, bool isDirectoryData) {
-		SFATLockGuard guard(mClusterReadWriteMutex);
+		CacheShard& shard = _getShard(clusterIndex);
+		SFATLockGuard guard(shard.mMutex);
+
+		auto it = shard.mInFlightReads.find(clusterIndex);
+		if (it != shard.mInFlightReads.end()) {
+			// The threads reading the cluster will read it again, after it is written.
+			it->second->mIsInvalidated = true;
+			shard.mInFlightReads.erase(it);
+		}
 
 		ErrorCode err = ErrorCode::RESULT_OK;
 		bool clusterWritten = false;
 		if (!mVolumeManager.isInTransaction() || !isDirectoryData) {
 			// When not in transaction, we have to write the cluster on spot.
-			err = _writeCluster(buffer, clusterIndex);
+			SFAT_ASSERT(buffer.size() >= mClusterSize, "The buffer size should be at least one cluster big in size!");
+			err = _writeCluster(buffer.data(), clusterIndex);
 			clusterWritten = (err == ErrorCode::RESULT_OK);
 			if (!clusterWritten) {
 				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Failed to write cluster data!");
 			}
 		}
 		if (isDirectoryData) {
-			// Check first if we have the cluster data cached
-			ClusterDataCache clusterCache;
-			auto res = mCachedClusters.insert(std::pair<ClusterIndexType, ClusterDataCache>(clusterIndex, clusterCache));
-			ClusterDataCache& clusterData = res.first->second;
-			if (res.second) {
-				// A new cache element has been just inserted. Initialize it
-				clusterData.mBuffer.resize(mClusterSize);
-				clusterData.mClusterIndex = clusterIndex;
-			}
-			memcpy(clusterData.mBuffer.data(), buffer.data(), mClusterSize);
-			clusterData.mIsCacheInSync = clusterWritten;
+			// In transaction the cached cluster is the only up to date copy, until it is written.
+			shard.mClusterCache.insert(clusterIndex, buffer.data(), ClusterCachePriority::CCP_METADATA, clusterWritten);
+		}
+		else if (clusterWritten) {
+			// The file data is cached only on read, so writing large files doesn't evict the clusters being read.
+			shard.mClusterCache.update(clusterIndex, buffer.data(), true);
+		}
+		else {
+			// The content of the cluster on the storage is not known after a failed write.
+			shard.mClusterCache.erase(clusterIndex);
 		}
 
 		if (err == ErrorCode::RESULT_OK) {
@@ -159,15 +369,14 @@ namespace SFAT {
 		return err;
 	}
 
-	ErrorCode DataBlockManager::_writeCluster(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex) {
+	ErrorCode DataBlockManager::_writeCluster(const uint8_t* buffer, ClusterIndexType clusterIndex) {
 		FilePositionType position = _getPosition(clusterIndex);
 
 		FileHandle file = mVolumeManager.getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_WRITE);
 		SFAT_ASSERT(file.isOpen(), "The cluster data file should be open!");
-		SFAT_ASSERT(buffer.size() >= mClusterSize, "The buffer size should be at least one cluster big in size!");
 
 		size_t bytesWritten = 0;
-		ErrorCode err = file.writeAtPosition(buffer.data(), mClusterSize, position, bytesWritten);
+		ErrorCode err = file.writeAtPosition(buffer, mClusterSize, position, bytesWritten);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Error #%08X writing cluster!", err);
 			return err;
@@ -180,50 +389,83 @@ namespace SFAT {
 	}
 
 	ErrorCode DataBlockManager::flush() {
-		SFATLockGuard guard(mClusterReadWriteMutex);
-
-		for (auto& elem : mCachedClusters) {
-			ClusterDataCache& clusterCache = elem.second;
-			if (!clusterCache.mIsCacheInSync) {
-				ErrorCode err = _writeCluster(clusterCache.mBuffer, clusterCache.mClusterIndex);
-				if (err != ErrorCode::RESULT_OK) {
-					return err;
-				}
-				clusterCache.mIsCacheInSync = true;
+		return _executeOnAllDirtyClusters([this](ClusterIndexType clusterIndex, uint8_t* buffer, bool& isInSync)->ErrorCode {
+			ErrorCode err = _writeCluster(buffer, clusterIndex);
+			isInSync = (err == ErrorCode::RESULT_OK);
+			return err;
+		});
+	}
+
+	ErrorCode DataBlockManager::executeOnDirtyClusters(ClusterDataCallbackType callback) {
+		return _executeOnAllDirtyClusters([&callback](ClusterIndexType clusterIndex, uint8_t* buffer, bool& isInSync)->ErrorCode {
+			(void)isInSync;
+			return callback(clusterIndex, buffer);
+		});
+	}
+
+	ErrorCode DataBlockManager::_executeOnAllDirtyClusters(DirtyClusterCallbackType callback) {
+		// The shards are always locked in the same order.
+		for (auto& shard : mCacheShards) {
+			shard->mMutex.lock();
+		}
+
+		std::vector<std::pair<ClusterIndexType, CacheShard*>> dirtyClusters;
+		std::vector<ClusterIndexType> clusterIndices;
+		for (auto& shard : mCacheShards) {
+			clusterIndices.clear();
+			shard->mClusterCache.getDirtyClusters(clusterIndices);
+			for (ClusterIndexType clusterIndex : clusterIndices) {
+				dirtyClusters.emplace_back(clusterIndex, shard.get());
 			}
 		}
-		return ErrorCode::RESULT_OK;
+		// Keeps the clusters in the order of their position on the storage.
+		std::sort(dirtyClusters.begin(), dirtyClusters.end());
+
+		ErrorCode err = ErrorCode::RESULT_OK;
+		for (const auto& elem : dirtyClusters) {
+			err = elem.second->mClusterCache.executeOnDirtyCluster(elem.first, callback);
+			if (err != ErrorCode::RESULT_OK) {
+				break;
+			}
+		}
+
+		for (auto it = mCacheShards.rbegin(); it != mCacheShards.rend(); ++it) {
+			(*it)->mMutex.unlock();
+		}
+		return err;
+	}
+
+	size_t DataBlockManager::getDirtyBytes() const {
+		size_t countDirtyClusters = 0;
+		for (auto& shard : mCacheShards) {
+			countDirtyClusters += shard->mClusterCache.getCountDirtyClusters();
+		}
+		return countDirtyClusters * mClusterSize;
 	}
 
 	//For testing purposes only
 #if !defined(MCPE_PUBLISH)
 	//To be used for simulation of missed data flush.
 	ErrorCode DataBlockManager::discardCachedChanges() {
-		SFATLockGuard guard(mClusterReadWriteMutex);
-
 		FileHandle file = mVolumeManager.getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_READ);
 		SFAT_ASSERT(file.isOpen(), "The cluster/directory data file should be open!");
 
-		for (auto& elem : mCachedClusters) {
-			ClusterDataCache& clusterCache = elem.second;
-			if (!clusterCache.mIsCacheInSync) {
-
-				FilePositionType position = _getPosition(clusterCache.mClusterIndex);
+		return _executeOnAllDirtyClusters([this, &file](ClusterIndexType clusterIndex, uint8_t* buffer, bool& isInSync)->ErrorCode {
+			FilePositionType position = _getPosition(clusterIndex);
 
-				size_t bytesRead = 0;
-				ErrorCode err = file.readAtPosition(clusterCache.mBuffer.data(), mClusterSize, position, bytesRead);
-				if (err != ErrorCode::RESULT_OK) {
-					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Error #%08X reading cluster!", err);
-					return err;
-				}
-				if (bytesRead != mClusterSize) {
-					return ErrorCode::ERROR_READING_CLUSTER_DATA;
-				}
-
-				clusterCache.mIsCacheInSync = true;
+			size_t bytesRead = 0;
+			ErrorCode err = file.readAtPosition(buffer, mClusterSize, position, bytesRead);
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Error #%08X reading cluster!", err);
+				return err;
 			}
-		}
-		return ErrorCode::RESULT_OK;
+			if (bytesRead != mClusterSize) {
+				return ErrorCode::ERROR_READING_CLUSTER_DATA;
+			}
+
+			isInSync = true;
+			return ErrorCode::RESULT_OK;
+		});
 	}
 #endif //!defined(MCPE_PUBLISH)
 
@@ -16,13 +16,38 @@
 namespace SFAT {
 
 	/**************************************************************************
+	*	AllocationContext implementation
+	**************************************************************************/
+
+	AllocationContext::AllocationContext()
+		: mLastCluster(ClusterValues::INVALID_VALUE)
+		, mDescriptorClusterIndex(ClusterValues::INVALID_VALUE)
+		, mRecordIndex(0)
+		, mCountClustersToAllocate(1)
+		, mExpectedFileSize(0)
+		, mPattern(AllocationPattern::AP_UNKNOWN)
+		, mUseFileDataStorage(true) {
+	}
+
+	AllocationContext::AllocationContext(ClusterIndexType lastCluster, bool useFileDataStorage)
+		: mLastCluster(lastCluster)
+		, mDescriptorClusterIndex(ClusterValues::INVALID_VALUE)
+		, mRecordIndex(0)
+		, mCountClustersToAllocate(1)
+		, mExpectedFileSize(0)
+		, mPattern(AllocationPattern::AP_UNKNOWN)
+		, mUseFileDataStorage(useFileDataStorage) {
+	}
+
+	/**************************************************************************
 	*	DataPlacementStrategyBase implementation
 	**************************************************************************/
 
 	DataPlacementStrategyBase::DataPlacementStrategyBase(VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem)
 		: mVolumeManager(volumeManager)
 		, mVirtualFileSystem(virtualFileSystem)
-		, mIsActive(false) {
+		, mIsActive(false)
+		, mAllocationWindowsUseCounter(0) {
 	}
 
 	bool DataPlacementStrategyBase::isActive() const {
@@ -30,6 +55,11 @@ namespace SFAT {
 	}
 
 	ErrorCode DataPlacementStrategyBase::moveCluster(ClusterIndexType sourceClusterIndex, ClusterIndexType destClusterIndex) {
+		// The clusters freed in the transaction stay allocated until the commit, and a rollback needs their content unchanged.
+		// A moved copy of such a cluster would never be freed.
+		if (mVolumeManager.isClusterFreePending(sourceClusterIndex) || mVolumeManager.isClusterFreePending(destClusterIndex)) {
+			return ErrorCode::RESULT_OK;
+		}
 		return mVirtualFileSystem.moveCluster(sourceClusterIndex, destClusterIndex);
 	}
 
@@ -49,4 +79,216 @@ namespace SFAT {
 		return mVolumeManager.getBlockVirtualization().swapScratchBlockWithVirtualBlock(virtualBlockIndex);
 	}
 
+	ErrorCode DataPlacementStrategyBase::findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& context) {
+		return _findFreeClusterNearChain(newClusterIndex, context, [this, &context](ClusterIndexType& freeClusterIndex) {
+			return findFreeCluster(freeClusterIndex, context.mUseFileDataStorage);
+		});
+	}
+
+	void DataPlacementStrategyBase::releaseAllocationWindows() {
+		SFATLockGuard lock(mAllocationWindowsMutex);
+		mAllocationWindows.clear();
+		mAllocationWindowStarts.clear();
+	}
+
+	ErrorCode DataPlacementStrategyBase::_findFreeClusterNearChain(ClusterIndexType& newClusterIndex, const AllocationContext& context, const FreeClusterSelector& selectFreeCluster) {
+#if (SPLIT_FAT__ENABLE_LOCALITY_AWARE_ALLOCATION == 1)
+		if (context.mUseFileDataStorage) {
+			SFATLockGuard lock(mAllocationWindowsMutex);
+
+			const uint64_t fileKey = _getFileKey(context);
+			uint32_t windowLength = 1;
+			if (context.mPattern != AllocationPattern::AP_RANDOM) {
+				if (isValidClusterIndex(context.mLastCluster)) {
+					// Continue the chain right after its last cluster if possible.
+					ClusterIndexType nextClusterIndex = context.mLastCluster + 1;
+					const uint32_t blockIndex = mVolumeManager.getBlockIndex(context.mLastCluster);
+					if ((mVolumeManager.getBlockIndex(nextClusterIndex) == blockIndex) && _canContinueChainInBlock(blockIndex) &&
+						_isFreeClusterAvailable(nextClusterIndex, fileKey)) {
+						AllocationWindow* window = _findAllocationWindow(fileKey);
+						if (window != nullptr) {
+							window->mLastUse = ++mAllocationWindowsUseCounter;
+						}
+						newClusterIndex = nextClusterIndex;
+						return ErrorCode::RESULT_OK;
+					}
+				}
+
+				// The chain can't continue in place, so the previous window of the file is not useful anymore.
+				_removeAllocationWindow(fileKey);
+
+				windowLength = context.mCountClustersToAllocate;
+				if (!isValidClusterIndex(context.mLastCluster) && (context.mExpectedFileSize > 0)) {
+					// A new chain. Reserve space for the expected size of the file.
+					const FileSizeType clusterSize = mVolumeManager.getClusterSize();
+					const FileSizeType expectedClustersCount = (context.mExpectedFileSize + clusterSize - 1) / clusterSize;
+					windowLength = static_cast<uint32_t>(std::max<FileSizeType>(windowLength, std::min<FileSizeType>(expectedClustersCount, kMaxAllocationWindowClusters)));
+				}
+				if (context.mPattern == AllocationPattern::AP_SEQUENTIAL) {
+					// The file will most likely continue growing.
+					windowLength = std::max(windowLength, kSequentialAllocationWindowClusters);
+				}
+				windowLength = std::min(windowLength, kMaxAllocationWindowClusters);
+			}
+			// Even without a window of its own, the file doesn't take the clusters from the windows of the other files.
+			return _findClusterForNewWindow(newClusterIndex, context, windowLength, selectFreeCluster);
+		}
+#endif
+		return selectFreeCluster(newClusterIndex);
+	}
+
+	bool DataPlacementStrategyBase::_canContinueChainInBlock(uint32_t blockIndex) const {
+		(void)blockIndex; // Not used parameter
+		return true;
+	}
+
+	bool DataPlacementStrategyBase::_isFreeClusterAvailable(ClusterIndexType clusterIndex, uint64_t fileKey) {
+		if (!isValidClusterIndex(clusterIndex) || (mVolumeManager.getBlockIndex(clusterIndex) >= mVolumeManager.getCountAllocatedDataBlocks())) {
+			return false;
+		}
+
+		// The clusters reserved for another file should not be taken.
+		const AllocationWindow* window = _findAllocationWindowContaining(clusterIndex);
+		if ((window != nullptr) && (window->mFileKey != fileKey)) {
+			return false;
+		}
+
+		FATCellValueType cellValue = FATCellValueType::invalidCellValue();
+		ErrorCode err = mVolumeManager.getFATCell(clusterIndex, cellValue);
+		return (err == ErrorCode::RESULT_OK) && cellValue.isFreeCluster();
+	}
+
+	ErrorCode DataPlacementStrategyBase::_findClusterForNewWindow(ClusterIndexType& newClusterIndex, const AllocationContext& context, uint32_t windowLength, const FreeClusterSelector& selectFreeCluster) {
+		// Let the strategy select the block first.
+		ClusterIndexType freeClusterIndex = ClusterValues::INVALID_VALUE;
+		ErrorCode err = selectFreeCluster(freeClusterIndex);
+		if ((err != ErrorCode::RESULT_OK) || !isValidClusterIndex(freeClusterIndex)) {
+			newClusterIndex = freeClusterIndex;
+			return err;
+		}
+
+		const uint64_t fileKey = _getFileKey(context);
+		if (windowLength <= 1) {
+			const AllocationWindow* window = _findAllocationWindowContaining(freeClusterIndex);
+			if ((window == nullptr) || (window->mFileKey == fileKey)) {
+				newClusterIndex = freeClusterIndex;
+				return ErrorCode::RESULT_OK;
+			}
+		}
+
+		const uint32_t blockIndex = mVolumeManager.getBlockIndex(freeClusterIndex);
+		BitSet freeClustersSet;
+		err = copyFreeClustersBitSet(freeClustersSet, blockIndex);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		// The windows don't cross the block boundaries.
+		const ClusterIndexType blockStartClusterIndex = mVolumeManager.getFATDataManager().getStartClusterIndex(blockIndex);
+		const ClusterIndexType blockEndClusterIndex = blockStartClusterIndex + mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		for (auto it = mAllocationWindows.lower_bound(blockStartClusterIndex); (it != mAllocationWindows.end()) && (it->first < blockEndClusterIndex); ++it) {
+			const AllocationWindow& window = it->second;
+			if (window.mFileKey != fileKey) {
+				freeClustersSet.setRange(window.mStartClusterIndex - blockStartClusterIndex, window.mEndClusterIndex - window.mStartClusterIndex, false);
+			}
+		}
+
+		const size_t startOffset = freeClusterIndex - blockStartClusterIndex;
+		size_t offsetFound = BitSet::npos;
+		if ((windowLength > 1) && freeClustersSet.findFirstRun(offsetFound, true, windowLength, startOffset)) {
+			newClusterIndex = blockStartClusterIndex + static_cast<ClusterIndexType>(offsetFound);
+			_addAllocationWindow(fileKey, newClusterIndex, windowLength);
+			return ErrorCode::RESULT_OK;
+		}
+
+		if (freeClustersSet.findFirstOne(offsetFound, startOffset) || freeClustersSet.findFirstOne(offsetFound, 0)) {
+			newClusterIndex = blockStartClusterIndex + static_cast<ClusterIndexType>(offsetFound);
+			return ErrorCode::RESULT_OK;
+		}
+
+		// All free clusters in the block are in the windows of other files. Take the one found by the strategy.
+		_releaseWindowCluster(freeClusterIndex);
+		newClusterIndex = freeClusterIndex;
+		return ErrorCode::RESULT_OK;
+	}
+
+	DataPlacementStrategyBase::AllocationWindow* DataPlacementStrategyBase::_findAllocationWindow(uint64_t fileKey) {
+		auto startIt = mAllocationWindowStarts.find(fileKey);
+		if (startIt == mAllocationWindowStarts.end()) {
+			return nullptr;
+		}
+		auto it = mAllocationWindows.find(startIt->second);
+		SFAT_ASSERT(it != mAllocationWindows.end(), "Every file in mAllocationWindowStarts should have a window!");
+		return &it->second;
+	}
+
+	const DataPlacementStrategyBase::AllocationWindow* DataPlacementStrategyBase::_findAllocationWindowContaining(ClusterIndexType clusterIndex) const {
+		// The windows don't overlap, so only the last one starting before or at the cluster could contain it.
+		auto it = mAllocationWindows.upper_bound(clusterIndex);
+		if (it == mAllocationWindows.begin()) {
+			return nullptr;
+		}
+		--it;
+		return (clusterIndex < it->second.mEndClusterIndex) ? &it->second : nullptr;
+	}
+
+	void DataPlacementStrategyBase::_addAllocationWindow(uint64_t fileKey, ClusterIndexType startClusterIndex, uint32_t windowLength) {
+		_removeAllocationWindow(fileKey);
+		if (mAllocationWindows.size() >= kMaxAllocationWindowsCount) {
+			// Drop the least recently used window.
+			auto it = std::min_element(mAllocationWindows.begin(), mAllocationWindows.end(), [](const AllocationWindowsMap::value_type& a, const AllocationWindowsMap::value_type& b) {
+				return a.second.mLastUse < b.second.mLastUse;
+			});
+			mAllocationWindowStarts.erase(it->second.mFileKey);
+			mAllocationWindows.erase(it);
+		}
+
+		AllocationWindow window;
+		window.mFileKey = fileKey;
+		window.mStartClusterIndex = startClusterIndex;
+		window.mEndClusterIndex = startClusterIndex + windowLength;
+		window.mLastUse = ++mAllocationWindowsUseCounter;
+		mAllocationWindows[startClusterIndex] = window;
+		mAllocationWindowStarts[fileKey] = startClusterIndex;
+	}
+
+	void DataPlacementStrategyBase::_removeAllocationWindow(uint64_t fileKey) {
+		auto startIt = mAllocationWindowStarts.find(fileKey);
+		if (startIt == mAllocationWindowStarts.end()) {
+			return;
+		}
+		mAllocationWindows.erase(startIt->second);
+		mAllocationWindowStarts.erase(startIt);
+	}
+
+	void DataPlacementStrategyBase::_releaseWindowCluster(ClusterIndexType clusterIndex) {
+		auto it = mAllocationWindows.upper_bound(clusterIndex);
+		if (it == mAllocationWindows.begin()) {
+			return;
+		}
+		--it;
+		AllocationWindow& window = it->second;
+		if (clusterIndex >= window.mEndClusterIndex) {
+			return;
+		}
+		if (clusterIndex > window.mStartClusterIndex) {
+			window.mEndClusterIndex = clusterIndex;
+			return;
+		}
+
+		// The window starts after the cluster now, so it is moved to the new key.
+		AllocationWindow movedWindow = window;
+		mAllocationWindows.erase(it);
+		mAllocationWindowStarts.erase(movedWindow.mFileKey);
+		movedWindow.mStartClusterIndex = clusterIndex + 1;
+		if (movedWindow.mStartClusterIndex < movedWindow.mEndClusterIndex) {
+			mAllocationWindows[movedWindow.mStartClusterIndex] = movedWindow;
+			mAllocationWindowStarts[movedWindow.mFileKey] = movedWindow.mStartClusterIndex;
+		}
+	}
+
+	uint64_t DataPlacementStrategyBase::_getFileKey(const AllocationContext& context) {
+		return (static_cast<uint64_t>(context.mDescriptorClusterIndex) << 32) | static_cast<uint64_t>(context.mRecordIndex);
+	}
+
 } // namespace SFAT
@@ -5,11 +5,15 @@
 
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/FATCellDecoder.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeDescriptor.h"
 #include "SplitFAT/utils/SFATAssert.h"
 #include "SplitFAT/utils/Logger.h"
 #include "SplitFAT/utils/CRC.h"
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
 
 namespace SFAT {
 
@@ -20,6 +24,9 @@ namespace SFAT {
 	FATBlock::FATBlock(VolumeManager& volumeManager, uint32_t blockIndex) // ClusterIndexType startCluster, ClusterIndexType clustersCount);
 		: mVolumeDescriptor(volumeManager.getVolumeDescriptor())
 		, mBlockIndex(blockIndex)
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		, mIsBlockControlDataStale(false)
+#endif
 		, mIsCacheInSync(false) {
 
 		SFAT_ASSERT(getVolumeDescriptor().isInitialized(), "The VolumeDescriptor is not initialized!");
@@ -27,7 +34,7 @@ namespace SFAT {
 		mStartClusterIndex = mBlockIndex * clustersPerBlock;
 		mEndClusterIndex = mStartClusterIndex + clustersPerBlock - 1;
 #if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
-		mBlockControlData.mCRC = 0; //calculateCRC32();
+		memset(&mBlockControlData, 0, sizeof(BlockControlData));
 		mBlockControlData.mBlockIndex = mBlockIndex;
 #endif
 		FATCellValueType freeCellValue = FATCellValueType::freeCellValue();
@@ -41,6 +48,8 @@ namespace SFAT {
 			mFreeClustersSet.insert(index);
 		}
 #endif
+		// The table and the bit-set of the free clusters
+		mMemoryCharge.set(volumeManager.getMemoryBudget(), MemoryComponent::MC_FAT_CACHE, mTable.capacity() * sizeof(FATCellValueType) + clustersPerBlock / 8);
 	}
 
 	const VolumeDescriptor& FATBlock::getVolumeDescriptor() const {
@@ -75,6 +84,18 @@ namespace SFAT {
 
 	// Reads from specific place
 	ErrorCode FATBlock::read(FileHandle& file, FilePositionType filePosition) {
+		ErrorCode err = readTable(file, filePosition);
+		updateFreeClustersSet();
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		if (err == ErrorCode::RESULT_OK) {
+			_validateBlockControlData();
+		}
+#endif
+		mIsCacheInSync = true;
+		return err;
+	}
+
+	ErrorCode FATBlock::readTable(FileHandle& file, FilePositionType filePosition) {
 		SFAT_ASSERT(file.isOpen(), "The file in not opened or in a proper read/write mode!");
 		SFAT_ASSERT(mTable.size() == getVolumeDescriptor().getClustersPerFATBlock(), "The FATBlock table is invalid size!");
 
@@ -82,18 +103,20 @@ namespace SFAT {
 		size_t bytesRead = 0;
 		ErrorCode err;
 #if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
-		err = file.readAtPosition(&mBlockControlData, countBytesToRead, filePosition, bytesRead);
-		if (err != ErrorCode::RESULT_OK) {
-			SFAT_LOGE(LogArea::LA_FAT_READ, "Error #%08X during reading!");
-			return err;
-		}
-		if (bytesRead != countBytesToRead) {
-			SFAT_LOGE(LogArea::LA_FAT_READ, "The read size is less than the requested for reading!");
-			return err;
+		if (getVolumeDescriptor().isBlockControlDataSupported()) {
+			err = file.readAtPosition(&mBlockControlData, countBytesToRead, filePosition, bytesRead);
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_FAT_READ, "Error #%08X during reading!");
+				return err;
+			}
+			if (bytesRead != countBytesToRead) {
+				SFAT_LOGE(LogArea::LA_FAT_READ, "The read size is less than the requested for reading!");
+				return ErrorCode::ERROR_READING;
+			}
 		}
 #endif
 
-		filePosition += countBytesToRead;
+		filePosition += getVolumeDescriptor().getBlockControlDataSize();
 		countBytesToRead = static_cast<size_t>(getVolumeDescriptor().getByteSizeOfFATBlock());
 		bytesRead = 0;
 		err = file.readAtPosition(mTable.data(), countBytesToRead, filePosition, bytesRead);
@@ -106,15 +129,14 @@ namespace SFAT {
 			err = ErrorCode::ERROR_READING;
 		}
 
+		return err;
+	}
+
+	void FATBlock::updateFreeClustersSet() {
 		// Find all free clusters from this block and fill the mFreeClustersSet
-#if (SPLIT_FAT__USE_BITSET == 1)
-		mFreeClustersBitSet.setAll(false);
-		ClusterIndexType cellsCount = static_cast<ClusterIndexType>(mTable.size());
-		for (ClusterIndexType cellIndex = 0; cellIndex < cellsCount; ++cellIndex) {
-			if (mTable[cellIndex].isFreeCluster()) {
-				mFreeClustersBitSet.setValue(cellIndex, true);
-			}
-		}
+#if (SPLIT_FAT__USE_BITSET == 1)
+		// The cells are classified in bulk and the result is written directly into the words of the BitSet.
+		FATCellDecoder::decodeFreeClusters(mTable, mFreeClustersBitSet);
 #else
 		mFreeClustersSet.clear();
 		ClusterIndexType cellsCount = static_cast<ClusterIndexType>(mTable.size());
@@ -124,35 +146,39 @@ namespace SFAT {
 			}
 		}
 #endif
-
-		mIsCacheInSync = true;
-		return err;
 	}
 
 	// Writes to specific place
 	ErrorCode FATBlock::write(FileHandle& file, FilePositionType filePosition) const {
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		if (getVolumeDescriptor().isBlockControlDataSupported()) {
+			BlockControlData controlData = makeBlockControlData();
+			return _write(file, filePosition, &controlData);
+		}
+#endif
+		return _write(file, filePosition, nullptr);
+	}
+
+	ErrorCode FATBlock::_write(FileHandle& file, FilePositionType filePosition, const BlockControlData* controlData) const {
 		SFAT_ASSERT(file.isOpen(), "The file in not opened or in a proper read/write mode!");
 		SFAT_ASSERT(mTable.size() == getVolumeDescriptor().getClustersPerFATBlock(), "The FATBlock table is invalid size!");
 
 		ErrorCode err;
 		// Write first the block-control data
-		size_t countBytesToWrite = static_cast<size_t>(sizeof(BlockControlData));
-		size_t bytesWritten = 0;
 #if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
-		err = file.writeAtPosition(&mBlockControlData, countBytesToWrite, filePosition, bytesWritten);
-		if (err != ErrorCode::RESULT_OK) {
-			SFAT_LOGE(LogArea::LA_FAT_WRITE, "Error #%08X during writing!");
-			return err;
-		}
-		if (bytesWritten != countBytesToWrite) {
-			SFAT_LOGE(LogArea::LA_FAT_WRITE, "The written size is less than the requested for writing!");
-			return ErrorCode::ERROR_WRITING;
+		if (controlData != nullptr) {
+			err = _writeBlockControlData(file, filePosition, *controlData);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
 		}
-		bytesWritten = 0;
-#endif //if (BLOCK_CONTROL_DATA_SAVING_ENABLED == 1)
+#else
+		(void)controlData; // Not used parameter
+#endif //if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
 
-		filePosition += countBytesToWrite;
-		countBytesToWrite = static_cast<size_t>(getVolumeDescriptor().getByteSizeOfFATBlock());
+		filePosition += getVolumeDescriptor().getBlockControlDataSize();
+		size_t countBytesToWrite = static_cast<size_t>(getVolumeDescriptor().getByteSizeOfFATBlock());
+		size_t bytesWritten = 0;
 		err = file.writeAtPosition(mTable.data(), countBytesToWrite, filePosition, bytesWritten);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_FAT_WRITE, "Error #%08X during writing!");
@@ -168,6 +194,24 @@ namespace SFAT {
 	}
 
 	ErrorCode FATBlock::flush(FileHandle& file, FilePositionType filePosition) {
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		if (getVolumeDescriptor().isBlockControlDataSupported()) {
+			if (!mIsCacheInSync || mIsBlockControlDataStale) {
+				BlockControlData controlData = makeBlockControlData();
+				ErrorCode err = mIsCacheInSync ? _writeBlockControlData(file, filePosition, controlData) : _write(file, filePosition, &controlData);
+				if (err == ErrorCode::RESULT_OK) {
+					mBlockControlData = controlData;
+					mIsBlockControlDataStale = false;
+					mIsCacheInSync = true;
+				}
+				else {
+					mIsCacheInSync = false;
+				}
+				return err;
+			}
+			return ErrorCode::RESULT_OK;
+		}
+#endif
 		if (!mIsCacheInSync) {
 			ErrorCode err = write(file, filePosition);
 			mIsCacheInSync = (err == ErrorCode::RESULT_OK);
@@ -190,6 +234,73 @@ namespace SFAT {
 	BlockControlData& FATBlock::getBlockControlData() {
 		return mBlockControlData;
 	}
+
+	BlockControlData FATBlock::makeBlockControlData() const {
+		BlockControlData controlData;
+		memset(&controlData, 0, sizeof(BlockControlData));
+		controlData.mCRC = calculateCRC32();
+		controlData.mBlockIndex = mBlockIndex;
+		controlData.mVersion = BlockControlData::CURRENT_VERSION;
+		controlData.mCountFreeClusters = getCountFreeClusters();
+		ClusterIndexType firstFreeClusterIndex;
+		if (getFirstFreeClusterIndex(firstFreeClusterIndex)) {
+			controlData.mFirstFreeClusterOffset = firstFreeClusterIndex - mStartClusterIndex;
+		}
+		else {
+			controlData.mFirstFreeClusterOffset = getVolumeDescriptor().getClustersPerFATBlock();
+		}
+		controlData.mControlDataCRC = calculateControlDataCRC(controlData);
+		return controlData;
+	}
+
+	bool FATBlock::isBlockControlDataValid() const {
+		return !mIsBlockControlDataStale;
+	}
+
+	uint32_t FATBlock::calculateControlDataCRC(const BlockControlData& controlData) {
+		return CRC32::calculate(&controlData, offsetof(BlockControlData, mControlDataCRC));
+	}
+
+	bool FATBlock::verifyBlockControlData(const BlockControlData& controlData, uint32_t blockIndex, uint32_t clustersPerBlock) {
+		return (controlData.mVersion == BlockControlData::CURRENT_VERSION) &&
+			(controlData.mBlockIndex == blockIndex) &&
+			(controlData.mCountFreeClusters <= clustersPerBlock) &&
+			(controlData.mFirstFreeClusterOffset <= clustersPerBlock) &&
+			(controlData.mControlDataCRC == calculateControlDataCRC(controlData));
+	}
+
+	ErrorCode FATBlock::_writeBlockControlData(FileHandle& file, FilePositionType filePosition, const BlockControlData& controlData) const {
+		size_t countBytesToWrite = static_cast<size_t>(sizeof(BlockControlData));
+		size_t bytesWritten = 0;
+		ErrorCode err = file.writeAtPosition(&controlData, countBytesToWrite, filePosition, bytesWritten);
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_FAT_WRITE, "Error #%08X during writing!");
+			return err;
+		}
+		if (bytesWritten != countBytesToWrite) {
+			SFAT_LOGE(LogArea::LA_FAT_WRITE, "The written size is less than the requested for writing!");
+			return ErrorCode::ERROR_WRITING;
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
+	void FATBlock::_validateBlockControlData() {
+		mIsBlockControlDataStale = false;
+		if (!getVolumeDescriptor().isBlockControlDataSupported()) {
+			return;
+		}
+
+		// The control data should describe exactly the table that was read with it.
+		BlockControlData expectedControlData = makeBlockControlData();
+		if (!verifyBlockControlData(mBlockControlData, mBlockIndex, getVolumeDescriptor().getClustersPerFATBlock()) ||
+			(mBlockControlData.mCRC != expectedControlData.mCRC) ||
+			(mBlockControlData.mCountFreeClusters != expectedControlData.mCountFreeClusters) ||
+			(mBlockControlData.mFirstFreeClusterOffset != expectedControlData.mFirstFreeClusterOffset)) {
+			SFAT_LOGW(LogArea::LA_FAT_READ, "The control data of FAT block #%u is stale. It will be updated with the next flush.", mBlockIndex);
+			mIsBlockControlDataStale = true;
+		}
+		mBlockControlData = expectedControlData;
+	}
 #endif
 
 	uint32_t FATBlock::getCountFreeClusters() const {
@@ -209,7 +320,7 @@ namespace SFAT {
 	}
 
 	void FATBlock::markOutOfSync() {
-		mIsCacheInSync = true;
+		mIsCacheInSync = false;
 	}
 
 	bool FATBlock::getFirstFreeClusterIndex(ClusterIndexType& clusterIndex) const {
@@ -250,10 +361,18 @@ namespace SFAT {
 
 	FATDataManager::FATDataManager(VolumeManager& volumeManager)
 		: mVolumeDescriptor(volumeManager.getVolumeDescriptor())
-		, mVolumeManager(volumeManager) {
+		, mVolumeManager(volumeManager)
+		, mCountActivePreloadWorkers(0)
+		, mPreloadNextBlockIndex(0)
+		, mPreloadEndBlockIndex(0)
+		, mPreloadError(ErrorCode::RESULT_OK) {
 
 	}
 
+	FATDataManager::~FATDataManager() {
+		waitForPreloadCompletion();
+	}
+
 	ErrorCode FATDataManager::_updateCache(uint32_t blockIndex) {
 		//
 		// Note! The cache can be updated only for FAT blocks that have been already allocated.
@@ -265,13 +384,18 @@ namespace SFAT {
 			return ErrorCode::ERROR_BLOCK_INDEX_OUT_OF_RANGE;
 		}
 
-		if ((blockIndex < static_cast<uint32_t>(mFATBlocksCache.size())) && (mFATBlocksCache[blockIndex] != nullptr)) {
+		if (_isBlockCached(blockIndex)) {
 			// No need to do anything. The data is already cached.
 			return ErrorCode::RESULT_OK;
 		}
 
 		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
 
+		// The block could be in process of loading by the background preload.
+		while (mBlocksBeingLoaded.getValue(blockIndex)) {
+			mBlockLoadedCondition.wait(mFATBlockReadWriteMutex);
+		}
+
 		// Check again. Another thread could have already cached the block before the lock.
 		if ((blockIndex < static_cast<uint32_t>(mFATBlocksCache.size())) && (mFATBlocksCache[blockIndex] != nullptr)) {
 			// No need to do anything. The data is already cached.
@@ -283,17 +407,30 @@ namespace SFAT {
 			SFAT_LOGI(LogArea::LA_PHYSICAL_DISK, "Expanded the FAT cache %u block(s).", blockIndex + 1);
 		}
 
-		ErrorCode err = ErrorCode::RESULT_OK;
-		std::unique_ptr<FATBlock> fatBlockPtr = std::make_unique<FATBlock>(mVolumeManager, blockIndex);;
+		std::unique_ptr<FATBlock> fatBlockPtr;
+		ErrorCode err = _loadBlock(blockIndex, fatBlockPtr);
+		mFATBlocksCache[blockIndex] = std::move(fatBlockPtr);
+
+		return err;
+	}
+
+	bool FATDataManager::_isBlockCached(uint32_t blockIndex) const {
+		// While the preloading workers are running, the cache can be checked only under the lock.
+		if (mCountActivePreloadWorkers != 0) {
+			return false;
+		}
+		return (blockIndex < static_cast<uint32_t>(mFATBlocksCache.size())) && (mFATBlocksCache[blockIndex] != nullptr);
+	}
+
+	ErrorCode FATDataManager::_loadBlock(uint32_t blockIndex, std::unique_ptr<FATBlock>& fatBlockPtr) {
+		fatBlockPtr = std::make_unique<FATBlock>(mVolumeManager, blockIndex);
 		FileHandle file = mVolumeManager.getLowLevelFileAccess().getFATDataFile(AccessMode::AM_READ);
 		SFAT_ASSERT(file.isOpen(), "The FAT data file should be open for reading!");
 		FilePositionType offset = mVolumeManager.getFATBlockStartPosition(blockIndex);
-		err = fatBlockPtr->read(file, offset);
+		ErrorCode err = fatBlockPtr->read(file, offset);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't read a FATBlock which should be allocated!");
 		}
-		mFATBlocksCache[blockIndex] = std::move(fatBlockPtr);
-
 		return err;
 	}
 
@@ -321,6 +458,7 @@ namespace SFAT {
 	}
 
 	ErrorCode FATDataManager::setValue(ClusterIndexType index, FATCellValueType value) {
+		SFATLockGuard cellsLockGuard(mFATCellsMutex);
 		uint32_t blockIndex = mVolumeManager.getBlockIndex(index);
 		ErrorCode err = _updateCache(blockIndex);
 		if (err != ErrorCode::RESULT_OK) {
@@ -334,14 +472,87 @@ namespace SFAT {
 			return ErrorCode::ERROR_FAT_NOT_CACHED;
 		}
 
+		_setCellValue(*mFATBlocksCache[blockIndex], index, value);
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode FATDataManager::setCRC(ClusterIndexType index, uint16_t crc) {
+		SFATLockGuard cellsLockGuard(mFATCellsMutex);
+		uint32_t blockIndex = mVolumeManager.getBlockIndex(index);
+		ErrorCode err = _updateCache(blockIndex);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		if (mFATBlocksCache[blockIndex] == nullptr) {
+			return ErrorCode::ERROR_FAT_NOT_CACHED;
+		}
+
+		// Read and changed under the lock, so a concurrent change of the next cluster in the chain is not lost.
 		FATBlock& block = *mFATBlocksCache[blockIndex];
+		FATCellValueType value = block.getValue(index);
+		value.encodeCRC(crc);
+		value.setClusterInitialized(true);
+		_setCellValue(block, index, value);
 
+		return ErrorCode::RESULT_OK;
+	}
+
+	void FATDataManager::_setCellValue(FATBlock& block, ClusterIndexType index, FATCellValueType value) {
 		// Take care for the transaction data here.
+#if (SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO == 1)
+		// Every page is logged on its first change, so every change has to be reported.
+		if (mVolumeManager.isInTransaction()) {
+#else
 		if (mVolumeManager.isInTransaction() && block.isCacheInSync()) {
+#endif
 			mVolumeManager.logFATCellChange(index, block.getTable());
 		}
 
 		block.setValue(index, value);
+	}
+
+	ErrorCode FATDataManager::freeClusters(std::vector<ClusterIndexType>& clusterIndices) {
+		SFATLockGuard cellsLockGuard(mFATCellsMutex);
+		std::sort(clusterIndices.begin(), clusterIndices.end());
+		clusterIndices.erase(std::unique(clusterIndices.begin(), clusterIndices.end()), clusterIndices.end());
+
+		const FATCellValueType freeCellValue = FATCellValueType::freeCellValue();
+		const size_t countClusters = clusterIndices.size();
+		size_t index = 0;
+		while (index < countClusters) {
+			uint32_t blockIndex = mVolumeManager.getBlockIndex(clusterIndices[index]);
+			ErrorCode err = _updateCache(blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
+				return err;
+			}
+
+			FATBlock& block = *mFATBlocksCache[blockIndex];
+			const bool isInTransaction = mVolumeManager.isInTransaction();
+#if (SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO == 0)
+			if (isInTransaction && block.isCacheInSync()) {
+				err = mVolumeManager.logFATCellChange(clusterIndices[index], block.getTable());
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+			}
+#endif
+
+			for (; (index < countClusters) && (mVolumeManager.getBlockIndex(clusterIndices[index]) == blockIndex); ++index) {
+#if (SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO == 1)
+				if (isInTransaction) {
+					// Logs the page of the cell, if it is not logged yet.
+					err = mVolumeManager.logFATCellChange(clusterIndices[index], block.getTable());
+					if (err != ErrorCode::RESULT_OK) {
+						return err;
+					}
+				}
+#endif
+				block.setValue(clusterIndices[index], freeCellValue);
+			}
+		}
 
 		return ErrorCode::RESULT_OK;
 	}
@@ -408,7 +619,12 @@ namespace SFAT {
 		}
 
 		for (uint32_t blockIndex = startBlockIndex; blockIndex < countBlocks; ++blockIndex) {
-			if ((blockIndex >= mFATBlocksCache.size()) || (mFATBlocksCache[blockIndex] == nullptr)) {
+			if (!_isBlockCached(blockIndex)) {
+				BlockControlData controlData;
+				if (_tryGetBlockControlData(blockIndex, controlData) && (controlData.mCountFreeClusters == 0)) {
+					// The block is full. No need to load it.
+					continue;
+				}
 				ErrorCode err = _updateCache(blockIndex);
 				if (err != ErrorCode::RESULT_OK) {
 					return err;
@@ -429,8 +645,9 @@ namespace SFAT {
 			SFAT_LOGE(SFAT::LogArea::LA_FAT_READ, "Invalid FAT block index %u of [0, %u]", blockIndex, mVolumeManager.getMaxPossibleFATBlocksCount() - 1);
 			return ErrorCode::ERROR_INVALID_FAT_BLOCK_INDEX;
 		}
-		if ((blockIndex >= mFATBlocksCache.size()) || (mFATBlocksCache[blockIndex] == nullptr)) {
-			ErrorCode err = preallocateAllFATDataBlocks();
+		if (!_isBlockCached(blockIndex)) {
+			// The block could be allocated, but still not loaded by the background preload.
+			ErrorCode err = (blockIndex < mVolumeManager.getCountAllocatedFATBlocks()) ? _updateCache(blockIndex) : preallocateAllFATDataBlocks();
 			if (err != ErrorCode::RESULT_OK) {
 				return err;
 			}
@@ -446,6 +663,8 @@ namespace SFAT {
 	}
 
 	ErrorCode FATDataManager::flush() {
+		// The cells are not changed while they are written.
+		SFATLockGuard cellsLockGuard(mFATCellsMutex);
 		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
 
 		ErrorCode finalErr = ErrorCode::RESULT_OK;
@@ -460,6 +679,11 @@ namespace SFAT {
 						SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't save the FATDataBlock #%u!", blockIndex);
 						finalErr = err;
 					}
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+					else if (blockIndex < static_cast<uint32_t>(mBlocksControlData.size())) {
+						mBlocksControlData[blockIndex] = mFATBlocksCache[blockIndex]->getBlockControlData();
+					}
+#endif
 				}
 			}
 		}
@@ -472,6 +696,7 @@ namespace SFAT {
 	//Instead of writing down all cached changes, this function will ignore them and read from the physical storage.
 	//It will simulate lost of the changes this way.
 	ErrorCode FATDataManager::discardCachedChanges() {
+		waitForPreloadCompletion();
 		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
 
 		ErrorCode finalErr = ErrorCode::RESULT_OK;
@@ -501,7 +726,12 @@ namespace SFAT {
 			return ErrorCode::ERROR_TRYING_TO_READ_NOT_ALLOCATED_FAT_BLOCK;
 		}
 
-		if (mFATBlocksCache[blockIndex] == nullptr) {
+		if (!_isBlockCached(blockIndex)) {
+			BlockControlData controlData;
+			if (_tryGetBlockControlData(blockIndex, controlData)) {
+				countFreeClusters = controlData.mCountFreeClusters;
+				return ErrorCode::RESULT_OK;
+			}
 			ErrorCode err = _updateCache(blockIndex);
 			if (err != ErrorCode::RESULT_OK) {
 				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
@@ -525,19 +755,15 @@ namespace SFAT {
 		blockIndexFound = static_cast<uint32_t>(BlockIndexValues::INVALID_VALUE);
 		uint32_t currentMaxValue = 0;
 		for (uint32_t blockIndex = startBlockIndex; blockIndex < countBlocks; ++blockIndex) {
-			if ((blockIndex >= mFATBlocksCache.size()) || (mFATBlocksCache[blockIndex] == nullptr)) {
-				ErrorCode err = _updateCache(blockIndex);
-				if (err != ErrorCode::RESULT_OK) {
-					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
-					return err;
-				}
-			}
-
 			if (blockIndex == blockIndexToAvoid) {
 				continue;
 			}
 
-			countFreeClusters = mFATBlocksCache[blockIndex]->getCountFreeClusters();
+			ErrorCode err = getCountFreeClusters(countFreeClusters, blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+
 			uint32_t value = (countFreeClusters + granularity - 1) / granularity;
 			if (value > currentMaxValue){
 				maxFreeClustersInABlock = countFreeClusters;
@@ -557,7 +783,10 @@ namespace SFAT {
 
 		if ((maxFreeClustersInABlock == 0) && (blockIndexToAvoid != static_cast<uint32_t>(BlockIndexValues::INVALID_VALUE))) {
 			// There was no block with empty space found. So as a last resort we have to use the block that was selected for defragmentation.
-			maxFreeClustersInABlock = mFATBlocksCache[blockIndexToAvoid]->getCountFreeClusters();
+			ErrorCode err = getCountFreeClusters(maxFreeClustersInABlock, blockIndexToAvoid);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
 			blockIndexFound = blockIndexToAvoid;
 		}
 
@@ -571,20 +800,19 @@ namespace SFAT {
 		uint32_t startBlockIndex = mVolumeManager.getFirstFileDataBlockIndex();
 
 		for (uint32_t blockIndex = startBlockIndex; blockIndex < countBlocks; ++blockIndex) {
-			if ((blockIndex >= mFATBlocksCache.size()) || (mFATBlocksCache[blockIndex] == nullptr)) {
-				ErrorCode err = _updateCache(blockIndex);
-				if (err != ErrorCode::RESULT_OK) {
-					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
-					return err;
-				}
+			uint32_t countFreeClustersInBlock = 0;
+			ErrorCode err = getCountFreeClusters(countFreeClustersInBlock, blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
 			}
-			countFreeClusters += mFATBlocksCache[blockIndex]->getCountFreeClusters();
+			countFreeClusters += countFreeClustersInBlock;
 		}
 
 		return ErrorCode::RESULT_OK;
 	}
 
 	ErrorCode FATDataManager::executeOnBlock(uint32_t blockIndex, FATBlockCallbackType callback) {
+		SFATLockGuard cellsLockGuard(mFATCellsMutex);
 		ErrorCode err = _prepareBlock(blockIndex);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
@@ -598,6 +826,7 @@ namespace SFAT {
 		}
 
 		if (wasChanged) {
+			mFATBlocksCache[blockIndex]->updateFreeClustersSet();
 			mFATBlocksCache[blockIndex]->markOutOfSync();
 		}
 
@@ -612,7 +841,7 @@ namespace SFAT {
 			}
 			mFATBlocksCache.resize(blockIndex + 1);
 		}
-		if (mFATBlocksCache[blockIndex] == nullptr) {
+		if (!_isBlockCached(blockIndex)) {
 			ErrorCode err = _updateCache(blockIndex);
 			if (err != ErrorCode::RESULT_OK) {
 				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
@@ -622,29 +851,216 @@ namespace SFAT {
 		return ErrorCode::RESULT_OK;
 	}
 
-	ErrorCode FATDataManager::preloadAllFATDataBlocks() {
-		uint32_t currentBlocksCount = mVolumeManager.getCountAllocatedFATBlocks();
-		uint32_t currentCachedBlocksCount = static_cast<uint32_t>(mFATBlocksCache.size());
-		if (currentCachedBlocksCount == currentBlocksCount) {
+	ErrorCode FATDataManager::preloadAllFATDataBlocks() {
+		ErrorCode err = startPreloadingAllFATDataBlocks();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		return waitForPreloadCompletion();
+	}
+
+	ErrorCode FATDataManager::startPreloadingAllFATDataBlocks() {
+		SFATLockGuard preloadGuard(mPreloadMutex);
+		if (!mPreloadCompletions.empty()) {
+			// Already started
 			return ErrorCode::RESULT_OK;
 		}
 
+		uint32_t currentBlocksCount = mVolumeManager.getCountAllocatedFATBlocks();
 		SFAT_ASSERT(currentBlocksCount <= mVolumeManager.getMaxPossibleFATBlocksCount(), "The created FAT-data blocks should not be less or equal to the maximum allowed!");
 		SFAT_ASSERT(mFATBlocksCache.size() <= mVolumeManager.getMaxPossibleFATBlocksCount(), "The cached FAT-data blocks should not be more than the maximum allowed!");
 
-		// Preload in the cache all created FAT-data blocks.
-		mFATBlocksCache.resize(currentBlocksCount);
-		for (size_t blockIndex = currentCachedBlocksCount; blockIndex < currentBlocksCount; ++blockIndex) {
-			ErrorCode err = _updateCache(static_cast<uint32_t>(blockIndex));
+#if (SPLIT_FAT__ENABLE_PARALLEL_FAT_PRELOAD == 1)
+		// The free space of the blocks can be answered from the control data, while the blocks are loading.
+		ErrorCode err = readAllBlockControlData();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+#endif
+
+		uint32_t countWorkers = 0;
+		{
+			SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+
+			// Find the first block that is not cached yet.
+			uint32_t firstBlockIndexToLoad = 0;
+			uint32_t currentCachedBlocksCount = static_cast<uint32_t>(mFATBlocksCache.size());
+			while ((firstBlockIndexToLoad < currentBlocksCount) && (firstBlockIndexToLoad < currentCachedBlocksCount) && (mFATBlocksCache[firstBlockIndexToLoad] != nullptr)) {
+				++firstBlockIndexToLoad;
+			}
+			if (firstBlockIndexToLoad >= currentBlocksCount) {
+				return ErrorCode::RESULT_OK;
+			}
+
+			// The cache should not be reallocated while the preloading workers are running.
+			mFATBlocksCache.reserve(mVolumeManager.getMaxPossibleFATBlocksCount());
+			if (currentCachedBlocksCount < currentBlocksCount) {
+				mFATBlocksCache.resize(currentBlocksCount);
+			}
+
+#if (SPLIT_FAT__ENABLE_PARALLEL_FAT_PRELOAD == 1)
+			mBlocksBeingLoaded.setSize(currentBlocksCount);
+			mBlocksBeingLoaded.setAll(false);
+			mPreloadNextBlockIndex = firstBlockIndexToLoad;
+			mPreloadEndBlockIndex = currentBlocksCount;
+			mPreloadError = ErrorCode::RESULT_OK;
+
+			countWorkers = mVolumeManager.getIOScheduler().getCountThreads();
+			if (countWorkers > kMaxPreloadWorkersCount) {
+				countWorkers = kMaxPreloadWorkersCount;
+			}
+			if (countWorkers > currentBlocksCount - firstBlockIndexToLoad) {
+				countWorkers = currentBlocksCount - firstBlockIndexToLoad;
+			}
+			if (countWorkers == 0) {
+				countWorkers = 1;
+			}
+			mCountActivePreloadWorkers = countWorkers;
+			SFAT_LOGI(LogArea::LA_PHYSICAL_DISK, "Preloading FAT blocks [%u, %u) with %u worker(s).", firstBlockIndexToLoad, currentBlocksCount, countWorkers);
+#else
+			for (uint32_t blockIndex = firstBlockIndexToLoad; blockIndex < currentBlocksCount; ++blockIndex) {
+				if (mFATBlocksCache[blockIndex] != nullptr) {
+					continue;
+				}
+				std::unique_ptr<FATBlock> fatBlockPtr;
+				ErrorCode err = _loadBlock(blockIndex, fatBlockPtr);
+				if (err != ErrorCode::RESULT_OK) {
+					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
+					return err;
+				}
+				mFATBlocksCache[blockIndex] = std::move(fatBlockPtr);
+			}
+#endif
+		}
+
+#if (SPLIT_FAT__ENABLE_PARALLEL_FAT_PRELOAD == 1)
+		// Submitted without holding the FAT lock, as the pending requests could be waiting for it.
+		for (uint32_t i = 0; i < countWorkers; ++i) {
+			mPreloadCompletions.emplace_back();
+			mVolumeManager.getIOScheduler().submit(IOPriority::IOP_FOREGROUND_READ, [this]() {
+				_preloadWorker();
+				return ErrorCode::RESULT_OK;
+			}, mPreloadCompletions.back());
+		}
+#endif
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode FATDataManager::waitForPreloadCompletion() {
+		SFATLockGuard preloadGuard(mPreloadMutex);
+		for (auto& completion : mPreloadCompletions) {
+			mVolumeManager.getIOScheduler().wait(completion);
+		}
+		mPreloadCompletions.clear();
+
+		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+		ErrorCode err = mPreloadError;
+		mPreloadError = ErrorCode::RESULT_OK;
+		return err;
+	}
+
+	ErrorCode FATDataManager::readAllBlockControlData() {
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		if (!mVolumeDescriptor.isBlockControlDataSupported()) {
+			// Volume created with older version. The blocks have to be scanned.
+			return ErrorCode::RESULT_OK;
+		}
+
+		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+
+		FileHandle file = mVolumeManager.getLowLevelFileAccess().getFATDataFile(AccessMode::AM_READ);
+		SFAT_ASSERT(file.isOpen(), "The FAT data file should be open for reading!");
+
+		uint32_t countBlocks = mVolumeManager.getCountAllocatedFATBlocks();
+		uint32_t clustersPerBlock = mVolumeDescriptor.getClustersPerFATBlock();
+		uint32_t countValid = 0;
+		BlockControlData emptyControlData;
+		memset(&emptyControlData, 0, sizeof(BlockControlData));
+		mBlocksControlData.assign(countBlocks, emptyControlData);
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			BlockControlData& controlData = mBlocksControlData[blockIndex];
+			FilePositionType offset = mVolumeManager.getFATBlockStartPosition(blockIndex);
+			size_t bytesRead = 0;
+			ErrorCode err = file.readAtPosition(&controlData, sizeof(BlockControlData), offset, bytesRead);
 			if (err != ErrorCode::RESULT_OK) {
-				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
+				SFAT_LOGE(LogArea::LA_FAT_READ, "Can't read the control data of FAT block #%u!", blockIndex);
 				return err;
 			}
+			if ((bytesRead != sizeof(BlockControlData)) || !FATBlock::verifyBlockControlData(controlData, blockIndex, clustersPerBlock)) {
+				// The block will be scanned when needed.
+				controlData = emptyControlData;
+				continue;
+			}
+			++countValid;
 		}
 
-		return ErrorCode::RESULT_OK;
-	}
-
+		if (countValid < countBlocks) {
+			SFAT_LOGW(LogArea::LA_FAT_READ, "Only %u of %u FAT blocks have valid control data.", countValid, countBlocks);
+		}
+#endif
+		return ErrorCode::RESULT_OK;
+	}
+
+	bool FATDataManager::_tryGetBlockControlData(uint32_t blockIndex, BlockControlData& controlData) {
+#if (SPLIT_FAT__BLOCK_CONTROL_DATA_READING_WRITING_ENABLED == 1)
+		SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+		if ((blockIndex < static_cast<uint32_t>(mFATBlocksCache.size())) && (mFATBlocksCache[blockIndex] != nullptr)) {
+			// The cached block is always more recent.
+			return false;
+		}
+		if ((blockIndex >= static_cast<uint32_t>(mBlocksControlData.size())) || (mBlocksControlData[blockIndex].mVersion != BlockControlData::CURRENT_VERSION)) {
+			return false;
+		}
+		controlData = mBlocksControlData[blockIndex];
+		return true;
+#else
+		(void)blockIndex; // Not used parameter
+		(void)controlData; // Not used parameter
+		return false;
+#endif
+	}
+
+	void FATDataManager::_preloadWorker() {
+		for (;;) {
+			uint32_t blockIndex = mPreloadNextBlockIndex.fetch_add(1);
+			if (blockIndex >= mPreloadEndBlockIndex) {
+				break;
+			}
+
+			{
+				SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+				if (mFATBlocksCache[blockIndex] != nullptr) {
+					// Already loaded on demand.
+					continue;
+				}
+				mBlocksBeingLoaded.setValue(blockIndex, true);
+			}
+
+			// The reading and the decoding of the free clusters are done without holding the FAT lock,
+			// so the other threads can continue working with the blocks that are already loaded.
+			std::unique_ptr<FATBlock> fatBlockPtr;
+			ErrorCode err = _loadBlock(blockIndex, fatBlockPtr);
+
+			{
+				SFATLockGuard lockGuard(mFATBlockReadWriteMutex);
+				mBlocksBeingLoaded.setValue(blockIndex, false);
+				if (err == ErrorCode::RESULT_OK) {
+					mFATBlocksCache[blockIndex] = std::move(fatBlockPtr);
+				}
+				else {
+					SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't load FATDataBlock #%u!", blockIndex);
+					if (mPreloadError == ErrorCode::RESULT_OK) {
+						mPreloadError = err;
+					}
+				}
+			}
+			mBlockLoadedCondition.notify_all();
+		}
+
+		--mCountActivePreloadWorkers;
+	}
+
 	ErrorCode FATDataManager::preallocateAllFATDataBlocks() {
 		uint32_t maxFATBlocksCount = mVolumeManager.getMaxPossibleFATBlocksCount();
 
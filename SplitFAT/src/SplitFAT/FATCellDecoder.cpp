@@ -0,0 +1,188 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/FATCellDecoder.h"
+#include "SplitFAT/utils/SFATAssert.h"
+
+#if (SPLIT_FAT__ENABLE_SIMD_FAT_DECODE == 1)
+#	if defined(__AVX2__)
+#		define SPLIT_FAT__FAT_DECODE_AVX2	1
+#		include <immintrin.h>
+#	elif defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#		define SPLIT_FAT__FAT_DECODE_SSE2	1
+#		include <emmintrin.h>
+#	endif
+#endif
+
+namespace SFAT {
+
+	static_assert(sizeof(FATCellValueType) == 2 * sizeof(uint32_t), "The FAT cell is expected to be two 32-bit words - mPrev followed by mNext!");
+
+	namespace {
+
+		typedef FATCellDecoder::WordType WordType;
+
+		struct CellWords {
+			WordType mFree;
+			WordType mStartOfChain;
+			WordType mEndOfChain;
+			WordType mCRCInitialized;
+		};
+
+		// Classifies up to 64 cells into a single word per category.
+		void _classifyWordScalar(const FATCellValueType* cells, size_t countCells, CellWords& words) {
+			words.mFree = 0;
+			words.mStartOfChain = 0;
+			words.mEndOfChain = 0;
+			words.mCRCInitialized = 0;
+			for (size_t i = 0; i < countCells; ++i) {
+				const FATCellValueType& cell = cells[i];
+				const WordType bit = static_cast<WordType>(1) << i;
+				if (cell.isFreeCluster()) {
+					words.mFree |= bit;
+				}
+				if (cell.isStartOfChain()) {
+					words.mStartOfChain |= bit;
+				}
+				if (cell.isEndOfChain()) {
+					words.mEndOfChain |= bit;
+				}
+				if (cell.isCRCInitialized()) {
+					words.mCRCInitialized |= bit;
+				}
+			}
+		}
+
+#if (SPLIT_FAT__FAT_DECODE_AVX2 == 1)
+		// Classifies exactly 64 cells, 8 cells per iteration.
+		void _classifyWordSIMD(const FATCellValueType* cells, CellWords& words) {
+			const uint32_t* raw = reinterpret_cast<const uint32_t*>(cells);
+			const __m256i flagsAndIndexMask = _mm256_set1_epi32(static_cast<int>(ClusterValues::FLAGS_AND_INDEX_MASK));
+			const __m256i zero = _mm256_setzero_si256();
+			words.mFree = 0;
+			words.mStartOfChain = 0;
+			words.mEndOfChain = 0;
+			words.mCRCInitialized = 0;
+			for (uint32_t i = 0; i < 64; i += 8) {
+				// a = [p0 n0 p1 n1 | p2 n2 p3 n3], b = [p4 n4 p5 n5 | p6 n6 p7 n7]
+				__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(raw + 2 * i)));
+				__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(raw + 2 * i + 8)));
+				// Separate the mPrev and mNext values and restore the cell order, [p0 p1 p4 p5 | p2 p3 p6 p7] -> [p0 .. p7]
+				__m256i prev = _mm256_castpd_si256(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+				__m256i next = _mm256_castpd_si256(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+
+				__m256i isFree = _mm256_cmpeq_epi32(_mm256_and_si256(next, flagsAndIndexMask), zero);
+				// The start/end of chain flags are the bit 31, so they can be taken directly with movemask.
+				// The CRC-initialized flag is moved to the bit 31 as well.
+				__m256i crcInitialized = _mm256_slli_epi32(prev, 31 - ClusterValues::CLUSTER_INDEX_BITS_COUNT);
+
+				words.mFree |= static_cast<WordType>(_mm256_movemask_ps(_mm256_castsi256_ps(isFree))) << i;
+				words.mStartOfChain |= static_cast<WordType>(_mm256_movemask_ps(_mm256_castsi256_ps(prev))) << i;
+				words.mEndOfChain |= static_cast<WordType>(_mm256_movemask_ps(_mm256_castsi256_ps(next))) << i;
+				words.mCRCInitialized |= static_cast<WordType>(_mm256_movemask_ps(_mm256_castsi256_ps(crcInitialized))) << i;
+			}
+		}
+#elif (SPLIT_FAT__FAT_DECODE_SSE2 == 1)
+		// Classifies exactly 64 cells, 4 cells per iteration.
+		void _classifyWordSIMD(const FATCellValueType* cells, CellWords& words) {
+			const uint32_t* raw = reinterpret_cast<const uint32_t*>(cells);
+			const __m128i flagsAndIndexMask = _mm_set1_epi32(static_cast<int>(ClusterValues::FLAGS_AND_INDEX_MASK));
+			const __m128i zero = _mm_setzero_si128();
+			words.mFree = 0;
+			words.mStartOfChain = 0;
+			words.mEndOfChain = 0;
+			words.mCRCInitialized = 0;
+			for (uint32_t i = 0; i < 64; i += 4) {
+				// a = [p0 n0 p1 n1], b = [p2 n2 p3 n3]
+				__m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(raw + 2 * i)));
+				__m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(raw + 2 * i + 4)));
+				__m128i prev = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				__m128i next = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+				__m128i isFree = _mm_cmpeq_epi32(_mm_and_si128(next, flagsAndIndexMask), zero);
+				// The start/end of chain flags are the bit 31, so they can be taken directly with movemask.
+				// The CRC-initialized flag is moved to the bit 31 as well.
+				__m128i crcInitialized = _mm_slli_epi32(prev, 31 - ClusterValues::CLUSTER_INDEX_BITS_COUNT);
+
+				words.mFree |= static_cast<WordType>(_mm_movemask_ps(_mm_castsi128_ps(isFree))) << i;
+				words.mStartOfChain |= static_cast<WordType>(_mm_movemask_ps(_mm_castsi128_ps(prev))) << i;
+				words.mEndOfChain |= static_cast<WordType>(_mm_movemask_ps(_mm_castsi128_ps(next))) << i;
+				words.mCRCInitialized |= static_cast<WordType>(_mm_movemask_ps(_mm_castsi128_ps(crcInitialized))) << i;
+			}
+		}
+#else
+		void _classifyWordSIMD(const FATCellValueType* cells, CellWords& words) {
+			_classifyWordScalar(cells, FATCellDecoder::kBitsPerWord, words);
+		}
+#endif
+
+		inline void _storeWords(const CellWords& words, size_t wordIndex, WordType* freeBits, WordType* startOfChainBits, WordType* endOfChainBits, WordType* crcInitializedBits) {
+			if (freeBits != nullptr) {
+				freeBits[wordIndex] = words.mFree;
+			}
+			if (startOfChainBits != nullptr) {
+				startOfChainBits[wordIndex] = words.mStartOfChain;
+			}
+			if (endOfChainBits != nullptr) {
+				endOfChainBits[wordIndex] = words.mEndOfChain;
+			}
+			if (crcInitializedBits != nullptr) {
+				crcInitializedBits[wordIndex] = words.mCRCInitialized;
+			}
+		}
+
+	} // namespace
+
+	void FATCellDecoder::classify(const FATCellValueType* cells, size_t countCells,
+		WordType* freeBits, WordType* startOfChainBits, WordType* endOfChainBits, WordType* crcInitializedBits) {
+
+		SFAT_ASSERT((cells != nullptr) || (countCells == 0), "The FAT cells buffer should not be nullptr!");
+
+		CellWords words;
+		const size_t countFullWords = countCells / kBitsPerWord;
+		for (size_t wordIndex = 0; wordIndex < countFullWords; ++wordIndex) {
+			_classifyWordSIMD(cells + wordIndex * kBitsPerWord, words);
+			_storeWords(words, wordIndex, freeBits, startOfChainBits, endOfChainBits, crcInitializedBits);
+		}
+
+		const size_t countTailCells = countCells % kBitsPerWord;
+		if (countTailCells > 0) {
+			_classifyWordScalar(cells + countFullWords * kBitsPerWord, countTailCells, words);
+			_storeWords(words, countFullWords, freeBits, startOfChainBits, endOfChainBits, crcInitializedBits);
+		}
+	}
+
+	void FATCellDecoder::classifyScalar(const FATCellValueType* cells, size_t countCells,
+		WordType* freeBits, WordType* startOfChainBits, WordType* endOfChainBits, WordType* crcInitializedBits) {
+
+		CellWords words;
+		const size_t countWords = getCountWords(countCells);
+		for (size_t wordIndex = 0; wordIndex < countWords; ++wordIndex) {
+			size_t countCellsInWord = countCells - wordIndex * kBitsPerWord;
+			if (countCellsInWord > kBitsPerWord) {
+				countCellsInWord = kBitsPerWord;
+			}
+			_classifyWordScalar(cells + wordIndex * kBitsPerWord, countCellsInWord, words);
+			_storeWords(words, wordIndex, freeBits, startOfChainBits, endOfChainBits, crcInitializedBits);
+		}
+	}
+
+	void FATCellDecoder::decodeFreeClusters(const FATBlockTableType& table, BitSet& freeClustersSet) {
+		freeClustersSet.setSize(table.size());
+		SFAT_ASSERT(freeClustersSet.getElementsCount() == getCountWords(table.size()), "The BitSet words count doesn't match the count of the FAT cells!");
+		classify(table.data(), table.size(), freeClustersSet.getElementsData(), nullptr, nullptr, nullptr);
+	}
+
+	const char* FATCellDecoder::getKernelName() {
+#if (SPLIT_FAT__FAT_DECODE_AVX2 == 1)
+		return "AVX2";
+#elif (SPLIT_FAT__FAT_DECODE_SSE2 == 1)
+		return "SSE2";
+#else
+		return "Scalar";
+#endif
+	}
+
+} // namespace SFAT
@@ -15,6 +15,8 @@ namespace SFAT {
 		, mPosition(0)
 		, mPositionClusterIndex(ClusterValues::INVALID_VALUE)
 		, mNextPosition(0)
+		, mExpectedFileSize(0)
+		, mOpenFileStateGeneration(0)
 		, mIsValid(false) {
 		memset(&mFileDescriptorRecord, 0, sizeof(FileDescriptorRecord));
 		mLocation.mDirectoryStartClusterIndex = ClusterValues::INVALID_VALUE;
@@ -34,8 +36,12 @@ namespace SFAT {
 		mPosition = fm.mPosition;
 		mPositionClusterIndex = fm.mPositionClusterIndex;
 		mNextPosition = fm.mNextPosition;
+		mExpectedFileSize = fm.mExpectedFileSize;
+		mOpenFileState = std::move(fm.mOpenFileState);
+		mOpenFileStateGeneration = fm.mOpenFileStateGeneration;
 
 		mBuffer = std::move(fm.mBuffer);
+		mBufferCharge = std::move(fm.mBufferCharge);
 		mFullPath = std::move(fm.mFullPath);
 
 		mIsValid = fm.mIsValid;
@@ -44,9 +50,10 @@ namespace SFAT {
 		return *this;
 	}
 
-	std::vector<uint8_t>& FileManipulator::getBuffer(size_t requiredMinSize) {
+	std::vector<uint8_t>& FileManipulator::getBuffer(size_t requiredMinSize, const std::shared_ptr<MemoryBudget>& memoryBudget) {
 		if (mBuffer.size() < requiredMinSize) {
 			mBuffer.resize(requiredMinSize);
+			mBufferCharge.set(memoryBudget, MemoryComponent::MC_FILE_BUFFERS, mBuffer.capacity());
 		}
 		return mBuffer;
 	}
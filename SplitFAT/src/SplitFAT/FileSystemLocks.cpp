@@ -0,0 +1,247 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/FileSystemLocks.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include <iterator>
+#include <vector>
+
+namespace SFAT {
+
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+	namespace {
+		struct HeldLock {
+			const FileSystemLocks* mLocks;
+			LockLevel mLevel;
+			uint64_t mKey;
+		};
+
+		thread_local std::vector<HeldLock> tHeldLocks;
+
+		bool isLeafLevel(LockLevel level) {
+			return (level == LockLevel::LL_ALLOCATION) || (level == LockLevel::LL_DESCRIPTOR_CLUSTER);
+		}
+	}
+#endif //(SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+
+	FileSystemLock::FileSystemLock()
+		: mLocks(nullptr)
+		, mLevel(LockLevel::LL_VOLUME)
+		, mMode(LockMode::LM_SHARED)
+		, mKey(0) {
+	}
+
+	FileSystemLock::FileSystemLock(FileSystemLock&& other)
+		: mLocks(other.mLocks)
+		, mLevel(other.mLevel)
+		, mMode(other.mMode)
+		, mKey(other.mKey) {
+		other.mLocks = nullptr;
+	}
+
+	FileSystemLock& FileSystemLock::operator=(FileSystemLock&& other) {
+		if (this != &other) {
+			release();
+			mLocks = other.mLocks;
+			mLevel = other.mLevel;
+			mMode = other.mMode;
+			mKey = other.mKey;
+			other.mLocks = nullptr;
+		}
+		return *this;
+	}
+
+	FileSystemLock::~FileSystemLock() {
+		release();
+	}
+
+	void FileSystemLock::release() {
+		if (mLocks != nullptr) {
+			mLocks->_unlock(*this);
+			mLocks = nullptr;
+		}
+	}
+
+	FileSystemLocks::EntityEntry::EntityEntry()
+		: mCountUsers(0) {
+	}
+
+	FileSystemLocks::FileSystemLocks() {
+	}
+
+	FileSystemLock FileSystemLocks::lockVolume(LockMode mode) {
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_verifyLockOrder(LockLevel::LL_VOLUME, 0);
+#endif
+		if (mode == LockMode::LM_EXCLUSIVE) {
+			mVolumeMutex.lock();
+		}
+		else {
+			mVolumeMutex.lockShared();
+		}
+
+		FileSystemLock lock;
+		lock.mLocks = this;
+		lock.mLevel = LockLevel::LL_VOLUME;
+		lock.mMode = mode;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_onLocked(LockLevel::LL_VOLUME, 0);
+#endif
+		return lock;
+	}
+
+	FileSystemLock FileSystemLocks::lockEntity(ClusterIndexType descriptorClusterIndex, uint32_t relativeRecordIndex, LockMode mode) {
+		const uint64_t key = (static_cast<uint64_t>(descriptorClusterIndex) << 32) | relativeRecordIndex;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_verifyLockOrder(LockLevel::LL_ENTITY, key);
+#endif
+
+		EntityEntry* entry = nullptr;
+		{
+			SFATLockGuard guard(mEntitiesMutex);
+			std::unique_ptr<EntityEntry>& entryRef = mEntities[key];
+			if (entryRef == nullptr) {
+				entryRef = std::make_unique<EntityEntry>();
+			}
+			entry = entryRef.get();
+			// The entry is not removed while it has users, so it can be locked outside of mEntitiesMutex.
+			++entry->mCountUsers;
+		}
+
+		if (mode == LockMode::LM_EXCLUSIVE) {
+			entry->mMutex.lock();
+		}
+		else {
+			entry->mMutex.lockShared();
+		}
+
+		FileSystemLock lock;
+		lock.mLocks = this;
+		lock.mLevel = LockLevel::LL_ENTITY;
+		lock.mMode = mode;
+		lock.mKey = key;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_onLocked(LockLevel::LL_ENTITY, key);
+#endif
+		return lock;
+	}
+
+	FileSystemLock FileSystemLocks::lockAllocation() {
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_verifyLockOrder(LockLevel::LL_ALLOCATION, 0);
+#endif
+		mAllocationMutex.lock();
+
+		FileSystemLock lock;
+		lock.mLocks = this;
+		lock.mLevel = LockLevel::LL_ALLOCATION;
+		lock.mMode = LockMode::LM_EXCLUSIVE;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_onLocked(LockLevel::LL_ALLOCATION, 0);
+#endif
+		return lock;
+	}
+
+	FileSystemLock FileSystemLocks::lockDescriptorCluster(ClusterIndexType descriptorClusterIndex) {
+		const uint64_t key = descriptorClusterIndex;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_verifyLockOrder(LockLevel::LL_DESCRIPTOR_CLUSTER, key);
+#endif
+		_getDescriptorClusterMutex(key).lock();
+
+		FileSystemLock lock;
+		lock.mLocks = this;
+		lock.mLevel = LockLevel::LL_DESCRIPTOR_CLUSTER;
+		lock.mMode = LockMode::LM_EXCLUSIVE;
+		lock.mKey = key;
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_onLocked(LockLevel::LL_DESCRIPTOR_CLUSTER, key);
+#endif
+		return lock;
+	}
+
+	size_t FileSystemLocks::getCountLockedEntities() const {
+		SFATLockGuard guard(mEntitiesMutex);
+		return mEntities.size();
+	}
+
+	void FileSystemLocks::_unlock(FileSystemLock& lock) {
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+		_onUnlocked(lock.mLevel, lock.mKey);
+#endif
+		switch (lock.mLevel) {
+			case LockLevel::LL_VOLUME: {
+				if (lock.mMode == LockMode::LM_EXCLUSIVE) {
+					mVolumeMutex.unlock();
+				}
+				else {
+					mVolumeMutex.unlockShared();
+				}
+			} break;
+			case LockLevel::LL_ENTITY: {
+				SFATLockGuard guard(mEntitiesMutex);
+				auto it = mEntities.find(lock.mKey);
+				SFAT_ASSERT(it != mEntities.end(), "The locked entity should be registered!");
+				EntityEntry& entry = *it->second;
+				if (lock.mMode == LockMode::LM_EXCLUSIVE) {
+					entry.mMutex.unlock();
+				}
+				else {
+					entry.mMutex.unlockShared();
+				}
+				SFAT_ASSERT(entry.mCountUsers > 0, "The locked entity should have users!");
+				if (--entry.mCountUsers == 0) {
+					mEntities.erase(it);
+				}
+			} break;
+			case LockLevel::LL_ALLOCATION: {
+				mAllocationMutex.unlock();
+			} break;
+			case LockLevel::LL_DESCRIPTOR_CLUSTER: {
+				_getDescriptorClusterMutex(lock.mKey).unlock();
+			} break;
+		}
+	}
+
+	SFATMutex& FileSystemLocks::_getDescriptorClusterMutex(uint64_t key) {
+		return mDescriptorClusterMutexes[key % kCountDescriptorClusterMutexes];
+	}
+
+#if (SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+	void FileSystemLocks::_verifyLockOrder(LockLevel level, uint64_t key) const {
+		for (const HeldLock& heldLock : tHeldLocks) {
+			if (heldLock.mLocks != this) {
+				continue;
+			}
+			if (level == LockLevel::LL_VOLUME) {
+				SFAT_ASSERT(false, "The volume lock should be taken first, and only once by a thread!");
+			}
+			else if (level == LockLevel::LL_ENTITY) {
+				SFAT_ASSERT(!isLeafLevel(heldLock.mLevel), "An entity can't be locked while the allocation or a descriptor cluster is locked!");
+				SFAT_ASSERT((heldLock.mLevel != LockLevel::LL_ENTITY) || (heldLock.mKey != key), "The entity is already locked by this thread!");
+			}
+			else {
+				SFAT_ASSERT(!isLeafLevel(heldLock.mLevel), "The allocation and the descriptor cluster locks can't be nested!");
+			}
+		}
+	}
+
+	void FileSystemLocks::_onLocked(LockLevel level, uint64_t key) {
+		tHeldLocks.push_back(HeldLock{ this, level, key });
+	}
+
+	void FileSystemLocks::_onUnlocked(LockLevel level, uint64_t key) {
+		// The locks are not always released in reverse order, so search from the last one.
+		for (auto it = tHeldLocks.rbegin(); it != tHeldLocks.rend(); ++it) {
+			if ((it->mLocks == this) && (it->mLevel == level) && (it->mKey == key)) {
+				tHeldLocks.erase(std::next(it).base());
+				return;
+			}
+		}
+		SFAT_ASSERT(false, "The lock should be held by this thread!");
+	}
+#endif //(SPLIT_FAT_ENABLE_LOCK_ORDER_VERIFICATION == 1)
+
+} // namespace SFAT
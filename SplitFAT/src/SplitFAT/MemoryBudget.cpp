@@ -0,0 +1,186 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/MemoryBudget.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include <algorithm>
+
+namespace SFAT {
+
+	/**************************************************************************
+	*	MemoryBudget implementation
+	**************************************************************************/
+
+	MemoryBudget::Component::Component()
+		: mUsage(0)
+		, mLimit(0) {
+	}
+
+	MemoryBudget::MemoryBudget()
+		: mChangedBytes(0)
+		, mIsRebalanceNeeded(false) {
+	}
+
+	void MemoryBudget::setup(const MemoryBudgetSettings& settings) {
+		{
+			SFATLockGuard guard(mMutex);
+			mSettings = settings;
+		}
+		rebalance();
+	}
+
+	bool MemoryBudget::isEnabled() const {
+		SFATLockGuard guard(mMutex);
+		return mSettings.mMaxBytes != 0;
+	}
+
+	void MemoryBudget::registerComponent(MemoryComponent component, UsageFunction getUsage, LimitFunction setLimit) {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		SFATLockGuard guard(mMutex);
+		mComponents[static_cast<size_t>(component)].mGetUsage = std::move(getUsage);
+		mComponents[static_cast<size_t>(component)].mSetLimit = std::move(setLimit);
+		mIsRebalanceNeeded = true;
+	}
+
+	void MemoryBudget::unregisterComponent(MemoryComponent component) {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		SFATLockGuard guard(mMutex);
+		mComponents[static_cast<size_t>(component)].mGetUsage = nullptr;
+		mComponents[static_cast<size_t>(component)].mSetLimit = nullptr;
+		mComponents[static_cast<size_t>(component)].mLimit = 0;
+	}
+
+	void MemoryBudget::addUsage(MemoryComponent component, size_t bytes) {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		mComponents[static_cast<size_t>(component)].mUsage += bytes;
+		_markChanged(bytes);
+	}
+
+	void MemoryBudget::removeUsage(MemoryComponent component, size_t bytes) {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		SFAT_ASSERT(mComponents[static_cast<size_t>(component)].mUsage >= bytes, "Removing more memory than added!");
+		mComponents[static_cast<size_t>(component)].mUsage -= bytes;
+		_markChanged(bytes);
+	}
+
+	size_t MemoryBudget::getUsage(MemoryComponent component) const {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		SFATLockGuard guard(mMutex);
+		return _getUsage(mComponents[static_cast<size_t>(component)]);
+	}
+
+	size_t MemoryBudget::getTotalUsage() const {
+		SFATLockGuard guard(mMutex);
+		size_t totalBytes = 0;
+		for (const auto& component : mComponents) {
+			totalBytes += _getUsage(component);
+		}
+		return totalBytes;
+	}
+
+	size_t MemoryBudget::getLimit(MemoryComponent component) const {
+		SFAT_ASSERT(component < MemoryComponent::MC_COUNT, "Invalid memory component!");
+		SFATLockGuard guard(mMutex);
+		return mComponents[static_cast<size_t>(component)].mLimit;
+	}
+
+	void MemoryBudget::rebalance() {
+		SFATLockGuard guard(mMutex);
+		mIsRebalanceNeeded = false;
+		mChangedBytes = 0;
+
+		const size_t maxBytes = mSettings.mMaxBytes;
+		if (maxBytes == 0) {
+			return;
+		}
+
+		Component& bufferPool = mComponents[static_cast<size_t>(MemoryComponent::MC_BUFFER_POOL)];
+		bufferPool.mLimit = maxBytes / 100 * mSettings.mBufferPoolPercent;
+		if (bufferPool.mSetLimit) {
+			bufferPool.mSetLimit(bufferPool.mLimit);
+		}
+
+		// The cluster cache gets what is left by the rest of the components, but not less than its minimal share.
+		const size_t usedBytes = _getUsage(mComponents[static_cast<size_t>(MemoryComponent::MC_FAT_CACHE)])
+			+ _getUsage(mComponents[static_cast<size_t>(MemoryComponent::MC_FILE_BUFFERS)])
+			+ std::min(_getUsage(bufferPool), bufferPool.mLimit);
+		const size_t minClusterCacheBytes = maxBytes / 100 * mSettings.mMinClusterCachePercent;
+		Component& clusterCache = mComponents[static_cast<size_t>(MemoryComponent::MC_CLUSTER_CACHE)];
+		clusterCache.mLimit = std::max(minClusterCacheBytes, (usedBytes < maxBytes) ? (maxBytes - usedBytes) : 0);
+		if (clusterCache.mSetLimit) {
+			clusterCache.mSetLimit(clusterCache.mLimit);
+		}
+	}
+
+	void MemoryBudget::rebalanceIfNeeded() {
+		if (mIsRebalanceNeeded) {
+			rebalance();
+		}
+	}
+
+	size_t MemoryBudget::_getUsage(const Component& component) const {
+		return component.mGetUsage ? component.mGetUsage() : component.mUsage.load();
+	}
+
+	void MemoryBudget::_markChanged(size_t bytes) {
+		if ((mChangedBytes += bytes) >= kRebalanceGranularity) {
+			mIsRebalanceNeeded = true;
+		}
+	}
+
+	/**************************************************************************
+	*	MemoryCharge implementation
+	**************************************************************************/
+
+	MemoryCharge::MemoryCharge()
+		: mComponent(MemoryComponent::MC_COUNT)
+		, mBytes(0) {
+	}
+
+	MemoryCharge::MemoryCharge(MemoryCharge&& other)
+		: MemoryCharge() {
+		*this = std::move(other);
+	}
+
+	MemoryCharge& MemoryCharge::operator=(MemoryCharge&& other) {
+		if (this != &other) {
+			release();
+			mMemoryBudget = std::move(other.mMemoryBudget);
+			mComponent = other.mComponent;
+			mBytes = other.mBytes;
+			other.mMemoryBudget.reset();
+			other.mBytes = 0;
+		}
+		return *this;
+	}
+
+	MemoryCharge::~MemoryCharge() {
+		release();
+	}
+
+	void MemoryCharge::set(const std::shared_ptr<MemoryBudget>& memoryBudget, MemoryComponent component, size_t bytes) {
+		release();
+		if ((memoryBudget == nullptr) || (bytes == 0)) {
+			return;
+		}
+		memoryBudget->addUsage(component, bytes);
+		mMemoryBudget = memoryBudget;
+		mComponent = component;
+		mBytes = bytes;
+	}
+
+	void MemoryCharge::release() {
+		if (mBytes == 0) {
+			return;
+		}
+		std::shared_ptr<MemoryBudget> memoryBudget = mMemoryBudget.lock();
+		if (memoryBudget != nullptr) {
+			memoryBudget->removeUsage(mComponent, mBytes);
+		}
+		mMemoryBudget.reset();
+		mBytes = 0;
+	}
+
+} // namespace SFAT
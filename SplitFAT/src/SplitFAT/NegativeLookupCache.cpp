@@ -0,0 +1,96 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/NegativeLookupCache.h"
+#include "SplitFAT/FileDescriptorRecord.h"
+#include <algorithm>
+#include <ctype.h>
+
+namespace SFAT {
+
+	bool NegativeLookupCache::Key::operator==(const Key& other) const {
+		return (mDirectoryStartCluster == other.mDirectoryStartCluster) && (mName == other.mName);
+	}
+
+	size_t NegativeLookupCache::KeyHash::operator()(const Key& key) const {
+		return std::hash<std::string>()(key.mName) ^ (static_cast<size_t>(key.mDirectoryStartCluster) * 2654435769U);
+	}
+
+	NegativeLookupCache::NegativeLookupCache(size_t maxCountEntries)
+		: mMaxCountEntries(maxCountEntries)
+		, mGeneration(0)
+		, mCountHits(0) {
+	}
+
+	bool NegativeLookupCache::contains(ClusterIndexType directoryStartCluster, const std::string& name) {
+		Key key = _makeKey(directoryStartCluster, name);
+		SFATLockGuard guard(mMutex);
+		if (mEntries.find(key) == mEntries.end()) {
+			return false;
+		}
+		++mCountHits;
+		return true;
+	}
+
+	uint32_t NegativeLookupCache::getGeneration() const {
+		SFATLockGuard guard(mMutex);
+		return mGeneration;
+	}
+
+	void NegativeLookupCache::add(ClusterIndexType directoryStartCluster, const std::string& name, uint32_t generation) {
+		Key key = _makeKey(directoryStartCluster, name);
+		SFATLockGuard guard(mMutex);
+		if (generation != mGeneration) {
+			// The name could have been added to the directory after it was scanned.
+			return;
+		}
+		if (!mEntries.insert(key).second) {
+			return;
+		}
+		mInsertionOrder.push_back(std::move(key));
+		while (mInsertionOrder.size() > mMaxCountEntries) {
+			// The invalidated names are still in the queue, so this could remove a newer entry of the same name. It is just a cache miss later.
+			mEntries.erase(mInsertionOrder.front());
+			mInsertionOrder.pop_front();
+		}
+	}
+
+	void NegativeLookupCache::invalidate(ClusterIndexType directoryStartCluster, const std::string& name) {
+		Key key = _makeKey(directoryStartCluster, name);
+		SFATLockGuard guard(mMutex);
+		++mGeneration;
+		mEntries.erase(key);
+	}
+
+	void NegativeLookupCache::clear() {
+		SFATLockGuard guard(mMutex);
+		++mGeneration;
+		mEntries.clear();
+		mInsertionOrder.clear();
+	}
+
+	size_t NegativeLookupCache::getCountEntries() const {
+		SFATLockGuard guard(mMutex);
+		return mEntries.size();
+	}
+
+	uint32_t NegativeLookupCache::getCountHits() const {
+		SFATLockGuard guard(mMutex);
+		return mCountHits;
+	}
+
+	NegativeLookupCache::Key NegativeLookupCache::_makeKey(ClusterIndexType directoryStartCluster, const std::string& name) {
+		// Only that many characters are compared with the names in the FileDescriptorRecord.
+		const size_t maxNameLength = sizeof(FileDescriptorRecord::mEntityName);
+		Key key;
+		key.mDirectoryStartCluster = directoryStartCluster;
+		key.mName.reserve(std::min(name.size(), maxNameLength));
+		for (size_t i = 0; (i < name.size()) && (i < maxNameLength) && (name[i] != 0); ++i) {
+			key.mName.push_back(static_cast<char>(tolower(static_cast<unsigned char>(name[i]))));
+		}
+		return key;
+	}
+
+} // namespace SFAT
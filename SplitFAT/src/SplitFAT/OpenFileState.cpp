@@ -0,0 +1,160 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/OpenFileState.h"
+#include "SplitFAT/FATCellValue.h"
+#include <algorithm>
+#include <string.h>
+
+namespace SFAT {
+
+	namespace {
+		const size_t kMinCountStatesForCleanup = 16;
+	}
+
+	/**************************************************************************
+	*	OpenFileState implementation
+	**************************************************************************/
+
+	OpenFileState::OpenFileState(uint64_t fileKey, const FileDescriptorRecord& record)
+		: mFileKey(fileKey)
+		, mIsRemoved(false)
+		, mRecord(record)
+		, mGeneration(0)
+		, mCachedRelativeClusterIndex(0)
+		, mCachedClusterIndex(ClusterValues::INVALID_VALUE) {
+	}
+
+	bool OpenFileState::syncRecord(FileDescriptorRecord& record, uint32_t& generation) const {
+		SFATLockGuard lock(mMutex);
+		if ((generation == mGeneration) && (memcmp(&record, &mRecord, sizeof(FileDescriptorRecord)) == 0)) {
+			return false;
+		}
+		record = mRecord;
+		generation = mGeneration;
+		return true;
+	}
+
+	void OpenFileState::updateRecord(const FileDescriptorRecord& record) {
+		SFATLockGuard lock(mMutex);
+		if ((record.mStartCluster != mRecord.mStartCluster) || (record.mFileSize < mRecord.mFileSize)) {
+			// The cached cluster could be released.
+			mCachedClusterIndex = ClusterValues::INVALID_VALUE;
+		}
+		mRecord = record;
+	}
+
+	void OpenFileState::invalidateClusterIndices() {
+		SFATLockGuard lock(mMutex);
+		++mGeneration;
+		mCachedClusterIndex = ClusterValues::INVALID_VALUE;
+	}
+
+	bool OpenFileState::getCachedCluster(uint32_t maxRelativeClusterIndex, uint32_t& relativeClusterIndex, ClusterIndexType& clusterIndex) const {
+		SFATLockGuard lock(mMutex);
+		if (!isValidClusterIndex(mCachedClusterIndex) || (mCachedRelativeClusterIndex > maxRelativeClusterIndex)) {
+			return false;
+		}
+		relativeClusterIndex = mCachedRelativeClusterIndex;
+		clusterIndex = mCachedClusterIndex;
+		return true;
+	}
+
+	void OpenFileState::setCachedCluster(uint32_t relativeClusterIndex, ClusterIndexType clusterIndex) {
+		SFATLockGuard lock(mMutex);
+		mCachedRelativeClusterIndex = relativeClusterIndex;
+		mCachedClusterIndex = clusterIndex;
+	}
+
+	/**************************************************************************
+	*	OpenFileTable implementation
+	**************************************************************************/
+
+	OpenFileTable::OpenFileTable()
+		: mCountStatesForCleanup(kMinCountStatesForCleanup) {
+	}
+
+	std::shared_ptr<OpenFileState> OpenFileTable::find(uint64_t fileKey) const {
+		SFATLockGuard lock(mMutex);
+		auto it = mStates.find(fileKey);
+		if (it == mStates.end()) {
+			return nullptr;
+		}
+		return it->second.lock();
+	}
+
+	std::shared_ptr<OpenFileState> OpenFileTable::acquire(uint64_t fileKey, const FileDescriptorRecord& record) {
+		SFATLockGuard lock(mMutex);
+		std::weak_ptr<OpenFileState>& stateRef = mStates[fileKey];
+		std::shared_ptr<OpenFileState> state = stateRef.lock();
+		if (state == nullptr) {
+			state = std::make_shared<OpenFileState>(fileKey, record);
+			stateRef = state;
+			if (mStates.size() >= mCountStatesForCleanup) {
+				_removeExpired();
+			}
+		}
+		return state;
+	}
+
+	void OpenFileTable::remove(uint64_t fileKey) {
+		SFATLockGuard lock(mMutex);
+		auto it = mStates.find(fileKey);
+		if (it == mStates.end()) {
+			return;
+		}
+		std::shared_ptr<OpenFileState> state = it->second.lock();
+		if (state != nullptr) {
+			state->markRemoved();
+		}
+		mStates.erase(it);
+	}
+
+	void OpenFileTable::clear() {
+		SFATLockGuard lock(mMutex);
+		for (const auto& element : mStates) {
+			std::shared_ptr<OpenFileState> state = element.second.lock();
+			if (state != nullptr) {
+				state->markRemoved();
+			}
+		}
+		mStates.clear();
+	}
+
+	void OpenFileTable::invalidateClusterIndices() {
+		SFATLockGuard lock(mMutex);
+		for (const auto& element : mStates) {
+			std::shared_ptr<OpenFileState> state = element.second.lock();
+			if (state != nullptr) {
+				state->invalidateClusterIndices();
+			}
+		}
+	}
+
+	size_t OpenFileTable::getCountOpenFiles() const {
+		SFATLockGuard lock(mMutex);
+		size_t count = 0;
+		for (const auto& element : mStates) {
+			if (!element.second.expired()) {
+				++count;
+			}
+		}
+		return count;
+	}
+
+	void OpenFileTable::_removeExpired() {
+		for (auto it = mStates.begin(); it != mStates.end();) {
+			if (it->second.expired()) {
+				it = mStates.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		// Don't check again before the table doubles.
+		mCountStatesForCleanup = std::max(kMinCountStatesForCleanup, 2 * mStates.size());
+	}
+
+} // namespace SFAT
@@ -7,6 +7,7 @@
 #include "SplitFAT/FAT.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/DataBlockManager.h"
 #include "SplitFAT/VirtualFileSystem.h"
 #include "SplitFAT/FileManipulator.h"
 #include "SplitFAT/utils/SFATAssert.h"
@@ -34,161 +35,175 @@ namespace SFAT {
 		mCellsWithProblem.push_back(result);
 	}
 
-	ErrorCode RecoveryManager::testIntegrity() {
+	ErrorCode RecoveryManager::_iterateThroughAllocatedClusters(AllocatedClusterCallback callback) {
 		FATDataManager& fatMgr = mVolumeManager.getFATDataManager();
 		uint32_t countFATBlocks = mVolumeManager.getCountAllocatedFATBlocks();
 		uint32_t clustersPerBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
-		ClusterIndexType totalClusters = static_cast<ClusterIndexType>(countFATBlocks * clustersPerBlock);
-		BitSet testedClustersSet(totalClusters);
-		testedClustersSet.setAll(false);
-		FATCellValueType cellValue;
-		ErrorCode err = ErrorCode::RESULT_OK;
-		mClusterDataBuffer.resize(mVolumeManager.getClusterSize());
-		mCellsWithProblem.clear();
-		for (ClusterIndexType clusterIndex = 0; clusterIndex < totalClusters; ++clusterIndex) {
-			if (testedClustersSet.getValue(clusterIndex)) {
-				continue;
-			}
+		constexpr size_t bitsPerWord = sizeof(BitSet::ElementType) * 8;
 
-			err = fatMgr.getValue(clusterIndex, cellValue);
-			if (err != ErrorCode::RESULT_OK) {
-				break;
+		for (uint32_t blockIndex = 0; blockIndex < countFATBlocks; ++blockIndex) {
+			// The free-clusters set of the FAT block is kept decoded, so whole words of free cells can be skipped at once.
+			const BitSet* freeClustersSet = fatMgr.getFreeClustersSet(blockIndex);
+			if (freeClustersSet == nullptr) {
+				return ErrorCode::ERROR_FAT_NOT_CACHED;
 			}
 
-			if (!cellValue.isFreeCluster()) {
-				if (cellValue.isStartOfChain()) {
-					//
-					// The cell is first one in the chain, so the FileDescriptorRecord should point to this first element.
-					//
-					CellTestResult result;
-					err = verifyFileDescriptorClusterIndex(cellValue, clusterIndex, true, result);
+			ClusterIndexType startClusterIndex = fatMgr.getStartClusterIndex(blockIndex);
+			const BitSet::ElementType* freeWords = freeClustersSet->getElementsData();
+			size_t countWords = freeClustersSet->getElementsCount();
+			for (size_t wordIndex = 0; wordIndex < countWords; ++wordIndex) {
+				BitSet::ElementType allocatedBits = ~freeWords[wordIndex];
+				size_t countCellsInWord = static_cast<size_t>(clustersPerBlock) - wordIndex * bitsPerWord;
+				if (countCellsInWord < bitsPerWord) {
+					allocatedBits &= (static_cast<BitSet::ElementType>(1) << countCellsInWord) - 1;
+				}
+
+				while (allocatedBits != 0) {
+					uint32_t bitIndex = BitSet::countTrailingZeros(allocatedBits);
+					allocatedBits &= allocatedBits - 1;
+
+					ClusterIndexType clusterIndex = startClusterIndex + static_cast<ClusterIndexType>(wordIndex * bitsPerWord + bitIndex);
+					FATCellValueType cellValue;
+					ErrorCode err = fatMgr.getValue(clusterIndex, cellValue);
 					if (err != ErrorCode::RESULT_OK) {
 						return err;
 					}
-					if (result.mStatus != IntegrityStatus::NO_ERROR) {
-						mCellsWithProblem.push_back(result);
-					}
-				}
-				else {
-					//
-					// The cell is not first, so another (the previous) cell should point to the current one as next.
-					//
-					ClusterIndexType prevClusterIndex = cellValue.getPrev();
-					if (!isValidClusterIndex(prevClusterIndex)) {
-						_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_PREVIOUS_CELL, clusterIndex);
-					}
-					else {
-						FATCellValueType prevCellValue;
-						err = fatMgr.getValue(prevClusterIndex, prevCellValue);
-						if (err != ErrorCode::RESULT_OK) {
-							break;
-						}
-
-						if (prevCellValue.isEndOfChain() || (prevCellValue.getNext() != clusterIndex)) {
-							_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_NEXT_CELL, clusterIndex);
-						}
+
+					bool doQuit = false;
+					err = callback(doQuit, clusterIndex, cellValue);
+					if ((err != ErrorCode::RESULT_OK) || doQuit) {
+						return err;
 					}
 				}
+			}
+		}
 
+		return ErrorCode::RESULT_OK;
+	}
 
-				if (cellValue.isEndOfChain()) {
-					//
-					// The cell is last one in the chain, so the FileDescriptorRecord should point to this last element.
-					//
-					CellTestResult result;
-					err = verifyFileDescriptorClusterIndex(cellValue, clusterIndex, false, result);
+	ErrorCode RecoveryManager::testIntegrity() {
+		FATDataManager& fatMgr = mVolumeManager.getFATDataManager();
+		mClusterDataBuffer.resize(mVolumeManager.getClusterSize());
+		mCellsWithProblem.clear();
+
+		ErrorCode err = _iterateThroughAllocatedClusters([&fatMgr, this](bool& doQuit, ClusterIndexType clusterIndex, FATCellValueType cellValue)->ErrorCode {
+			(void)doQuit; // Not used parameter
+
+			if (cellValue.isStartOfChain()) {
+				//
+				// The cell is first one in the chain, so the FileDescriptorRecord should point to this first element.
+				//
+				CellTestResult result;
+				ErrorCode err = verifyFileDescriptorClusterIndex(cellValue, clusterIndex, true, result);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+				if (result.mStatus != IntegrityStatus::NO_ERROR) {
+					mCellsWithProblem.push_back(result);
+				}
+			}
+			else {
+				//
+				// The cell is not first, so another (the previous) cell should point to the current one as next.
+				//
+				ClusterIndexType prevClusterIndex = cellValue.getPrev();
+				if (!isValidClusterIndex(prevClusterIndex)) {
+					_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_PREVIOUS_CELL, clusterIndex);
+				}
+				else {
+					FATCellValueType prevCellValue;
+					ErrorCode err = fatMgr.getValue(prevClusterIndex, prevCellValue);
 					if (err != ErrorCode::RESULT_OK) {
 						return err;
 					}
-					if (result.mStatus != IntegrityStatus::NO_ERROR) {
-						mCellsWithProblem.push_back(result);
+
+					if (prevCellValue.isEndOfChain() || (prevCellValue.getNext() != clusterIndex)) {
+						_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_NEXT_CELL, clusterIndex);
 					}
 				}
+			}
+
+
+			if (cellValue.isEndOfChain()) {
+				//
+				// The cell is last one in the chain, so the FileDescriptorRecord should point to this last element.
+				//
+				CellTestResult result;
+				ErrorCode err = verifyFileDescriptorClusterIndex(cellValue, clusterIndex, false, result);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+				if (result.mStatus != IntegrityStatus::NO_ERROR) {
+					mCellsWithProblem.push_back(result);
+				}
+			}
+			else {
+				//
+				// The cell is not last in the chain, so another (the next) cell should point to this one as previous.
+				//
+				ClusterIndexType nextClusterIndex = cellValue.getNext();
+				if (!isValidClusterIndex(nextClusterIndex)) {
+					_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_NEXT_CELL, clusterIndex);
+				}
 				else {
-					//
-					// The cell is not last in the chain, so another (the next) cell should point to this one as previous.
-					//
-					ClusterIndexType nextClusterIndex = cellValue.getNext();
-					if (!isValidClusterIndex(nextClusterIndex)) {
-						_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_NEXT_CELL, clusterIndex);
+					FATCellValueType nextCellValue;
+					ErrorCode err = fatMgr.getValue(nextClusterIndex, nextCellValue);
+					if (err != ErrorCode::RESULT_OK) {
+						return err;
 					}
-					else {
-						FATCellValueType nextCellValue;
-						err = fatMgr.getValue(nextClusterIndex, nextCellValue);
-						if (err != ErrorCode::RESULT_OK) {
-							break;
-						}
-
-						if (nextCellValue.isStartOfChain() || (nextCellValue.getPrev() != clusterIndex)) {
-							_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_PREVIOUS_CELL, clusterIndex);
-						}
+
+					if (nextCellValue.isStartOfChain() || (nextCellValue.getPrev() != clusterIndex)) {
+						_registerError(IntegrityStatus::INVALID_CELL_INDEX_FOR_PREVIOUS_CELL, clusterIndex);
 					}
 				}
-
-				testedClustersSet.setValue(static_cast<size_t>(clusterIndex), true);
 			}
-		}
 
-		return ErrorCode::RESULT_OK;
+			return ErrorCode::RESULT_OK;
+		});
+
+		return err;
 	}
 
 	ErrorCode RecoveryManager::testDataConsistency() {
-		FATDataManager& fatMgr = mVolumeManager.getFATDataManager();
-		uint32_t countFATBlocks = mVolumeManager.getCountAllocatedFATBlocks();
-		uint32_t clustersPerBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
-		ClusterIndexType totalClusters = static_cast<ClusterIndexType>(countFATBlocks * clustersPerBlock);
-		BitSet testedClustersSet(totalClusters);
-		testedClustersSet.setAll(false);
-		FATCellValueType cellValue;
-		ErrorCode err = ErrorCode::RESULT_OK;
 		mClusterDataBuffer.resize(mVolumeManager.getClusterSize());
 		//mCellsWithProblem.clear();
 		mClusterChainsWithProblem.clear();
 		ClusterChainTestResult result;
 		result.mStatus = IntegrityStatus::CRC_DOES_NOT_MATCH_FOR_CLUSTER;
 
-		for (ClusterIndexType clusterIndex = 0; clusterIndex < totalClusters; ++clusterIndex) {
-			if (testedClustersSet.getValue(clusterIndex)) {
-				continue;
-			}
+		ErrorCode err = _iterateThroughAllocatedClusters([&result, this](bool& doQuit, ClusterIndexType clusterIndex, FATCellValueType cellValue)->ErrorCode {
+			(void)doQuit; // Not used parameter
 
-			err = fatMgr.getValue(clusterIndex, cellValue);
+			ErrorCode err = mVolumeManager.readCluster(mClusterDataBuffer, clusterIndex);
 			if (err != ErrorCode::RESULT_OK) {
-				break;
+				return err;
 			}
 
-			if (!cellValue.isFreeCluster()) {
-				err = mVolumeManager.readCluster(mClusterDataBuffer, clusterIndex);
-				if (err != ErrorCode::RESULT_OK) {
-					return err;
-				}
-
 #if (SPLIT_FAT__ENABLE_CRC_PER_CLUSTER == 1)
-				const uint32_t calculatedCrc = CRC16::calculate(mClusterDataBuffer.data(), mVolumeManager.getClusterSize());
+			const uint32_t calculatedCrc = CRC16::calculate(mClusterDataBuffer.data(), mVolumeManager.getClusterSize());
 #else
-				const uint32 calculatedCrc = 0;
+			const uint32 calculatedCrc = 0;
 #endif
-				if (calculatedCrc != static_cast<uint32_t>(cellValue.decodeCRC())) {
-					std::string fullFilePath;
-					FileManipulator fileManipulator;
-					err = mVirtualFileSystem.findFileFromCluster(clusterIndex, fileManipulator);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
-
-					err = mVirtualFileSystem.createFullFilePathFromFileManipulator(fileManipulator, fullFilePath);
-					result.mLocation = fileManipulator.getDescriptorLocation();
-					mClusterChainsWithProblem.push_back(result);
-
-					FileSizeType fileSize = fileManipulator.getFileSize();
-					SFAT_LOGW(LogArea::LA_VIRTUAL_DISK, "CRC doesn't match for cluster #%08X from file \"%s\", size:%u", clusterIndex, fullFilePath.c_str(), fileSize);
+			if (calculatedCrc != static_cast<uint32_t>(cellValue.decodeCRC())) {
+				std::string fullFilePath;
+				FileManipulator fileManipulator;
+				err = mVirtualFileSystem.findFileFromCluster(clusterIndex, fileManipulator);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
 				}
 
-				testedClustersSet.setValue(static_cast<size_t>(clusterIndex), true);
+				err = mVirtualFileSystem.createFullFilePathFromFileManipulator(fileManipulator, fullFilePath);
+				result.mLocation = fileManipulator.getDescriptorLocation();
+				mClusterChainsWithProblem.push_back(result);
+
+				FileSizeType fileSize = fileManipulator.getFileSize();
+				SFAT_LOGW(LogArea::LA_VIRTUAL_DISK, "CRC doesn't match for cluster #%08X from file \"%s\", size:%u", clusterIndex, fullFilePath.c_str(), fileSize);
 			}
-		}
 
-		return ErrorCode::RESULT_OK;
+			return ErrorCode::RESULT_OK;
+		});
+
+		return err;
 	}
 
 	ErrorCode RecoveryManager::verifyFileDescriptorClusterIndex(const FATCellValueType& cellValue, ClusterIndexType sourceClusterIndex, bool startCluster, CellTestResult& result) {
@@ -204,16 +219,14 @@ namespace SFAT {
 		uint32_t relativeRecordIndex;
 		cellValue.decodeFileDescriptorLocation(descriptorClusterIndex, relativeRecordIndex);
 
-		if (mClusterDataBuffer.size() != static_cast<size_t>(mVolumeManager.getClusterSize())) {
-			mClusterDataBuffer.resize(mVolumeManager.getClusterSize());
-		}
-
-		ErrorCode err = mVolumeManager.readCluster(mClusterDataBuffer, descriptorClusterIndex);
+		// The directory clusters are usually cached, so the record is checked without copying the cluster.
+		ClusterView clusterView;
+		ErrorCode err = mVolumeManager.acquireClusterView(descriptorClusterIndex, clusterView);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
-		FileDescriptorRecord* record = mVirtualFileSystem._getFileDescriptorRecordInCluster(mClusterDataBuffer.data(), relativeRecordIndex);
+		const FileDescriptorRecord* record = reinterpret_cast<const FileDescriptorRecord*>(clusterView.data() + relativeRecordIndex*mVolumeManager.getFileDescriptorRecordStorageSize());
 
 		result.mClusterIndex = sourceClusterIndex;
 		result.mStatus = IntegrityStatus::NO_ERROR;
@@ -0,0 +1,358 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/SizeClassDataPlacementStrategy.h"
+#include "SplitFAT/FAT.h"
+#include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/utils/BitSet.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include "SplitFAT/utils/Logger.h"
+#include <algorithm>
+
+namespace SFAT {
+
+	/**************************************************************************
+	*	SizeClassPlacementSettings implementation
+	**************************************************************************/
+
+	SizeClassPlacementSettings::SizeClassPlacementSettings()
+		: mSmallFileMaxSize(16 * (1 << 10)) // 16KB
+		, mLargeFileMinSize(16 * (1 << 20)) { // 16MB
+	}
+
+	/**************************************************************************
+	*	SizeClassPlacementStats implementation
+	**************************************************************************/
+
+	SizeClassPlacementStats::SizeClassPlacementStats()
+		: mCountContiguousAllocations(0)
+		, mCountNonContiguousAllocations(0)
+		, mCountSizeClassChanges(0)
+		, mCountFallbackAllocations(0) {
+		for (uint32_t i = 0; i < static_cast<uint32_t>(SizeClass::SC_COUNT); ++i) {
+			mCountAllocations[i] = 0;
+			mCountBlocks[i] = 0;
+		}
+	}
+
+	/**************************************************************************
+	*	FragmentationStats implementation
+	**************************************************************************/
+
+	FragmentationStats::FragmentationStats()
+		: mCountBlocks(0)
+		, mCountFreeClusters(0)
+		, mCountFreeRuns(0)
+		, mLongestFreeRun(0) {
+	}
+
+	/**************************************************************************
+	*	SizeClassDataPlacementStrategy implementation
+	**************************************************************************/
+
+	SizeClassDataPlacementStrategy::SizeClassDataPlacementStrategy(VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem, const SizeClassPlacementSettings& settings)
+		: DataPlacementStrategyBase(volumeManager, virtualFileSystem)
+		, mSettings(settings) {
+		for (uint32_t i = 0; i < static_cast<uint32_t>(SizeClass::SC_COUNT); ++i) {
+			mCurrentBlockIndex[i] = static_cast<uint32_t>(BlockIndexValues::INVALID_VALUE);
+		}
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::prepareForWriteTransaction() {
+		// Nothing is moved on the transaction end. The placement is done only on allocation.
+		mIsActive = true;
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::performDefragmentaionOnTransactionEnd() {
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage) {
+		if (!useFileDataStorage) {
+			return mVolumeManager.findFreeCluster(newClusterIndex, useFileDataStorage);
+		}
+
+		// Nothing is known about the file.
+		SFATLockGuard lock(mPlacementMutex);
+		return _findFreeCluster(newClusterIndex, SizeClass::SC_MEDIUM);
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& context) {
+		if (!context.mUseFileDataStorage) {
+			return DataPlacementStrategyBase::findFreeCluster(newClusterIndex, context);
+		}
+
+		SFATLockGuard lock(mPlacementMutex);
+		_updateBlockClasses();
+		SizeClass sizeClass = _getSizeClass(context.mExpectedFileSize);
+		AllocationContext classContext = context;
+		if (isValidClusterIndex(context.mLastCluster)) {
+			const SizeClass lastClusterSizeClass = _getBlockSizeClass(mVolumeManager.getBlockIndex(context.mLastCluster));
+			if (lastClusterSizeClass > sizeClass) {
+				// The expected size could be smaller than the file already is, e.g. it is written at a position before its end.
+				// The file never moves to a smaller class.
+				sizeClass = lastClusterSizeClass;
+			}
+			else if (lastClusterSizeClass != sizeClass) {
+				// The file grew out of its size class. Continue the chain in a block for the new class.
+				classContext.mLastCluster = ClusterValues::INVALID_VALUE;
+				++mStats.mCountSizeClassChanges;
+			}
+		}
+		if (sizeClass == SizeClass::SC_SMALL) {
+			// Windows for the sequential writers would only leave gaps between the small files.
+			classContext.mPattern = AllocationPattern::AP_UNKNOWN;
+		}
+
+		// The block of a new window is selected for the size class.
+		ErrorCode err = _findFreeClusterNearChain(newClusterIndex, classContext, [this, sizeClass](ClusterIndexType& freeClusterIndex) {
+			return _findFreeCluster(freeClusterIndex, sizeClass);
+		});
+
+		if ((err == ErrorCode::RESULT_OK) && isValidClusterIndex(newClusterIndex)) {
+			++mStats.mCountAllocations[static_cast<uint32_t>(sizeClass)];
+			if (isValidClusterIndex(context.mLastCluster)) {
+				if (newClusterIndex == context.mLastCluster + 1) {
+					++mStats.mCountContiguousAllocations;
+				}
+				else {
+					++mStats.mCountNonContiguousAllocations;
+				}
+			}
+		}
+		return err;
+	}
+
+	SizeClassPlacementSettings SizeClassDataPlacementStrategy::getSettings() const {
+		SFATLockGuard lock(mPlacementMutex);
+		return mSettings;
+	}
+
+	void SizeClassDataPlacementStrategy::setSettings(const SizeClassPlacementSettings& settings) {
+		SFATLockGuard lock(mPlacementMutex);
+		mSettings = settings;
+	}
+
+	SizeClass SizeClassDataPlacementStrategy::getSizeClass(FileSizeType expectedFileSize) const {
+		SFATLockGuard lock(mPlacementMutex);
+		return _getSizeClass(expectedFileSize);
+	}
+
+	SizeClass SizeClassDataPlacementStrategy::getBlockSizeClass(uint32_t blockIndex) const {
+		SFATLockGuard lock(mPlacementMutex);
+		return _getBlockSizeClass(blockIndex);
+	}
+
+	SizeClassPlacementStats SizeClassDataPlacementStrategy::getPlacementStats() const {
+		SFATLockGuard lock(mPlacementMutex);
+		return mStats;
+	}
+
+	void SizeClassDataPlacementStrategy::resetPlacementStats() {
+		SFATLockGuard lock(mPlacementMutex);
+		SizeClassPlacementStats stats;
+		// The count of the blocks describes the current state, so it is kept.
+		for (uint32_t i = 0; i < static_cast<uint32_t>(SizeClass::SC_COUNT); ++i) {
+			stats.mCountBlocks[i] = mStats.mCountBlocks[i];
+		}
+		mStats = stats;
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::getFragmentationStats(FragmentationStats& stats, SizeClass sizeClass) {
+		SFATLockGuard lock(mPlacementMutex);
+		_updateBlockClasses();
+		stats = FragmentationStats();
+
+		BitSet freeClustersSet;
+		const uint32_t countBlocks = static_cast<uint32_t>(mBlockClasses.size());
+		for (uint32_t blockIndex = mVolumeManager.getFirstFileDataBlockIndex(); blockIndex < countBlocks; ++blockIndex) {
+			if (mBlockClasses[blockIndex] != sizeClass) {
+				continue;
+			}
+			ErrorCode err = copyFreeClustersBitSet(freeClustersSet, blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			_addFragmentationStats(stats, freeClustersSet);
+		}
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	SizeClass SizeClassDataPlacementStrategy::_getSizeClass(FileSizeType expectedFileSize) const {
+		if (expectedFileSize == 0) {
+			// Not known
+			return SizeClass::SC_MEDIUM;
+		}
+		if (expectedFileSize <= mSettings.mSmallFileMaxSize) {
+			return SizeClass::SC_SMALL;
+		}
+		if (expectedFileSize >= mSettings.mLargeFileMinSize) {
+			return SizeClass::SC_LARGE;
+		}
+		return SizeClass::SC_MEDIUM;
+	}
+
+	SizeClass SizeClassDataPlacementStrategy::_getBlockSizeClass(uint32_t blockIndex) const {
+		if (blockIndex < mBlockClasses.size()) {
+			return mBlockClasses[blockIndex];
+		}
+		return SizeClass::SC_MEDIUM;
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::_findFreeCluster(ClusterIndexType& newClusterIndex, SizeClass sizeClass) {
+		ErrorCode err = _findFreeClusterInSizeClass(newClusterIndex, sizeClass);
+		if ((err != ErrorCode::RESULT_OK) || isValidClusterIndex(newClusterIndex)) {
+			return err;
+		}
+
+		// There is no space in the blocks for this size class, and the volume can't expand. Use any free cluster.
+		++mStats.mCountFallbackAllocations;
+		return mVolumeManager.findFreeCluster(newClusterIndex, true);
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::_findFreeClusterInSizeClass(ClusterIndexType& newClusterIndex, SizeClass sizeClass) {
+		_updateBlockClasses();
+		FATDataManager& fatMgr = mVolumeManager.getFATDataManager();
+		const uint32_t firstBlockIndex = mVolumeManager.getFirstFileDataBlockIndex();
+		const uint32_t countBlocks = static_cast<uint32_t>(mBlockClasses.size());
+		uint32_t& currentBlockIndex = mCurrentBlockIndex[static_cast<uint32_t>(sizeClass)];
+
+		// Start from the block used last time for this class, so the blocks are filled one by one.
+		uint32_t startBlockIndex = ((currentBlockIndex >= firstBlockIndex) && (currentBlockIndex < countBlocks)) ? currentBlockIndex : firstBlockIndex;
+		uint32_t countFileDataBlocks = (countBlocks > firstBlockIndex) ? (countBlocks - firstBlockIndex) : 0;
+		for (uint32_t i = 0; i < countFileDataBlocks; ++i) {
+			uint32_t blockIndex = firstBlockIndex + (startBlockIndex - firstBlockIndex + i) % countFileDataBlocks;
+			if (mBlockClasses[blockIndex] != sizeClass) {
+				continue;
+			}
+
+			// Uses the block control data if the block is not loaded yet.
+			uint32_t countFreeClusters = 0;
+			ErrorCode err = fatMgr.getCountFreeClusters(countFreeClusters, blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			if (countFreeClusters == 0) {
+				continue;
+			}
+
+			err = fatMgr.tryFindFreeClusterInBlock(newClusterIndex, blockIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			if (isValidClusterIndex(newClusterIndex)) {
+				currentBlockIndex = blockIndex;
+				return ErrorCode::RESULT_OK;
+			}
+		}
+
+		// All blocks for this class are full.
+		uint32_t blockIndex = static_cast<uint32_t>(BlockIndexValues::INVALID_VALUE);
+		ErrorCode err = _reserveBlock(blockIndex, sizeClass);
+		if ((err != ErrorCode::RESULT_OK) || !isValidBlockIndex(blockIndex)) {
+			return err;
+		}
+
+		err = fatMgr.tryFindFreeClusterInBlock(newClusterIndex, blockIndex);
+		if (err == ErrorCode::RESULT_OK) {
+			currentBlockIndex = blockIndex;
+		}
+		return err;
+	}
+
+	ErrorCode SizeClassDataPlacementStrategy::_reserveBlock(uint32_t& blockIndex, SizeClass sizeClass) {
+		blockIndex = static_cast<uint32_t>(BlockIndexValues::INVALID_VALUE);
+
+		if (sizeClass != SizeClass::SC_MEDIUM) {
+			// Try first with a completely free block that is not reserved yet.
+			FATDataManager& fatMgr = mVolumeManager.getFATDataManager();
+			const uint32_t clustersPerBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+			const uint32_t countBlocks = static_cast<uint32_t>(mBlockClasses.size());
+			for (uint32_t localBlockIndex = mVolumeManager.getFirstFileDataBlockIndex(); localBlockIndex < countBlocks; ++localBlockIndex) {
+				if (mBlockClasses[localBlockIndex] != SizeClass::SC_MEDIUM) {
+					continue;
+				}
+				uint32_t countFreeClusters = 0;
+				ErrorCode err = fatMgr.getCountFreeClusters(countFreeClusters, localBlockIndex);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+				if (countFreeClusters == clustersPerBlock) {
+					mBlockClasses[localBlockIndex] = sizeClass;
+					--mStats.mCountBlocks[static_cast<uint32_t>(SizeClass::SC_MEDIUM)];
+					++mStats.mCountBlocks[static_cast<uint32_t>(sizeClass)];
+					blockIndex = localBlockIndex;
+					return ErrorCode::RESULT_OK;
+				}
+			}
+		}
+
+		// Expand the volume with one more block.
+		uint32_t newBlockIndex = mVolumeManager.getCountAllocatedDataBlocks();
+		ErrorCode err = mVolumeManager.allocateBlockByIndex(newBlockIndex);
+		if (err == ErrorCode::ERROR_VOLUME_CAN_NOT_EXPAND) {
+			// Not an error. The caller should use some other block.
+			return ErrorCode::RESULT_OK;
+		}
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't allocate block #%u for the size-class placement!", newBlockIndex);
+			return err;
+		}
+
+		_updateBlockClasses();
+		SFAT_ASSERT(newBlockIndex < mBlockClasses.size(), "The new block should be allocated!");
+		if (sizeClass != SizeClass::SC_MEDIUM) {
+			mBlockClasses[newBlockIndex] = sizeClass;
+			--mStats.mCountBlocks[static_cast<uint32_t>(SizeClass::SC_MEDIUM)];
+			++mStats.mCountBlocks[static_cast<uint32_t>(sizeClass)];
+		}
+		blockIndex = newBlockIndex;
+		return ErrorCode::RESULT_OK;
+	}
+
+	void SizeClassDataPlacementStrategy::_updateBlockClasses() {
+		// The blocks allocated meanwhile are not reserved.
+		const uint32_t countBlocks = mVolumeManager.getCountAllocatedDataBlocks();
+		const uint32_t firstBlockIndex = mVolumeManager.getFirstFileDataBlockIndex();
+		for (uint32_t blockIndex = static_cast<uint32_t>(mBlockClasses.size()); blockIndex < countBlocks; ++blockIndex) {
+			mBlockClasses.push_back(SizeClass::SC_MEDIUM);
+			if (blockIndex >= firstBlockIndex) {
+				++mStats.mCountBlocks[static_cast<uint32_t>(SizeClass::SC_MEDIUM)];
+			}
+		}
+	}
+
+	//static
+	void SizeClassDataPlacementStrategy::_addFragmentationStats(FragmentationStats& stats, const BitSet& freeClustersSet) {
+		constexpr uint32_t bitsPerWord = sizeof(BitSet::ElementType) * 8;
+		const size_t size = freeClustersSet.getSize();
+		const size_t countWords = std::min((size + bitsPerWord - 1) / bitsPerWord, freeClustersSet.getElementsCount());
+		const BitSet::ElementType* freeWords = freeClustersSet.getElementsData();
+
+		// A free cluster is a start of a run if the previous cluster is occupied.
+		BitSet::ElementType lastWasFree = 0;
+		for (size_t wordIndex = 0; wordIndex < countWords; ++wordIndex) {
+			BitSet::ElementType freeBits = freeWords[wordIndex];
+			size_t bitsInWord = size - wordIndex * bitsPerWord;
+			if (bitsInWord < bitsPerWord) {
+				freeBits &= (static_cast<BitSet::ElementType>(1) << bitsInWord) - 1;
+			}
+			BitSet::ElementType runStarts = freeBits & ~((freeBits << 1) | lastWasFree);
+			lastWasFree = freeBits >> (bitsPerWord - 1);
+			stats.mCountFreeRuns += BitSet::popCount(runStarts);
+		}
+
+		size_t startIndex = 0;
+		size_t longestRun = 0;
+		if (freeClustersSet.findLongestRun(startIndex, longestRun, true)) {
+			stats.mLongestFreeRun = std::max(stats.mLongestFreeRun, static_cast<uint32_t>(longestRun));
+		}
+		stats.mCountFreeClusters += static_cast<uint32_t>(freeClustersSet.getCountOnes());
+		++stats.mCountBlocks;
+	}
+
+} // namespace SFAT
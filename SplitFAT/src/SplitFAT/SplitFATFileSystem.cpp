@@ -386,6 +386,30 @@ namespace SFAT {
 		return err;
 	}
 
+	ErrorCode SplitFATFileStorage::endTransactionAsync(std::shared_future<ErrorCode>& completion) {
+#if (SPLIT_FAT_ENABLE_PERFORMANCE_COUNTERS == 1)
+		mPerformanceCounters->mTransactionEndTime = std::chrono::high_resolution_clock::now();
+		mPerformanceCounters->LogPerfCounters();
+#endif
+		ErrorCode err = ErrorCode::RESULT_OK;
+		if (mVirtualFileSystem->isInTransaction()) {
+			err = mVirtualFileSystem->endTransactionAsync(completion);
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGW(LogArea::LA_TRANSACTION, "Transaction end with an error: 0x%4x!", err);
+			}
+
+			mTransactionMutex.unlock();
+		}
+		else {
+			SFAT_LOGW(LogArea::LA_TRANSACTION, "endTransactionAsync() called without startTransaction()");
+			err = ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED;
+			std::promise<ErrorCode> result;
+			result.set_value(err);
+			completion = result.get_future().share();
+		}
+		return err;
+	}
+
 	ErrorCode SplitFATFileStorage::tryRestoreFromTransactionFile() {
 		return mVirtualFileSystem->tryRestoreFromTransactionFile();
 	}
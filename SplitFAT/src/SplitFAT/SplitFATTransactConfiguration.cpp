@@ -65,11 +65,14 @@ namespace SFAT {
 			!mTempTransactionFile.checkAccessMode(AccessMode::AM_WRITE)) {
 			return ErrorCode::ERROR_VOLUME_TRANSACTION_ERROR;
 		}
-		// Flush the temp transaction file
-		ErrorCode err = mTempTransactionFile.flush();
-		SFAT_ASSERT(err == ErrorCode::RESULT_OK, "The flush operation failed for the transaction file!");
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
+		// Flush the temp transaction file, if it wasn't synced already by the "log durable" barrier
+		ErrorCode err = ErrorCode::RESULT_OK;
+		if (mTempTransactionFile.hasUnsyncedWrites()) {
+			err = mTempTransactionFile.flush();
+			SFAT_ASSERT(err == ErrorCode::RESULT_OK, "The flush operation failed for the transaction file!");
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
 		}
 		// Close the temp transaction file
 		err = mTempTransactionFile.close();
@@ -77,10 +80,30 @@ namespace SFAT {
 			return err;
 		}
 
+		if (mIsAppendingToFinalFile) {
+			// The file already has its final name.
+			mIsAppendingToFinalFile = false;
+			return ErrorCode::RESULT_OK;
+		}
+
 		// Rename it to the name of the final transaction file
 		return mTransactionFileStorage->renameFile(_getTransactionTempFilePath(), _getTransactionFinalFilePath());
 	}
 
+	ErrorCode SplitFATTransactConfiguration::reopenFinalTransactionFileForAppend() {
+		if (mTempTransactionFile.isOpen()) {
+			return ErrorCode::ERROR_TRANSACTION_IS_ALREADY_STARTED;
+		}
+		ErrorCode err = mTransactionFileStorage->openFile(mTempTransactionFile, _getTransactionFinalFilePath(), "ab");
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't open the transaction file for appending.");
+			return err;
+		}
+		mIsAppendingToFinalFile = true;
+
+		return err;
+	}
+
 	ErrorCode SplitFATTransactConfiguration::closeReadOnlyTransactionFile() {
 		if (mTransactionFile.isOpen()) {
 			SFAT_ASSERT(mTransactionFile.checkAccessMode(AccessMode::AM_READ), "Read mode is required!");
@@ -103,6 +126,7 @@ namespace SFAT {
 	void SplitFATTransactConfiguration::_transactionShutdown() {
 		mTransactionFile.reset();
 		mTempTransactionFile.reset();
+		mIsAppendingToFinalFile = false;
 	}
 
 } // namespace SFAT
@@ -5,31 +5,170 @@
 
 #include "SplitFAT/Transaction.h"
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/DataBlockManager.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/utils/SFATAssert.h"
 #include "SplitFAT/utils/Logger.h"
 #include "SplitFAT/utils/CRC.h"
+#include "SplitFAT/utils/Compression.h"
+#include <algorithm>
+#include <string.h>
 
 namespace SFAT {
 
+	namespace {
+
+		// Reads the events after the file header sequentially in large chunks.
+		// An event that doesn't fit in the rest of a chunk is read again at the start of the next one.
+		class TransactionFileReader {
+		public:
+			TransactionFileReader(FileHandle& fileHandle, size_t chunkSize, size_t maxPayloadSize)
+				: mFileHandle(fileHandle)
+				, mChunkSize(std::max(chunkSize, sizeof(TransactionEvent)))
+				, mMaxPayloadSize(maxPayloadSize)
+				, mFilePosition(sizeof(TransactionFileHeader))
+				, mHasIncompleteEvent(false) {
+			}
+
+			// Reads the complete events from the next chunk. No events are returned at the end of the file.
+			// The payloads point in the internal buffer and stay valid until the next call.
+			ErrorCode readEvents(std::vector<TransactionEventView>& events) {
+				events.clear();
+				size_t readSize = mChunkSize;
+				for (;;) {
+					mBuffer.resize(readSize);
+					size_t bytesRead = 0;
+					ErrorCode err = mFileHandle.readAtPosition(mBuffer.data(), readSize, mFilePosition, bytesRead);
+					if (err != ErrorCode::RESULT_OK) {
+						return err;
+					}
+
+					size_t position = 0;
+					size_t nextEventSize = 0;
+					while (position + sizeof(TransactionEvent) <= bytesRead) {
+						TransactionEventView eventView;
+						memcpy(&eventView.mEvent, mBuffer.data() + position, sizeof(TransactionEvent));
+						if (eventView.mEvent.mPayloadSize > mMaxPayloadSize) {
+							// The size of an event, which writing was interrupted, could be anything. Only the last event in the file can be such.
+							bool isAtEnd = false;
+							err = _isEndOfFile(mFilePosition + position + sizeof(TransactionEvent) + mMaxPayloadSize, isAtEnd);
+							if (err != ErrorCode::RESULT_OK) {
+								return err;
+							}
+							if (!isAtEnd) {
+								SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the payload in the transaction file is incorrect!");
+								return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+							}
+							mFilePosition += position;
+							mHasIncompleteEvent = true;
+							return ErrorCode::RESULT_OK;
+						}
+						nextEventSize = sizeof(TransactionEvent) + eventView.mEvent.mPayloadSize;
+						if (position + nextEventSize > bytesRead) {
+							break;
+						}
+						eventView.mPayload = mBuffer.data() + position + sizeof(TransactionEvent);
+						events.push_back(eventView);
+						position += nextEventSize;
+					}
+					mFilePosition += position;
+
+					if (!events.empty() || (bytesRead < readSize)) {
+						// At the end of the file, the rest is an event which writing was interrupted.
+						mHasIncompleteEvent = events.empty() && (bytesRead > 0);
+						return ErrorCode::RESULT_OK;
+					}
+					// The next event is larger than the chunk.
+					readSize = nextEventSize;
+				}
+			}
+
+			bool hasIncompleteEvent() const {
+				return mHasIncompleteEvent;
+			}
+
+			// Checks if anything follows the events read so far.
+			ErrorCode isAtEndOfFile(bool& isAtEnd) {
+				return _isEndOfFile(mFilePosition, isAtEnd);
+			}
+
+		private:
+			ErrorCode _isEndOfFile(FilePositionType position, bool& isAtEnd) {
+				uint8_t byte = 0;
+				size_t bytesRead = 0;
+				ErrorCode err = mFileHandle.readAtPosition(&byte, sizeof(byte), position, bytesRead);
+				isAtEnd = (bytesRead == 0);
+				return err;
+			}
+
+			FileHandle& mFileHandle;
+			const size_t mChunkSize;
+			const size_t mMaxPayloadSize;
+			FilePositionType mFilePosition;
+			bool mHasIncompleteEvent;
+			std::vector<uint8_t> mBuffer;
+		};
+
+	} // namespace
+
+	TransactionLogStats::TransactionLogStats()
+		: mCountEvents(0)
+		, mCountWrites(0)
+		, mCountBytes(0)
+		, mCountPayloadBytes(0)
+		, mCountCheckpoints(0) {
+	}
+
 	TransactionEventsLog::TransactionEventsLog(VolumeManager& volumeManager)
 		: mVolumeManager(volumeManager)
-		, mIsInTransaction(false) {
+		, mIsInTransaction(false)
+		, mLogMode(TransactionLogMode::TLM_UNDO)
+		, mIsCheckpointPending(false)
+		, mAreAutomaticCheckpointsEnabled(false)
+		, mIsCheckpointRequested(false)
+		, mCountFATPagesSinceCheckpoint(0)
+		, mRestoreReadChunkSize(kRestoreReadChunkSize)
+		, mLogFilePosition(0) {
+	}
+
+	TransactionEventsLog::~TransactionEventsLog() {
+		waitForCheckpoint();
 	}
 
 	ErrorCode TransactionEventsLog::logFATCellChange(ClusterIndexType cellIndex, const FATBlockTableType& buffer) {
 		uint32_t blockIndex = mVolumeManager.getBlockIndex(cellIndex);
 		ErrorCode err = ErrorCode::RESULT_OK;
-		TransactionEvent transactionEvent = { TransactionEventType::FAT_BLOCK_CHANGED, { blockIndex }, 0 /*Ignore the CRC for now*/ };
+#if (SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO == 1)
+		// Log only the page containing the cell, the first time it is changed.
+		const uint32_t cellsPerPage = kFATPageSize / sizeof(FATCellValueType);
+		const ClusterIndexType blockStartCellIndex = static_cast<ClusterIndexType>(blockIndex) * mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		const uint32_t pageCellOffset = ((cellIndex - blockStartCellIndex) / cellsPerPage) * cellsPerPage;
+		const ClusterIndexType pageStartCellIndex = blockStartCellIndex + pageCellOffset;
+		SFAT_ASSERT(pageCellOffset < buffer.size(), "The cell should be in the FAT block!");
+		TransactionEvent transactionEvent = { TransactionEventType::FAT_PAGE_CHANGED, { pageStartCellIndex }, 0 /*Calculated on writing*/ };
+
+		SFATLockGuard logLockGuard(mLogMutex);
+		// Try inserting the element
+		// In redo mode the page is only registered. Its new content is logged on commit.
+		auto result = mFATPageChanges.insert(std::pair<ClusterIndexType, TransactionEvent>(pageStartCellIndex, transactionEvent));
+		if (result.second && (mLogMode == TransactionLogMode::TLM_UNDO)) {
+			// The element was just inserted.
+			err = _writeIntoTransactionFile(transactionEvent, buffer.data() + pageCellOffset);
+			++mCountFATPagesSinceCheckpoint;
+		}
+#else
+		TransactionEvent transactionEvent = { TransactionEventType::FAT_BLOCK_CHANGED, { blockIndex }, 0 /*Calculated on writing*/ };
 
+		SFATLockGuard logLockGuard(mLogMutex);
 		// Try inserting the element
 		auto result = mFATBlockChanges.insert(std::pair<uint32_t, TransactionEvent>(blockIndex, transactionEvent));
-		if (result.second) {
+		if (result.second && (mLogMode == TransactionLogMode::TLM_UNDO)) {
 			// The element was just inserted.
-			//TODO: Calculate and update the CRC.
 			err = _writeIntoTransactionFile(transactionEvent, buffer.data());
+			mCountFATPagesSinceCheckpoint += static_cast<uint32_t>(mVolumeManager.getVolumeDescriptor().getByteSizeOfFATBlock() / kFATPageSize);
 		}
+#endif
 
 		return err;
 	}
@@ -38,31 +177,39 @@ namespace SFAT {
 		(void)oldRecord; // Not used parameter
 		(void)newRecord; // Not used parameter
 
-		ErrorCode err = ErrorCode::RESULT_OK;
-		TransactionEvent transactionEvent = { TransactionEventType::DIRECTORY_CLUSTER_CHANGED, { descriptorClusterIndex }, 0 /*Ignore the CRC for now*/ };
+		TransactionEvent transactionEvent = { TransactionEventType::DIRECTORY_CLUSTER_CHANGED, { descriptorClusterIndex }, 0 /*Calculated on writing*/ };
 
-		// Try inserting the element
-		auto result = mDirectoryClusterChanges.insert(std::pair<ClusterIndexType, TransactionEvent>(descriptorClusterIndex, transactionEvent));
-		if (result.second) {
-			// The element was just inserted.
-			// Copy the corresponding cluster before it is changed.
-			err = mVolumeManager.readCluster(mClusterDataBuffer, descriptorClusterIndex);
-			if (err != ErrorCode::RESULT_OK) {
-				return err;
+		{
+			SFATLockGuard logLockGuard(mLogMutex);
+			// Try inserting the element
+			auto result = mDirectoryClusterChanges.insert(std::pair<ClusterIndexType, TransactionEvent>(descriptorClusterIndex, transactionEvent));
+			// In redo mode all dirty directory clusters are logged on commit, so there is no need to read them.
+			if (!result.second || (mLogMode != TransactionLogMode::TLM_UNDO)) {
+				return ErrorCode::RESULT_OK;
 			}
-			err = _writeIntoTransactionFile(transactionEvent, mClusterDataBuffer.data());
 		}
 
-		return err;
+		// The element was just inserted.
+		// Copy the corresponding cluster before it is changed.
+		// Read without the log locked, as a thread writing a cluster could be waiting for the log while the cluster data is locked.
+		// The descriptor cluster is locked by the caller, so it can't be changed meanwhile.
+		std::vector<uint8_t> clusterData;
+		ErrorCode err = mVolumeManager.readCluster(clusterData, descriptorClusterIndex);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		SFATLockGuard logLockGuard(mLogMutex);
+		return _writeIntoTransactionFile(transactionEvent, clusterData.data());
 	}
 
 	ErrorCode TransactionEventsLog::logBlockVirtualizationChange() {
-		const uint32_t crc = mVolumeManager.getBlockVirtualization().getActiveDescriptorCRC();
 		const uint32_t activeDescriptorIndex = mVolumeManager.getBlockVirtualization().getActiveDescriptorIndex();
-		TransactionEvent transactionEvent = { TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED, { activeDescriptorIndex }, crc };
+		TransactionEvent transactionEvent = { TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED, { activeDescriptorIndex }, 0 /*Calculated on writing*/ };
 
 		const VolumeDescriptorExtraParameters& extraParameters = mVolumeManager.getVolumeDescriptorExtraParameters();
 
+		SFATLockGuard logLockGuard(mLogMutex);
 		return _writeIntoTransactionFile(transactionEvent, &extraParameters);
 	}
 
@@ -70,6 +217,7 @@ namespace SFAT {
 		ErrorCode err = ErrorCode::RESULT_OK;
 		TransactionEvent transactionEvent = { TransactionEventType::FILE_CLUSTER_CHANGED, { clusterIndex }, 0 /*Ignore the CRC for now*/ };
 
+		SFATLockGuard logLockGuard(mLogMutex);
 		// Try inserting the element
 		auto result = mFileClusterChanges.insert(std::pair<uint32_t, TransactionEvent>(clusterIndex, transactionEvent));
 		if (result.second) {
@@ -80,32 +228,106 @@ namespace SFAT {
 		return err;
 	}
 
+	void TransactionEventsLog::deferClusterFree(ClusterIndexType clusterIndex) {
+		SFAT_ASSERT(mIsInTransaction, "Should be called only in transaction!");
+		SFATLockGuard logLockGuard(mLogMutex);
+		mPendingFreeClusters.push_back(clusterIndex);
+	}
+
+	bool TransactionEventsLog::isClusterFreePending(ClusterIndexType clusterIndex) {
+		SFATLockGuard logLockGuard(mLogMutex);
+		return std::find(mPendingFreeClusters.begin(), mPendingFreeClusters.end(), clusterIndex) != mPendingFreeClusters.end();
+	}
+
+#if !defined(MCPE_PUBLISH)
+	void TransactionEventsLog::discardPendingClusterFrees() {
+		SFATLockGuard logLockGuard(mLogMutex);
+		mPendingFreeClusters.clear();
+	}
+#endif //!defined(MCPE_PUBLISH)
+
 	ErrorCode TransactionEventsLog::start() {
-		mFATBlockChanges.clear();
-		mFileClusterChanges.clear();
-		mDirectoryClusterChanges.clear();
+		{
+			SFATLockGuard logLockGuard(mLogMutex);
+			mFATBlockChanges.clear();
+			mFATPageChanges.clear();
+			mFileClusterChanges.clear();
+			mDirectoryClusterChanges.clear();
+			mPendingFreeClusters.clear();
+			mLogBuffer.clear();
+			mLogFilePosition = 0;
+			mLogStats = TransactionLogStats();
+		}
 
+		// Waits for the background checkpoint of the previous transaction and makes the pending checkpoint as well, so everything is in sync with the storage at the start.
 		ErrorCode err = mVolumeManager.flush();
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
+		mLogMode = mVolumeManager.getLowLevelFileAccess().getTransactionLogMode();
+		mCheckpointThresholds = mVolumeManager.getLowLevelFileAccess().getTransactionCheckpointThresholds();
+		// In redo mode nothing can be written in place before the commit.
+		mAreAutomaticCheckpointsEnabled = (SPLIT_FAT__ENABLE_AUTOMATIC_CHECKPOINTS == 1) && (mLogMode == TransactionLogMode::TLM_UNDO);
+		mIsCheckpointRequested = false;
+		mCountFATPagesSinceCheckpoint = 0;
+		mLastCheckpointTime = std::chrono::steady_clock::now();
 		err = mVolumeManager.getLowLevelFileAccess().createTempTransactionFile();
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 		mIsInTransaction = true;
 
-		return ErrorCode::RESULT_OK;
+		SFATLockGuard logLockGuard(mLogMutex);
+		err = _writeFileHeader();
+		if ((err == ErrorCode::RESULT_OK) && (mLogMode == TransactionLogMode::TLM_REDO)) {
+			TransactionEvent transactionEvent = { TransactionEventType::REDO_LOG_STARTED, { 0 }, 0 /*Calculated on writing*/ };
+			err = _writeIntoTransactionFile(transactionEvent, nullptr);
+		}
+
+		return err;
 	}
 
 	ErrorCode TransactionEventsLog::_finalizeTransacion() {
 		SFAT_ASSERT(mIsInTransaction, "Should be called only in transaction!");
+		mAreAutomaticCheckpointsEnabled = false;
+
+		// The FAT blocks changed by the freeing are still logged, so it has to be done before the transaction file is closed.
+		ErrorCode err = _freePendingClusters();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to free the clusters released during the transaction!");
+			return err;
+		}
+
+		if (mLogMode == TransactionLogMode::TLM_REDO) {
+			err = _logRedoImages();
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to log the changes of the transaction!");
+				return err;
+			}
+		}
 
-		ErrorCode err = logBlockVirtualizationChange();
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
-		}
+		err = logBlockVirtualizationChange();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		if (mLogMode == TransactionLogMode::TLM_REDO) {
+			TransactionEvent transactionEvent = { TransactionEventType::TRANSACTION_COMMITTED, { 0 }, 0 /*Calculated on writing*/ };
+			{
+				SFATLockGuard logLockGuard(mLogMutex);
+				err = _writeIntoTransactionFile(transactionEvent, nullptr);
+			}
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+		}
+
+		// Flush barrier "log durable" - nothing of the transaction is written in place before it.
+		err = makeLogDurable();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
 
 		// Close the transaction file.
 		err = mVolumeManager.getLowLevelFileAccess().finalizeTransactionFile();
@@ -115,6 +337,13 @@ namespace SFAT {
 			return err;
 		}
 
+		if (mLogMode == TransactionLogMode::TLM_REDO) {
+			// The transaction is committed. The changes stay in the caches until the checkpoint.
+			mIsCheckpointPending = true;
+			mIsInTransaction = false;
+			return ErrorCode::RESULT_OK;
+		}
+
 		//
 		// At this point we have the transaction file finalized, so we can revert in case something fails.
 
@@ -130,7 +359,61 @@ namespace SFAT {
 			return ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED;
 		}
 
+		return _commit();
+	}
+
+	ErrorCode TransactionEventsLog::commitAsync(std::shared_future<ErrorCode>& completion) {
+		if (!mIsInTransaction) {
+			return ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED;
+		}
+
+		// In undo mode the transaction file can only revert the transaction, so the changes are written in place synchronously.
+		ErrorCode err = _commit();
+		if ((err != ErrorCode::RESULT_OK) || !mIsCheckpointPending) {
+			std::promise<ErrorCode> checkpointResult;
+			checkpointResult.set_value(err);
+			completion = checkpointResult.get_future().share();
+			return err;
+		}
+
+		SFATLockGuard lock(mCheckpointResultMutex);
+		SFAT_ASSERT(!mCheckpointResult.valid(), "The previous checkpoint should be completed at the start of the transaction!");
+		mVolumeManager.getIOScheduler().submit(IOPriority::IOP_BACKGROUND, [this]() { return _backgroundCheckpoint(); }, mCheckpointResult);
+		completion = mCheckpointResult;
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode TransactionEventsLog::_backgroundCheckpoint() {
+		ErrorCode err = checkpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			// The checkpoint stays pending and will be retried on the next flush.
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The background checkpoint failed!");
+		}
+		return err;
+	}
+
+	ErrorCode TransactionEventsLog::waitForCheckpoint() {
+		// Called from any of the writing threads. The first one waits and clears the result, the rest wait for it on the lock.
+		SFATLockGuard lock(mCheckpointResultMutex);
+		if (!mCheckpointResult.valid()) {
+			return ErrorCode::RESULT_OK;
+		}
+		ErrorCode err = mVolumeManager.getIOScheduler().wait(mCheckpointResult);
+		mCheckpointResult = std::shared_future<ErrorCode>();
+		return err;
+	}
+
+	ErrorCode TransactionEventsLog::_commit() {
 		ErrorCode err = _finalizeTransacion();
+		if (mLogMode == TransactionLogMode::TLM_REDO) {
+			// The redo log is deleted on checkpoint.
+			// If the commit failed, there is no complete redo log, and the changes of the transaction are only in the caches.
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to commit the transaction! The volume has to be reopened!");
+			}
+			return err;
+		}
 
 		// If there was an error during the transaction closing, restore from the transaction file.
 		if (err != ErrorCode::RESULT_OK) {
@@ -153,10 +436,287 @@ namespace SFAT {
 		return err;
 	}
 
+	ErrorCode TransactionEventsLog::_freePendingClusters() {
+		std::vector<ClusterIndexType> clustersToFree;
+		{
+			SFATLockGuard logLockGuard(mLogMutex);
+			clustersToFree.swap(mPendingFreeClusters);
+		}
+		if (clustersToFree.empty()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		// Not under the log lock, as the changed FAT cells are logged.
+		return mVolumeManager.getFATDataManager().freeClusters(clustersToFree);
+	}
+
 	bool TransactionEventsLog::isInTransaction() const {
 		return mIsInTransaction;
 	}
 
+	TransactionLogMode TransactionEventsLog::getLogMode() const {
+		return mLogMode;
+	}
+
+	ErrorCode TransactionEventsLog::checkpoint() {
+		if (!mIsCheckpointPending) {
+			return ErrorCode::RESULT_OK;
+		}
+		SFAT_ASSERT(!mIsInTransaction, "The checkpoint should not be made in transaction!");
+
+		// The redo log is needed until all changes are written in place.
+		ErrorCode err = mVolumeManager.immediateFlush();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to write the committed changes in place!");
+			return err;
+		}
+
+		err = mVolumeManager.getLowLevelFileAccess().cleanupTransactionFinalFile();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to clean up the transaction file!");
+			return err;
+		}
+		mIsCheckpointPending = false;
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	bool TransactionEventsLog::isCheckpointPending() const {
+		return mIsCheckpointPending;
+	}
+
+	void TransactionEventsLog::requestCheckpointIfNeeded() {
+		if (!mIsInTransaction || !mAreAutomaticCheckpointsEnabled || mIsCheckpointRequested) {
+			return;
+		}
+
+		bool isThresholdExceeded = false;
+		if ((mCheckpointThresholds.mMaxDirtyBytes > 0) && (mVolumeManager.getDataBlockManager().getDirtyBytes() >= mCheckpointThresholds.mMaxDirtyBytes)) {
+			isThresholdExceeded = true;
+		}
+		else if ((mCheckpointThresholds.mMaxLoggedFATPages > 0) && (mCountFATPagesSinceCheckpoint >= mCheckpointThresholds.mMaxLoggedFATPages)) {
+			isThresholdExceeded = true;
+		}
+		else if (mCheckpointThresholds.mMaxDurationMs > 0) {
+			auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - mLastCheckpointTime);
+			isThresholdExceeded = (duration.count() >= mCheckpointThresholds.mMaxDurationMs);
+		}
+
+		if (isThresholdExceeded) {
+			mIsCheckpointRequested = true;
+		}
+	}
+
+	bool TransactionEventsLog::isCheckpointRequested() const {
+		return mIsCheckpointRequested;
+	}
+
+	ErrorCode TransactionEventsLog::checkpointIfNeeded() {
+		if (!mIsCheckpointRequested) {
+			return ErrorCode::RESULT_OK;
+		}
+		mIsCheckpointRequested = false;
+		if (!mIsInTransaction || !mAreAutomaticCheckpointsEnabled) {
+			return ErrorCode::RESULT_OK;
+		}
+		return _makeAutomaticCheckpoint();
+	}
+
+	ErrorCode TransactionEventsLog::_makeAutomaticCheckpoint() {
+		SplitFATConfigurationBase& lowLevelFileAccess = mVolumeManager.getLowLevelFileAccess();
+
+		// The original data has to be in the final transaction file, before anything is overwritten.
+		// On a crash from now on, the whole transaction is reverted on the next start.
+		ErrorCode err = makeLogDurable();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if (mLogStats.mCountCheckpoints == 0) {
+			err = lowLevelFileAccess.finalizeTransactionFile();
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to finalize the transaction file!");
+				return err;
+			}
+			// The next segment of the log is appended to the final file.
+			err = lowLevelFileAccess.reopenFinalTransactionFileForAppend();
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to reopen the transaction file!");
+				return err;
+			}
+		}
+
+		err = mVolumeManager.immediateFlush();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to write the changes of the transaction in place!");
+			return err;
+		}
+
+		++mLogStats.mCountCheckpoints;
+		mCountFATPagesSinceCheckpoint = 0;
+		mLastCheckpointTime = std::chrono::steady_clock::now();
+		SFAT_LOGI(LogArea::LA_TRANSACTION, "Automatic checkpoint #%u of the transaction.", mLogStats.mCountCheckpoints);
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode TransactionEventsLog::_logRedoImages() {
+		const uint32_t clustersPerBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		ErrorCode err = ErrorCode::RESULT_OK;
+		// Committed with the volume locked exclusively, so nothing is logged while the changes are iterated.
+		// The log is locked only for every write, as the FAT cells are locked before it.
+#if (SPLIT_FAT__ENABLE_PAGE_GRANULAR_FAT_UNDO == 1)
+		for (auto& elem : mFATPageChanges) {
+			const TransactionEvent& transactionEvent = elem.second;
+			const uint32_t blockIndex = mVolumeManager.getBlockIndex(transactionEvent.mClusterIndex);
+			const size_t pageCellOffset = static_cast<size_t>(transactionEvent.mClusterIndex % clustersPerBlock);
+			err = mVolumeManager.executeOnFATBlock(blockIndex, [this, &transactionEvent, pageCellOffset](uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)->ErrorCode {
+				(void)blockIndex; // Not used parameter
+
+				wasChanged = false;
+				SFATLockGuard logLockGuard(mLogMutex);
+				return _writeIntoTransactionFile(transactionEvent, table.data() + pageCellOffset);
+			});
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+		}
+#else
+		(void)clustersPerBlock; // Not used
+		for (auto& elem : mFATBlockChanges) {
+			const TransactionEvent& transactionEvent = elem.second;
+			err = mVolumeManager.executeOnFATBlock(transactionEvent.mBlockIndex, [this, &transactionEvent](uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)->ErrorCode {
+				(void)blockIndex; // Not used parameter
+
+				wasChanged = false;
+				SFATLockGuard logLockGuard(mLogMutex);
+				return _writeIntoTransactionFile(transactionEvent, table.data());
+			});
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+		}
+#endif
+
+		// Everything was in sync at the start of the transaction, so all dirty directory clusters are changed by it.
+		return mVolumeManager.getDataBlockManager().executeOnDirtyClusters([this](ClusterIndexType clusterIndex, const uint8_t* buffer)->ErrorCode {
+			TransactionEvent transactionEvent = { TransactionEventType::DIRECTORY_CLUSTER_CHANGED, { clusterIndex }, 0 /*Calculated on writing*/ };
+			SFATLockGuard logLockGuard(mLogMutex);
+			return _writeIntoTransactionFile(transactionEvent, buffer);
+		});
+	}
+
+	ErrorCode TransactionEventsLog::flushLog() {
+		SFATLockGuard logLockGuard(mLogMutex);
+		return _flushLog();
+	}
+
+	ErrorCode TransactionEventsLog::_flushLog() {
+		if (mLogBuffer.empty()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		FileHandle fileHandle;
+		mVolumeManager.getLowLevelFileAccess().getTempTransactionFile(fileHandle);
+		if (!fileHandle.isOpen()) {
+			return ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED;
+		}
+
+		// All buffered events are written with a single sequential write.
+		size_t bytesWritten = 0;
+		ErrorCode err = fileHandle.writeAtPosition(mLogBuffer.data(), mLogBuffer.size(), mLogFilePosition, bytesWritten);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if (bytesWritten != mLogBuffer.size()) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the data written into the transaction file is incorrect!");
+			return ErrorCode::ERROR_WRITING;
+		}
+
+		mLogFilePosition += bytesWritten;
+		++mLogStats.mCountWrites;
+		mLogStats.mCountBytes += bytesWritten;
+		mLogBuffer.clear();
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode TransactionEventsLog::makeLogDurable() {
+		SFATLockGuard logLockGuard(mLogMutex);
+		return _makeLogDurable();
+	}
+
+	ErrorCode TransactionEventsLog::_makeLogDurable() {
+		ErrorCode err = _flushLog();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "Wasn't able to write the buffered events into the transaction file!");
+			return err;
+		}
+
+		FileHandle fileHandle;
+		mVolumeManager.getLowLevelFileAccess().getTempTransactionFile(fileHandle);
+		FlushStats& flushStats = mVolumeManager.getFlushStats();
+		if (!fileHandle.hasUnsyncedWrites()) {
+			// Already synced by a previous barrier.
+			++flushStats.mCountSkippedSyncs;
+			return ErrorCode::RESULT_OK;
+		}
+
+		err = fileHandle.flush();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The transaction file wasn't flushed correctly!");
+			return err;
+		}
+		++flushStats.mCountLogSyncs;
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	const TransactionLogStats& TransactionEventsLog::getLogStats() const {
+		return mLogStats;
+	}
+
+	size_t TransactionEventsLog::_getFATPageByteSize(ClusterIndexType pageStartCellIndex) const {
+		const uint32_t clustersPerBlock = mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		const size_t pageCellOffset = static_cast<size_t>(pageStartCellIndex % clustersPerBlock);
+		const size_t bytesToBlockEnd = (static_cast<size_t>(clustersPerBlock) - pageCellOffset) * sizeof(FATCellValueType);
+		return std::min(static_cast<size_t>(kFATPageSize), bytesToBlockEnd);
+	}
+
+	ErrorCode TransactionEventsLog::_writeFileHeader() {
+		TransactionFileHeader header;
+		header.mSignature = TransactionFileHeader::SIGNATURE;
+		header.mVersion = TransactionFileHeader::CURRENT_VERSION;
+		header.mEventSize = static_cast<uint32_t>(sizeof(TransactionEvent));
+		header.mReserved = 0;
+
+#if (SPLIT_FAT__ENABLE_BUFFERED_TRANSACTION_LOG == 1)
+		// Written together with the first batch of events.
+		const uint8_t* headerData = reinterpret_cast<const uint8_t*>(&header);
+		mLogBuffer.insert(mLogBuffer.end(), headerData, headerData + sizeof(TransactionFileHeader));
+		return ErrorCode::RESULT_OK;
+#else
+		FileHandle fileHandle;
+		mVolumeManager.getLowLevelFileAccess().getTempTransactionFile(fileHandle);
+		if (!fileHandle.isOpen()) {
+			return ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED;
+		}
+
+		size_t bytesWritten = 0;
+		ErrorCode err = fileHandle.writeAtPosition(&header, sizeof(TransactionFileHeader), 0, bytesWritten);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if (bytesWritten != sizeof(TransactionFileHeader)) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the data written into the transaction file is incorrect!");
+			return ErrorCode::ERROR_WRITING;
+		}
+		++mLogStats.mCountWrites;
+		mLogStats.mCountBytes += bytesWritten;
+
+		return ErrorCode::RESULT_OK;
+#endif
+	}
+
 	ErrorCode TransactionEventsLog::_writeIntoTransactionFile(const TransactionEvent& transactionEvent, const void* pBuffer) {
 		FileHandle fileHandle;
 		mVolumeManager.getLowLevelFileAccess().getTempTransactionFile(fileHandle);
@@ -165,30 +725,45 @@ namespace SFAT {
 		}
 
 		size_t countBytesToWrite = 0;
-		switch (transactionEvent.mEventType) {
-			case TransactionEventType::FAT_BLOCK_CHANGED: {
-				countBytesToWrite = static_cast<size_t>(mVolumeManager.getVolumeDescriptor().getByteSizeOfFATBlock());
-			} break;
-			case TransactionEventType::DIRECTORY_CLUSTER_CHANGED: {
-				countBytesToWrite = static_cast<size_t>(mVolumeManager.getClusterSize());
-			} break;
-			case TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED: {
-				countBytesToWrite = sizeof(VolumeDescriptorExtraParameters);
-			} break;
-			default: {
-				return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
-			}
+		ErrorCode err = _getPayloadByteSize(transactionEvent, countBytesToWrite);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		// The CRC is always of the original data, so the restored data can be verified after the decompression.
+		TransactionEvent event = transactionEvent;
+		event.mCRC = CRC32::calculate(pBuffer, countBytesToWrite);
+		event.mCodec = _compressPayload(event.mEventType, pBuffer, countBytesToWrite);
+		const void* pPayload = pBuffer;
+		event.mPayloadSize = static_cast<uint32_t>(countBytesToWrite);
+		if (event.mCodec != TransactionPayloadCodec::TPC_RAW) {
+			pPayload = mCompressionBuffer.data();
+			event.mPayloadSize = static_cast<uint32_t>(mCompressionBuffer.size());
 		}
+		mLogStats.mCountPayloadBytes += countBytesToWrite;
 
+#if (SPLIT_FAT__ENABLE_BUFFERED_TRANSACTION_LOG == 1)
+		// Only append to the buffer. The events are written before the data they log can be overwritten on the storage.
+		const uint8_t* eventData = reinterpret_cast<const uint8_t*>(&event);
+		mLogBuffer.insert(mLogBuffer.end(), eventData, eventData + sizeof(TransactionEvent));
+		const uint8_t* payloadData = static_cast<const uint8_t*>(pPayload);
+		mLogBuffer.insert(mLogBuffer.end(), payloadData, payloadData + event.mPayloadSize);
+		++mLogStats.mCountEvents;
+
+		if (mLogBuffer.size() >= kLogBufferFlushThreshold) {
+			return _flushLog();
+		}
+		return ErrorCode::RESULT_OK;
+#else
 		FilePositionType position;
-		ErrorCode err = fileHandle.getPosition(position);
+		err = fileHandle.getPosition(position);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
 		// Write the event descriptor data
 		size_t bytesWritten = 0;
-		err = fileHandle.writeAtPosition(&transactionEvent, sizeof(TransactionEvent), position, bytesWritten);
+		err = fileHandle.writeAtPosition(&event, sizeof(TransactionEvent), position, bytesWritten);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
@@ -196,9 +771,212 @@ namespace SFAT {
 		position += sizeof(TransactionEvent);
 
 		// Write the data from the buffer
-		err = fileHandle.writeAtPosition(pBuffer, countBytesToWrite, position, bytesWritten);
-		SFAT_ASSERT(countBytesToWrite == bytesWritten, "The size of the written should match!");
+		err = fileHandle.writeAtPosition(pPayload, event.mPayloadSize, position, bytesWritten);
+		SFAT_ASSERT(event.mPayloadSize == bytesWritten, "The size of the written should match!");
+		++mLogStats.mCountEvents;
+		mLogStats.mCountWrites += 2;
+		mLogStats.mCountBytes += sizeof(TransactionEvent) + bytesWritten;
+
+		return err;
+#endif
+	}
+
+	TransactionPayloadCodec TransactionEventsLog::_compressPayload(TransactionEventType eventType, const void* pBuffer, size_t countBytes) {
+#if (SPLIT_FAT__ENABLE_TRANSACTION_LOG_COMPRESSION == 1)
+		switch (eventType) {
+			case TransactionEventType::FAT_BLOCK_CHANGED:
+			case TransactionEventType::FAT_PAGE_CHANGED: {
+				// The free cells are zeros.
+				if (ZeroRunCodec::compress(pBuffer, countBytes, mCompressionBuffer)) {
+					return TransactionPayloadCodec::TPC_ZERO_RUN;
+				}
+			} break;
+			case TransactionEventType::DIRECTORY_CLUSTER_CHANGED: {
+				if (LZCodec::compress(pBuffer, countBytes, mCompressionBuffer)) {
+					return TransactionPayloadCodec::TPC_LZ;
+				}
+			} break;
+			default: {
+			} break;
+		}
+#else
+		(void)eventType; // Not used parameter
+		(void)pBuffer; // Not used parameter
+		(void)countBytes; // Not used parameter
+#endif
+		// Stored as it is, if the compression doesn't make it smaller.
+		return TransactionPayloadCodec::TPC_RAW;
+	}
+
+	ErrorCode TransactionEventsLog::_getPayloadByteSize(const TransactionEvent& transactionEvent, size_t& countBytes) const {
+		switch (transactionEvent.mEventType) {
+			case TransactionEventType::FAT_BLOCK_CHANGED: {
+				countBytes = static_cast<size_t>(mVolumeManager.getVolumeDescriptor().getByteSizeOfFATBlock());
+			} break;
+			case TransactionEventType::DIRECTORY_CLUSTER_CHANGED: {
+				countBytes = static_cast<size_t>(mVolumeManager.getClusterSize());
+			} break;
+			case TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED: {
+				countBytes = sizeof(VolumeDescriptorExtraParameters);
+			} break;
+			case TransactionEventType::FAT_PAGE_CHANGED: {
+				countBytes = _getFATPageByteSize(transactionEvent.mClusterIndex);
+			} break;
+			case TransactionEventType::REDO_LOG_STARTED:
+			case TransactionEventType::TRANSACTION_COMMITTED: {
+				countBytes = 0;
+			} break;
+			default: {
+				countBytes = 0;
+				return ErrorCode::ERROR_FEATURE_NOT_SUPPORTED;
+			}
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
+	size_t TransactionEventsLog::_getMaxPayloadSize() const {
+		// The compressed payloads are always smaller than the original data.
+		size_t maxPayloadSize = std::max(static_cast<size_t>(mVolumeManager.getVolumeDescriptor().getByteSizeOfFATBlock()), static_cast<size_t>(mVolumeManager.getClusterSize()));
+		return std::max(maxPayloadSize, sizeof(VolumeDescriptorExtraParameters));
+	}
+
+	ErrorCode TransactionEventsLog::_decodePayload(const TransactionEvent& transactionEvent, const uint8_t* pPayload, void* pBuffer, size_t countBytes) {
+		bool isDecompressed = true;
+		switch (transactionEvent.mCodec) {
+			case TransactionPayloadCodec::TPC_RAW: {
+				if (transactionEvent.mPayloadSize != countBytes) {
+					SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the payload in the transaction file is incorrect!");
+					return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+				}
+				if (countBytes > 0) {
+					memcpy(pBuffer, pPayload, countBytes);
+				}
+			} break;
+			case TransactionPayloadCodec::TPC_ZERO_RUN: {
+				isDecompressed = ZeroRunCodec::decompress(pPayload, transactionEvent.mPayloadSize, pBuffer, countBytes);
+			} break;
+			case TransactionPayloadCodec::TPC_LZ: {
+				isDecompressed = LZCodec::decompress(pPayload, transactionEvent.mPayloadSize, pBuffer, countBytes);
+			} break;
+			default: {
+				isDecompressed = false;
+			} break;
+		}
+		if (!isDecompressed) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The payload in the transaction file can't be decompressed!");
+			return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+		}
 
+		if (CRC32::calculate(pBuffer, countBytes) != transactionEvent.mCRC) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "CRC mismatch of the payload in the transaction file!");
+			return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+		}
+
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode TransactionEventsLog::_decodeEvents(const std::vector<TransactionEventView>& events, std::vector<std::vector<uint8_t>>& decodedPayloads, size_t& failedEventIndex) {
+		const size_t countEvents = events.size();
+		failedEventIndex = countEvents;
+		if (decodedPayloads.size() < countEvents) {
+			decodedPayloads.resize(countEvents);
+		}
+		for (size_t i = 0; i < countEvents; ++i) {
+			size_t countBytes = 0;
+			_getPayloadByteSize(events[i].mEvent, countBytes);
+			decodedPayloads[i].resize(countBytes);
+		}
+
+		uint32_t countChunks = 1;
+#if (SPLIT_FAT__ENABLE_PARALLEL_TRANSACTION_RESTORE == 1)
+		if (countEvents >= kMinEventsForParallelRestore) {
+			countChunks = std::max(1U, std::min(mVolumeManager.getIOScheduler().getCountThreads(), kMaxRestoreChunksCount));
+		}
+#endif
+		// Every chunk is a continuous range of events.
+		const size_t chunkSize = (countEvents + countChunks - 1) / countChunks;
+		std::vector<size_t> failedEventIndices(countChunks, countEvents);
+		auto decodeChunk = [&events, &decodedPayloads, &failedEventIndices, countEvents, chunkSize](uint32_t chunkIndex)->ErrorCode {
+			const size_t endIndex = std::min(countEvents, (chunkIndex + 1) * chunkSize);
+			for (size_t i = chunkIndex * chunkSize; i < endIndex; ++i) {
+				std::vector<uint8_t>& data = decodedPayloads[i];
+				if (data.empty()) {
+					// No payload, or not supported event
+					continue;
+				}
+				ErrorCode err = _decodePayload(events[i].mEvent, events[i].mPayload, data.data(), data.size());
+				if (err != ErrorCode::RESULT_OK) {
+					failedEventIndices[chunkIndex] = i;
+					return err;
+				}
+			}
+			return ErrorCode::RESULT_OK;
+		};
+
+		// The first chunk is decoded on the calling thread, while the rest are executed by the IOScheduler.
+		std::vector<std::shared_future<ErrorCode>> completions(countChunks);
+		for (uint32_t chunkIndex = 1; chunkIndex < countChunks; ++chunkIndex) {
+			mVolumeManager.getIOScheduler().submit(IOPriority::IOP_FOREGROUND_READ, [&decodeChunk, chunkIndex]() {
+				return decodeChunk(chunkIndex);
+			}, completions[chunkIndex]);
+		}
+		ErrorCode result = decodeChunk(0);
+		failedEventIndex = failedEventIndices[0];
+		for (uint32_t chunkIndex = 1; chunkIndex < countChunks; ++chunkIndex) {
+			ErrorCode err = mVolumeManager.getIOScheduler().wait(completions[chunkIndex]);
+			if (result == ErrorCode::RESULT_OK) {
+				result = err;
+				failedEventIndex = failedEventIndices[chunkIndex];
+			}
+		}
+
+		return result;
+	}
+
+	ErrorCode TransactionEventsLog::_restoreEvent(const TransactionEvent& transactionEvent, std::vector<uint8_t>& data) {
+		ErrorCode err = ErrorCode::RESULT_OK;
+		switch (transactionEvent.mEventType) {
+			case TransactionEventType::FAT_BLOCK_CHANGED: {
+				err = mVolumeManager.executeOnFATBlock(transactionEvent.mBlockIndex, [&data](uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)->ErrorCode {
+					(void)blockIndex; // Not used parameter
+
+					SFAT_ASSERT(table.size() * sizeof(FATCellValueType) == data.size(), "The size of the restored FAT block should match!");
+					wasChanged = true;
+					memcpy(table.data(), data.data(), data.size());
+					return ErrorCode::RESULT_OK;
+				});
+			} break;
+			case TransactionEventType::DIRECTORY_CLUSTER_CHANGED: {
+				err = mVolumeManager.writeCluster(data, transactionEvent.mClusterIndex);
+			} break;
+			case TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED: {
+				VolumeDescriptorExtraParameters extraParameters;
+				memcpy(&extraParameters, data.data(), sizeof(VolumeDescriptorExtraParameters));
+				err = mVolumeManager.getBlockVirtualization().setBlockVirtualizationData(extraParameters);
+			} break;
+			case TransactionEventType::FAT_PAGE_CHANGED: {
+				const uint32_t blockIndex = mVolumeManager.getBlockIndex(transactionEvent.mClusterIndex);
+				const size_t pageCellOffset = static_cast<size_t>(transactionEvent.mClusterIndex % mVolumeManager.getVolumeDescriptor().getClustersPerFATBlock());
+				err = mVolumeManager.executeOnFATBlock(blockIndex, [&data, pageCellOffset](uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)->ErrorCode {
+					(void)blockIndex; // Not used parameter
+
+					// Only the page is restored. The rest of the block was not changed in the transaction.
+					wasChanged = true;
+					memcpy(table.data() + pageCellOffset, data.data(), data.size());
+					return ErrorCode::RESULT_OK;
+				});
+			} break;
+			case TransactionEventType::REDO_LOG_STARTED:
+			case TransactionEventType::TRANSACTION_COMMITTED: {
+				// No payload
+			} break;
+			case TransactionEventType::FILE_CLUSTER_CHANGED: {
+				SFAT_LOGW(LogArea::LA_TRANSACTION, "File cluster changes are not processed.");
+			} break;
+			default: {
+				SFAT_LOGW(LogArea::LA_TRANSACTION, "Unknown event in the transaction file will be ignored.");
+			} break;
+		}
 		return err;
 	}
 
@@ -210,103 +988,128 @@ namespace SFAT {
 			return ErrorCode::ERROR_NO_TRANSACTION_FILE_FOUND;
 		}
 
-		TransactionEvent transactionEvent;
+		TransactionFileHeader header;
+		size_t bytesRead = 0;
+		ErrorCode err = fileHandle.readAtPosition(&header, sizeof(TransactionFileHeader), 0, bytesRead);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if (bytesRead < sizeof(TransactionFileHeader)) {
+			// The file was created, but nothing was logged into it.
+			SFAT_LOGW(LogArea::LA_TRANSACTION, "The transaction file has no events and will be ignored.");
+			return fileHandle.close();
+		}
+		err = _verifyFileHeader(header);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
 
-		FilePositionType position = 0;
-		ErrorCode err = ErrorCode::RESULT_OK;
+		// The redo log starts with REDO_LOG_STARTED event, and has to be scanned for its commit first.
+		TransactionEvent firstEvent;
+		err = fileHandle.readAtPosition(&firstEvent, sizeof(TransactionEvent), sizeof(TransactionFileHeader), bytesRead);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if ((bytesRead == sizeof(TransactionEvent)) && (firstEvent.mEventType == TransactionEventType::REDO_LOG_STARTED)) {
+			bool isCommitted = false;
+			err = _scanTransactionFile(fileHandle, isCommitted);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			if (!isCommitted) {
+				// The transaction didn't reach its commit, and nothing was written in place.
+				SFAT_LOGW(LogArea::LA_TRANSACTION, "The redo log is not complete and will be ignored.");
+				return fileHandle.close();
+			}
+		}
+
+		if (mRestoreCallback) {
+			mRestoreCallback();
+		}
 
-		size_t bytesRead;
-		do {
-			// Read the transaction-event descriptor data
-			bytesRead = 0;
-			err = fileHandle.readAtPosition(&transactionEvent, sizeof(TransactionEvent), position, bytesRead);
+		// Every chunk of the file is decoded in parallel, then the events are applied in the order of the log.
+		TransactionFileReader fileReader(fileHandle, mRestoreReadChunkSize, _getMaxPayloadSize());
+		std::vector<TransactionEventView> events;
+		std::vector<std::vector<uint8_t>> decodedPayloads;
+		bool hasIncompleteEvent = false;
+		while (!hasIncompleteEvent) {
+			err = fileReader.readEvents(events);
 			if (err != ErrorCode::RESULT_OK) {
 				return err;
 			}
-			if (bytesRead != sizeof(TransactionEvent)) {
+			if (events.empty()) {
+				hasIncompleteEvent = fileReader.hasIncompleteEvent();
 				break;
 			}
-			position += sizeof(TransactionEvent);
-
-			// Read the specific data and restore
-			size_t countBytesToRead = 0;
-			switch (transactionEvent.mEventType) {
-				case TransactionEventType::FAT_BLOCK_CHANGED: {
-					countBytesToRead = static_cast<size_t>(mVolumeManager.getVolumeDescriptor().getByteSizeOfFATBlock());
-					uint32_t blockIndex = transactionEvent.mBlockIndex;
-					err = mVolumeManager.executeOnFATBlock(blockIndex, [&fileHandle, &position, &countBytesToRead](uint32_t blockIndex, FATBlockTableType& table, bool& wasChanged)->ErrorCode{
-						(void)blockIndex; // Not used parameter
-
-						wasChanged = true;
-						size_t bytesRead = 0;
-						ErrorCode err = fileHandle.readAtPosition(table.data(), countBytesToRead, position, bytesRead);
-						if (err != ErrorCode::RESULT_OK) {
-							return err;
-						}
-						if (countBytesToRead != bytesRead) {
-							SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the FAT block read from the transaction file is incorrect!");
-							return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
-						}
-						return ErrorCode::RESULT_OK;
-					});
 
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
+			size_t countEventsToRestore = events.size();
+			size_t failedEventIndex = 0;
+			err = _decodeEvents(events, decodedPayloads, failedEventIndex);
+			if (err != ErrorCode::RESULT_OK) {
+				// The payload of an event, which writing was interrupted, could be damaged. Only the last event in the file can be such.
+				bool isAtEnd = false;
+				if ((failedEventIndex + 1 != events.size()) || (fileReader.isAtEndOfFile(isAtEnd) != ErrorCode::RESULT_OK) || !isAtEnd) {
+					return err;
+				}
+				countEventsToRestore = failedEventIndex;
+				hasIncompleteEvent = true;
+			}
 
-					position += countBytesToRead;
-				} break;
-				case TransactionEventType::DIRECTORY_CLUSTER_CHANGED: {
-					countBytesToRead = static_cast<size_t>(mVolumeManager.getClusterSize());
-					// Read the cluster data from the transaction file
-					if (mClusterDataBuffer.size() < countBytesToRead) {
-						mClusterDataBuffer.resize(countBytesToRead);
-					}
-					err = fileHandle.readAtPosition(mClusterDataBuffer.data(), countBytesToRead, position, bytesRead);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
-					if (countBytesToRead != bytesRead) {
-						SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the cluster data read from the transaction file is incorrect!");
-						return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
-					}
+			for (size_t i = 0; i < countEventsToRestore; ++i) {
+				err = _restoreEvent(events[i].mEvent, decodedPayloads[i]);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+			}
+		}
+		if (hasIncompleteEvent) {
+			SFAT_LOGW(LogArea::LA_TRANSACTION, "The last event in the transaction file is incomplete and will be ignored.");
+		}
 
-					err = mVolumeManager.writeCluster(mClusterDataBuffer, transactionEvent.mClusterIndex);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
+		err = fileHandle.close();
+		SFAT_ASSERT(err == ErrorCode::RESULT_OK, "It will be impossible to delete the transaction file if it is not closed!");
 
-					position += countBytesToRead;
-				} break;
-				case TransactionEventType::BLOCK_VIRTUALIZATION_TABLE_CHANGED: {
-					countBytesToRead = sizeof(VolumeDescriptorExtraParameters);
-					VolumeDescriptorExtraParameters extraParameters;
-					err = fileHandle.readAtPosition(&extraParameters, countBytesToRead, position, bytesRead);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
-					if (countBytesToRead != bytesRead) {
-						SFAT_LOGE(LogArea::LA_TRANSACTION, "The size of the data read from the transaction file is incorrect!");
-						return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
-					}
+		return mVolumeManager.flush();
+	}
 
-					err = mVolumeManager.getBlockVirtualization().setBlockVirtualizationData(extraParameters);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
+	ErrorCode TransactionEventsLog::_scanTransactionFile(FileHandle& fileHandle, bool& isCommitted) {
+		isCommitted = false;
 
-					position += countBytesToRead;
-				} break;
-				case TransactionEventType::FILE_CLUSTER_CHANGED: {
-					SFAT_LOGW(LogArea::LA_TRANSACTION, "File cluster changes are not processed.");
+		TransactionFileReader fileReader(fileHandle, mRestoreReadChunkSize, _getMaxPayloadSize());
+		std::vector<TransactionEventView> events;
+		for (;;) {
+			ErrorCode err = fileReader.readEvents(events);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			if (events.empty()) {
+				break;
+			}
+			for (const auto& eventView : events) {
+				if (eventView.mEvent.mEventType == TransactionEventType::TRANSACTION_COMMITTED) {
+					isCommitted = true;
 				}
 			}
-		} while (bytesRead > 0);
+		}
 
-		err = fileHandle.close();
-		SFAT_ASSERT(err == ErrorCode::RESULT_OK, "It will be impossible to delete the transaction file if it is not closed!");
+		return ErrorCode::RESULT_OK;
+	}
 
-		return mVolumeManager.flush();
+	ErrorCode TransactionEventsLog::_verifyFileHeader(const TransactionFileHeader& header) {
+		if (header.mSignature != TransactionFileHeader::SIGNATURE) {
+			// The files of version 1 start directly with an event.
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The transaction file is of an old or unknown format and can't be restored!");
+			return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+		}
+		if ((header.mVersion != TransactionFileHeader::CURRENT_VERSION) || (header.mEventSize != sizeof(TransactionEvent))) {
+			SFAT_LOGE(LogArea::LA_TRANSACTION, "The version of the transaction file is not supported!");
+			return ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR;
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
+	void TransactionEventsLog::setRestoreCallback(RestoreCallback callback) {
+		mRestoreCallback = std::move(callback);
 	}
 
 	ErrorCode TransactionEventsLog::tryRestoreFromTransactionFile() {
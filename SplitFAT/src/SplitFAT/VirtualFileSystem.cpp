@@ -8,6 +8,7 @@
 #include "SplitFAT/FileManipulator.h"
 
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/DataBlockManager.h"
 
 #include "SplitFAT/utils/HelperFunctions.h"
 #include "SplitFAT/utils/Logger.h"
@@ -16,7 +17,6 @@
 #include <algorithm>
 #include <string.h>
 #include <vector>
-#include <stack>
 
 #define SPLIT_FAT_WARN_FOR_WRITE_OUT_OF_TRANSACTION		0
 #define SPLITFAT_ENABLE_MOVECLUSTER_DEBUGGING	0
@@ -24,27 +24,30 @@
 
 namespace SFAT {
 
-	StackAutoElement::StackAutoElement(FileManipulatorStack& stack)
-		: mStackRef(stack) {
-		// Allocate new element at the top
-		mStackRef.emplace();
-	}
-
-	StackAutoElement::~StackAutoElement() {
-		// Deallocate the top element
-		mStackRef.pop();
-	}
-
-	FileManipulator& StackAutoElement::getTop() {
-		return mStackRef.top();
-	}
+	// The entity of a path and its parent directory, locked by _lockPath().
+	struct VirtualFileSystem::LockedPath {
+		FileSystemLock mParentLock;
+		FileSystemLock mEntityLock;
+		FileManipulator mParentFM; /// Valid if the parent directory was found.
+		FileManipulator mEntityFM; /// Valid if the entity was found.
+	};
 
 	VirtualFileSystem::VirtualFileSystem()
-		: mIsValid(false) {
+		: mIsValid(false)
+		, mNegativeLookupCache(kMaxCountNegativeLookups) {
 		mRecoveryManager = std::make_unique<RecoveryManager>(mVolumeManager, *this);
+		// Both the restore on start and the revert of a failed commit could change any directory and file.
+		// The volume is locked exclusively during them.
+		mVolumeManager.setRestoreCallback([this]() {
+			mNegativeLookupCache.clear();
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+			mOpenFiles.clear();
+#endif
+		});
 	}
 
 	VirtualFileSystem::~VirtualFileSystem() {
+		mVolumeManager.getMemoryBudget()->unregisterComponent(MemoryComponent::MC_BUFFER_POOL);
 	}
 
 	ErrorCode VirtualFileSystem::setup(std::shared_ptr<SplitFATConfigurationBase> lowLevelFileAccess) {
@@ -65,7 +68,10 @@ namespace SFAT {
 		// Update all cached parameters
 		mClusterSize = mVolumeManager.getClusterSize();
 		// Usually used by at most 2 threads, so 2 buffers. Should not keep more than 10 buffers if they are not used.
-		mMemoryBufferPool = std::make_unique<MemoryBufferPool>(2, mClusterSize, 10);
+		mMemoryBufferPool = std::make_unique<MemoryBufferPool>(2, mClusterSize, kMaxCountFreeBuffers);
+		mVolumeManager.getMemoryBudget()->registerComponent(MemoryComponent::MC_BUFFER_POOL,
+			[this]() { return mMemoryBufferPool->getAllocatedBytes(); },
+			[this](size_t maxBytes) { mMemoryBufferPool->setMaxCountFree(std::min<size_t>(maxBytes / mClusterSize, kMaxCountFreeBuffers)); });
 
 		err = mVolumeManager.createIfDoesNotExist();
 		mIsValid = (err == ErrorCode::RESULT_OK);
@@ -89,7 +95,8 @@ namespace SFAT {
 		}
 
 		if (err == ErrorCode::RESULT_OK) {
-			err = mVolumeManager.preloadAllFATDataBlocks();
+			// The rest of the FAT blocks are loaded in background. The blocks needed meanwhile are loaded on demand.
+			err = mVolumeManager.startPreloadingAllFATDataBlocks();
 		}
 
 		//Some sanity check
@@ -105,12 +112,32 @@ namespace SFAT {
 			}
 		}
 
+#if (SPLIT_FAT__ENABLE_WARM_CACHE_MANIFEST == 1)
+		if (err == ErrorCode::RESULT_OK) {
+			// Not critical. The volume works the same without the prefetched clusters.
+			ErrorCode prefetchErr = mVolumeManager.startWarmCachePrefetch();
+			if (prefetchErr != ErrorCode::RESULT_OK) {
+				SFAT_LOGW(LogArea::LA_VOLUME_MANAGER, "Can't start the warm-cache prefetch. Error #%08X.", prefetchErr);
+			}
+		}
+#endif
+
 		return err;
 	}
 
 	ErrorCode VirtualFileSystem::_appendClusterToEndOfChain(const DescriptorLocation& location, ClusterIndexType endOfChainClusterIndex, ClusterIndexType& allocatedClusterIndex, bool useFileDataStorage) {
+		AllocationContext allocationContext(endOfChainClusterIndex, useFileDataStorage);
+		allocationContext.mDescriptorClusterIndex = location.mDescriptorClusterIndex;
+		allocationContext.mRecordIndex = location.mRecordIndex;
+		return _appendClusterToEndOfChain(location, endOfChainClusterIndex, allocatedClusterIndex, allocationContext);
+	}
+
+	ErrorCode VirtualFileSystem::_appendClusterToEndOfChain(const DescriptorLocation& location, ClusterIndexType endOfChainClusterIndex, ClusterIndexType& allocatedClusterIndex, const AllocationContext& allocationContext) {
+		// The cluster found has to be marked as allocated before any other writer looks for a free cluster.
+		FileSystemLock allocationLock = mLocks.lockAllocation();
+
 		ClusterIndexType newClusterIndex = ClusterValues::INVALID_VALUE;
-		ErrorCode err = _findFreeCluster(newClusterIndex, useFileDataStorage);
+		ErrorCode err = _findFreeCluster(newClusterIndex, allocationContext);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "Can't find free cluster!");
 			return err;
@@ -159,7 +186,7 @@ namespace SFAT {
 		return ErrorCode::RESULT_OK;
 	}
 
-	ErrorCode VirtualFileSystem::_expandClusterChain(const FileManipulator& fileManipulator, uint32_t countClusters, ClusterIndexType& resultStartClusterIndex, ClusterIndexType& resultEndClusterIndex, bool useFileDataStorage) {
+	ErrorCode VirtualFileSystem::_expandClusterChain(const FileManipulator& fileManipulator, uint32_t countClusters, ClusterIndexType& resultStartClusterIndex, ClusterIndexType& resultEndClusterIndex, const AllocationContext& allocationContext) {
 		const ClusterIndexType startClusterIndex = fileManipulator.mFileDescriptorRecord.mStartCluster;
 		ClusterIndexType endOfChainClusterIndex = fileManipulator.getLastCluster();
 		SFAT_ASSERT(isValidClusterIndex(endOfChainClusterIndex) == isValidClusterIndex(startClusterIndex), "Both cluster indices have to be defined at the same time!");
@@ -174,10 +201,16 @@ namespace SFAT {
 		}
 #endif
 		resultStartClusterIndex = startClusterIndex;
+		const DescriptorLocation& location = fileManipulator.getDescriptorLocation();
+		AllocationContext clusterAllocationContext = allocationContext;
+		clusterAllocationContext.mDescriptorClusterIndex = location.mDescriptorClusterIndex;
+		clusterAllocationContext.mRecordIndex = location.mRecordIndex;
 		ClusterIndexType allocatedClusterIndex;
 		for (uint32_t i = 0; i < countClusters; ++i) {
 			allocatedClusterIndex = ClusterValues::INVALID_VALUE;
-			ErrorCode err = _appendClusterToEndOfChain(fileManipulator.getDescriptorLocation(), endOfChainClusterIndex, allocatedClusterIndex, useFileDataStorage);
+			clusterAllocationContext.mLastCluster = endOfChainClusterIndex;
+			clusterAllocationContext.mCountClustersToAllocate = countClusters - i;
+			ErrorCode err = _appendClusterToEndOfChain(location, endOfChainClusterIndex, allocatedClusterIndex, clusterAllocationContext);
 			if (err != ErrorCode::RESULT_OK) {
 				// Should we revert the allocated clusters here? There won't be need to revert if the transaction is made on higner level.
 				// It is possible also the error to be coming from the physical storage, and it may break the revert process as well.
@@ -197,10 +230,10 @@ namespace SFAT {
 	}
 
 
-	ErrorCode VirtualFileSystem::_findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage) {
+	ErrorCode VirtualFileSystem::_findFreeCluster(ClusterIndexType& newClusterIndex, const AllocationContext& allocationContext) {
 #if (SPLIT_FAT_ENABLE_DEFRAGMENTATION == 1)
 		newClusterIndex = ClusterValues::INVALID_VALUE;
-		ErrorCode err = mDefragmentation->findFreeCluster(newClusterIndex, useFileDataStorage);
+		ErrorCode err = mDefragmentation->findFreeCluster(newClusterIndex, allocationContext);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
@@ -208,7 +241,7 @@ namespace SFAT {
 			return ErrorCode::RESULT_OK;
 		}
 #endif
-		return mVolumeManager.findFreeCluster(newClusterIndex, useFileDataStorage);
+		return mVolumeManager.findFreeCluster(newClusterIndex, allocationContext.mUseFileDataStorage);
 	}
 
 	ErrorCode VirtualFileSystem::_createRoot() {
@@ -415,7 +448,7 @@ namespace SFAT {
 
 	ErrorCode VirtualFileSystem::_updatePosition(FileManipulator& fileManipulator) {
 		ClusterIndexType newClusterIndex = ClusterValues::INVALID_VALUE;
-		ErrorCode err = _getClusterForPosition(fileManipulator.mFileDescriptorRecord, fileManipulator.mNextPosition, newClusterIndex);
+		ErrorCode err = _getClusterForPosition(fileManipulator, fileManipulator.mNextPosition, newClusterIndex);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
@@ -484,10 +517,18 @@ namespace SFAT {
 
 		ErrorCode err = ErrorCode::RESULT_OK;
 		if (currentClusterCount < newClusterCount) {
+			AllocationContext allocationContext(fileManipulator.getLastCluster(), useFileDataStorage);
+			// The file could be written in small pieces, so the size it is expected to reach is used if it is known.
+			allocationContext.mExpectedFileSize = std::max<FileSizeType>(newSize, fileManipulator.mExpectedFileSize);
+			// Writing at the end of the file (or appending) means it will most likely continue growing.
+			// The expansion for a position after the end of the file is treated as unknown pattern.
+			if (fileManipulator.hasAccessMode(AccessMode::AM_APPEND) || (fileManipulator.mNextPosition <= sizeToPosition(currentFileSize))) {
+				allocationContext.mPattern = AllocationPattern::AP_SEQUENTIAL;
+			}
 			ClusterIndexType resultExpansionStart = ClusterValues::INVALID_VALUE;
 			ClusterIndexType resultEndClusterIndex = ClusterValues::INVALID_VALUE;
 			//TODO: Test how it will behave when the volume is full. Will it allocate a few clusters and fail after that, and leave the clusters not attached?
-			err = _expandClusterChain(fileManipulator, newClusterCount - currentClusterCount, resultExpansionStart, resultEndClusterIndex, useFileDataStorage);
+			err = _expandClusterChain(fileManipulator, newClusterCount - currentClusterCount, resultExpansionStart, resultEndClusterIndex, allocationContext);
 			if (err != ErrorCode::RESULT_OK) {
 				return err;
 			}
@@ -501,6 +542,7 @@ namespace SFAT {
 				fileManipulator.mFileDescriptorRecord.mOldClusterTrace = fileManipulator.mFileDescriptorRecord.mStartCluster;
 
 				// Update FAT-cell value for the first cluster in the chain to contain encoded the FileDescriptorRecord location.
+				FileSystemLock allocationLock = mLocks.lockAllocation();
 				FATCellValueType cellValue;
 				ClusterIndexType currentCluster = fileManipulator.mFileDescriptorRecord.mStartCluster;
 				err = mVolumeManager.getFATCell(currentCluster, cellValue);
@@ -581,6 +623,60 @@ namespace SFAT {
 		return err;
 	}
 
+	ErrorCode VirtualFileSystem::_getClusterForPosition(const FileManipulator& fileManipulator, size_t position, ClusterIndexType& clusterIndex) {
+		const uint32_t relativeClusterIndex = static_cast<uint32_t>(position / static_cast<size_t>(_getClusterSize()));
+		uint32_t startRelativeClusterIndex = 0;
+		ClusterIndexType startClusterIndex = fileManipulator.getStartCluster();
+
+		// The cluster of the current position is still in the chain, only if the position is still in the file.
+		if (isValidClusterIndex(fileManipulator.mPositionClusterIndex) && (fileManipulator.mPosition < sizeToPosition(fileManipulator.getFileSize()))) {
+			const uint32_t positionRelativeClusterIndex = static_cast<uint32_t>(fileManipulator.mPosition / _getClusterSize());
+			if (positionRelativeClusterIndex <= relativeClusterIndex) {
+				startRelativeClusterIndex = positionRelativeClusterIndex;
+				startClusterIndex = fileManipulator.mPositionClusterIndex;
+			}
+		}
+
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		OpenFileState* openFileState = fileManipulator.mOpenFileState.get();
+		uint32_t cachedRelativeClusterIndex = 0;
+		ClusterIndexType cachedClusterIndex = ClusterValues::INVALID_VALUE;
+		if ((openFileState != nullptr) && openFileState->getCachedCluster(relativeClusterIndex, cachedRelativeClusterIndex, cachedClusterIndex) &&
+			(cachedRelativeClusterIndex > startRelativeClusterIndex)) {
+			startRelativeClusterIndex = cachedRelativeClusterIndex;
+			startClusterIndex = cachedClusterIndex;
+		}
+#endif
+
+		uint32_t countClustersToSkip = relativeClusterIndex - startRelativeClusterIndex;
+		ClusterIndexType foundClusterIndex = ClusterValues::INVALID_VALUE;
+		ErrorCode err = _iterateThroughClusterChain(startClusterIndex,
+			[&foundClusterIndex, &countClustersToSkip](bool& doQuit, ClusterIndexType currentCluster, FATCellValueType cellValue)->ErrorCode {
+			(void)cellValue; // Not used parameter
+
+			if (countClustersToSkip == 0) {
+				foundClusterIndex = currentCluster;
+				doQuit = true;
+			}
+			else {
+				--countClustersToSkip;
+			}
+			return ErrorCode::RESULT_OK;
+		}
+		);
+
+		if (err == ErrorCode::RESULT_OK) {
+			clusterIndex = foundClusterIndex;
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+			if ((openFileState != nullptr) && isValidClusterIndex(foundClusterIndex)) {
+				openFileState->setCachedCluster(relativeClusterIndex, foundClusterIndex);
+			}
+#endif
+		}
+
+		return err;
+	}
+
 	FileDescriptorRecord* VirtualFileSystem::_getFileDescriptorRecordInCluster(uint8_t *clusterData, uint32_t relativeClusterIndex) {
 		uint8_t* recordAddress = clusterData + relativeClusterIndex*getFileDescriptorRecordStorageSize();
 		return reinterpret_cast<FileDescriptorRecord*>(recordAddress);
@@ -588,15 +684,37 @@ namespace SFAT {
 
 
 	ErrorCode VirtualFileSystem::_writeFileDescriptor(const FileManipulator& fileManipulator) {
-		auto handle = mMemoryBufferPool->acquireBuffer();
-		auto& clusterDataBuffer = handle->get();
-
-		ErrorCode err = mVolumeManager.readCluster(clusterDataBuffer, fileManipulator.mLocation.mDescriptorClusterIndex);
+		// The other records in the same cluster could be written meanwhile by other threads.
+		FileSystemLock descriptorClusterLock = mLocks.lockDescriptorCluster(fileManipulator.mLocation.mDescriptorClusterIndex);
+		ClusterView clusterView;
+		ErrorCode err = mVolumeManager.acquireClusterView(fileManipulator.mLocation.mDescriptorClusterIndex, clusterView);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
 		uint32_t relativeRecordIndex = fileManipulator.mLocation.mRecordIndex % _getRecordsPerCluster();
+		const uint8_t* oldRecordAddress = clusterView.data() + relativeRecordIndex*getFileDescriptorRecordStorageSize();
+		if (memcmp(oldRecordAddress, &fileManipulator.mFileDescriptorRecord, sizeof(FileDescriptorRecord)) == 0) {
+			// Nothing changed, so there is nothing to log and write.
+			return ErrorCode::RESULT_OK;
+		}
+
+#if (SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
+		const FileDescriptorRecord* oldRecord = reinterpret_cast<const FileDescriptorRecord*>(oldRecordAddress);
+		const FileDescriptorRecord& newRecord = fileManipulator.mFileDescriptorRecord;
+		if (!newRecord.isEmpty() && !newRecord.isDeleted() &&
+			(oldRecord->isEmpty() || oldRecord->isDeleted() || (strncmp(oldRecord->mEntityName, newRecord.mEntityName, sizeof(FileDescriptorRecord::mEntityName)) != 0))) {
+			// A name is added to the directory - created or renamed.
+			mNegativeLookupCache.invalidate(fileManipulator.mLocation.mDirectoryStartClusterIndex,
+				std::string(newRecord.mEntityName, strnlen(newRecord.mEntityName, sizeof(FileDescriptorRecord::mEntityName))));
+		}
+#endif //(SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
+
+		auto handle = mMemoryBufferPool->acquireBuffer();
+		auto& clusterDataBuffer = handle->get();
+		memcpy(clusterDataBuffer.data(), clusterView.data(), _getClusterSize());
+		clusterView.release();
+
 		FileDescriptorRecord* record = _getFileDescriptorRecordInCluster(clusterDataBuffer.data(), relativeRecordIndex);
 
 		if (isInTransaction()) {
@@ -609,10 +727,119 @@ namespace SFAT {
 		*record = fileManipulator.mFileDescriptorRecord;
 
 		err = mVolumeManager.writeCluster(clusterDataBuffer, fileManipulator.mLocation.mDescriptorClusterIndex);
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		if (err == ErrorCode::RESULT_OK) {
+			_publishFileDescriptor(fileManipulator);
+		}
+#endif
 
 		return err;
 	}
 
+	ErrorCode VirtualFileSystem::_reloadFileDescriptor(FileManipulator& fileManipulator) {
+		ClusterView clusterView;
+		ErrorCode err = mVolumeManager.acquireClusterView(fileManipulator.mLocation.mDescriptorClusterIndex, clusterView);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		uint32_t relativeRecordIndex = fileManipulator.mLocation.mRecordIndex % _getRecordsPerCluster();
+		const uint8_t* recordAddress = clusterView.data() + relativeRecordIndex*getFileDescriptorRecordStorageSize();
+		if (memcmp(recordAddress, &fileManipulator.mFileDescriptorRecord, sizeof(FileDescriptorRecord)) == 0) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		FileDescriptorRecord record;
+		memcpy(&record, recordAddress, sizeof(FileDescriptorRecord));
+		clusterView.release();
+
+		DescriptorLocation location = fileManipulator.mLocation;
+		return _createFileManipulatorForExisting(location, record, fileManipulator.mAccessMode, fileManipulator);
+	}
+
+	FileSystemLock VirtualFileSystem::_lockEntity(const DescriptorLocation& location, LockMode mode) {
+		// The same relative record index is encoded in the FAT cells, so the entities found from a cluster get the same lock.
+		return mLocks.lockEntity(location.mDescriptorClusterIndex, location.mRecordIndex % _getRecordsPerCluster(), mode);
+	}
+
+	ErrorCode VirtualFileSystem::makeRequestedCheckpoint() {
+		if (!mVolumeManager.isCheckpointRequested()) {
+			return ErrorCode::RESULT_OK;
+		}
+		// Nothing is logged or changed while the changes of the transaction are written in place.
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_EXCLUSIVE);
+		return mVolumeManager.checkpointIfNeeded();
+	}
+
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+	ErrorCode VirtualFileSystem::_syncOpenFileState(FileManipulator& fileManipulator) {
+		if (!fileManipulator.isValid() || !fileManipulator.getFileDescriptorRecord().isFile()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		if ((fileManipulator.mOpenFileState != nullptr) && fileManipulator.mOpenFileState->isRemoved()) {
+			// The file was deleted, or the volume restored.
+			fileManipulator.mOpenFileState = nullptr;
+			fileManipulator.mOpenFileStateGeneration = 0;
+		}
+
+		if (fileManipulator.mOpenFileState == nullptr) {
+			const uint64_t fileKey = _getFileKey(fileManipulator.mLocation);
+			std::shared_ptr<OpenFileState> openFileState = mOpenFiles.find(fileKey);
+			if (openFileState == nullptr) {
+				// The first file-manipulator to use the file. Its record could be outdated, so the state starts with the stored one.
+				ClusterView clusterView;
+				ErrorCode err = mVolumeManager.acquireClusterView(fileManipulator.mLocation.mDescriptorClusterIndex, clusterView);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
+				FileDescriptorRecord record;
+				uint32_t relativeRecordIndex = fileManipulator.mLocation.mRecordIndex % _getRecordsPerCluster();
+				memcpy(&record, clusterView.data() + relativeRecordIndex*getFileDescriptorRecordStorageSize(), sizeof(FileDescriptorRecord));
+				clusterView.release();
+				if (!record.isFile() || record.isDeleted()) {
+					// The file was deleted after the file-manipulator was created.
+					return ErrorCode::RESULT_OK;
+				}
+				openFileState = mOpenFiles.acquire(fileKey, record);
+			}
+			fileManipulator.mOpenFileState = openFileState;
+		}
+
+		if (fileManipulator.mOpenFileState->syncRecord(fileManipulator.mFileDescriptorRecord, fileManipulator.mOpenFileStateGeneration)) {
+			// Changed through another file-manipulator. The cluster of the current position could be released or moved.
+			fileManipulator.mPosition = 0;
+			fileManipulator.mPositionClusterIndex = fileManipulator.getStartCluster();
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
+	void VirtualFileSystem::_publishFileDescriptor(const FileManipulator& fileManipulator) {
+		const FileDescriptorRecord& record = fileManipulator.mFileDescriptorRecord;
+		if (!record.isFile()) {
+			return;
+		}
+
+		const uint64_t fileKey = _getFileKey(fileManipulator.mLocation);
+		std::shared_ptr<OpenFileState> openFileState = fileManipulator.mOpenFileState;
+		if (openFileState == nullptr) {
+			// Changed without reading or writing, e.g. renamed.
+			openFileState = mOpenFiles.find(fileKey);
+		}
+		if (openFileState != nullptr) {
+			openFileState->updateRecord(record);
+		}
+		if (record.isDeleted()) {
+			mOpenFiles.remove(fileKey);
+		}
+	}
+
+	uint64_t VirtualFileSystem::_getFileKey(const DescriptorLocation& location) const {
+		// The same as the key of the entity lock.
+		return (static_cast<uint64_t>(location.mDescriptorClusterIndex) << 32) | static_cast<uint64_t>(location.mRecordIndex % _getRecordsPerCluster());
+	}
+#endif //(SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+
 	uint32_t VirtualFileSystem::_getRecordsPerCluster() const {
 		return _getClusterSize() / getFileDescriptorRecordStorageSize();
 	}
@@ -636,6 +863,7 @@ namespace SFAT {
 			return true;
 		}
 
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		FileManipulator directoryFM;
 		ErrorCode err = _createFileManipulatorForDirectoryPath(path, directoryFM);
 		if (err != ErrorCode::RESULT_OK) {
@@ -736,8 +964,9 @@ namespace SFAT {
 		// Make the file-manipulator initially invalid.
 		fileManipulator.mIsValid = false;
 
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		FileManipulator fileFM;
-		ErrorCode err = createGenericFileManipulatorForExistingEntity(filePath, fileFM);
+		ErrorCode err = _findEntity(filePath, fileFM);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
@@ -761,7 +990,7 @@ namespace SFAT {
 		fileManipulator.mIsValid = false;
 		
 		FileManipulator directoryFM;
-		ErrorCode err = createGenericFileManipulatorForExistingEntity(directoryPath, directoryFM);
+		ErrorCode err = _findEntity(directoryPath, directoryFM);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
@@ -783,61 +1012,101 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::createGenericFileManipulatorForExistingEntity(PathString entiryPath, FileManipulator& fileManipulator) {
-		if (entiryPath.isEmpty() || entiryPath.isRoot()) {
-			return _createRootDirFileManipulator(fileManipulator);
-		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		return _findEntity(entiryPath, fileManipulator);
+	}
 
+	ErrorCode VirtualFileSystem::_findEntity(const PathString& entityPath, FileManipulator& fileManipulator) {
 		// Make it initially invalid.
 		fileManipulator.mIsValid = false;
 
-		FileManipulator parentDirFM;
-		ErrorCode err = _createRootDirFileManipulator(parentDirFM);
+		LockedPath lockedPath;
+		ErrorCode err = _lockPath(entityPath, LockMode::LM_SHARED, LockMode::LM_SHARED, lockedPath);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
 
-		std::string entityName = entiryPath.getFirstPathEntity();
-		SFAT_ASSERT(entityName.size() > 0, "The entity name is not supposed to be empty!");
-		FileManipulator entityFM;
+		if (lockedPath.mEntityFM.isValid()) {
+			fileManipulator = std::move(lockedPath.mEntityFM);
+		}
+		return ErrorCode::RESULT_OK;
+	}
 
-		uint32_t countNestedDirectories = 0;
+	ErrorCode VirtualFileSystem::_lockPath(const PathString& path, LockMode parentMode, LockMode entityMode, LockedPath& lockedPath) {
+		std::vector<std::string> entityNames;
+		if (!path.isEmpty() && !path.isRoot()) {
+			PathString remainingPath(path);
+			for (std::string entityName = remainingPath.getFirstPathEntity(); !entityName.empty(); entityName = remainingPath.getNextPathEntity()) {
+				if (entityNames.size() >= kMaxCountNestedDirectories) {
+					SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "Reached the maximum allowed depth of nested directories (%u)!", kMaxCountNestedDirectories);
+					return ErrorCode::ERROR_REACHED_MAX_DIRECTORY_DEPTH;
+				}
+				entityNames.push_back(std::move(entityName));
+			}
+		}
+
+		// The Root directory has no record of its own, so it is locked with the location of the hidden record pointing to itself.
+		FileManipulator directoryFM;
+		DescriptorLocation rootLocation;
+		rootLocation.mDescriptorClusterIndex = ClusterValues::ROOT_START_CLUSTER_INDEX;
+		rootLocation.mDirectoryStartClusterIndex = ClusterValues::ROOT_START_CLUSTER_INDEX;
+		rootLocation.mRecordIndex = 0;
+		FileSystemLock directoryLock = _lockEntity(rootLocation, entityNames.empty() ? entityMode : ((entityNames.size() == 1) ? parentMode : LockMode::LM_SHARED));
+		ErrorCode err = _createRootDirFileManipulator(directoryFM);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		SFAT_ASSERT(directoryFM.mFullPath.getLength() > 0, "The root path should be updated!");
 
-		SFAT_ASSERT(parentDirFM.mFullPath.getLength() > 0, "The root path should be updated!");
+		if (entityNames.empty()) {
+			lockedPath.mEntityLock = std::move(directoryLock);
+			lockedPath.mEntityFM = std::move(directoryFM);
+			return ErrorCode::RESULT_OK;
+		}
 
-		do {
-			err = _findRecordInDirectory(parentDirFM, entityName, entityFM);
+		for (size_t i = 0; i < entityNames.size(); ++i) {
+			const bool isLastEntity = (i + 1 == entityNames.size());
+			FileManipulator entityFM;
+			err = _findRecordInDirectory(directoryFM, entityNames[i], entityFM);
 			if (err != ErrorCode::RESULT_OK) {
 				return err;
 			}
 
 			if (!entityFM.isValid()) {
-				// There is no error, but the fileManupilator will remain invalid, showing that the entity wasn't found.
+				// There is no error, but the entity file-manipulator will remain invalid, showing that the entity wasn't found.
+				if (isLastEntity) {
+					lockedPath.mParentLock = std::move(directoryLock);
+					lockedPath.mParentFM = std::move(directoryFM);
+				}
 				return ErrorCode::RESULT_OK;
 			}
 
-			std::string nextEntityName = entiryPath.getNextPathEntity();
-			if (nextEntityName.empty()) {
-				// All sub-directories of the entiryPath were found, so we have the final file manipulator in entityFM. Transfer it to fileManipulator.
-				fileManipulator = std::move(entityFM);
+			// If we have to continue, the current entity should be a directory!
+			if (!isLastEntity && !entityFM.getFileDescriptorRecord().isDirectory()) {
+				SFAT_LOGW(LogArea::LA_VIRTUAL_DISK, "Found a file instead of directory - %s", entityFM.mFullPath.c_str());
 				return ErrorCode::RESULT_OK;
 			}
 
-			// If we have to continue, the current entity should be a directory!
-			if (!entityFM.getFileDescriptorRecord().isDirectory()) {
-				SFAT_LOGW(LogArea::LA_VIRTUAL_DISK, "Found a file instead of directory - %s", entiryPath.getCurrentPath().c_str());
+			// The directory is still locked, so the entity can't be deleted or renamed, but it could have been changed before it was locked.
+			FileSystemLock entityLock = _lockEntity(entityFM.getDescriptorLocation(), isLastEntity ? entityMode : ((i + 2 == entityNames.size()) ? parentMode : LockMode::LM_SHARED));
+			err = _reloadFileDescriptor(entityFM);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+
+			if (isLastEntity) {
+				lockedPath.mParentLock = std::move(directoryLock);
+				lockedPath.mParentFM = std::move(directoryFM);
+				lockedPath.mEntityLock = std::move(entityLock);
+				lockedPath.mEntityFM = std::move(entityFM);
 				return ErrorCode::RESULT_OK;
 			}
 
-			// Transfer
-			parentDirFM = std::move(entityFM);
+			// Transfer. The lock of the parent directory is released.
+			directoryLock = std::move(entityLock);
+			directoryFM = std::move(entityFM);
 			// Grant a read-access for the directory, which is necessary later to read from it with _findRecordInDirectory().
-			parentDirFM.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ;
-			entityName = std::move(nextEntityName);
-
-			++countNestedDirectories;
-
-		} while (countNestedDirectories < kMaxCountNestedDirectories);
-
-		if (countNestedDirectories >= kMaxCountNestedDirectories) {
-			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "Reached the maximum allowed depth of nested directories (%u)!", kMaxCountNestedDirectories);
-			return ErrorCode::ERROR_REACHED_MAX_DIRECTORY_DEPTH;
+			directoryFM.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ;
 		}
 
 		return ErrorCode::RESULT_OK;
@@ -853,63 +1122,85 @@ namespace SFAT {
 			return ErrorCode::ERROR_INVALID_FILE_MANIPULATOR;
 		}
 
+		if (!parentDirFM.hasAccessMode(AccessMode::AM_READ)) {
+			return ErrorCode::ERROR_TRYING_TO_READ_FILE_WITHOUT_READ_ACCESS_MODE;
+		}
+
 		size_t fileSize = 0;
 		ErrorCode err = _getFileSize(parentDirFM, fileSize);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
-		err = seek(parentDirFM, 0, SeekMode::SM_SET); // Move to the begining of the directory
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
+		const uint32_t recordSize = getFileDescriptorRecordStorageSize();
+		const uint32_t recordsPerCluster = _getRecordsPerCluster();
+		const uint32_t countRecordsInDirectory = static_cast<uint32_t>(std::min<size_t>(fileSize / recordSize, kMaxCountEntitiesInDirectory));
+		if (countRecordsInDirectory == 0) {
+			return ErrorCode::RESULT_OK;
 		}
 
-		size_t sizeToRead = getFileDescriptorRecordStorageSize();
-		size_t sizeRead = 0;
-		std::vector<uint8_t> buffer(sizeToRead);
-		uint32_t countRecords = 0;
-
 		SFAT_ASSERT(parentDirFM.mFullPath.getLength() > 0, "The full path should be available here!");
 
-		// Start reading the records in loop
-		while (countRecords < kMaxCountEntitiesInDirectory)
-		{
-			err = read(parentDirFM, buffer.data(), sizeToRead, sizeRead);
-			if (err != ErrorCode::RESULT_OK) {
-				return err;
-			}
+		const ClusterIndexType directoryStartCluster = parentDirFM.getFileDescriptorRecord().mStartCluster;
+#if (SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
+		if (mNegativeLookupCache.contains(directoryStartCluster, entityName)) {
+			// Known to be missing, so the directory is not scanned.
+			return ErrorCode::RESULT_OK;
+		}
+		const uint32_t negativeLookupGeneration = mNegativeLookupCache.getGeneration();
+#endif //(SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
 
-			if (sizeToRead != sizeRead) {
-				// Wasn't able to find anything!
-				break;
-			}
+		uint32_t countRecords = 0;
+		ClusterView clusterView;
+		// The records are compared directly in the cached clusters of the directory, without copying them.
+		err = _iterateThroughClusterChain(directoryStartCluster,
+			[&](bool& doQuit, ClusterIndexType currentCluster, FATCellValueType cellValue)->ErrorCode {
+				(void)cellValue; // Not used parameter
 
-			const FileDescriptorRecord* record = reinterpret_cast<FileDescriptorRecord*>(buffer.data());
-			if (record->isEmpty()) {
-				// No more records in the directory.
-				break;
-			}
+				ErrorCode err = mVolumeManager.acquireClusterView(currentCluster, clusterView);
+				if (err != ErrorCode::RESULT_OK) {
+					return err;
+				}
 
-			if (!record->isDeleted() && !record->checkAttribute(FileAttributes::HIDDEN) && record->isSameName(entityName)) {
-				// The name matches! Create file-manipulator for it.
+				for (uint32_t i = 0; (i < recordsPerCluster) && (countRecords < countRecordsInDirectory); ++i, ++countRecords) {
+					const FileDescriptorRecord* record = reinterpret_cast<const FileDescriptorRecord*>(clusterView.data() + i*recordSize);
+					if (record->isEmpty()) {
+						// No more records in the directory.
+						doQuit = true;
+						return ErrorCode::RESULT_OK;
+					}
 
-				DescriptorLocation location;
-				location.mDescriptorClusterIndex = parentDirFM.mPositionClusterIndex;
-				location.mDirectoryStartClusterIndex = parentDirFM.getFileDescriptorRecord().mStartCluster;
-				location.mRecordIndex = countRecords;
+					if (!record->isDeleted() && !record->checkAttribute(FileAttributes::HIDDEN) && record->isSameName(entityName)) {
+						// The name matches! Create file-manipulator for it.
 
-				err = _createFileManipulatorForExisting(location, *record, AM_UNSPECIFIED, outputFileManipulator);
-				// Update the full path to the current entity
-				outputFileManipulator.mFullPath = PathString::combinePath(parentDirFM.mFullPath, record->mEntityName);
+						DescriptorLocation location;
+						location.mDescriptorClusterIndex = currentCluster;
+						location.mDirectoryStartClusterIndex = directoryStartCluster;
+						location.mRecordIndex = countRecords;
 
-				return err;
+						err = _createFileManipulatorForExisting(location, *record, AM_UNSPECIFIED, outputFileManipulator);
+						// Update the full path to the current entity
+						outputFileManipulator.mFullPath = PathString::combinePath(parentDirFM.mFullPath, record->mEntityName);
+
+						doQuit = true;
+						return err;
+					}
+				}
+
+				if (countRecords >= countRecordsInDirectory) {
+					doQuit = true;
+				}
+				return ErrorCode::RESULT_OK;
 			}
+		);
 
-			++countRecords;
+#if (SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
+		if ((err == ErrorCode::RESULT_OK) && !outputFileManipulator.isValid()) {
+			mNegativeLookupCache.add(directoryStartCluster, entityName, negativeLookupGeneration);
 		}
-		SFAT_ASSERT(countRecords <= kMaxCountEntitiesInDirectory, "Not supposed to reach the maximal count FileDescriptorRecords!");
+#endif //(SPLIT_FAT_ENABLE_NEGATIVE_LOOKUP_CACHE == 1)
 
-		return ErrorCode::RESULT_OK;
+		return err;
 	}
 
 	ErrorCode VirtualFileSystem::_iterateThroughDirectory(FileManipulator& parentDirFM, DirectoryIterationCallbackInternal callback) {
@@ -934,7 +1225,7 @@ namespace SFAT {
 
 		// Start reading the record in loop
 		while ((countRecords < kMaxCountEntitiesInDirectory) && (!doQuit)) {
-			err = read(parentDirFM, buffer.data(), sizeToRead, sizeRead);
+			err = _read(parentDirFM, buffer.data(), sizeToRead, sizeRead);
 			if (err != ErrorCode::RESULT_OK) {
 				return err;
 			}
@@ -997,6 +1288,20 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::read(FileManipulator& fileManipulator, void* buffer, size_t sizeToRead, size_t& sizeRead) {
+		sizeRead = 0;
+		mVolumeManager.getMemoryBudget()->rebalanceIfNeeded();
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		FileSystemLock fileLock = _lockEntity(fileManipulator.getDescriptorLocation(), LockMode::LM_SHARED);
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		ErrorCode err = _syncOpenFileState(fileManipulator);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+#endif
+		return _read(fileManipulator, buffer, sizeToRead, sizeRead);
+	}
+
+	ErrorCode VirtualFileSystem::_read(FileManipulator& fileManipulator, void* buffer, size_t sizeToRead, size_t& sizeRead) {
 		sizeRead = 0;
 		if (!fileManipulator.isValid()) {
 			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator for the file is invalid!");
@@ -1035,7 +1340,7 @@ namespace SFAT {
 		size_t	bytesRemainedToCopy = sizeToRead;
 		uint8_t* outputBuffer = reinterpret_cast<uint8_t*>(buffer);
 
-		std::vector<uint8_t>& clusterData = fileManipulator.getBuffer(_getClusterSize());
+		std::vector<uint8_t>& clusterData = fileManipulator.getBuffer(_getClusterSize(), mVolumeManager.getMemoryBudget());
 
 		uint32_t countClustersRead = 0;
 		err = _iterateThroughClusterChain(fileManipulator.mPositionClusterIndex,
@@ -1103,6 +1408,17 @@ namespace SFAT {
 				fileManipulator.mNextPosition = fileManipulator.mPosition + offset;
 			} break;
 			case SeekMode::SM_END: {
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+				{
+					// The size could be changed through another file-manipulator.
+					FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+					FileSystemLock fileLock = _lockEntity(fileManipulator.getDescriptorLocation(), LockMode::LM_SHARED);
+					ErrorCode err = _syncOpenFileState(fileManipulator);
+					if (err != ErrorCode::RESULT_OK) {
+						return err;
+					}
+				}
+#endif
 				if ((offset < 0) && (fileManipulator.getFileSize() < static_cast<size_t>(-offset))) {
 					SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The sum (fileSize + offset) should be positive or zero!");
 					return ErrorCode::ERROR_INVALID_SEEK_PARAMETERS;
@@ -1124,6 +1440,24 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::write(FileManipulator& fileManipulator, const void* buffer, size_t sizeToWrite, size_t& sizeWritten) {
+		sizeWritten = 0;
+		mVolumeManager.getMemoryBudget()->rebalanceIfNeeded();
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		FileSystemLock fileLock = _lockEntity(fileManipulator.getDescriptorLocation(), LockMode::LM_EXCLUSIVE);
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		err = _syncOpenFileState(fileManipulator);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+#endif
+		return _write(fileManipulator, buffer, sizeToWrite, sizeWritten);
+	}
+
+	ErrorCode VirtualFileSystem::_write(FileManipulator& fileManipulator, const void* buffer, size_t sizeToWrite, size_t& sizeWritten) {
 		sizeWritten = 0;
 		if (!fileManipulator.isValid()) {
 			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator for the file is invalid!");
@@ -1148,10 +1482,8 @@ namespace SFAT {
 
 		// If the access mode is "append" move first the position to the end of the file.
 		if (fileManipulator.hasAccessMode(AccessMode::AM_APPEND)) {
-			ErrorCode err = seek(fileManipulator, 0, SeekMode::SM_END);
-			if (err != ErrorCode::RESULT_OK) {
-				return err;
-			}
+			// Not through seek(), because the file is already locked.
+			fileManipulator.mNextPosition = fileManipulator.getFileSize();
 		}
 
 		// Allocates the amount of required clusters in the cluster chain and prepares for writing at the specific position
@@ -1176,7 +1508,7 @@ namespace SFAT {
 		size_t	bytesRemainedToCopy = sizeToWrite;
 		const uint8_t* inputBuffer = reinterpret_cast<const uint8_t*>(buffer);
 
-		std::vector<uint8_t>& clusterData = fileManipulator.getBuffer(_getClusterSize());
+		std::vector<uint8_t>& clusterData = fileManipulator.getBuffer(_getClusterSize(), mVolumeManager.getMemoryBudget());
 
 		uint32_t countClustersWritten = 0;
 		err = _iterateThroughClusterChain(fileManipulator.mPositionClusterIndex,
@@ -1348,19 +1680,27 @@ namespace SFAT {
 		}
 
 		PathString parentDirectoryPath(path.getParentPath());
-		FileManipulator parentDirFM;
-		ErrorCode err = _createFileManipulatorForDirectoryPath(parentDirectoryPath, parentDirFM);
+		LockedPath lockedPath;
+		// No other entity can take the same name or record while the parent directory is locked exclusively.
+		ErrorCode err = _lockPath(parentDirectoryPath, LockMode::LM_SHARED, LockMode::LM_EXCLUSIVE, lockedPath);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
-		if (!parentDirFM.isValid()) {
+		FileManipulator& parentDirFM = lockedPath.mEntityFM;
+		if (!parentDirFM.isValid() || !parentDirFM.getFileDescriptorRecord().isDirectory()) {
 			return ErrorCode::ERROR_PARENT_DIRECTORY_DOES_NOT_EXIST;
 		}
+		parentDirFM.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ | AccessMode::AM_WRITE;
 
 		return _createEntity(parentDirFM, path.getName(), mAccessMode, attributes, outputFileManipulator);
 	}
 
 	ErrorCode VirtualFileSystem::createFile(const PathString& filePath, uint32_t accessMode, bool isBinaryFile, FileManipulator& outputFileManipulator) {
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		return _createEntity(filePath,
 			accessMode | AccessMode::AM_WRITE,
 			static_cast<uint32_t>(FileAttributes::FILE) | (isBinaryFile ? static_cast<uint32_t>(FileAttributes::BINARY) : 0),
@@ -1368,6 +1708,11 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::createDirectory(const PathString& directiryPath, FileManipulator& outputFileManipulator) {
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		return _createEntity(directiryPath,
 			AccessMode::AM_BINARY | AccessMode::AM_READ | AccessMode::AM_WRITE,
 			static_cast<uint32_t>(FileAttributes::BINARY),
@@ -1412,6 +1757,7 @@ namespace SFAT {
 		const DescriptorLocation& location = fileManipulator.getDescriptorLocation();
 
 		if (clusterIndexToStartFrom <= ClusterValues::LAST_CLUSTER_INDEX_VALUE) {
+			FileSystemLock allocationLock = mLocks.lockAllocation();
 			err = _iterateThroughClusterChain(clusterIndexToStartFrom,
 				[&location, newLastClusterIndex, this](bool& doQuit, ClusterIndexType currentCluster, FATCellValueType cellValue)->ErrorCode {
 				(void)doQuit; // Not used parameter
@@ -1426,8 +1772,7 @@ namespace SFAT {
 					}
 				}
 				else {
-					FATCellValueType freeCellValue = FATCellValueType::freeCellValue();
-					err = mVolumeManager.setFATCell(currentCluster, freeCellValue);
+					err = mVolumeManager.freeCluster(currentCluster);
 					if (err != ErrorCode::RESULT_OK) {
 						SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "Wasn't able to free cluster #%x", currentCluster);
 					}
@@ -1452,6 +1797,9 @@ namespace SFAT {
 					SFAT_ASSERT(fileManipulator.mFileDescriptorRecord.mLastCluster == ClusterValues::INVALID_VALUE, "The last cluster should be already set to invalid");
 					fileManipulator.mFileDescriptorRecord.mOldClusterTrace = ClusterValues::INVALID_VALUE;
 				}
+				// The cluster of the current position could be released.
+				fileManipulator.mPosition = 0;
+				fileManipulator.mPositionClusterIndex = fileManipulator.mFileDescriptorRecord.mStartCluster;
 			}
 			err = _writeFileDescriptor(fileManipulator);
 		}
@@ -1470,9 +1818,36 @@ namespace SFAT {
 			return ErrorCode::ERROR_INVALID_FILE_MANIPULATOR;
 		}
 
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		FileSystemLock fileLock = _lockEntity(fileManipulator.getDescriptorLocation(), LockMode::LM_EXCLUSIVE);
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		err = _syncOpenFileState(fileManipulator);
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+#endif
 		return _trunc(fileManipulator, newSize, false);
 	}
 
+	ErrorCode VirtualFileSystem::setExpectedFileSize(FileManipulator& fileManipulator, FileSizeType expectedFileSize) {
+		if (!fileManipulator.isValid()) {
+			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator is invalid!");
+			return ErrorCode::ERROR_INVALID_FILE_MANIPULATOR;
+		}
+
+		if (!fileManipulator.getFileDescriptorRecord().isFile()) {
+			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator does not represent a file!");
+			return ErrorCode::ERROR_INVALID_FILE_MANIPULATOR;
+		}
+
+		fileManipulator.mExpectedFileSize = expectedFileSize;
+		return ErrorCode::RESULT_OK;
+	}
+
 	ErrorCode VirtualFileSystem::_deleteFile(FileManipulator& fileManipulator) {
 		if (!fileManipulator.isValid()) {
 			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator is invalid!");
@@ -1535,22 +1910,34 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::deleteFile(const PathString& filePath) {
-		FileManipulator fm;
-		ErrorCode err = createGenericFileManipulatorForFilePath(filePath, fm);
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		LockedPath lockedPath;
+		err = _lockPath(filePath, LockMode::LM_EXCLUSIVE, LockMode::LM_EXCLUSIVE, lockedPath);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
-		return _deleteFile(fm);
+		return _deleteFile(lockedPath.mEntityFM);
 	}
 
 	ErrorCode VirtualFileSystem::removeDirectory(const PathString& directoryPath) {
-		FileManipulator fm;
-		ErrorCode err = _createFileManipulatorForDirectoryPath(directoryPath, fm);
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+		LockedPath lockedPath;
+		err = _lockPath(directoryPath, LockMode::LM_EXCLUSIVE, LockMode::LM_EXCLUSIVE, lockedPath);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
+		FileManipulator& fm = lockedPath.mEntityFM;
+		fm.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ | AccessMode::AM_WRITE;
 		return _removeDirectory(fm);
 	}
 
@@ -1558,19 +1945,22 @@ namespace SFAT {
 		ErrorCode err = ErrorCode::RESULT_OK;
 		// Flushes the FAT on closing of file with a write access mode. Could be slow for many small files.
 		if (fileManipulator.hasAccessMode(AccessMode::AM_WRITE)) {
+			FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+			// The FAT is not changed while it is written.
+			FileSystemLock allocationLock = mLocks.lockAllocation();
 			err = mVolumeManager.flush();
 		}
 		return err;
 	}
 
 	ErrorCode VirtualFileSystem::_renameEntity(const PathString& entityPath, const PathString& newName) {
-		FileManipulator directoryFM;
-		PathString directoryPath(entityPath.getParentPath());
-		ErrorCode err = _createFileManipulatorForDirectoryPath(directoryPath, directoryFM);
+		LockedPath lockedPath;
+		ErrorCode err = _lockPath(entityPath, LockMode::LM_EXCLUSIVE, LockMode::LM_EXCLUSIVE, lockedPath);
 		if (err != ErrorCode::RESULT_OK) {
 			return err;
 		}
 
+		FileManipulator& directoryFM = lockedPath.mParentFM;
 		if (!directoryFM.isValid()) {
 			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "The file-manipulator is invalid!");
 			return ErrorCode::ERROR_INVALID_FILE_MANIPULATOR;
@@ -1597,12 +1987,7 @@ namespace SFAT {
 			return ErrorCode::ERROR_CANT_RENAME_A_FILE__NAME_DUPLICATION;
 		}
 
-		FileManipulator entityFM;
-		err = _findRecordInDirectory(directoryFM, entityPath.getName(), entityFM);
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
-		}
-
+		FileManipulator& entityFM = lockedPath.mEntityFM;
 		if (entityFM.isValid()) {
 			memset(entityFM.mFileDescriptorRecord.mEntityName, 0, sizeof(FileDescriptorRecord::mEntityName));
 			strncpy(entityFM.mFileDescriptorRecord.mEntityName, newNameStr.c_str(), sizeof(FileDescriptorRecord::mEntityName));
@@ -1613,10 +1998,20 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::renameFile(const PathString& filePath, const PathString& newName) {
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		return _renameEntity(filePath, newName);
 	}
 
 	ErrorCode VirtualFileSystem::renameDirectory(const PathString& directoryPath, const PathString& newName) {
+		ErrorCode err = makeRequestedCheckpoint();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
 		return _renameEntity(directoryPath, newName);
 	}
 
@@ -1634,67 +2029,69 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::_iterateThroughDirectoryRecursively(const PathString& directoryPath, uint32_t flags, DirectoryIterationCallbackInternal callback) {
-		FileManipulatorStack fmStack;
-		StackAutoElement autoStack(fmStack);
-		FileManipulator& directoryFM = autoStack.getTop();
-		ErrorCode err = _createFileManipulatorForDirectoryPath(directoryPath, directoryFM);
-		if (err != ErrorCode::RESULT_OK) {
-			return err;
-		}
-
-		if (!directoryFM.isValid()) {
-			return ErrorCode::ERROR_DIRECTORY_NOT_FOUND;
-		}
-
-		autoStack.getTop().mFullPath = directoryPath;
-
-		return _iterateThroughDirectoryRecursively(fmStack, flags, callback);
-	}
-
-	ErrorCode VirtualFileSystem::_iterateThroughDirectoryRecursively(FileManipulatorStack& fmStack, uint32_t flags, DirectoryIterationCallbackInternal callback) {
-		if (fmStack.empty() || !fmStack.top().isValid()) {
-			SFAT_LOGE(LogArea::LA_VIRTUAL_DISK, "Directory \"%s\" not found!", fmStack.top().mFullPath.c_str());
-			return ErrorCode::ERROR_DIRECTORY_NOT_FOUND;
-		}
+		struct DirectoryEntry {
+			DescriptorLocation mLocation;
+			FileDescriptorRecord mRecord;
+			std::string mFullPath;
+		};
+
+		// The records are copied while the directory is locked, and the callbacks are called after that.
+		std::vector<DirectoryEntry> entries;
+		{
+			FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_SHARED);
+			LockedPath lockedPath;
+			ErrorCode err = _lockPath(directoryPath, LockMode::LM_SHARED, LockMode::LM_SHARED, lockedPath);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
 
-		FileManipulator& parentDirFM = fmStack.top();
-		SFAT_ASSERT(parentDirFM.getFileDescriptorRecord().isDirectory(), "The entity should be a directory!");
+			FileManipulator& directoryFM = lockedPath.mEntityFM;
+			if (!directoryFM.isValid() || !directoryFM.getFileDescriptorRecord().isDirectory()) {
+				return ErrorCode::ERROR_DIRECTORY_NOT_FOUND;
+			}
+			directoryFM.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ;
+			directoryFM.mFullPath = directoryPath;
 
-		ErrorCode err = _iterateThroughDirectory(parentDirFM, [this, &flags, &callback, &fmStack](bool& doQuit, const DescriptorLocation& location, const FileDescriptorRecord& record, const std::string& fullPath)->ErrorCode {
-			if (record.isEmpty()) {
-				doQuit = true;
+			err = _iterateThroughDirectory(directoryFM, [&entries](bool& doQuit, const DescriptorLocation& location, const FileDescriptorRecord& record, const std::string& fullPath)->ErrorCode {
+				if (record.isEmpty()) {
+					doQuit = true;
+				}
+				else if (!record.isDeleted()) {
+					entries.push_back(DirectoryEntry{ location, record, fullPath });
+				}
+				return ErrorCode::RESULT_OK;
+			});
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
 			}
-			else if (!record.isDeleted()) {
+		}
 
-				bool shouldExecuteCallback = record.isFile() && ((flags & DI_FILE) != 0);
-				shouldExecuteCallback |= record.isDirectory() && ((flags & DI_DIRECTORY) != 0);
-				if (shouldExecuteCallback) {
-					ErrorCode callBackError = callback(doQuit, location, record, fullPath);
-					if (callBackError != ErrorCode::RESULT_OK) {
-						return callBackError;
-					}
+		for (const DirectoryEntry& entry : entries) {
+			bool doQuit = false;
+			bool shouldExecuteCallback = entry.mRecord.isFile() && ((flags & DI_FILE) != 0);
+			shouldExecuteCallback |= entry.mRecord.isDirectory() && ((flags & DI_DIRECTORY) != 0);
+			if (shouldExecuteCallback) {
+				ErrorCode callBackError = callback(doQuit, entry.mLocation, entry.mRecord, entry.mFullPath);
+				if (callBackError != ErrorCode::RESULT_OK) {
+					return callBackError;
 				}
+			}
 
-				// Iterate recusively through a sub-directory
-				if (record.isDirectory() && ((flags & DI_RECURSIVE) != 0)) {
-					StackAutoElement autoStack(fmStack);
-					FileManipulator& subdirFileManipulator = autoStack.getTop();
-					ErrorCode err = _createFileManipulatorForDirectory(location, record, subdirFileManipulator);
-					if (err != ErrorCode::RESULT_OK) {
-						return err;
-					}
-					subdirFileManipulator.mFullPath = fullPath;
-					ErrorCode recursiveIterationError = _iterateThroughDirectoryRecursively(fmStack, flags, callback);
-					if (recursiveIterationError != ErrorCode::RESULT_OK) {
-						return recursiveIterationError;
-					}
+			// Iterate recusively through a sub-directory
+			if (entry.mRecord.isDirectory() && ((flags & DI_RECURSIVE) != 0)) {
+				ErrorCode recursiveIterationError = _iterateThroughDirectoryRecursively(PathString(entry.mFullPath), flags, callback);
+				// The sub-directory could have been removed meanwhile.
+				if ((recursiveIterationError != ErrorCode::RESULT_OK) && (recursiveIterationError != ErrorCode::ERROR_DIRECTORY_NOT_FOUND)) {
+					return recursiveIterationError;
 				}
 			}
 
-			return ErrorCode::RESULT_OK;
-		});
+			if (doQuit) {
+				break;
+			}
+		}
 
-		return err;
+		return ErrorCode::RESULT_OK;
 	}
 
 
@@ -1706,6 +2103,7 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::startTransaction() {
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_EXCLUSIVE);
 #if (SPLIT_FAT_ENABLE_DEFRAGMENTATION == 1)
 		ErrorCode err = mDefragmentation->prepareForWriteTransaction();
 		if (err != ErrorCode::RESULT_OK) {
@@ -1716,6 +2114,19 @@ namespace SFAT {
 	}
 
 	ErrorCode VirtualFileSystem::endTransaction() {
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_EXCLUSIVE);
+		_prepareForTransactionEnd();
+		return mVolumeManager.endTransaction();
+	}
+
+	ErrorCode VirtualFileSystem::endTransactionAsync(std::shared_future<ErrorCode>& completion) {
+		// The commit is completed in background, but the changes to be committed are taken before the lock is released.
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_EXCLUSIVE);
+		_prepareForTransactionEnd();
+		return mVolumeManager.endTransactionAsync(completion);
+	}
+
+	void VirtualFileSystem::_prepareForTransactionEnd() {
 #if (SPLIT_FAT_ENABLE_DEFRAGMENTATION == 1)
 		if (mDefragmentation->isActive()) {
 			ErrorCode localErr = mDefragmentation->performDefragmentaionOnTransactionEnd();
@@ -1724,11 +2135,13 @@ namespace SFAT {
 				SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Defragmentation failed!");
 			}
 		}
+		// The reserved windows are valid only for the allocations in the same transaction.
+		mDefragmentation->releaseAllocationWindows();
 #endif
-		return mVolumeManager.endTransaction();
 	}
 
 	ErrorCode VirtualFileSystem::tryRestoreFromTransactionFile() {
+		FileSystemLock volumeLock = mLocks.lockVolume(LockMode::LM_EXCLUSIVE);
 		return mVolumeManager.tryRestoreFromTransactionFile();
 	}
 
@@ -1746,6 +2159,12 @@ namespace SFAT {
 			return ErrorCode::RESULT_OK;
 		}
 
+		// The start cluster of a directory could change, and the names cached for the old one could be wrong for another directory later.
+		mNegativeLookupCache.clear();
+#if (SPLIT_FAT_ENABLE_OPEN_FILE_STATE == 1)
+		mOpenFiles.invalidateClusterIndices();
+#endif
+
 		if (!isValidClusterIndex(destClusterIndex) || !isValidClusterIndex(sourceClusterIndex)) {
 			SFAT_LOGW(LogArea::LA_VIRTUAL_DISK, "Can't move a cluster! Invalid source or destination cluster index!");
 			return ErrorCode::RESULT_OK;
@@ -58,6 +58,15 @@ namespace SFAT {
 		return getClusterIndexSize() * getClustersPerFATBlock();
 	}
 
+	uint32_t VolumeDescriptor::getBlockControlDataSize() const {
+		return mBlockControlDataSize;
+	}
+
+	bool VolumeDescriptor::isBlockControlDataSupported() const {
+		// Volumes created before the BlockControlData was extended keep the 8 bytes gap, and the summary of their FAT blocks is never stored.
+		return mBlockControlDataSize == sizeof(BlockControlData);
+	}
+
 	uint32_t VolumeDescriptor::getVerificationCode() const {
 		return mVolumeVerificationCode;
 	}
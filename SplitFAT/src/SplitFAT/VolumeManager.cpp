@@ -8,33 +8,69 @@
 #include "SplitFAT/utils/SFATAssert.h"
 #include "SplitFAT/FAT.h"
 #include "SplitFAT/DataBlockManager.h"
-
-#if (SPLIT_FAT__ENABLE_CRC_PER_CLUSTER == 1)
-#	include "SplitFAT/utils/CRC.h"
-#endif
+#include "SplitFAT/utils/CRC.h"
+#include <thread>
+#include <algorithm>
 
 #define	SFAT_ENABLE_TRACKING_OF_A_PARTICULAR_CLUSTER	0
 
 namespace SFAT {
 
+	/**************************************************************************
+	*	FlushStats implementation
+	**************************************************************************/
+	FlushStats::FlushStats() {
+		reset();
+	}
+
+	void FlushStats::reset() {
+		mCountLogSyncs = 0;
+		mCountFATDataSyncs = 0;
+		mCountClusterDataSyncs = 0;
+		mCountSkippedSyncs = 0;
+	}
+
+	uint32_t FlushStats::getCountSyncs() const {
+		return mCountLogSyncs + mCountFATDataSyncs + mCountClusterDataSyncs;
+	}
+
 	/**************************************************************************
 	*	VolumeManager implementation
 	**************************************************************************/
 	VolumeManager::VolumeManager() 
-		: mTransaction(*this)
+		: mMemoryBudget(std::make_shared<MemoryBudget>())
+		, mTransaction(*this)
 		, mBlockVirtualization(*this)
+		, mIsWarmCachePrefetchCancelled(false)
+		, mCountPrefetchedClusters(0)
 		, mState(FileSystemState::FSS_UNKNOWN) {
 
 		_initializeWithDefaults();
 		mFATDataManager = std::make_unique<FATDataManager>(*this);
 		mDataBlockManager = std::make_unique<DataBlockManager>(*this);
+		mMemoryBudget->registerComponent(MemoryComponent::MC_CLUSTER_CACHE,
+			[this]() { return mDataBlockManager->getCacheAllocatedBytes(); },
+			[this](size_t maxBytes) { mDataBlockManager->setCacheMaxBytes(maxBytes); });
 	}
 
 	VolumeManager::~VolumeManager() {
+		cancelWarmCachePrefetch();
+		waitForWarmCachePrefetch();
+		mMemoryBudget->unregisterComponent(MemoryComponent::MC_CLUSTER_CACHE);
+		// The FAT data file should not be closed while the FAT blocks are still loading.
+		waitForFATPreloadCompletion();
 		ErrorCode err = flush();
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Failed to write FAT on closing VolumeManager!");
 		}
+#if (SPLIT_FAT__ENABLE_WARM_CACHE_MANIFEST == 1)
+		else {
+			err = writeWarmCacheManifest();
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGW(LogArea::LA_VOLUME_MANAGER, "Failed to write the warm-cache manifest on closing VolumeManager.");
+			}
+		}
+#endif
 	}
 
 	void VolumeManager::_initializeWithDefaults() {
@@ -49,6 +85,13 @@ namespace SFAT {
 
 		SFAT_ASSERT(mLowLevelAccess->isReady(), "At this stage of the process the lowLevelFileAccess object is expected to be ready!");
 		if (mLowLevelAccess->isReady()) {
+			mDataBlockManager->setCacheSettings(mLowLevelAccess->getClusterCacheSettings());
+			// Overrides the budget of the cluster cache, if enabled.
+			mMemoryBudget->setup(mLowLevelAccess->getMemoryBudgetSettings());
+			if (!mIOScheduler.isStarted()) {
+				IOSchedulerSettings schedulerSettings = mLowLevelAccess->getIOSchedulerSettings();
+				mIOScheduler.start(schedulerSettings.mCountThreads, schedulerSettings.mMaxQueueDepth);
+			}
 			setState(FileSystemState::FSS_STORAGE_SETUP);
 			return ErrorCode::RESULT_OK;
 		}
@@ -219,6 +262,10 @@ namespace SFAT {
 	}
 
 	ErrorCode VolumeManager::removeVolume() {
+		cancelWarmCachePrefetch();
+		waitForWarmCachePrefetch();
+		waitForFATPreloadCompletion();
+		mTransaction.waitForCheckpoint();
 		ErrorCode err = getLowLevelFileAccess().close();
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Trying to remove the volume, but can't close the volume physical files.");
@@ -287,6 +334,9 @@ namespace SFAT {
 			return ErrorCode::RESULT_OK;
 		}
 
+		// The allocation writes the volume control data and the new blocks directly into the files.
+		mTransaction.waitForCheckpoint();
+
 		if (blockIndexToAllocate >= getMaxPossibleBlocksCount()) {
 			return ErrorCode::ERROR_VOLUME_CAN_NOT_EXPAND;
 		}
@@ -430,7 +480,7 @@ namespace SFAT {
 	}
 
 	FilePositionType VolumeManager::getFATBlockStartPosition(uint32_t blockIndex ) const {
-		FilePositionType offset = static_cast<FilePositionType>(mVolumeDescriptor.getByteSizeOfFATBlock() + sizeof(BlockControlData)) * blockIndex + mVolumeDescriptor.getFATOffset();
+		FilePositionType offset = static_cast<FilePositionType>(mVolumeDescriptor.getByteSizeOfFATBlock() + mVolumeDescriptor.getBlockControlDataSize()) * blockIndex + mVolumeDescriptor.getFATOffset();
 		return offset;
 	}
 
@@ -461,6 +511,8 @@ namespace SFAT {
 			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Trying to write an invalid value in the FAT!");
 			return ErrorCode::ERROR_WRITING_INVALID_FAT_CELL_VALUE;
 		}
+		// The FAT cache can't be changed while the background checkpoint writes it.
+		mTransaction.waitForCheckpoint();
 		uint32_t cellBlockIndex = getBlockIndex(cellIndex);
 		uint32_t nextCellBlockIndex = getBlockIndex(value.getNext());
 		uint32_t blockIndex = cellBlockIndex; // A block that we may need to allocate
@@ -484,6 +536,17 @@ namespace SFAT {
 		return mFATDataManager->getValue(cellIndex, value);
 	}
 
+	ErrorCode VolumeManager::freeCluster(ClusterIndexType clusterIndex) {
+#if (SPLIT_FAT__ENABLE_DEFERRED_CLUSTER_FREE == 1)
+		if (isInTransaction()) {
+			mTransaction.deferClusterFree(clusterIndex);
+			return ErrorCode::RESULT_OK;
+		}
+#endif
+		mTransaction.waitForCheckpoint();
+		return mFATDataManager->setValue(clusterIndex, FATCellValueType::freeCellValue());
+	}
+
 	uint32_t VolumeManager::getBlockIndex(ClusterIndexType clusterIndex) const {
 		return clusterIndex / mVolumeDescriptor.getClustersPerFATBlock();
 	}
@@ -525,15 +588,8 @@ namespace SFAT {
 	ErrorCode VolumeManager::updateCRCOnWrite(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex) {
 #if (SPLIT_FAT__ENABLE_CRC_PER_CLUSTER == 1)
 		uint16_t calculatedCrc = CRC16::calculate(buffer.data(), getClusterSize());
-		FATCellValueType cellValue = FATCellValueType::invalidCellValue();
-		ErrorCode err = getFATCell(clusterIndex, cellValue);
-		if (err != ErrorCode::RESULT_OK) {
-			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "Error reading FAT cell #%08X!", clusterIndex);
-			return err;
-		}
-		cellValue.encodeCRC(calculatedCrc);
-		cellValue.setClusterInitialized(true);
-		err = setFATCell(clusterIndex, cellValue);
+		// Not through setFATCell(), as the cell is changed without the allocation lock. The FATDataManager serializes it with the allocations.
+		ErrorCode err = mFATDataManager->setCRC(clusterIndex, calculatedCrc);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "Error writing FAT cell #%08X!", clusterIndex);
 			return err;
@@ -559,6 +615,10 @@ namespace SFAT {
 		return err;
 	}
 
+	ErrorCode VolumeManager::acquireClusterView(ClusterIndexType clusterIndex, ClusterView& view) {
+		return mDataBlockManager->acquireClusterView(clusterIndex, !isFileDataCluster(clusterIndex), view);
+	}
+
 	ErrorCode VolumeManager::writeCluster(const std::vector<uint8_t> &buffer, ClusterIndexType clusterIndex) {
 		bool isDirectoryData = !isFileDataCluster(clusterIndex);
 #if !defined(MCPE_PUBLISH) && (SFAT_ENABLE_TRACKING_OF_A_PARTICULAR_CLUSTER == 1)
@@ -570,6 +630,11 @@ namespace SFAT {
 			}
 		}
 #endif //!defined(MCPE_PUBLISH)
+		// The CRC is set in the FAT cache, which can't be changed while the background checkpoint writes it.
+		// Waited for here, as the checkpoint needs the DataBlockManager, which is locked while the CRC is set.
+		mTransaction.waitForCheckpoint();
+		// Only requested here, as the volume is locked shared. The VirtualFileSystem makes it before its next change.
+		mTransaction.requestCheckpointIfNeeded();
 		return mDataBlockManager->writeCluster(buffer, clusterIndex, isDirectoryData);
 	}
 
@@ -638,7 +703,32 @@ namespace SFAT {
 		return mTransaction.commit();
 	}
 
+	ErrorCode VolumeManager::endTransactionAsync(std::shared_future<ErrorCode>& completion) {
+		return mTransaction.commitAsync(completion);
+	}
+
+	bool VolumeManager::isClusterFreePending(ClusterIndexType clusterIndex) {
+		return mTransaction.isClusterFreePending(clusterIndex);
+	}
+
+	ErrorCode VolumeManager::waitForCheckpoint() {
+		return mTransaction.waitForCheckpoint();
+	}
+
+	void VolumeManager::setRestoreCallback(TransactionEventsLog::RestoreCallback callback) {
+		mTransaction.setRestoreCallback(std::move(callback));
+	}
+
+	bool VolumeManager::isCheckpointRequested() const {
+		return mTransaction.isCheckpointRequested();
+	}
+
+	ErrorCode VolumeManager::checkpointIfNeeded() {
+		return mTransaction.checkpointIfNeeded();
+	}
+
 	ErrorCode VolumeManager::tryRestoreFromTransactionFile() {
+		mTransaction.waitForCheckpoint();
 		return mTransaction.tryRestoreFromTransactionFile();
 	}
 
@@ -661,43 +751,113 @@ namespace SFAT {
 	ErrorCode VolumeManager::flush() {
 		ErrorCode err = ErrorCode::RESULT_OK;
 		if (!isInTransaction()) {
-			err = immediateFlush();
+			// A failed background checkpoint stays pending and is retried below.
+			mTransaction.waitForCheckpoint();
+			if (mTransaction.isCheckpointPending()) {
+				// Writes in place the changes committed in redo mode.
+				err = mTransaction.checkpoint();
+			}
+			else {
+				err = immediateFlush();
+			}
 		}
 		return err;
 	}
 
 	ErrorCode VolumeManager::immediateFlush() {
-		// Write the cached FAT data to the corresponding physical file
-		ErrorCode err = mFATDataManager->flush();
+		ErrorCode err = ErrorCode::RESULT_OK;
+		if (isInTransaction()) {
+			// Write-ahead ordering - the logged original data has to be durable in the transaction file, before it is overwritten.
+			err = mTransaction.makeLogDurable();
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The transaction log wasn't written correctly!");
+				return err;
+			}
+		}
+
+#if (SPLIT_FAT__ENABLE_OVERLAPPED_FLUSH == 1)
+		// The FAT-data and the cluster-data don't depend on each other, and both are already protected by the transaction log.
+		// When they are in the same physical file, the writes are not overlapped.
+		if (getLowLevelFileAccess().getFATDataFile(AccessMode::AM_WRITE).getImplementation() != getLowLevelFileAccess().getClusterDataFile(AccessMode::AM_WRITE).getImplementation()) {
+			std::shared_future<ErrorCode> fatFlushCompletion;
+			mIOScheduler.submit(IOPriority::IOP_FOREGROUND_WRITE, [this]() { return _flushFATData(); }, fatFlushCompletion);
+			err = _flushClusterData();
+			ErrorCode fatErr = mIOScheduler.wait(fatFlushCompletion);
+			return (fatErr != ErrorCode::RESULT_OK) ? fatErr : err;
+		}
+#endif
+
+		err = _flushFATData();
 		if (err != ErrorCode::RESULT_OK) {
-			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The FAT-data wasn't written correctly on the physical storage!");
 			return err;
 		}
 
-		// Write the cached cluster-data to the corresponding physical file
-		err = mDataBlockManager->flush();
+		return _flushClusterData();
+	}
+
+	ErrorCode VolumeManager::_flushFATData() {
+		// Write the cached FAT data to the corresponding physical file
+		ErrorCode err = mFATDataManager->flush();
 		if (err != ErrorCode::RESULT_OK) {
-			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The cluster-data wasn't written correctly on the physical storage!");
+			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The FAT-data wasn't written correctly on the physical storage!");
 			return err;
 		}
 
 		// Flush the FAT physical file 
-		err = getLowLevelFileAccess().flushFATDataFile();
+		SplitFATConfigurationBase& lowLevelFileAccess = getLowLevelFileAccess();
+		err = _syncFile(lowLevelFileAccess.getFATDataFile(AccessMode::AM_WRITE), [&lowLevelFileAccess]()->ErrorCode {
+			return lowLevelFileAccess.flushFATDataFile();
+		}, mFlushStats.mCountFATDataSyncs);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The physical file for the FAT-data wasn't flushed correctly!");
+		}
+		return err;
+	}
+
+	ErrorCode VolumeManager::_flushClusterData() {
+		// Write the cached cluster-data to the corresponding physical file
+		ErrorCode err = mDataBlockManager->flush();
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The cluster-data wasn't written correctly on the physical storage!");
 			return err;
 		}
 
 		// Flush the cluster data physical file 
-		err = getLowLevelFileAccess().flushClusterDataFile();
+		SplitFATConfigurationBase& lowLevelFileAccess = getLowLevelFileAccess();
+		err = _syncFile(lowLevelFileAccess.getClusterDataFile(AccessMode::AM_WRITE), [&lowLevelFileAccess]()->ErrorCode {
+			return lowLevelFileAccess.flushClusterDataFile();
+		}, mFlushStats.mCountClusterDataSyncs);
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The physical file for the cluster-data wasn't flushed correctly!");
-			return err;
 		}
+		return err;
+	}
 
+	ErrorCode VolumeManager::_syncFile(FileHandle file, std::function<ErrorCode()> flushFunction, std::atomic<uint32_t>& countSyncs) {
+		// When the FAT-data and the cluster-data share a physical file, the second sync is skipped here.
+		if (file.isOpen() && !file.hasUnsyncedWrites()) {
+			++mFlushStats.mCountSkippedSyncs;
+			return ErrorCode::RESULT_OK;
+		}
+		ErrorCode err = flushFunction();
+		if (err == ErrorCode::RESULT_OK) {
+			++countSyncs;
+		}
 		return err;
 	}
 
+	FlushStats& VolumeManager::getFlushStats() {
+		return mFlushStats;
+	}
+
+	const std::shared_ptr<MemoryBudget>& VolumeManager::getMemoryBudget() const {
+		return mMemoryBudget;
+	}
+
+	IOScheduler& VolumeManager::getIOScheduler() {
+		return mIOScheduler;
+	}
+
 	ErrorCode VolumeManager::getFreeSpace(FileSizeType& countFreeBytes) {
 		countFreeBytes = 0;
 		uint32_t countFreeClusters;
@@ -730,6 +890,182 @@ namespace SFAT {
 		return mFATDataManager->preloadAllFATDataBlocks();
 	}
 
+	ErrorCode VolumeManager::startPreloadingAllFATDataBlocks() {
+		return mFATDataManager->startPreloadingAllFATDataBlocks();
+	}
+
+	ErrorCode VolumeManager::waitForFATPreloadCompletion() {
+		return mFATDataManager->waitForPreloadCompletion();
+	}
+
+	ErrorCode VolumeManager::writeWarmCacheManifest() {
+		if ((mLowLevelAccess == nullptr) || (getState() != FileSystemState::FSS_READY) || isInTransaction() || !fatDataFileExists()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		ClusterCacheSettings settings = getLowLevelFileAccess().getClusterCacheSettings();
+		size_t maxCountClusters = std::min(settings.mMaxPrefetchBytes, settings.mMaxBytes) / getClusterSize();
+		if (maxCountClusters == 0) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		std::vector<ClusterIndexType> clusterIndices;
+		mDataBlockManager->getHotClusters(maxCountClusters, clusterIndices);
+		if (clusterIndices.empty()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		WarmCacheManifest manifest;
+		manifest.setVolumeStamp(_calculateVolumeStamp());
+		manifest.setClusters(std::move(clusterIndices));
+		for (auto& range : manifest.getRanges()) {
+			ErrorCode err = _calculateFATChecksum(range.mStartCluster, range.mCountClusters, range.mFATChecksum);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+		}
+
+		FileHandle file;
+		ErrorCode err = getLowLevelFileAccess().createWarmCacheManifest(file);
+		if (err == ErrorCode::ERROR_FEATURE_NOT_SUPPORTED) {
+			return ErrorCode::RESULT_OK;
+		}
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
+		err = manifest.write(file);
+		ErrorCode closeErr = file.close();
+		if ((err != ErrorCode::RESULT_OK) || (closeErr != ErrorCode::RESULT_OK)) {
+			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "Can't write the warm-cache manifest.");
+			getLowLevelFileAccess().removeWarmCacheManifest();
+			return (err != ErrorCode::RESULT_OK) ? err : closeErr;
+		}
+
+		SFAT_LOGI(LogArea::LA_VOLUME_MANAGER, "Warm-cache manifest written with %u range(s).", static_cast<uint32_t>(manifest.getRanges().size()));
+		return ErrorCode::RESULT_OK;
+	}
+
+	ErrorCode VolumeManager::startWarmCachePrefetch() {
+		if (mWarmCachePrefetchCompletion.valid()) {
+			// Already started
+			return ErrorCode::RESULT_OK;
+		}
+
+		FileHandle file;
+		ErrorCode err = getLowLevelFileAccess().tryOpenWarmCacheManifest(file);
+		if (err == ErrorCode::ERROR_FEATURE_NOT_SUPPORTED) {
+			return ErrorCode::RESULT_OK;
+		}
+		if ((err != ErrorCode::RESULT_OK) || !file.isOpen()) {
+			return err;
+		}
+
+		WarmCacheManifest manifest;
+		err = manifest.read(file);
+		file.close();
+		// The manifest is used only once. Only a clean shutdown leaves a manifest for the next mount.
+		ErrorCode removeErr = getLowLevelFileAccess().removeWarmCacheManifest();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+		if (removeErr != ErrorCode::RESULT_OK) {
+			return removeErr;
+		}
+
+		if (manifest.getVolumeStamp() != _calculateVolumeStamp()) {
+			SFAT_LOGI(LogArea::LA_VOLUME_MANAGER, "The volume has changed since the warm-cache manifest was written.");
+			return ErrorCode::RESULT_OK;
+		}
+
+		ClusterCacheSettings settings = getLowLevelFileAccess().getClusterCacheSettings();
+		size_t maxCountClusters = std::min(settings.mMaxPrefetchBytes, settings.mMaxBytes) / getClusterSize();
+		if ((maxCountClusters == 0) || manifest.getRanges().empty()) {
+			return ErrorCode::RESULT_OK;
+		}
+
+		mIsWarmCachePrefetchCancelled = false;
+		mCountPrefetchedClusters = 0;
+		mIOScheduler.submit(IOPriority::IOP_BACKGROUND, [this, ranges = std::move(manifest.getRanges()), maxCountClusters]() {
+			_prefetchWarmClusters(ranges, maxCountClusters);
+			return ErrorCode::RESULT_OK;
+		}, mWarmCachePrefetchCompletion);
+		return ErrorCode::RESULT_OK;
+	}
+
+	uint32_t VolumeManager::waitForWarmCachePrefetch() {
+		if (mWarmCachePrefetchCompletion.valid()) {
+			mIOScheduler.wait(mWarmCachePrefetchCompletion);
+			mWarmCachePrefetchCompletion = std::shared_future<ErrorCode>();
+		}
+		return mCountPrefetchedClusters;
+	}
+
+	void VolumeManager::cancelWarmCachePrefetch() {
+		mIsWarmCachePrefetchCancelled = true;
+	}
+
+	void VolumeManager::_prefetchWarmClusters(const std::vector<WarmCacheRange>& ranges, size_t maxCountClusters) {
+		// The position in the physical file and the index of every cluster to be read
+		std::vector<std::pair<FilePositionType, ClusterIndexType>> clusters;
+		for (const auto& range : ranges) {
+			if (mIsWarmCachePrefetchCancelled || (clusters.size() >= maxCountClusters)) {
+				break;
+			}
+			if ((range.mCountClusters == 0) || (getBlockIndex(range.mStartCluster + range.mCountClusters - 1) >= getCountAllocatedDataBlocks())) {
+				continue;
+			}
+			// Skip the clusters changed since the manifest was written.
+			uint32_t checksum = 0;
+			ErrorCode err = _calculateFATChecksum(range.mStartCluster, range.mCountClusters, checksum);
+			if ((err != ErrorCode::RESULT_OK) || (checksum != range.mFATChecksum)) {
+				continue;
+			}
+			for (uint32_t i = 0; (i < range.mCountClusters) && (clusters.size() < maxCountClusters); ++i) {
+				ClusterIndexType clusterIndex = range.mStartCluster + i;
+				clusters.emplace_back(mDataBlockManager->getClusterPosition(clusterIndex), clusterIndex);
+			}
+		}
+
+		// Read in the order of the physical file.
+		std::sort(clusters.begin(), clusters.end());
+		std::vector<uint8_t> buffer(getClusterSize());
+		for (const auto& cluster : clusters) {
+			if (mIsWarmCachePrefetchCancelled) {
+				break;
+			}
+			ErrorCode err = readCluster(buffer, cluster.second);
+			if (err != ErrorCode::RESULT_OK) {
+				SFAT_LOGW(LogArea::LA_VOLUME_MANAGER, "Warm-cache prefetch stopped. Error #%08X reading cluster #%08X.", err, cluster.second);
+				break;
+			}
+			++mCountPrefetchedClusters;
+		}
+	}
+
+	uint32_t VolumeManager::_calculateVolumeStamp() const {
+		const uint32_t values[] = {
+			mVolumeControlData.mCountAllocatedDataBlocks,
+			mVolumeControlData.mCountAllocatedFATBlocks,
+			mVolumeControlData.mCountTotalDataClusters,
+			getClusterSize()
+		};
+		return CRC32::calculate(values, sizeof(values));
+	}
+
+	ErrorCode VolumeManager::_calculateFATChecksum(ClusterIndexType startCluster, uint32_t countClusters, uint32_t& checksum) {
+		checksum = 0;
+		for (uint32_t i = 0; i < countClusters; ++i) {
+			FATCellValueType value;
+			ErrorCode err = getFATCell(startCluster + i, value);
+			if (err != ErrorCode::RESULT_OK) {
+				return err;
+			}
+			checksum = CRC32::calculate(&value, sizeof(value), checksum);
+		}
+		return ErrorCode::RESULT_OK;
+	}
+
 	ErrorCode VolumeManager::blockSwitch() {
 		return ErrorCode::NOT_IMPLEMENTED;
 	}
@@ -737,6 +1073,8 @@ namespace SFAT {
 	//For testing purposes only
 #if !defined(MCPE_PUBLISH)
 	ErrorCode VolumeManager::discardFATCachedChanges() {
+		// The clusters waiting to be freed at the end of the transaction are part of the cached FAT changes.
+		mTransaction.discardPendingClusterFrees();
 		ErrorCode err = mFATDataManager->discardCachedChanges();
 		if (err != ErrorCode::RESULT_OK) {
 			SFAT_LOGE(LogArea::LA_VOLUME_MANAGER, "The FAT-data wasn't written correctly on the physical storage!");
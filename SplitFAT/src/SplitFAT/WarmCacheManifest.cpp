@@ -0,0 +1,99 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/WarmCacheManifest.h"
+#include "SplitFAT/AbstractFileSystem.h"
+#include "SplitFAT/utils/CRC.h"
+#include "SplitFAT/utils/Logger.h"
+#include <algorithm>
+
+namespace SFAT {
+
+	namespace {
+		const uint32_t kManifestSignature = 0x43574653; // "SFWC"
+		const uint32_t kManifestVersion = 1;
+		const uint32_t kMaxCountRanges = 1 << 20;
+
+		struct ManifestHeader {
+			uint32_t mSignature;
+			uint32_t mVersion;
+			uint32_t mVolumeStamp;
+			uint32_t mCountRanges;
+			uint32_t mRangesCRC;
+		};
+	}
+
+	WarmCacheManifest::WarmCacheManifest()
+		: mVolumeStamp(0) {
+	}
+
+	void WarmCacheManifest::setClusters(std::vector<ClusterIndexType> clusterIndices) {
+		mRanges.clear();
+		std::sort(clusterIndices.begin(), clusterIndices.end());
+		for (ClusterIndexType clusterIndex : clusterIndices) {
+			if (!mRanges.empty() && (mRanges.back().mStartCluster + mRanges.back().mCountClusters == clusterIndex)) {
+				++mRanges.back().mCountClusters;
+			}
+			else if (mRanges.empty() || (mRanges.back().mStartCluster + mRanges.back().mCountClusters < clusterIndex)) {
+				mRanges.push_back({ clusterIndex, 1, 0 });
+			}
+		}
+	}
+
+	ErrorCode WarmCacheManifest::write(FileHandle& file) const {
+		ManifestHeader header;
+		header.mSignature = kManifestSignature;
+		header.mVersion = kManifestVersion;
+		header.mVolumeStamp = mVolumeStamp;
+		header.mCountRanges = static_cast<uint32_t>(mRanges.size());
+		header.mRangesCRC = CRC32::calculate(mRanges.data(), mRanges.size() * sizeof(WarmCacheRange));
+
+		size_t bytesWritten = 0;
+		ErrorCode err = file.write(&header, sizeof(header), bytesWritten);
+		if ((err != ErrorCode::RESULT_OK) || (bytesWritten != sizeof(header))) {
+			return (err != ErrorCode::RESULT_OK) ? err : ErrorCode::ERROR_WRITING;
+		}
+		if (mRanges.empty()) {
+			return ErrorCode::RESULT_OK;
+		}
+		err = file.write(mRanges.data(), mRanges.size() * sizeof(WarmCacheRange), bytesWritten);
+		if ((err == ErrorCode::RESULT_OK) && (bytesWritten != mRanges.size() * sizeof(WarmCacheRange))) {
+			err = ErrorCode::ERROR_WRITING;
+		}
+		return err;
+	}
+
+	ErrorCode WarmCacheManifest::read(FileHandle& file) {
+		mRanges.clear();
+
+		ManifestHeader header;
+		size_t bytesRead = 0;
+		ErrorCode err = file.read(&header, sizeof(header), bytesRead);
+		if ((err != ErrorCode::RESULT_OK) || (bytesRead != sizeof(header))) {
+			return (err != ErrorCode::RESULT_OK) ? err : ErrorCode::ERROR_READING;
+		}
+		if ((header.mSignature != kManifestSignature) || (header.mVersion != kManifestVersion) || (header.mCountRanges > kMaxCountRanges)) {
+			SFAT_LOGW(LogArea::LA_PHYSICAL_DISK, "Unknown format of the warm-cache manifest.");
+			return ErrorCode::ERROR_INCONSISTENCY;
+		}
+
+		std::vector<WarmCacheRange> ranges(header.mCountRanges);
+		if (!ranges.empty()) {
+			err = file.read(ranges.data(), ranges.size() * sizeof(WarmCacheRange), bytesRead);
+			if ((err != ErrorCode::RESULT_OK) || (bytesRead != ranges.size() * sizeof(WarmCacheRange))) {
+				return (err != ErrorCode::RESULT_OK) ? err : ErrorCode::ERROR_READING;
+			}
+		}
+		if (CRC32::calculate(ranges.data(), ranges.size() * sizeof(WarmCacheRange)) != header.mRangesCRC) {
+			SFAT_LOGW(LogArea::LA_PHYSICAL_DISK, "The warm-cache manifest is damaged.");
+			return ErrorCode::ERROR_INCONSISTENCY;
+		}
+
+		mVolumeStamp = header.mVolumeStamp;
+		mRanges = std::move(ranges);
+		return ErrorCode::RESULT_OK;
+	}
+
+} // namespace SFAT
@@ -8,8 +8,29 @@
 #include <algorithm>
 #include <string.h>
 
+#if (SPLIT_FAT__ENABLE_SIMD_BITSET_SCAN == 1) && defined(__AVX2__)
+#	define SPLIT_FAT__BITSET_SCAN_AVX2	1
+#	include <immintrin.h>
+#endif
+
 namespace SFAT {
 
+	namespace {
+		constexpr size_t kBitsPerElement = sizeof(BitSet::ElementType) * 8;
+	} // namespace
+
+	const size_t BitSet::npos;
+
+	// Mask of the bits in the element of bitIndex, that are at or after bitIndex.
+	BitSet::ElementType BitSet::_getStartMask(size_t bitIndex) {
+		return ~static_cast<ElementType>(0) << (bitIndex % kBitsPerElement);
+	}
+
+	// Mask of the bits in the element of bitIndex, that are at or before bitIndex.
+	BitSet::ElementType BitSet::_getEndMask(size_t bitIndex) {
+		return ~static_cast<ElementType>(0) >> (kBitsPerElement - 1 - bitIndex % kBitsPerElement);
+	}
+
 	BitSet::BitSet()
 		: mSize(0) {
 	}
@@ -94,53 +115,92 @@ namespace SFAT {
 		}
 	}
 
-	bool BitSet::findFirst(size_t& bitIndexFound, bool valueToLookFor, size_t startIndex) const {
-		bitIndexFound = npos;
-		constexpr size_t bitsCount = sizeof(ElementType) * 8;
+	BitSet::ElementType BitSet::_getSearchElement(size_t elementIndex, bool valueToLookFor) const {
+		ElementType elementValue = mElements[elementIndex];
+		if (!valueToLookFor) {
+			elementValue = ~elementValue;
+		}
+		if (elementIndex + 1 == mElements.size()) {
+			elementValue &= _getEndMask(mSize - 1);
+		}
+		return elementValue;
+	}
+
+	size_t BitSet::_findFirstNonEmptyElement(size_t startElementIndex, bool valueToLookFor) const {
 		size_t elementsCount = mElements.size();
-		size_t startElement = startIndex / bitsCount;
-		size_t startBit = startIndex % bitsCount;
-		ElementType bitTestValue = 0;
-		ElementType allBitsTestValue = ~static_cast<ElementType>(0);
-		if (valueToLookFor) {
-			bitTestValue = 1;
-			allBitsTestValue = 0;
-		}
-		for (size_t elementIndex = startElement; elementIndex < elementsCount; ++elementIndex) {
-			ElementType elementValue = mElements[elementIndex];
-			if (elementValue != allBitsTestValue) {
-				for (size_t bitIndex = startBit; bitIndex < bitsCount; ++bitIndex) {
-					if (bitTestValue == ((elementValue >> bitIndex) & 1)) {
-						size_t index = elementIndex * bitsCount + bitIndex;
-						if (index >= mSize) {
-							return false;
-						}
-						bitIndexFound = index;
-						return true;
-					}
-				}
+		size_t elementIndex = startElementIndex;
+#if (SPLIT_FAT__BITSET_SCAN_AVX2 == 1)
+		// Skip four elements at once. The last element is left for the scalar loop, as it needs masking.
+		const __m256i allBitsSet = _mm256_set1_epi64x(-1);
+		const ElementType* data = mElements.data();
+		while (elementIndex + 4 < elementsCount) {
+			__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + elementIndex));
+			int isEmpty = valueToLookFor ? _mm256_testz_si256(value, value) : _mm256_testc_si256(value, allBitsSet);
+			if (!isEmpty) {
+				break;
 			}
-			startBit = 0;
+			elementIndex += 4;
 		}
-		return false;
+#endif
+		for (; elementIndex < elementsCount; ++elementIndex) {
+			if (_getSearchElement(elementIndex, valueToLookFor) != 0) {
+				return elementIndex;
+			}
+		}
+		return elementsCount;
 	}
 
-	bool BitSet::findLast(size_t& bitIndexFound, bool valueToLookFor) const {
+	size_t BitSet::_findLastNonEmptyElement(size_t endElementIndex, bool valueToLookFor) const {
+		size_t elementIndex = endElementIndex + 1;
+		if (elementIndex == mElements.size()) {
+			// The last element needs masking.
+			--elementIndex;
+			if (_getSearchElement(elementIndex, valueToLookFor) != 0) {
+				return elementIndex;
+			}
+		}
+#if (SPLIT_FAT__BITSET_SCAN_AVX2 == 1)
+		const __m256i allBitsSet = _mm256_set1_epi64x(-1);
+		const ElementType* data = mElements.data();
+		while (elementIndex >= 4) {
+			__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + elementIndex - 4));
+			int isEmpty = valueToLookFor ? _mm256_testz_si256(value, value) : _mm256_testc_si256(value, allBitsSet);
+			if (!isEmpty) {
+				break;
+			}
+			elementIndex -= 4;
+		}
+#endif
+		while (elementIndex > 0) {
+			--elementIndex;
+			if (_getSearchElement(elementIndex, valueToLookFor) != 0) {
+				return elementIndex;
+			}
+		}
+		return npos;
+	}
+
+	bool BitSet::findFirst(size_t& bitIndexFound, bool valueToLookFor, size_t startIndex) const {
 		bitIndexFound = npos;
-		if (mSize == 0) {
+		if (startIndex >= mSize) {
 			return false;
 		}
 
-		size_t index = mSize;
-		do {
-			--index;
-			if (valueToLookFor == getValue(index)) {
-				bitIndexFound = index;
-				return true;
+		size_t elementIndex = startIndex / kBitsPerElement;
+		ElementType elementValue = _getSearchElement(elementIndex, valueToLookFor) & _getStartMask(startIndex);
+		if (elementValue == 0) {
+			elementIndex = _findFirstNonEmptyElement(elementIndex + 1, valueToLookFor);
+			if (elementIndex >= mElements.size()) {
+				return false;
 			}
-		} while (index != 0);
+			elementValue = _getSearchElement(elementIndex, valueToLookFor);
+		}
+		bitIndexFound = elementIndex * kBitsPerElement + countTrailingZeros(elementValue);
+		return true;
+	}
 
-		return false;
+	bool BitSet::findLast(size_t& bitIndexFound, bool valueToLookFor) const {
+		return findLast(bitIndexFound, valueToLookFor, npos);
 	}
 
 	bool BitSet::findStartOfLastKElements(size_t& startIndexFound, bool valueToLookFor, size_t endIndex, size_t countElements) const {
@@ -152,19 +212,25 @@ namespace SFAT {
 			endIndex = mSize - 1;
 		}
 
-		size_t index = endIndex + 1;
-		do {
-			--index;
-			if (valueToLookFor == getValue(index)) {
-				--countElements;
-				if (0 == countElements) {
-					startIndexFound = index;
-					return true;
+		size_t elementIndex = endIndex / kBitsPerElement;
+		ElementType elementValue = _getSearchElement(elementIndex, valueToLookFor) & _getEndMask(endIndex);
+		for (;;) {
+			size_t count = popCount(elementValue);
+			if (count >= countElements) {
+				// Drop the lower bits, that are not part of the last K elements.
+				for (size_t i = countElements; i < count; ++i) {
+					elementValue &= elementValue - 1;
 				}
+				startIndexFound = elementIndex * kBitsPerElement + countTrailingZeros(elementValue);
+				return true;
 			}
-		} while (index != 0);
-
-		return false;
+			countElements -= count;
+			if (elementIndex == 0) {
+				return false;
+			}
+			--elementIndex;
+			elementValue = _getSearchElement(elementIndex, valueToLookFor);
+		}
 	}
 
 	bool BitSet::findLast(size_t& bitIndexFound, bool valueToLookFor, size_t endIndex) const {
@@ -176,16 +242,20 @@ namespace SFAT {
 			endIndex = mSize - 1;
 		}
 
-		size_t index = endIndex + 1;
-		do {
-			--index;
-			if (valueToLookFor == getValue(index)) {
-				bitIndexFound = index;
-				return true;
+		size_t elementIndex = endIndex / kBitsPerElement;
+		ElementType elementValue = _getSearchElement(elementIndex, valueToLookFor) & _getEndMask(endIndex);
+		if (elementValue == 0) {
+			if (elementIndex == 0) {
+				return false;
 			}
-		} while (index != 0);
-
-		return false;
+			elementIndex = _findLastNonEmptyElement(elementIndex - 1, valueToLookFor);
+			if (elementIndex == npos) {
+				return false;
+			}
+			elementValue = _getSearchElement(elementIndex, valueToLookFor);
+		}
+		bitIndexFound = elementIndex * kBitsPerElement + (kBitsPerElement - 1 - countLeadingZeros(elementValue));
+		return true;
 	}
 
 	bool BitSet::findFirstZero(size_t& bitIndexFound, size_t startIndex) const {
@@ -196,6 +266,93 @@ namespace SFAT {
 		return findFirst(bitIndexFound, true, startIndex);
 	}
 
+	bool BitSet::findFirstRun(size_t& startIndexFound, bool valueToLookFor, size_t length, size_t startIndex) const {
+		startIndexFound = npos;
+		if (length == 0) {
+			return false;
+		}
+
+		size_t runStart = startIndex;
+		while (findFirst(runStart, valueToLookFor, runStart)) {
+			if (length > mSize - runStart) {
+				return false;
+			}
+			size_t runEnd;
+			if (!findFirst(runEnd, !valueToLookFor, runStart + 1)) {
+				runEnd = mSize;
+			}
+			if (runEnd - runStart >= length) {
+				startIndexFound = runStart;
+				return true;
+			}
+			runStart = runEnd;
+		}
+		return false;
+	}
+
+	bool BitSet::findLongestRun(size_t& startIndexFound, size_t& lengthFound, bool valueToLookFor) const {
+		startIndexFound = npos;
+		lengthFound = 0;
+
+		size_t runStart = 0;
+		while (findFirst(runStart, valueToLookFor, runStart)) {
+			if (mSize - runStart <= lengthFound) {
+				// The rest of the set is too short to contain a longer run.
+				break;
+			}
+			size_t runEnd;
+			if (!findFirst(runEnd, !valueToLookFor, runStart + 1)) {
+				runEnd = mSize;
+			}
+			if (runEnd - runStart > lengthFound) {
+				startIndexFound = runStart;
+				lengthFound = runEnd - runStart;
+			}
+			runStart = runEnd;
+		}
+		return lengthFound > 0;
+	}
+
+	void BitSet::setRange(size_t startIndex, size_t countElements, bool value) {
+		if ((startIndex >= mSize) || (countElements == 0)) {
+			return;
+		}
+		if (countElements > mSize - startIndex) {
+			countElements = mSize - startIndex;
+		}
+
+		size_t endIndex = startIndex + countElements - 1;
+		size_t startElementIndex = startIndex / kBitsPerElement;
+		size_t endElementIndex = endIndex / kBitsPerElement;
+		ElementType startBitMask = _getStartMask(startIndex);
+		ElementType endBitMask = _getEndMask(endIndex);
+		if (startElementIndex == endElementIndex) {
+			startBitMask &= endBitMask;
+		}
+
+		if (value) {
+			mElements[startElementIndex] |= startBitMask;
+		}
+		else {
+			mElements[startElementIndex] &= ~startBitMask;
+		}
+		if (startElementIndex == endElementIndex) {
+			return;
+		}
+
+		ElementType element = value ? ~static_cast<ElementType>(0) : static_cast<ElementType>(0);
+		for (size_t i = startElementIndex + 1; i < endElementIndex; ++i) {
+			mElements[i] = element;
+		}
+
+		if (value) {
+			mElements[endElementIndex] |= endBitMask;
+		}
+		else {
+			mElements[endElementIndex] &= ~endBitMask;
+		}
+	}
+
 	size_t BitSet::getSize() const {
 		return mSize;
 	}
@@ -206,28 +363,33 @@ namespace SFAT {
 
 	size_t BitSet::getCountOnes() const {
 		size_t count = 0;
-		for (size_t i = 0; i < mSize; ++i) {
-			if (getValue(i)) {
-				++count;
-			}
+		size_t elementsCount = mElements.size();
+		for (size_t i = 0; i < elementsCount; ++i) {
+			count += popCount(_getSearchElement(i, true));
 		}
 		return count;
 	}
 
 	size_t BitSet::getCountOnes(size_t firstIndex, size_t countIndices) const {
-		size_t count = 0;
-		if (mSize == 0) {
+		if ((firstIndex >= mSize) || (countIndices == 0)) {
 			return 0;
 		}
-		size_t endIndex = firstIndex + countIndices;
-		if (endIndex > mSize) {
-			endIndex = mSize;
+		if (countIndices > mSize - firstIndex) {
+			countIndices = mSize - firstIndex;
 		}
-		for (size_t i = firstIndex; i < endIndex; ++i) {
-			if (getValue(i)) {
-				++count;
-			}
+
+		size_t endIndex = firstIndex + countIndices - 1;
+		size_t startElementIndex = firstIndex / kBitsPerElement;
+		size_t endElementIndex = endIndex / kBitsPerElement;
+		if (startElementIndex == endElementIndex) {
+			return popCount(mElements[startElementIndex] & _getStartMask(firstIndex) & _getEndMask(endIndex));
+		}
+
+		size_t count = popCount(mElements[startElementIndex] & _getStartMask(firstIndex));
+		for (size_t i = startElementIndex + 1; i < endElementIndex; ++i) {
+			count += popCount(mElements[i]);
 		}
+		count += popCount(mElements[endElementIndex] & _getEndMask(endIndex));
 		return count;
 	}
 
@@ -271,23 +433,18 @@ namespace SFAT {
 	}
 
 	bool BitSet::anyInRange(size_t startIndex, size_t countElements) const {
-		if (startIndex >= mSize) {
+		if ((startIndex >= mSize) || (countElements == 0)) {
 			return false;
 		}
-		if (startIndex + countElements >= mSize) {
+		if (countElements > mSize - startIndex) {
 			countElements = mSize - startIndex;
 		}
-		if (countElements == 0) {
-			return false;
-		}
-		
-		constexpr size_t bitsPerElement = sizeof(ElementType) * 8;
-		size_t startElementIndex = startIndex / bitsPerElement;
-		size_t endElementIndex = (startIndex + countElements - 1) / bitsPerElement;
-		size_t bitPos = startElementIndex % bitsPerElement;
-		ElementType startBitMask = static_cast<ElementType>(-1) << bitPos;
-		bitPos = endElementIndex % bitsPerElement;
-		ElementType endBitMask = static_cast<ElementType>(-1) >> bitPos;
+
+		size_t endIndex = startIndex + countElements - 1;
+		size_t startElementIndex = startIndex / kBitsPerElement;
+		size_t endElementIndex = endIndex / kBitsPerElement;
+		ElementType startBitMask = _getStartMask(startIndex);
+		ElementType endBitMask = _getEndMask(endIndex);
 
 		if (startElementIndex == endElementIndex) {
 			bool value = ((mElements[startElementIndex] & (startBitMask & endBitMask)) != 0);
@@ -299,7 +456,7 @@ namespace SFAT {
 			return true;
 		}
 
-		for (size_t i = startIndex + 1; i < endElementIndex; ++i) {
+		for (size_t i = startElementIndex + 1; i < endElementIndex; ++i) {
 			if (mElements[i] != 0) {
 				return true;
 			}
@@ -318,6 +475,18 @@ namespace SFAT {
 		return false;
 	}
 
+	BitSet::ElementType* BitSet::getElementsData() {
+		return mElements.data();
+	}
+
+	const BitSet::ElementType* BitSet::getElementsData() const {
+		return mElements.data();
+	}
+
+	size_t BitSet::getElementsCount() const {
+		return mElements.size();
+	}
+
 
 } // namespace SFAT
 
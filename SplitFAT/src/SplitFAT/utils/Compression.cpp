@@ -0,0 +1,231 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/utils/Compression.h"
+#include <string.h>
+
+namespace SFAT {
+
+	namespace {
+
+		void appendUInt32(std::vector<uint8_t>& dest, uint32_t value) {
+			const uint8_t* data = reinterpret_cast<const uint8_t*>(&value);
+			dest.insert(dest.end(), data, data + sizeof(uint32_t));
+		}
+
+		bool readUInt32(const uint8_t* source, size_t sourceSize, size_t& position, uint32_t& value) {
+			if (position + sizeof(uint32_t) > sourceSize) {
+				return false;
+			}
+			memcpy(&value, source + position, sizeof(uint32_t));
+			position += sizeof(uint32_t);
+			return true;
+		}
+
+		// Writes the part of the length that doesn't fit in the token.
+		void appendExtendedLength(std::vector<uint8_t>& dest, size_t length) {
+			if (length < 15) {
+				return;
+			}
+			length -= 15;
+			while (length >= 255) {
+				dest.push_back(255);
+				length -= 255;
+			}
+			dest.push_back(static_cast<uint8_t>(length));
+		}
+
+		bool readExtendedLength(const uint8_t* source, size_t sourceSize, size_t& position, size_t& length) {
+			if (length < 15) {
+				return true;
+			}
+			uint8_t value;
+			do {
+				if (position >= sourceSize) {
+					return false;
+				}
+				value = source[position++];
+				length += value;
+			} while (value == 255);
+			return true;
+		}
+
+	} // namespace
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	// ZeroRunCodec Implementation
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool ZeroRunCodec::compress(const void* source, size_t sourceSize, std::vector<uint8_t>& dest) {
+		// A run of zeros shorter than the record header is cheaper to keep in the literals.
+		const size_t kMinZeroRunLength = 2 * sizeof(uint32_t);
+		const uint8_t* data = static_cast<const uint8_t*>(source);
+
+		dest.clear();
+		size_t position = 0;
+		while (position < sourceSize) {
+			const size_t zerosStart = position;
+			while ((position < sourceSize) && (data[position] == 0)) {
+				++position;
+			}
+			const size_t literalsStart = position;
+			while (position < sourceSize) {
+				if (data[position] != 0) {
+					++position;
+					continue;
+				}
+				size_t runEnd = position;
+				while ((runEnd < sourceSize) && (data[runEnd] == 0) && (runEnd - position < kMinZeroRunLength)) {
+					++runEnd;
+				}
+				if ((runEnd - position >= kMinZeroRunLength) || (runEnd == sourceSize)) {
+					break;
+				}
+				position = runEnd;
+			}
+
+			appendUInt32(dest, static_cast<uint32_t>(literalsStart - zerosStart));
+			appendUInt32(dest, static_cast<uint32_t>(position - literalsStart));
+			dest.insert(dest.end(), data + literalsStart, data + position);
+			if (dest.size() >= sourceSize) {
+				return false;
+			}
+		}
+
+		return dest.size() < sourceSize;
+	}
+
+	bool ZeroRunCodec::decompress(const void* source, size_t sourceSize, void* dest, size_t destSize) {
+		const uint8_t* sourceData = static_cast<const uint8_t*>(source);
+		uint8_t* destData = static_cast<uint8_t*>(dest);
+
+		size_t sourcePosition = 0;
+		size_t destPosition = 0;
+		while (sourcePosition < sourceSize) {
+			uint32_t countZeros = 0;
+			uint32_t countLiterals = 0;
+			if (!readUInt32(sourceData, sourceSize, sourcePosition, countZeros) ||
+				!readUInt32(sourceData, sourceSize, sourcePosition, countLiterals)) {
+				return false;
+			}
+			if ((destPosition + countZeros + countLiterals > destSize) || (sourcePosition + countLiterals > sourceSize)) {
+				return false;
+			}
+			memset(destData + destPosition, 0, countZeros);
+			destPosition += countZeros;
+			memcpy(destData + destPosition, sourceData + sourcePosition, countLiterals);
+			destPosition += countLiterals;
+			sourcePosition += countLiterals;
+		}
+
+		return destPosition == destSize;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	// LZCodec Implementation
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	bool LZCodec::compress(const void* source, size_t sourceSize, std::vector<uint8_t>& dest) {
+		const uint8_t* data = static_cast<const uint8_t*>(source);
+		// Keeps the last position + 1 of every hashed 4-byte sequence. Zero for not used.
+		std::vector<uint32_t> hashTable(static_cast<size_t>(1) << kHashBits, 0);
+
+		dest.clear();
+		size_t literalsStart = 0;
+		size_t position = 0;
+		while (position + kMinMatchLength <= sourceSize) {
+			uint32_t sequence;
+			memcpy(&sequence, data + position, sizeof(sequence));
+			const uint32_t hash = (sequence * 2654435761U) >> (32 - kHashBits);
+			const size_t candidate = hashTable[hash];
+			hashTable[hash] = static_cast<uint32_t>(position + 1);
+
+			if ((candidate == 0) || (position + 1 - candidate > kMaxOffset) || (memcmp(data + candidate - 1, data + position, kMinMatchLength) != 0)) {
+				++position;
+				continue;
+			}
+
+			const size_t matchStart = candidate - 1;
+			size_t matchLength = kMinMatchLength;
+			while ((position + matchLength < sourceSize) && (data[matchStart + matchLength] == data[position + matchLength])) {
+				++matchLength;
+			}
+
+			const size_t countLiterals = position - literalsStart;
+			const size_t matchLengthCode = matchLength - kMinMatchLength;
+			const uint8_t token = static_cast<uint8_t>(((countLiterals < 15 ? countLiterals : 15) << 4) | (matchLengthCode < 15 ? matchLengthCode : 15));
+			dest.push_back(token);
+			appendExtendedLength(dest, countLiterals);
+			dest.insert(dest.end(), data + literalsStart, data + position);
+			const uint16_t offset = static_cast<uint16_t>(position - matchStart);
+			dest.push_back(static_cast<uint8_t>(offset & 0xFF));
+			dest.push_back(static_cast<uint8_t>(offset >> 8));
+			appendExtendedLength(dest, matchLengthCode);
+
+			position += matchLength;
+			literalsStart = position;
+			if (dest.size() >= sourceSize) {
+				return false;
+			}
+		}
+
+		// The last sequence contains only the remaining literals.
+		const size_t countLiterals = sourceSize - literalsStart;
+		dest.push_back(static_cast<uint8_t>((countLiterals < 15 ? countLiterals : 15) << 4));
+		appendExtendedLength(dest, countLiterals);
+		dest.insert(dest.end(), data + literalsStart, data + sourceSize);
+
+		return dest.size() < sourceSize;
+	}
+
+	bool LZCodec::decompress(const void* source, size_t sourceSize, void* dest, size_t destSize) {
+		const uint8_t* sourceData = static_cast<const uint8_t*>(source);
+		uint8_t* destData = static_cast<uint8_t*>(dest);
+
+		size_t sourcePosition = 0;
+		size_t destPosition = 0;
+		while (sourcePosition < sourceSize) {
+			const uint8_t token = sourceData[sourcePosition++];
+
+			size_t countLiterals = token >> 4;
+			if (!readExtendedLength(sourceData, sourceSize, sourcePosition, countLiterals)) {
+				return false;
+			}
+			if ((sourcePosition + countLiterals > sourceSize) || (destPosition + countLiterals > destSize)) {
+				return false;
+			}
+			memcpy(destData + destPosition, sourceData + sourcePosition, countLiterals);
+			sourcePosition += countLiterals;
+			destPosition += countLiterals;
+
+			if (sourcePosition == sourceSize) {
+				// The last sequence
+				break;
+			}
+
+			if (sourcePosition + sizeof(uint16_t) > sourceSize) {
+				return false;
+			}
+			const size_t offset = static_cast<size_t>(sourceData[sourcePosition]) | (static_cast<size_t>(sourceData[sourcePosition + 1]) << 8);
+			sourcePosition += sizeof(uint16_t);
+			size_t matchLength = token & 0x0F;
+			if (!readExtendedLength(sourceData, sourceSize, sourcePosition, matchLength)) {
+				return false;
+			}
+			matchLength += kMinMatchLength;
+			if ((offset == 0) || (offset > destPosition) || (destPosition + matchLength > destSize)) {
+				return false;
+			}
+			// The match can overlap with the data being written, so it is copied byte by byte.
+			for (size_t i = 0; i < matchLength; ++i) {
+				destData[destPosition + i] = destData[destPosition - offset + i];
+			}
+			destPosition += matchLength;
+		}
+
+		return destPosition == destSize;
+	}
+
+} // namespace SFAT
@@ -0,0 +1,153 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/utils/IOScheduler.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include <algorithm>
+#include <thread>
+
+namespace SFAT {
+
+	namespace {
+		const uint32_t kMinDefaultCountThreads = 2;
+
+		uint64_t getMicroseconds(std::chrono::steady_clock::duration duration) {
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+		}
+	}
+
+	uint64_t IOSchedulerStats::getAverageLatencyMicroseconds() const {
+		if (mCountCompleted == 0) {
+			return 0;
+		}
+		return (mTotalWaitMicroseconds + mTotalExecutionMicroseconds) / mCountCompleted;
+	}
+
+	IOScheduler::IOScheduler()
+		: mQueueDepth(0)
+		, mMaxQueueDepth(0) {
+	}
+
+	IOScheduler::~IOScheduler() {
+		stop();
+	}
+
+	void IOScheduler::start(uint32_t countThreads, uint32_t maxQueueDepth) {
+		if (countThreads == 0) {
+			countThreads = std::max(kMinDefaultCountThreads, std::thread::hardware_concurrency());
+		}
+		mMaxQueueDepth = std::max(1U, maxQueueDepth);
+		mThreadPool.start(countThreads);
+	}
+
+	void IOScheduler::stop() {
+		mThreadPool.stop();
+		SFAT_ASSERT(mQueueDepth == 0, "All pending requests should be executed before the workers stop!");
+	}
+
+	bool IOScheduler::isStarted() const {
+		return mThreadPool.isStarted();
+	}
+
+	uint32_t IOScheduler::getCountThreads() const {
+		return mThreadPool.getCountThreads();
+	}
+
+	void IOScheduler::submit(IOPriority priority, IORequestTask task) {
+		IORequest request;
+		request.mTask = std::move(task);
+		_enqueue(priority, std::move(request));
+	}
+
+	void IOScheduler::submit(IOPriority priority, IORequestTask task, std::shared_future<ErrorCode>& completion) {
+		IORequest request;
+		request.mTask = std::move(task);
+		completion = request.mCompletion.get_future().share();
+		_enqueue(priority, std::move(request));
+	}
+
+	ErrorCode IOScheduler::wait(const std::shared_future<ErrorCode>& completion) {
+		SFAT_ASSERT(completion.valid(), "There is no request to wait for!");
+		if (mThreadPool.isWorkerThread()) {
+			// All workers could be waiting otherwise.
+			while (completion.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				if (!mThreadPool.tryRunPendingTask()) {
+					completion.wait_for(std::chrono::milliseconds(1));
+				}
+			}
+		}
+		return completion.get();
+	}
+
+	IOSchedulerStats IOScheduler::getStats(IOPriority priority) const {
+		SFATLockGuard lock(mMutex);
+		return mStats[static_cast<uint32_t>(priority)];
+	}
+
+	uint32_t IOScheduler::getQueueDepth() const {
+		SFATLockGuard lock(mMutex);
+		return mQueueDepth;
+	}
+
+	void IOScheduler::_enqueue(IOPriority priority, IORequest&& request) {
+		SFAT_ASSERT(priority < IOPriority::IOP_COUNT, "Invalid priority of the I/O request!");
+		if (!isStarted()) {
+			request.mCompletion.set_value(request.mTask());
+			return;
+		}
+
+		request.mSubmitTime = std::chrono::steady_clock::now();
+		{
+			SFATLockGuard lock(mMutex);
+			if (!mThreadPool.isWorkerThread()) {
+				mQueueSpaceCondition.wait(mMutex, [this]() { return mQueueDepth < mMaxQueueDepth; });
+			}
+			IOSchedulerStats& stats = mStats[static_cast<uint32_t>(priority)];
+			++stats.mQueueDepth;
+			stats.mMaxQueueDepth = std::max(stats.mMaxQueueDepth, stats.mQueueDepth);
+			++mQueueDepth;
+			mPendingRequests[static_cast<uint32_t>(priority)].push_back(std::move(request));
+		}
+		// Every task executes the request with the highest priority at the moment, not necessarily this one.
+		mThreadPool.submit([this]() { _executeNext(); });
+	}
+
+	void IOScheduler::_executeNext() {
+		IORequest request;
+		uint32_t priorityIndex = 0;
+		{
+			SFATLockGuard lock(mMutex);
+			while ((priorityIndex < static_cast<uint32_t>(IOPriority::IOP_COUNT)) && mPendingRequests[priorityIndex].empty()) {
+				++priorityIndex;
+			}
+			SFAT_ASSERT(priorityIndex < static_cast<uint32_t>(IOPriority::IOP_COUNT), "There should be a pending request for every task!");
+			request = std::move(mPendingRequests[priorityIndex].front());
+			mPendingRequests[priorityIndex].pop_front();
+			--mStats[priorityIndex].mQueueDepth;
+			--mQueueDepth;
+		}
+		mQueueSpaceCondition.notify_one();
+
+		const auto startTime = std::chrono::steady_clock::now();
+		ErrorCode err = request.mTask();
+		const auto endTime = std::chrono::steady_clock::now();
+
+		{
+			SFATLockGuard lock(mMutex);
+			IOSchedulerStats& stats = mStats[priorityIndex];
+			const uint64_t waitMicroseconds = getMicroseconds(startTime - request.mSubmitTime);
+			++stats.mCountCompleted;
+			if (err != ErrorCode::RESULT_OK) {
+				++stats.mCountFailed;
+			}
+			stats.mTotalWaitMicroseconds += waitMicroseconds;
+			stats.mMaxWaitMicroseconds = std::max(stats.mMaxWaitMicroseconds, waitMicroseconds);
+			stats.mTotalExecutionMicroseconds += getMicroseconds(endTime - startTime);
+		}
+		// Set after the stats are updated, so they include the request when the waiting thread continues.
+		request.mCompletion.set_value(err);
+	}
+
+} // namespace SFAT
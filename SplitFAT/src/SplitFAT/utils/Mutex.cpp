@@ -117,4 +117,39 @@ namespace SFAT {
 	}
 #endif
 
+
+	void SFATSharedMutex::lock() {
+		mMutex.lock();
+	}
+
+	void SFATSharedMutex::unlock() {
+		mMutex.unlock();
+	}
+
+	void SFATSharedMutex::lockShared() {
+		mMutex.lock_shared();
+	}
+
+	void SFATSharedMutex::unlockShared() {
+		mMutex.unlock_shared();
+	}
+
+	SFATSharedLockGuard::SFATSharedLockGuard(SFATSharedMutex& mutex)
+		: mMutex(mutex) {
+		mutex.lockShared();
+	}
+
+	SFATSharedLockGuard::~SFATSharedLockGuard() {
+		mMutex.unlockShared();
+	}
+
+	SFATExclusiveLockGuard::SFATExclusiveLockGuard(SFATSharedMutex& mutex)
+		: mMutex(mutex) {
+		mutex.lock();
+	}
+
+	SFATExclusiveLockGuard::~SFATExclusiveLockGuard() {
+		mMutex.unlock();
+	}
+
 } // namespace SFAT
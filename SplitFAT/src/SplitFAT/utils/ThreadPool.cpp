@@ -0,0 +1,162 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include "SplitFAT/utils/ThreadPool.h"
+#include "SplitFAT/utils/SFATAssert.h"
+#include <algorithm>
+#include <thread>
+
+namespace SFAT {
+
+	namespace {
+		// The pool and the index of the worker running on the current thread.
+		thread_local const ThreadPool* tCurrentPool = nullptr;
+		thread_local uint32_t tCurrentWorkerIndex = 0;
+	}
+
+	ThreadPool::ThreadPool()
+		: mCountThreads(0)
+		, mCountQueuedTasks(0)
+		, mNextQueueIndex(0)
+		, mCountStolenTasks(0)
+		, mIsStopping(false) {
+	}
+
+	ThreadPool::~ThreadPool() {
+		stop();
+	}
+
+	void ThreadPool::start(uint32_t countThreads) {
+		SFAT_ASSERT(!isStarted(), "The thread pool is already started!");
+		if (countThreads == 0) {
+			countThreads = std::max(1U, std::thread::hardware_concurrency());
+		}
+
+		mIsStopping = false;
+		for (uint32_t i = 0; i < countThreads; ++i) {
+			mQueues.emplace_back(std::make_unique<WorkerQueue>());
+		}
+		for (uint32_t i = 0; i < countThreads; ++i) {
+			mThreads.emplace_back(&ThreadPool::_workerLoop, this, i);
+		}
+		mCountThreads = countThreads;
+	}
+
+	void ThreadPool::stop() {
+		if (!isStarted()) {
+			return;
+		}
+
+		{
+			SFATLockGuard lock(mWakeMutex);
+			mIsStopping = true;
+		}
+		mWakeCondition.notify_all();
+		for (auto& thread : mThreads) {
+			thread.join();
+		}
+		mThreads.clear();
+		mCountThreads = 0;
+		SFAT_ASSERT(mCountQueuedTasks == 0, "All queued tasks should be executed before the workers stop!");
+		mQueues.clear();
+	}
+
+	bool ThreadPool::isStarted() const {
+		return mCountThreads != 0;
+	}
+
+	uint32_t ThreadPool::getCountThreads() const {
+		return mCountThreads;
+	}
+
+	void ThreadPool::submit(ThreadPoolTask task) {
+		if (!isStarted()) {
+			task();
+			return;
+		}
+
+		{
+			// Counted under the wake mutex, so a worker going to sleep can't miss it.
+			// Counted before it is queued, so the count can't go below zero.
+			SFATLockGuard lock(mWakeMutex);
+			++mCountQueuedTasks;
+		}
+		const uint32_t queueIndex = isWorkerThread() ? tCurrentWorkerIndex : (mNextQueueIndex++ % static_cast<uint32_t>(mQueues.size()));
+		{
+			WorkerQueue& queue = *mQueues[queueIndex];
+			SFATLockGuard lock(queue.mMutex);
+			queue.mTasks.push_back(std::move(task));
+		}
+		mWakeCondition.notify_one();
+	}
+
+	bool ThreadPool::tryRunPendingTask() {
+		if (!isStarted()) {
+			return false;
+		}
+
+		ThreadPoolTask task;
+		if (!_tryPopTask(isWorkerThread() ? tCurrentWorkerIndex : 0, task)) {
+			return false;
+		}
+		task();
+		return true;
+	}
+
+	bool ThreadPool::isWorkerThread() const {
+		return tCurrentPool == this;
+	}
+
+	uint32_t ThreadPool::getCountStolenTasks() const {
+		return mCountStolenTasks;
+	}
+
+	void ThreadPool::_workerLoop(uint32_t workerIndex) {
+		tCurrentPool = this;
+		tCurrentWorkerIndex = workerIndex;
+
+		for (;;) {
+			ThreadPoolTask task;
+			if (_tryPopTask(workerIndex, task)) {
+				task();
+				continue;
+			}
+
+			SFATLockGuard lock(mWakeMutex);
+			mWakeCondition.wait(mWakeMutex, [this]() { return mIsStopping || (mCountQueuedTasks != 0); });
+			if (mIsStopping && (mCountQueuedTasks == 0)) {
+				break;
+			}
+		}
+
+		tCurrentPool = nullptr;
+	}
+
+	bool ThreadPool::_tryPopTask(uint32_t workerIndex, ThreadPoolTask& task) {
+		const uint32_t countQueues = static_cast<uint32_t>(mQueues.size());
+		for (uint32_t i = 0; i < countQueues; ++i) {
+			const uint32_t queueIndex = (workerIndex + i) % countQueues;
+			WorkerQueue& queue = *mQueues[queueIndex];
+			SFATLockGuard lock(queue.mMutex);
+			if (queue.mTasks.empty()) {
+				continue;
+			}
+			if (i == 0) {
+				// The most recent of the own tasks - its data is most likely still in the CPU cache.
+				task = std::move(queue.mTasks.back());
+				queue.mTasks.pop_back();
+			}
+			else {
+				task = std::move(queue.mTasks.front());
+				queue.mTasks.pop_front();
+				++mCountStolenTasks;
+			}
+			--mCountQueuedTasks;
+			return true;
+		}
+		return false;
+	}
+
+} // namespace SFAT
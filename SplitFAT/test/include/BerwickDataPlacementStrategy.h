@@ -39,6 +39,7 @@ namespace Core { namespace SFAT {
 		BerwickDataPlacementStrategy(::SFAT::VolumeManager& volumeManager, ::SFAT::VirtualFileSystem& virtualFileSystem);
 		virtual ::SFAT::ErrorCode prepareForWriteTransaction() override;
 		virtual ::SFAT::ErrorCode performDefragmentaionOnTransactionEnd() override;
+		using ::SFAT::DataPlacementStrategyBase::findFreeCluster;
 		virtual ::SFAT::ErrorCode findFreeCluster(::SFAT::ClusterIndexType& newClusterIndex, bool useFileDataStorage) override;
 
 		// Moves all content as close as possible toward the beginning of the block.
@@ -55,6 +56,9 @@ namespace Core { namespace SFAT {
 		// It can use any free cluster space and also can move any cluster (new allocated or pre-transaction allocated).
 		::SFAT::ErrorCode optimizeBlockContent(uint32_t blockIndex, uint32_t lastChangedChunkIndex, const ::SFAT::BitSet& initialFreeClustersSet);
 
+	protected:
+		virtual bool _canContinueChainInBlock(uint32_t blockIndex) const override;
+
 	private:
 		static float calculateDegradationScore(const ::SFAT::FATBlockTableType& table);
 
@@ -35,8 +35,12 @@ namespace SFAT {
 		WindowsDataPlacementStrategy(VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem);
 		virtual ErrorCode prepareForWriteTransaction() override;
 		virtual ErrorCode performDefragmentaionOnTransactionEnd() override;
+		using DataPlacementStrategyBase::findFreeCluster;
 		virtual ErrorCode findFreeCluster(ClusterIndexType& newClusterIndex, bool useFileDataStorage) override;
 
+	protected:
+		virtual bool _canContinueChainInBlock(uint32_t blockIndex) const override;
+
 	private:
 		static float calculateDegradationScore(const FATBlockTableType& table);
 
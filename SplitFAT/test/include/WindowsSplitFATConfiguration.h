@@ -40,6 +40,11 @@ namespace SFAT {
 		virtual ErrorCode createDataPlacementStrategy(std::shared_ptr<DataPlacementStrategyBase>& dataPlacementStrategy,
 			VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem) override;
 
+		// Caching
+		virtual ErrorCode tryOpenWarmCacheManifest(FileHandle& fileHandle) override;
+		virtual ErrorCode createWarmCacheManifest(FileHandle& fileHandle) override;
+		virtual ErrorCode removeWarmCacheManifest() override;
+
 	protected:
 		// Transaction
 		virtual const char* _getTransactionFinalFilePath() const override;
@@ -60,6 +65,8 @@ namespace SFAT {
 		std::string mTransactionTempFilePath;
 		std::string mTransactionFinalFilePath;
 		std::string mTransactionPath;
+
+		std::string mWarmCacheManifestPath;
 	};
 
 } // namespace SFAT
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "Core/Debug/DebugUtils.h"
 #include "Core/Debug/Log.h"
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/FATCellDecoder.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/utils/CRC.h"
@@ -19,6 +20,7 @@
 #include "BerwickDataPlacementStrategy.h"
 
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/FATCellDecoder.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/utils/CRC.h"
@@ -174,17 +176,34 @@ namespace Core {
 		if (size == 0) {
 			return 0.0f;
 		}
-		bool previousIsOccupied = false;
-		size_t i = size;
+		typedef ::SFAT::BitSet::ElementType ElementType;
+		constexpr uint32_t bitsPerWord = sizeof(ElementType) * 8;
+
+		// Decode the free cells in bulk and find the (backward) starts of the free intervals a word at a time.
+		::SFAT::BitSet freeClustersSet;
+		::SFAT::FATCellDecoder::decodeFreeClusters(table, freeClustersSet);
+		const ElementType* freeWords = freeClustersSet.getElementsData();
+		size_t countWords = freeClustersSet.getElementsCount();
+		size_t countTailCells = size % bitsPerWord;
+		ElementType nextIsOccupied = 0;
+		size_t wordIndex = countWords;
 		do {
-			--i;
-			bool currentIsFree = table[i].isFreeCluster();
-			if (previousIsOccupied && currentIsFree) {
+			--wordIndex;
+			ElementType freeBits = freeWords[wordIndex];
+			if ((wordIndex == countWords - 1) && (countTailCells > 0)) {
+				// The cells after the end of the table should not be counted as occupied.
+				freeBits |= ~static_cast<ElementType>(0) << countTailCells;
+			}
+			// A free cell is a start of an interval if the next cell is occupied.
+			ElementType intervalStarts = freeBits & ((~freeBits >> 1) | (nextIsOccupied << (bitsPerWord - 1)));
+			nextIsOccupied = (~freeBits) & 1;
+			while (intervalStarts != 0) {
+				size_t i = wordIndex * bitsPerWord + ::SFAT::BitSet::countTrailingZeros(intervalStarts);
 				degradationScore += static_cast<uint32_t>(size - i);
 				++countIntervals;
+				intervalStarts &= intervalStarts - 1;
 			}
-			previousIsOccupied = !currentIsFree;
-		} while (i > 0);
+		} while (wordIndex > 0);
 		if (countIntervals > 0) {
 			// Calculates an average from the starts of the free cluster intervals.
 			return static_cast<float>(degradationScore) / static_cast<float>(countIntervals);
@@ -287,6 +306,11 @@ namespace Core {
 		return mVolumeManager.findFreeCluster(newClusterIndex, useFileDataStorage);
 	}
 
+	bool BerwickDataPlacementStrategy::_canContinueChainInBlock(uint32_t blockIndex) const {
+		// While active, the new clusters should go into the selected block.
+		return !isActive() || (blockIndex == getSelectedBlockIndex());
+	}
+
 	::SFAT::ErrorCode BerwickDataPlacementStrategy::optimizeBlockContentConservative(uint32_t blockIndex, uint32_t lastChangedChunkIndex, const ::SFAT::BitSet& initialFreeClustersSet) {
 		UNUSED1(lastChangedChunkIndex);
 		if (!mVolumeManager.isInTransaction()) {
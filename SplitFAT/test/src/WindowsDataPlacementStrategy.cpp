@@ -5,6 +5,7 @@
 
 #include "WindowsDataPlacementStrategy.h"
 #include "SplitFAT/FAT.h"
+#include "SplitFAT/FATCellDecoder.h"
 #include "SplitFAT/AbstractFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/utils/SFATAssert.h"
@@ -167,15 +168,24 @@ namespace SFAT {
 	float WindowsDataPlacementStrategy::calculateDegradationScore(const FATBlockTableType& table) {
 		uint32_t degradationScore = 0UL;
 		uint32_t countIntervals = 0UL;
-		size_t size = table.size();
-		bool lastWasOccupied = false;
-		for (size_t i = 0; i < size; ++i) {
-			bool currentIsFree = table[i].isFreeCluster();
-			if (lastWasOccupied && currentIsFree) {
-				degradationScore += static_cast<uint32_t>(i);
+		constexpr uint32_t bitsPerWord = sizeof(BitSet::ElementType) * 8;
+
+		// Decode the free cells in bulk and find the starts of the free intervals a word at a time.
+		BitSet freeClustersSet;
+		FATCellDecoder::decodeFreeClusters(table, freeClustersSet);
+		const BitSet::ElementType* freeWords = freeClustersSet.getElementsData();
+		size_t countWords = freeClustersSet.getElementsCount();
+		BitSet::ElementType lastWasOccupied = 0;
+		for (size_t wordIndex = 0; wordIndex < countWords; ++wordIndex) {
+			BitSet::ElementType freeBits = freeWords[wordIndex];
+			// A free cell is a start of an interval if the previous cell is occupied.
+			BitSet::ElementType intervalStarts = freeBits & ((~freeBits << 1) | lastWasOccupied);
+			lastWasOccupied = (~freeBits) >> (bitsPerWord - 1);
+			while (intervalStarts != 0) {
+				degradationScore += static_cast<uint32_t>(wordIndex * bitsPerWord + BitSet::countTrailingZeros(intervalStarts));
 				++countIntervals;
+				intervalStarts &= intervalStarts - 1;
 			}
-			lastWasOccupied = !currentIsFree;
 		}
 		if (countIntervals > 0) {
 			// Calculates an average from the starts of the free cluster intervals.
@@ -276,6 +286,11 @@ namespace SFAT {
 		return mVolumeManager.findFreeCluster(newClusterIndex, useFileDataStorage);
 	}
 
+	bool WindowsDataPlacementStrategy::_canContinueChainInBlock(uint32_t blockIndex) const {
+		// While active, the new clusters should go into the selected block.
+		return !isActive() || (blockIndex == getSelectedBlockIndex());
+	}
+
 	//ErrorCode onNewClusterAllocated(ClusterIndexType newClusterIndex, bool useFileDataStorage) {
 	//	return ErrorCode::RESULT_OK;
 	//}
@@ -17,6 +17,7 @@ namespace SFAT {
 	namespace {
 		const char* kTransactionFileName = "_sfat_trans.dat";
 		const char* kTransactionTempFileName = "_sfat_trans_temp.dat";
+		const char* kWarmCacheManifestFileName = "_sfat_warm_cache.dat";
 	}
 
 	/**************************************************************************
@@ -43,6 +44,7 @@ namespace SFAT {
 			mTransactionPath = std::move(PathString(fatDataFilePath).getParentPath().getString());
 			mTransactionTempFilePath = std::move(PathString::combinePath(mTransactionPath, kTransactionTempFileName).getString());
 			mTransactionFinalFilePath = std::move(PathString::combinePath(mTransactionPath, kTransactionFileName).getString());
+			mWarmCacheManifestPath = std::move(PathString::combinePath(mTransactionPath, kWarmCacheManifestFileName).getString());
 
 			mFATAndClusterDataStorage = std::make_shared<WindowsFileStorage>(); // Uses the same storage for FAT, volume control dara and cluster data
 
@@ -128,6 +130,11 @@ namespace SFAT {
 			}
 		}
 
+		ErrorCode err = removeWarmCacheManifest();
+		if (err != ErrorCode::RESULT_OK) {
+			return err;
+		}
+
 		if (clusterDataFileExists()) {
 			ErrorCode err = mFATAndClusterDataStorage->deleteFile(_getClusterDataFilePath());
 			if (err != ErrorCode::RESULT_OK) {
@@ -139,6 +146,42 @@ namespace SFAT {
 		return ErrorCode::RESULT_OK;
 	}
 
+	ErrorCode WindowsSplitFATConfiguration::tryOpenWarmCacheManifest(FileHandle& fileHandle) {
+		SFAT_ASSERT(mFATAndClusterDataStorage != nullptr, "The combine FAT and Cluster data storage should exist!");
+
+		if (!mFATAndClusterDataStorage->fileExists(mWarmCacheManifestPath.c_str())) {
+			return ErrorCode::RESULT_OK;
+		}
+		ErrorCode err = mFATAndClusterDataStorage->openFile(fileHandle, mWarmCacheManifestPath.c_str(), "rb");
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't open the warm-cache manifest.");
+		}
+		return err;
+	}
+
+	ErrorCode WindowsSplitFATConfiguration::createWarmCacheManifest(FileHandle& fileHandle) {
+		SFAT_ASSERT(mFATAndClusterDataStorage != nullptr, "The combine FAT and Cluster data storage should exist!");
+
+		ErrorCode err = mFATAndClusterDataStorage->openFile(fileHandle, mWarmCacheManifestPath.c_str(), "wb");
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't create the warm-cache manifest.");
+		}
+		return err;
+	}
+
+	ErrorCode WindowsSplitFATConfiguration::removeWarmCacheManifest() {
+		SFAT_ASSERT(mFATAndClusterDataStorage != nullptr, "The combine FAT and Cluster data storage should exist!");
+
+		if (!mFATAndClusterDataStorage->fileExists(mWarmCacheManifestPath.c_str())) {
+			return ErrorCode::RESULT_OK;
+		}
+		ErrorCode err = mFATAndClusterDataStorage->deleteFile(mWarmCacheManifestPath.c_str());
+		if (err != ErrorCode::RESULT_OK) {
+			SFAT_LOGE(LogArea::LA_PHYSICAL_DISK, "Can't delete the warm-cache manifest.");
+		}
+		return err;
+	}
+
 	ErrorCode WindowsSplitFATConfiguration::flushFATDataFile() {
 		ErrorCode err = mFATDataFile.flush();
 		return err;
@@ -4,6 +4,8 @@
 *********************************************************/
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
 #include <SplitFAT/utils/BitSet.h>
 
 using namespace SFAT;
@@ -275,3 +277,165 @@ TEST(BitSet, BooleanOperations) {
 		}
 	}
 }
+
+namespace {
+
+	// Creates a set with random runs of ones and zeros. setAll(true) leaves ones after the end of the set, which the search functions should ignore.
+	BitSet createRandomRunsBitSet(size_t size, std::mt19937& generator) {
+		BitSet bitSet(size);
+		bitSet.setAll(true);
+		std::uniform_int_distribution<size_t> runDistribution(1, 300);
+		bool value = false;
+		size_t index = 0;
+		while (index < size) {
+			size_t runLength = std::min(runDistribution(generator), size - index);
+			for (size_t i = 0; i < runLength; ++i) {
+				bitSet.setValue(index + i, value);
+			}
+			index += runLength;
+			value = !value;
+		}
+		return bitSet;
+	}
+
+	bool slowFindFirstRun(const BitSet& bitSet, size_t& startIndexFound, bool valueToLookFor, size_t length, size_t startIndex) {
+		size_t runLength = 0;
+		for (size_t i = startIndex; i < bitSet.getSize(); ++i) {
+			runLength = (bitSet.getValue(i) == valueToLookFor) ? runLength + 1 : 0;
+			if (runLength == length) {
+				startIndexFound = i + 1 - length;
+				return true;
+			}
+		}
+		return false;
+	}
+
+} // namespace
+
+TEST(BitSet, RandomSearchMatchesGetValue) {
+	std::mt19937 generator(31);
+	const size_t sizes[] = { 1, 63, 64, 65, 255, 256, 257, 1000, 32768 };
+	for (size_t size : sizes) {
+		BitSet bitSet = createRandomRunsBitSet(size, generator);
+		size_t countOnes = 0;
+		for (size_t i = 0; i < size; ++i) {
+			countOnes += bitSet.getValue(i) ? 1 : 0;
+		}
+		EXPECT_EQ(bitSet.getCountOnes(), countOnes);
+		EXPECT_EQ(bitSet.getCountZeros(), size - countOnes);
+
+		std::uniform_int_distribution<size_t> indexDistribution(0, size - 1);
+		for (int test = 0; test < 50; ++test) {
+			size_t index = indexDistribution(generator);
+			size_t count = indexDistribution(generator) % 200;
+			for (int value = 0; value < 2; ++value) {
+				size_t expectedFirst = BitSet::npos;
+				for (size_t i = index; i < size; ++i) {
+					if (bitSet.getValue(i) == (value != 0)) {
+						expectedFirst = i;
+						break;
+					}
+				}
+				size_t bitIndexFound;
+				EXPECT_EQ(bitSet.findFirst(bitIndexFound, value != 0, index), expectedFirst != BitSet::npos);
+				EXPECT_EQ(bitIndexFound, expectedFirst);
+
+				size_t expectedLast = BitSet::npos;
+				for (size_t i = index + 1; i > 0; --i) {
+					if (bitSet.getValue(i - 1) == (value != 0)) {
+						expectedLast = i - 1;
+						break;
+					}
+				}
+				EXPECT_EQ(bitSet.findLast(bitIndexFound, value != 0, index), expectedLast != BitSet::npos);
+				EXPECT_EQ(bitIndexFound, expectedLast);
+
+				size_t expectedStartOfLastK = BitSet::npos;
+				size_t countFound = 0;
+				for (size_t i = index + 1; (i > 0) && (count > 0); --i) {
+					if ((bitSet.getValue(i - 1) == (value != 0)) && (++countFound == count)) {
+						expectedStartOfLastK = i - 1;
+						break;
+					}
+				}
+				EXPECT_EQ(bitSet.findStartOfLastKElements(bitIndexFound, value != 0, index, count), expectedStartOfLastK != BitSet::npos);
+				EXPECT_EQ(bitIndexFound, expectedStartOfLastK);
+
+				size_t expectedRunStart = BitSet::npos;
+				bool expectedRunFound = slowFindFirstRun(bitSet, expectedRunStart, value != 0, count, index);
+				EXPECT_EQ(bitSet.findFirstRun(bitIndexFound, value != 0, count, index), expectedRunFound && (count > 0));
+				EXPECT_EQ(bitIndexFound, (count > 0) ? expectedRunStart : BitSet::npos);
+			}
+
+			size_t expectedCountOnes = 0;
+			for (size_t i = index; (i < index + count) && (i < size); ++i) {
+				expectedCountOnes += bitSet.getValue(i) ? 1 : 0;
+			}
+			EXPECT_EQ(bitSet.getCountOnes(index, count), expectedCountOnes);
+			EXPECT_EQ(bitSet.anyInRange(index, count), expectedCountOnes > 0);
+		}
+
+		size_t expectedLast;
+		bool expectedLastFound = bitSet.findLast(expectedLast, true, size - 1);
+		size_t bitIndexFound;
+		EXPECT_EQ(bitSet.findLast(bitIndexFound, true), expectedLastFound);
+		EXPECT_EQ(bitIndexFound, expectedLast);
+	}
+}
+
+TEST(BitSet, FindLongestRun) {
+	BitSet bitSet(1000);
+	bitSet.setAll(false);
+	size_t startIndexFound;
+	size_t lengthFound;
+	EXPECT_EQ(bitSet.findLongestRun(startIndexFound, lengthFound, true), false);
+	EXPECT_EQ(startIndexFound, BitSet::npos);
+	EXPECT_EQ(lengthFound, 0);
+	EXPECT_EQ(bitSet.findLongestRun(startIndexFound, lengthFound, false), true);
+	EXPECT_EQ(startIndexFound, 0);
+	EXPECT_EQ(lengthFound, 1000);
+
+	bitSet.setRange(10, 5, true);
+	bitSet.setRange(60, 130, true);
+	bitSet.setRange(300, 130, true);
+	bitSet.setRange(990, 100, true);
+	EXPECT_EQ(bitSet.findLongestRun(startIndexFound, lengthFound, true), true);
+	EXPECT_EQ(startIndexFound, 60);
+	EXPECT_EQ(lengthFound, 130);
+	EXPECT_EQ(bitSet.findLongestRun(startIndexFound, lengthFound, false), true);
+	EXPECT_EQ(startIndexFound, 430);
+	EXPECT_EQ(lengthFound, 560);
+
+	// The run at the end of the set should be clipped.
+	EXPECT_EQ(bitSet.findFirstRun(startIndexFound, true, 10, 431), true);
+	EXPECT_EQ(startIndexFound, 990);
+	EXPECT_EQ(bitSet.findFirstRun(startIndexFound, true, 11, 431), false);
+	EXPECT_EQ(startIndexFound, BitSet::npos);
+}
+
+TEST(BitSet, SetRange) {
+	std::mt19937 generator(7);
+	const size_t size = 1000;
+	std::uniform_int_distribution<size_t> indexDistribution(0, size + 10);
+	BitSet bitSet(size);
+	std::vector<bool> expected(size, false);
+	bitSet.setAll(false);
+	for (int test = 0; test < 200; ++test) {
+		size_t startIndex = indexDistribution(generator);
+		size_t count = indexDistribution(generator) % 150;
+		bool value = (test % 3) != 0;
+		bitSet.setRange(startIndex, count, value);
+		for (size_t i = startIndex; (i < startIndex + count) && (i < size); ++i) {
+			expected[i] = value;
+		}
+		for (size_t i = 0; i < size; ++i) {
+			ASSERT_EQ(bitSet.getValue(i), expected[i]) << "Test #" << test << ", index " << i;
+		}
+	}
+
+	// Should stay in the range of the set.
+	bitSet.setAll(false);
+	bitSet.setRange(900, BitSet::npos, true);
+	EXPECT_EQ(bitSet.getCountOnes(), 100);
+	EXPECT_EQ(bitSet.getElementsData()[bitSet.getElementsCount() - 1] >> (size % 64), 0);
+}
@@ -0,0 +1,355 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include <SplitFAT/ClusterCache.h>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+using namespace SFAT;
+
+namespace {
+
+	const size_t kClusterSize = 64;
+
+	std::vector<uint8_t> createClusterData(ClusterIndexType clusterIndex) {
+		return std::vector<uint8_t>(kClusterSize, static_cast<uint8_t>(clusterIndex));
+	}
+
+	void insertCluster(ClusterCache& cache, ClusterIndexType clusterIndex, ClusterCachePriority priority = ClusterCachePriority::CCP_FILE_DATA, bool isInSync = true) {
+		std::vector<uint8_t> data = createClusterData(clusterIndex);
+		cache.insert(clusterIndex, data.data(), priority, isInSync);
+	}
+
+} // namespace
+
+// Tests that the cache stays in its budget and counts the hits, the misses and the evictions.
+TEST(ClusterCache, BudgetIsRespected) {
+	ClusterCache cache(kClusterSize, 16 * kClusterSize);
+	EXPECT_EQ(cache.getMaxCountClusters(), 16u);
+
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 100; ++clusterIndex) {
+		EXPECT_EQ(cache.find(clusterIndex), nullptr);
+		insertCluster(cache, clusterIndex);
+		EXPECT_LE(cache.getCountCachedClusters(), 16u);
+	}
+
+	// The last inserted cluster is still there with the correct data.
+	const uint8_t* buffer = cache.find(99);
+	ASSERT_NE(buffer, nullptr);
+	EXPECT_EQ(memcmp(buffer, createClusterData(99).data(), kClusterSize), 0);
+
+	const ClusterCacheStats& stats = cache.getStats();
+	EXPECT_EQ(stats.mCountMisses, 100u);
+	EXPECT_EQ(stats.mCountHits, 1u);
+	EXPECT_EQ(stats.mCountEvictions, 100u - 16u);
+
+	// The smaller budget evicts the clusters immediately.
+	cache.setMaxBytes(4 * kClusterSize);
+	EXPECT_EQ(cache.getCountCachedClusters(), 4u);
+}
+
+// Tests that a single scan through many clusters doesn't evict the frequently used clusters.
+TEST(ClusterCache, ScanDoesNotEvictHotClusters) {
+	ClusterCache cache(kClusterSize, 16 * kClusterSize);
+
+	// Make the clusters 0..7 frequently used - they get evicted once and then are added again.
+	const ClusterIndexType kCountHotClusters = 8;
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < kCountHotClusters; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	for (ClusterIndexType clusterIndex = 1000; clusterIndex < 1016; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < kCountHotClusters; ++clusterIndex) {
+		EXPECT_EQ(cache.find(clusterIndex), nullptr);
+		insertCluster(cache, clusterIndex);
+	}
+	EXPECT_EQ(cache.getStats().mCountGhostHits, kCountHotClusters);
+
+	// Scan through a large file.
+	for (ClusterIndexType clusterIndex = 2000; clusterIndex < 3000; ++clusterIndex) {
+		if (cache.find(clusterIndex) == nullptr) {
+			insertCluster(cache, clusterIndex);
+		}
+	}
+
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < kCountHotClusters; ++clusterIndex) {
+		EXPECT_NE(cache.find(clusterIndex), nullptr);
+	}
+}
+
+// Tests that the metadata is evicted only if there is no file data to be evicted.
+TEST(ClusterCache, MetadataHasPriority) {
+	ClusterCache cache(kClusterSize, 8 * kClusterSize);
+
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 4; ++clusterIndex) {
+		insertCluster(cache, clusterIndex, ClusterCachePriority::CCP_METADATA);
+	}
+	for (ClusterIndexType clusterIndex = 100; clusterIndex < 200; ++clusterIndex) {
+		insertCluster(cache, clusterIndex, ClusterCachePriority::CCP_FILE_DATA);
+	}
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 4; ++clusterIndex) {
+		EXPECT_NE(cache.peek(clusterIndex), nullptr);
+	}
+
+	// Only metadata left to be evicted.
+	for (ClusterIndexType clusterIndex = 1000; clusterIndex < 1100; ++clusterIndex) {
+		insertCluster(cache, clusterIndex, ClusterCachePriority::CCP_METADATA);
+	}
+	EXPECT_EQ(cache.getCountCachedClusters(), 8u);
+	EXPECT_EQ(cache.peek(0), nullptr);
+}
+
+// Tests that the clusters not in sync with the storage are never evicted, and are visited in the order of the cluster indices.
+TEST(ClusterCache, DirtyClustersAreNotEvicted) {
+	ClusterCache cache(kClusterSize, 4 * kClusterSize);
+
+	for (ClusterIndexType clusterIndex = 10; clusterIndex > 0; --clusterIndex) {
+		insertCluster(cache, clusterIndex, ClusterCachePriority::CCP_METADATA, false);
+	}
+	EXPECT_EQ(cache.getCountDirtyClusters(), 10u);
+	EXPECT_EQ(cache.getCountCachedClusters(), 10u);
+	EXPECT_EQ(cache.getStats().mCountEvictions, 0u);
+
+	// The budget is exceeded by the dirty clusters, so a cluster in sync doesn't stay.
+	insertCluster(cache, 500);
+	EXPECT_EQ(cache.getCountCachedClusters(), 10u);
+	EXPECT_EQ(cache.peek(500), nullptr);
+	// Overwrite a dirty cluster
+	std::vector<uint8_t> data(kClusterSize, 0xAB);
+	EXPECT_TRUE(cache.update(5, data.data(), false));
+	EXPECT_FALSE(cache.update(12345, data.data(), true));
+
+	std::vector<ClusterIndexType> visitedClusters;
+	ErrorCode err = cache.executeOnDirtyClusters([&visitedClusters, &data](ClusterIndexType clusterIndex, uint8_t* buffer, bool& isInSync)->ErrorCode {
+		visitedClusters.push_back(clusterIndex);
+		EXPECT_EQ(memcmp(buffer, ((clusterIndex == 5) ? data : createClusterData(clusterIndex)).data(), kClusterSize), 0);
+		// Only the even clusters are "written".
+		isInSync = (clusterIndex % 2 == 0);
+		return ErrorCode::RESULT_OK;
+	});
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	ASSERT_EQ(visitedClusters.size(), 10u);
+	for (size_t i = 0; i < visitedClusters.size(); ++i) {
+		EXPECT_EQ(visitedClusters[i], static_cast<ClusterIndexType>(i + 1));
+	}
+
+	// The clusters in sync could be evicted now.
+	EXPECT_EQ(cache.getCountDirtyClusters(), 5u);
+	EXPECT_EQ(cache.getCountCachedClusters(), 5u);
+	for (ClusterIndexType clusterIndex = 1; clusterIndex <= 10; clusterIndex += 2) {
+		EXPECT_NE(cache.peek(clusterIndex), nullptr);
+	}
+}
+
+// Tests that a pinned cluster is not evicted, and its data is not changed when the cluster is written or erased meanwhile.
+TEST(ClusterCache, PinnedClustersAreStable) {
+	ClusterCache cache(kClusterSize, 4 * kClusterSize);
+	const std::vector<uint8_t> originalData = createClusterData(1);
+	insertCluster(cache, 1);
+
+	uint32_t entryIndex = 0;
+	const uint8_t* pinnedData = cache.pin(1, entryIndex);
+	ASSERT_NE(pinnedData, nullptr);
+	for (ClusterIndexType clusterIndex = 2; clusterIndex < 50; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	EXPECT_EQ(cache.peek(1), pinnedData);
+
+	// The new data goes in another buffer.
+	std::vector<uint8_t> data(kClusterSize, 0xAB);
+	EXPECT_TRUE(cache.update(1, data.data(), false));
+	EXPECT_NE(cache.peek(1), pinnedData);
+	EXPECT_EQ(memcmp(pinnedData, originalData.data(), kClusterSize), 0);
+	EXPECT_EQ(memcmp(cache.peek(1), data.data(), kClusterSize), 0);
+	EXPECT_EQ(cache.getCountDirtyClusters(), 1u);
+	cache.unpin(entryIndex);
+	EXPECT_EQ(cache.getCountDirtyClusters(), 1u);
+	EXPECT_EQ(memcmp(cache.peek(1), data.data(), kClusterSize), 0);
+
+	// Pinned twice and erased.
+	uint32_t entryIndex2 = 0;
+	pinnedData = cache.pin(1, entryIndex);
+	ASSERT_NE(pinnedData, nullptr);
+	EXPECT_EQ(cache.pin(1, entryIndex2), pinnedData);
+	EXPECT_EQ(entryIndex2, entryIndex);
+	cache.erase(1);
+	EXPECT_EQ(cache.peek(1), nullptr);
+	EXPECT_EQ(cache.getCountDirtyClusters(), 0u);
+	EXPECT_EQ(memcmp(pinnedData, data.data(), kClusterSize), 0);
+	cache.unpin(entryIndex);
+	// Still pinned once, so the buffer is not reused.
+	insertCluster(cache, 100);
+	EXPECT_NE(cache.peek(100), pinnedData);
+	EXPECT_EQ(memcmp(pinnedData, data.data(), kClusterSize), 0);
+	cache.unpin(entryIndex2);
+
+	// The cluster can be evicted again after it is unpinned.
+	EXPECT_EQ(cache.pin(12345, entryIndex), nullptr);
+	pinnedData = cache.pin(100, entryIndex);
+	ASSERT_NE(pinnedData, nullptr);
+	cache.unpin(entryIndex);
+	for (ClusterIndexType clusterIndex = 200; clusterIndex < 300; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	EXPECT_EQ(cache.peek(100), nullptr);
+	EXPECT_LE(cache.getCountCachedClusters(), 4u);
+}
+
+// Tests that the memory of the evicted clusters is released when the budget is reduced, and the rest of the clusters are kept intact.
+TEST(ClusterCache, MemoryIsReleasedWhenBudgetIsReduced) {
+	const size_t kClustersPerSlab = 64;
+	const size_t kSlabBytes = kClustersPerSlab * kClusterSize + ClusterCache::kSlabAlignment;
+	ClusterCache cache(kClusterSize, ClusterCache::kMinCountSlabs * kClustersPerSlab * kClusterSize);
+	EXPECT_EQ(cache.getAllocatedBytes(), 0u);
+
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 4 * kClustersPerSlab; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	EXPECT_EQ(cache.getAllocatedBytes(), 4 * kSlabBytes);
+
+	// The pinned cluster can't be moved, so its slab is kept.
+	const ClusterIndexType pinnedClusterIndex = 2 * kClustersPerSlab;
+	uint32_t entryIndex = 0;
+	const uint8_t* pinnedData = cache.pin(pinnedClusterIndex, entryIndex);
+	ASSERT_NE(pinnedData, nullptr);
+	cache.setMaxBytes(kClustersPerSlab * kClusterSize);
+	EXPECT_EQ(cache.getAllocatedBytes(), 3 * kSlabBytes);
+	EXPECT_EQ(cache.peek(pinnedClusterIndex), pinnedData);
+	EXPECT_EQ(memcmp(pinnedData, createClusterData(pinnedClusterIndex).data(), kClusterSize), 0);
+
+	cache.unpin(entryIndex);
+	cache.setMaxBytes(kClustersPerSlab * kClusterSize);
+	EXPECT_EQ(cache.getAllocatedBytes(), kSlabBytes);
+	EXPECT_EQ(cache.getCountCachedClusters(), kClustersPerSlab);
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 4 * kClustersPerSlab; ++clusterIndex) {
+		const uint8_t* buffer = cache.peek(clusterIndex);
+		if (buffer != nullptr) {
+			EXPECT_EQ(memcmp(buffer, createClusterData(clusterIndex).data(), kClusterSize), 0);
+		}
+	}
+
+	// The moved clusters are still in the replacement order.
+	for (ClusterIndexType clusterIndex = 1000; clusterIndex < 1000 + kClustersPerSlab; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	EXPECT_EQ(cache.getCountCachedClusters(), kClustersPerSlab);
+	EXPECT_EQ(cache.getAllocatedBytes(), kSlabBytes);
+	EXPECT_EQ(cache.peek(pinnedClusterIndex), nullptr);
+
+	// Nothing is allocated without clusters.
+	cache.setMaxBytes(0);
+	cache.erase(1000 + kClustersPerSlab - 1);
+	cache.setMaxBytes(0);
+	EXPECT_EQ(cache.getAllocatedBytes(), 0u);
+}
+
+// Tests the hash table with many insertions and removals, including long probe sequences wrapping around the end of the table.
+TEST(ClusterCache, HashTable) {
+	ClusterIndexHashTable table;
+	std::map<ClusterIndexType, uint32_t> reference;
+	std::mt19937 randomGenerator(7);
+	std::uniform_int_distribution<uint32_t> keyDistribution(0, 5000);
+
+	for (uint32_t i = 0; i < 50000; ++i) {
+		const ClusterIndexType key = keyDistribution(randomGenerator);
+		if (i % 3 == 0) {
+			EXPECT_EQ(table.erase(key), reference.erase(key) > 0);
+		}
+		else {
+			table.insert(key, i);
+			reference[key] = i;
+		}
+	}
+
+	EXPECT_EQ(table.size(), reference.size());
+	const uint32_t kInvalidValue = ClusterIndexHashTable::kInvalidValue;
+	for (ClusterIndexType key = 0; key <= 5000; ++key) {
+		auto it = reference.find(key);
+		EXPECT_EQ(table.find(key), (it != reference.end()) ? it->second : kInvalidValue);
+	}
+}
+
+// Tests that the cached cluster data is aligned and stays valid when more clusters are cached.
+TEST(ClusterCache, BuffersAreAligned) {
+	ClusterCache cache(kClusterSize, 10000 * kClusterSize);
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 10000; ++clusterIndex) {
+		insertCluster(cache, clusterIndex);
+	}
+	for (ClusterIndexType clusterIndex = 0; clusterIndex < 10000; ++clusterIndex) {
+		const uint8_t* buffer = cache.peek(clusterIndex);
+		ASSERT_NE(buffer, nullptr);
+		EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer) % kClusterSize, 0u);
+		EXPECT_EQ(memcmp(buffer, createClusterData(clusterIndex).data(), kClusterSize), 0);
+	}
+}
+
+// Compares the cost of the lookups and the insertions with the std::map of separately allocated buffers, used before.
+TEST(ClusterCache, LookupBenchmark) {
+	struct ClusterDataCache {
+		ClusterIndexType mClusterIndex;
+		std::vector<uint8_t> mBuffer;
+		bool mIsCacheInSync;
+	};
+	const size_t kBenchmarkClusterSize = 256;
+	const uint32_t kCountLookupRounds = 10;
+
+	for (uint32_t countClusters : { 10000u, 100000u }) {
+		// The clusters of a volume are spread in large blocks.
+		std::vector<ClusterIndexType> clusterIndices(countClusters);
+		for (uint32_t i = 0; i < countClusters; ++i) {
+			clusterIndices[i] = (i / 1000) * 32768 + (i % 1000);
+		}
+		std::mt19937 randomGenerator(11);
+		std::shuffle(clusterIndices.begin(), clusterIndices.end(), randomGenerator);
+		std::vector<uint8_t> data(kBenchmarkClusterSize, 0x5A);
+		uint64_t checksum = 0;
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		std::map<ClusterIndexType, ClusterDataCache> cachedClusters;
+		for (ClusterIndexType clusterIndex : clusterIndices) {
+			ClusterDataCache clusterCache;
+			clusterCache.mClusterIndex = clusterIndex;
+			clusterCache.mIsCacheInSync = true;
+			clusterCache.mBuffer.assign(data.begin(), data.end());
+			cachedClusters.insert(std::pair<ClusterIndexType, ClusterDataCache>(clusterIndex, std::move(clusterCache)));
+		}
+		auto mapInsertTime = std::chrono::high_resolution_clock::now();
+		for (uint32_t round = 0; round < kCountLookupRounds; ++round) {
+			for (ClusterIndexType clusterIndex : clusterIndices) {
+				checksum += cachedClusters.find(clusterIndex)->second.mBuffer[round];
+			}
+		}
+		auto mapLookupTime = std::chrono::high_resolution_clock::now();
+
+		ClusterCache cache(kBenchmarkClusterSize, countClusters * kBenchmarkClusterSize);
+		for (ClusterIndexType clusterIndex : clusterIndices) {
+			cache.insert(clusterIndex, data.data(), ClusterCachePriority::CCP_FILE_DATA, true);
+		}
+		auto cacheInsertTime = std::chrono::high_resolution_clock::now();
+		for (uint32_t round = 0; round < kCountLookupRounds; ++round) {
+			for (ClusterIndexType clusterIndex : clusterIndices) {
+				checksum += cache.find(clusterIndex)[round];
+			}
+		}
+		auto cacheLookupTime = std::chrono::high_resolution_clock::now();
+
+		EXPECT_EQ(cache.getCountCachedClusters(), countClusters);
+		EXPECT_EQ(checksum, 2ull * kCountLookupRounds * countClusters * 0x5A);
+
+		auto nsPerOperation = [](std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end, uint32_t countOperations) {
+			return std::chrono::duration<double, std::nano>(end - start).count() / countOperations;
+		};
+		printf("%u clusters - std::map: insert %.1fns, lookup %.1fns; ClusterCache: insert %.1fns, lookup %.1fns\n", countClusters,
+			nsPerOperation(startTime, mapInsertTime, countClusters),
+			nsPerOperation(mapInsertTime, mapLookupTime, countClusters * kCountLookupRounds),
+			nsPerOperation(mapLookupTime, cacheInsertTime, countClusters),
+			nsPerOperation(cacheInsertTime, cacheLookupTime, countClusters * kCountLookupRounds));
+	}
+}
@@ -0,0 +1,95 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include <SplitFAT/utils/Compression.h>
+#include <random>
+
+using namespace SFAT;
+
+namespace {
+
+	// Some non-zero data, separated with long runs of zeros, and a few repeated records.
+	std::vector<uint8_t> createSparseData(size_t size) {
+		std::vector<uint8_t> data(size, 0);
+		std::mt19937 randomGenerator(31);
+		std::uniform_int_distribution<int> byteDistribution(1, 255);
+		for (size_t position = 0; position + 300 < size; position += 1024) {
+			for (size_t i = 0; i < 40; ++i) {
+				data[position + i] = static_cast<uint8_t>(byteDistribution(randomGenerator));
+			}
+			for (size_t i = 40; i < 300; ++i) {
+				data[position + i] = static_cast<uint8_t>(i & 0x0F);
+			}
+		}
+		return data;
+	}
+
+	std::vector<uint8_t> createRandomData(size_t size) {
+		std::vector<uint8_t> data(size, 0);
+		std::mt19937 randomGenerator(17);
+		std::uniform_int_distribution<int> byteDistribution(0, 255);
+		for (auto& value : data) {
+			value = static_cast<uint8_t>(byteDistribution(randomGenerator));
+		}
+		return data;
+	}
+
+} // namespace
+
+// Tests that the zero-run codec restores the data exactly.
+TEST(Compression, ZeroRunCodec) {
+	std::vector<uint8_t> source = createSparseData(8192);
+	std::vector<uint8_t> compressed;
+	ASSERT_TRUE(ZeroRunCodec::compress(source.data(), source.size(), compressed));
+	EXPECT_LT(compressed.size(), source.size() / 2);
+
+	std::vector<uint8_t> restored(source.size(), 0xFF);
+	EXPECT_TRUE(ZeroRunCodec::decompress(compressed.data(), compressed.size(), restored.data(), restored.size()));
+	EXPECT_TRUE(restored == source);
+
+	// All zeros
+	std::vector<uint8_t> zeros(4096, 0);
+	ASSERT_TRUE(ZeroRunCodec::compress(zeros.data(), zeros.size(), compressed));
+	EXPECT_EQ(compressed.size(), 2 * sizeof(uint32_t));
+	EXPECT_TRUE(ZeroRunCodec::decompress(compressed.data(), compressed.size(), restored.data(), zeros.size()));
+	EXPECT_TRUE(std::equal(zeros.begin(), zeros.end(), restored.begin()));
+
+	// Wrong size of the destination
+	EXPECT_FALSE(ZeroRunCodec::decompress(compressed.data(), compressed.size(), restored.data(), zeros.size() - 1));
+
+	// Data without zeros doesn't get smaller.
+	std::vector<uint8_t> noZeros(4096, 0x5A);
+	EXPECT_FALSE(ZeroRunCodec::compress(noZeros.data(), noZeros.size(), compressed));
+}
+
+// Tests that the LZ codec restores the data exactly.
+TEST(Compression, LZCodec) {
+	std::vector<uint8_t> source = createSparseData(8192);
+	std::vector<uint8_t> compressed;
+	ASSERT_TRUE(LZCodec::compress(source.data(), source.size(), compressed));
+	EXPECT_LT(compressed.size(), source.size() / 4);
+
+	std::vector<uint8_t> restored(source.size(), 0xFF);
+	EXPECT_TRUE(LZCodec::decompress(compressed.data(), compressed.size(), restored.data(), restored.size()));
+	EXPECT_TRUE(restored == source);
+
+	// Repeated text with a match reaching the end of the data
+	const char* szText = "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog.";
+	const size_t textLength = strlen(szText);
+	ASSERT_TRUE(LZCodec::compress(szText, textLength, compressed));
+	std::vector<char> restoredText(textLength, 0);
+	EXPECT_TRUE(LZCodec::decompress(compressed.data(), compressed.size(), restoredText.data(), restoredText.size()));
+	EXPECT_EQ(std::string(restoredText.begin(), restoredText.end()), std::string(szText));
+
+	// Corrupted data
+	std::vector<uint8_t> corrupted = compressed;
+	corrupted.resize(corrupted.size() / 2);
+	EXPECT_FALSE(LZCodec::decompress(corrupted.data(), corrupted.size(), restoredText.data(), restoredText.size()));
+
+	// Random data doesn't get smaller.
+	std::vector<uint8_t> randomData = createRandomData(8192);
+	EXPECT_FALSE(LZCodec::compress(randomData.data(), randomData.size(), compressed));
+}
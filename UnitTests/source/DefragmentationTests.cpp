@@ -267,3 +267,214 @@ TEST_F(DefragmentationUnitTest, OnCorrectTransactionDataShouldBeStored) {
 
 }
 
+/// Tests that the clusters freed in a transaction are neither moved by the defragmentation at its end, nor overwritten before the commit.
+TEST_F(DefragmentationUnitTest, ClustersFreedInTransactionAreNotMoved) {
+	const size_t mb = 1ULL << 20;
+	const size_t kFileSize = 20 * mb;
+	const uint32_t kCountFiles = 10;
+	const uint32_t kCountFillFiles = 6;
+	const uint32_t kVictimFileId = kCountFiles + 2;
+
+	//
+	// Stage 1
+	// - Occupy more than a half of the first cluster-data block, so it is selected for defragmentation by the next transaction.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		for (uint32_t i = 0; i < kCountFiles; ++i) {
+			std::string filePath = "file" + std::to_string(i);
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = writeFile(file, kFileSize, i + 1);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+		ErrorCode err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	//
+	// Stage 2
+	// - Write a new file into the block selected by the defragmentation, then delete and truncate files from the degraded block.
+	//   The defragmentation at the end of the transaction moves as many clusters as were written.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		{
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, "newFile", "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = writeFile(file, kFileSize, kCountFiles + 1);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		// Taken after the new file is written, as writing it could allocate a new block.
+		FileSizeType initialFreeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		err = fileStorage->deleteFile("file0");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->deleteFile("file2");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		{
+			// Opening for writing truncates the file.
+			FileHandle file;
+			err = fileStorage->openFile(file, "file1", "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			file.close();
+		}
+
+		err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// All clusters of the deleted and the truncated files should be free, and nothing else should be allocated.
+		FileSizeType freeSpace = 0;
+		err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace + 3 * kFileSize);
+
+		err = fileStorage->executeDebugCommand("", "integrityTest");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The moved clusters should keep the content of the files.
+		for (uint32_t i = 3; i < kCountFiles; ++i) {
+			std::string filePath = "file" + std::to_string(i);
+			FileHandle file;
+			err = fileStorage->openFile(file, filePath.c_str(), "rb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = readFile(file, kFileSize, i + 1);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+		FileSizeType fileSize = 0;
+		err = fileStorage->getFileSize("file1", fileSize);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(fileSize, 0U);
+	}
+
+	//
+	// Stage 3
+	// - Fill the block, which the clusters were moved to, over a half, so it is selected for defragmentation by the next transactions.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		for (uint32_t i = 0; i < kCountFillFiles; ++i) {
+			std::string filePath = "fillFile" + std::to_string(i);
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = writeFile(file, kFileSize, kVictimFileId + 1 + i);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+		ErrorCode err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	//
+	// Stage 4
+	// - Write a file into the block selected by the defragmentation. It stays the selected block for the next transaction.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		FileHandle file;
+		ErrorCode err = fileStorage->openFile(file, "victimFile", "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = writeFile(file, kFileSize, kVictimFileId);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	FileSizeType committedFreeSpace = 0;
+
+	//
+	// Stage 5
+	// - Write more than the deleted file into the same block, so clusters are moved there at the end of the transaction.
+	//   The transaction file is left after the defragmentation, as if the commit didn't complete.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		ErrorCode err = fileStorage->getFreeSpace(committedFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		for (uint32_t i = 0; i < 2; ++i) {
+			std::string filePath = "rolledBackFile" + std::to_string(i);
+			FileHandle file;
+			err = fileStorage->openFile(file, filePath.c_str(), "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = writeFile(file, kFileSize, kVictimFileId + kCountFillFiles + 1 + i);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+		err = fileStorage->deleteFile("victimFile");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The defragmentation runs here, but the transaction file is not deleted.
+		VirtualFileSystem& virtualFileSystem = fileStorage->getVirtualFileSystem();
+		virtualFileSystem._prepareForTransactionEnd();
+		err = virtualFileSystem.mVolumeManager.mTransaction._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	//
+	// Stage 6
+	// - The storage is restored from the transaction file. The deleted file should keep its content.
+	//   In undo mode the content of the clusters is not logged, so it is lost if the defragmentation moved anything over it.
+	//
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		EXPECT_FALSE(fileStorage->fileExists("rolledBackFile0"));
+
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, committedFreeSpace);
+
+		err = fileStorage->executeDebugCommand("", "integrityTest");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		FileHandle file;
+		err = fileStorage->openFile(file, "victimFile", "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = readFile(file, kFileSize, kVictimFileId);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+}
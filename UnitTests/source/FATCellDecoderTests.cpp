@@ -0,0 +1,119 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include <random>
+#include <SplitFAT/FATCellDecoder.h>
+
+using namespace SFAT;
+
+namespace {
+
+	FATBlockTableType createRandomTable(size_t countCells, uint32_t seed) {
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<uint32_t> distribution;
+		FATBlockTableType table(countCells);
+		for (size_t i = 0; i < countCells; ++i) {
+			uint32_t kind = distribution(generator) % 6;
+			switch (kind) {
+			case 0:
+				table[i] = FATCellValueType::freeCellValue();
+				break;
+			case 1:
+				table[i] = FATCellValueType::singleElementClusterChainValue();
+				break;
+			case 2: {
+					// Free cell with garbage in the bits that are not used to determine if the cell is free.
+					uint32_t next = distribution(generator) & ~static_cast<uint32_t>(ClusterValues::FLAGS_AND_INDEX_MASK);
+					table[i] = FATCellValueType(distribution(generator), next);
+				} break;
+			default:
+				table[i] = FATCellValueType(distribution(generator), distribution(generator));
+				break;
+			}
+		}
+		return table;
+	}
+
+	void verifyClassification(const FATBlockTableType& table) {
+		size_t countWords = FATCellDecoder::getCountWords(table.size());
+		std::vector<BitSet::ElementType> freeBits(countWords, 0xCDCDCDCDCDCDCDCDULL);
+		std::vector<BitSet::ElementType> startBits(countWords, 0xCDCDCDCDCDCDCDCDULL);
+		std::vector<BitSet::ElementType> endBits(countWords, 0xCDCDCDCDCDCDCDCDULL);
+		std::vector<BitSet::ElementType> crcBits(countWords, 0xCDCDCDCDCDCDCDCDULL);
+		FATCellDecoder::classify(table.data(), table.size(), freeBits.data(), startBits.data(), endBits.data(), crcBits.data());
+
+		for (size_t i = 0; i < countWords * FATCellDecoder::kBitsPerWord; ++i) {
+			size_t wordIndex = i / FATCellDecoder::kBitsPerWord;
+			BitSet::ElementType mask = static_cast<BitSet::ElementType>(1) << (i % FATCellDecoder::kBitsPerWord);
+			bool expectedFree = false;
+			bool expectedStart = false;
+			bool expectedEnd = false;
+			bool expectedCRC = false;
+			if (i < table.size()) {
+				expectedFree = table[i].isFreeCluster();
+				expectedStart = table[i].isStartOfChain();
+				expectedEnd = table[i].isEndOfChain();
+				expectedCRC = table[i].isCRCInitialized();
+			}
+			EXPECT_EQ((freeBits[wordIndex] & mask) != 0, expectedFree) << "Cell #" << i;
+			EXPECT_EQ((startBits[wordIndex] & mask) != 0, expectedStart) << "Cell #" << i;
+			EXPECT_EQ((endBits[wordIndex] & mask) != 0, expectedEnd) << "Cell #" << i;
+			EXPECT_EQ((crcBits[wordIndex] & mask) != 0, expectedCRC) << "Cell #" << i;
+		}
+
+		// The scalar version should produce exactly the same words.
+		std::vector<BitSet::ElementType> scalarFreeBits(countWords);
+		std::vector<BitSet::ElementType> scalarStartBits(countWords);
+		std::vector<BitSet::ElementType> scalarEndBits(countWords);
+		std::vector<BitSet::ElementType> scalarCRCBits(countWords);
+		FATCellDecoder::classifyScalar(table.data(), table.size(), scalarFreeBits.data(), scalarStartBits.data(), scalarEndBits.data(), scalarCRCBits.data());
+		EXPECT_EQ(freeBits, scalarFreeBits);
+		EXPECT_EQ(startBits, scalarStartBits);
+		EXPECT_EQ(endBits, scalarEndBits);
+		EXPECT_EQ(crcBits, scalarCRCBits);
+	}
+
+} // namespace
+
+TEST(FATCellDecoder, ClassifyMatchesCellMethods) {
+	const size_t sizes[] = { 0, 1, 3, 63, 64, 65, 127, 128, 200, 32768 };
+	uint32_t seed = 17;
+	for (size_t size : sizes) {
+		FATBlockTableType table = createRandomTable(size, seed++);
+		verifyClassification(table);
+	}
+}
+
+TEST(FATCellDecoder, NullOutputsAreSkipped) {
+	FATBlockTableType table = createRandomTable(300, 5);
+	std::vector<BitSet::ElementType> endBits(FATCellDecoder::getCountWords(table.size()));
+	FATCellDecoder::classify(table.data(), table.size(), nullptr, nullptr, endBits.data(), nullptr);
+	for (size_t i = 0; i < table.size(); ++i) {
+		bool isSet = (endBits[i / 64] & (static_cast<BitSet::ElementType>(1) << (i % 64))) != 0;
+		EXPECT_EQ(isSet, table[i].isEndOfChain());
+	}
+}
+
+TEST(FATCellDecoder, DecodeFreeClusters) {
+	FATBlockTableType table = createRandomTable(32768 + 7, 23);
+	BitSet freeClustersSet;
+	FATCellDecoder::decodeFreeClusters(table, freeClustersSet);
+	ASSERT_EQ(freeClustersSet.getSize(), table.size());
+	size_t expectedCountFree = 0;
+	for (size_t i = 0; i < table.size(); ++i) {
+		EXPECT_EQ(freeClustersSet.getValue(i), table[i].isFreeCluster());
+		if (table[i].isFreeCluster()) {
+			++expectedCountFree;
+		}
+	}
+	EXPECT_EQ(freeClustersSet.getCountOnes(), expectedCountFree);
+
+	// All free
+	FATBlockTableType freeTable(1000, FATCellValueType::freeCellValue());
+	FATCellDecoder::decodeFreeClusters(freeTable, freeClustersSet);
+	EXPECT_EQ(freeClustersSet.getCountOnes(), freeTable.size());
+	EXPECT_EQ(freeClustersSet.getCountZeros(), 0);
+}
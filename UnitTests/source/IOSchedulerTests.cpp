@@ -0,0 +1,221 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include "SplitFAT/utils/ThreadPool.h"
+#include "SplitFAT/utils/IOScheduler.h"
+#include "SplitFAT/VirtualFileSystem.h"
+#include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/SplitFATFileSystem.h"
+#include "WindowsSplitFATConfiguration.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace SFAT;
+
+namespace {
+	const char* kVolumeControlAndFATDataFilePath = "SFATControl.dat";
+	const char* kClusterDataFilePath = "data.dat";
+	const char* kTransactionFilePath = "_SFATTransaction.dat";
+	const uint32_t kVolumeCountThreads = 3;
+
+	class ScheduledSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		virtual IOSchedulerSettings getIOSchedulerSettings() const override {
+			IOSchedulerSettings settings;
+			settings.mCountThreads = kVolumeCountThreads;
+			return settings;
+		}
+	};
+
+	void waitUntil(const std::atomic<bool>& condition) {
+		while (!condition) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+// Tests that the tasks queued to a busy worker are executed by the rest of the workers.
+TEST(ThreadPool, IdleWorkersStealTasks) {
+	const uint32_t kCountTasks = 100;
+	ThreadPool threadPool;
+	threadPool.start(4);
+	EXPECT_EQ(threadPool.getCountThreads(), 4u);
+	EXPECT_FALSE(threadPool.isWorkerThread());
+
+	std::atomic<uint32_t> countExecuted(0);
+	std::atomic<bool> isDone(false);
+	threadPool.submit([&threadPool, &countExecuted, &isDone, kCountTasks]() {
+		EXPECT_TRUE(threadPool.isWorkerThread());
+		// Queued to the current worker, which doesn't execute them.
+		for (uint32_t i = 0; i < kCountTasks; ++i) {
+			threadPool.submit([&countExecuted]() { ++countExecuted; });
+		}
+		while (countExecuted < kCountTasks) {
+			std::this_thread::yield();
+		}
+		isDone = true;
+	});
+	waitUntil(isDone);
+	EXPECT_GE(threadPool.getCountStolenTasks(), kCountTasks);
+
+	threadPool.stop();
+	EXPECT_FALSE(threadPool.isStarted());
+
+	// Executed on the calling thread, if the pool is not started.
+	bool isExecuted = false;
+	threadPool.submit([&isExecuted]() { isExecuted = true; });
+	EXPECT_TRUE(isExecuted);
+}
+
+// Tests that the pending requests are executed by priority, and the latency of every priority is measured.
+TEST(IOScheduler, RequestsAreExecutedByPriority) {
+	IOScheduler scheduler;
+	scheduler.start(1, 16);
+
+	// Keeps the only worker busy, while the rest of the requests are submitted.
+	std::atomic<bool> isStarted(false);
+	std::atomic<bool> isReleased(false);
+	std::shared_future<ErrorCode> blockingCompletion;
+	scheduler.submit(IOPriority::IOP_BACKGROUND, [&isStarted, &isReleased]() {
+		isStarted = true;
+		waitUntil(isReleased);
+		return ErrorCode::RESULT_OK;
+	}, blockingCompletion);
+	waitUntil(isStarted);
+
+	std::vector<IOPriority> executionOrder;
+	std::shared_future<ErrorCode> completions[3];
+	scheduler.submit(IOPriority::IOP_BACKGROUND, [&executionOrder]() {
+		executionOrder.push_back(IOPriority::IOP_BACKGROUND);
+		return ErrorCode::ERROR_READING;
+	}, completions[0]);
+	scheduler.submit(IOPriority::IOP_FOREGROUND_WRITE, [&executionOrder]() {
+		executionOrder.push_back(IOPriority::IOP_FOREGROUND_WRITE);
+		return ErrorCode::RESULT_OK;
+	}, completions[1]);
+	scheduler.submit(IOPriority::IOP_FOREGROUND_READ, [&executionOrder]() {
+		executionOrder.push_back(IOPriority::IOP_FOREGROUND_READ);
+		return ErrorCode::RESULT_OK;
+	}, completions[2]);
+	EXPECT_EQ(scheduler.getQueueDepth(), 3u);
+	EXPECT_EQ(scheduler.getStats(IOPriority::IOP_FOREGROUND_READ).mQueueDepth, 1u);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	isReleased = true;
+	EXPECT_EQ(scheduler.wait(blockingCompletion), ErrorCode::RESULT_OK);
+	EXPECT_EQ(scheduler.wait(completions[0]), ErrorCode::ERROR_READING);
+	EXPECT_EQ(scheduler.wait(completions[1]), ErrorCode::RESULT_OK);
+	EXPECT_EQ(scheduler.wait(completions[2]), ErrorCode::RESULT_OK);
+
+	std::vector<IOPriority> expectedOrder = { IOPriority::IOP_FOREGROUND_READ, IOPriority::IOP_FOREGROUND_WRITE, IOPriority::IOP_BACKGROUND };
+	EXPECT_EQ(executionOrder, expectedOrder);
+	EXPECT_EQ(scheduler.getQueueDepth(), 0u);
+
+	IOSchedulerStats readStats = scheduler.getStats(IOPriority::IOP_FOREGROUND_READ);
+	EXPECT_EQ(readStats.mQueueDepth, 0u);
+	EXPECT_EQ(readStats.mMaxQueueDepth, 1u);
+	EXPECT_EQ(readStats.mCountCompleted, 1u);
+	EXPECT_EQ(readStats.mCountFailed, 0u);
+	EXPECT_GE(readStats.mMaxWaitMicroseconds, 20000u);
+	EXPECT_GE(readStats.getAverageLatencyMicroseconds(), readStats.mMaxWaitMicroseconds);
+	IOSchedulerStats backgroundStats = scheduler.getStats(IOPriority::IOP_BACKGROUND);
+	EXPECT_EQ(backgroundStats.mCountCompleted, 2u);
+	EXPECT_EQ(backgroundStats.mCountFailed, 1u);
+}
+
+// Tests that the submitting threads wait while the queue is full, and a waiting worker executes the pending requests.
+TEST(IOScheduler, QueueDepthIsLimited) {
+	const uint32_t kMaxQueueDepth = 2;
+	IOScheduler scheduler;
+	scheduler.start(1, kMaxQueueDepth);
+
+	std::atomic<bool> isStarted(false);
+	std::atomic<bool> isReleased(false);
+	std::shared_future<ErrorCode> blockingCompletion;
+	scheduler.submit(IOPriority::IOP_FOREGROUND_READ, [&isStarted, &isReleased]() {
+		isStarted = true;
+		waitUntil(isReleased);
+		return ErrorCode::RESULT_OK;
+	}, blockingCompletion);
+	waitUntil(isStarted);
+
+	std::atomic<uint32_t> countSubmitted(0);
+	std::atomic<uint32_t> countExecuted(0);
+	std::thread submitter([&scheduler, &countSubmitted, &countExecuted, kMaxQueueDepth]() {
+		for (uint32_t i = 0; i <= kMaxQueueDepth; ++i) {
+			scheduler.submit(IOPriority::IOP_FOREGROUND_WRITE, [&countExecuted]() {
+				++countExecuted;
+				return ErrorCode::RESULT_OK;
+			});
+			++countSubmitted;
+		}
+	});
+	while (countSubmitted < kMaxQueueDepth) {
+		std::this_thread::yield();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(countSubmitted.load(), kMaxQueueDepth);
+	EXPECT_EQ(scheduler.getQueueDepth(), kMaxQueueDepth);
+
+	isReleased = true;
+	submitter.join();
+	scheduler.wait(blockingCompletion);
+
+	// The only worker waits for a request submitted after its own, so it has to execute it.
+	std::shared_future<ErrorCode> outerCompletion;
+	scheduler.submit(IOPriority::IOP_BACKGROUND, [&scheduler]() {
+		std::shared_future<ErrorCode> innerCompletion;
+		scheduler.submit(IOPriority::IOP_BACKGROUND, []() { return ErrorCode::ERROR_WRITING; }, innerCompletion);
+		return scheduler.wait(innerCompletion);
+	}, outerCompletion);
+	EXPECT_EQ(scheduler.wait(outerCompletion), ErrorCode::ERROR_WRITING);
+
+	scheduler.stop();
+	EXPECT_EQ(countExecuted.load(), kMaxQueueDepth + 1);
+	EXPECT_EQ(scheduler.getStats(IOPriority::IOP_FOREGROUND_WRITE).mMaxQueueDepth, kMaxQueueDepth);
+}
+
+// Tests that the volume starts its scheduler with the configured settings, and flushes the FAT-data through it.
+TEST(IOScheduler, VolumeUsesConfiguredScheduler) {
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		SplitFATFileStorage fileStorage;
+		fileStorage.setup(lowLevelFileAccess);
+		fileStorage.cleanUp();
+	}
+
+	std::shared_ptr<ScheduledSplitFATConfiguration> lowLevelFileAccess = std::make_shared<ScheduledSplitFATConfiguration>();
+	ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	SplitFATFileStorage fileStorage;
+	err = fileStorage.setup(lowLevelFileAccess);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	IOScheduler& scheduler = fileStorage.getVirtualFileSystem().mVolumeManager.getIOScheduler();
+	EXPECT_TRUE(scheduler.isStarted());
+	EXPECT_EQ(scheduler.getCountThreads(), kVolumeCountThreads);
+
+	FileHandle file;
+	err = fileStorage.openFile(file, "scheduled.bin", "wb");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	std::vector<uint8_t> buffer(64 * 1024, 0x3C);
+	size_t bytesWritten = 0;
+	err = file.write(buffer.data(), buffer.size(), bytesWritten);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	file.close();
+	err = fileStorage.getVirtualFileSystem().mVolumeManager.immediateFlush();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	// The FAT-data and the cluster-data are in different files, so their flushes are overlapped.
+	IOSchedulerStats writeStats = scheduler.getStats(IOPriority::IOP_FOREGROUND_WRITE);
+	EXPECT_GE(writeStats.mCountCompleted, 1u);
+	EXPECT_EQ(writeStats.mCountFailed, 0u);
+	EXPECT_EQ(scheduler.getQueueDepth(), 0u);
+}
@@ -7,9 +7,11 @@
 #include "SplitFAT/Common.h"
 #include "SplitFAT/DataBlockManager.h"
 #include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/FAT.h"
 #include "SplitFAT/utils/CRC.h"
 #include "WindowsSplitFATConfiguration.h"
 #include <memory>
+#include <stddef.h>
 
 using namespace SFAT;
 
@@ -457,6 +459,220 @@ TEST_F(LowLevelUnitTest, SetGetFATCellsInMoreBlocks) {
 	}
 }
 
+/// Tests the loading of the FAT blocks in background, while some of them are accessed on demand.
+TEST_F(LowLevelUnitTest, PreloadFATBlocksInBackground) {
+	uint32_t countBlocks = 0;
+
+	// Initial creation of the Volume
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		VolumeManager volumeManager;
+		volumeManager.setup(lowLevelFileAccess);
+
+		volumeManager.createVolume();
+		ErrorCode err = volumeManager.preallocateAllFATDataBlocks();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		countBlocks = volumeManager.getCountAllocatedFATBlocks();
+		EXPECT_GT(countBlocks, 1u);
+
+		// Every block gets different count of used clusters.
+		uint32_t clustersPerBlock = volumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		FATDataManager& fatDataManager = volumeManager.getFATDataManager();
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			for (uint32_t i = 0; i <= blockIndex % 7; ++i) {
+				err = fatDataManager.setValue(blockIndex * clustersPerBlock + i, FATCellValueType::singleElementClusterChainValue());
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			}
+		}
+		err = volumeManager.flush();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Open the Volume and use the blocks, while they are still loading.
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		VolumeManager volumeManager;
+		volumeManager.setup(lowLevelFileAccess);
+
+		volumeManager.openVolume();
+		// The preallocation of the FAT blocks doesn't update the VolumeControlData on the storage.
+		volumeManager.setCountAllocatedFATBlocks(countBlocks);
+		ErrorCode err = volumeManager.startPreloadingAllFATDataBlocks();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		uint32_t clustersPerBlock = volumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		for (uint32_t blockIndex = countBlocks; blockIndex > 0; --blockIndex) {
+			uint32_t countFreeClusters = 0;
+			err = volumeManager.getCountFreeClusters(countFreeClusters, blockIndex - 1);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(countFreeClusters, clustersPerBlock - ((blockIndex - 1) % 7 + 1));
+		}
+
+		err = volumeManager.waitForFATPreloadCompletion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		// Everything is loaded at that point.
+		err = volumeManager.preloadAllFATDataBlocks();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			FATCellValueType value = FATCellValueType::badCellValue();
+			err = volumeManager.getFATCell(blockIndex * clustersPerBlock + blockIndex % 7, value);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_TRUE(value.isStartOfChain());
+			EXPECT_TRUE(value.isEndOfChain());
+			value = FATCellValueType::badCellValue();
+			err = volumeManager.getFATCell(blockIndex * clustersPerBlock + blockIndex % 7 + 1, value);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_TRUE(value.isFreeCluster());
+		}
+	}
+}
+
+/// Tests the control data stored in front of every FAT block.
+/// The free space should be answered without loading the blocks, and the stale control data should be detected and updated.
+TEST_F(LowLevelUnitTest, BlockControlData) {
+	uint32_t countBlocks = 0;
+	uint32_t clustersPerBlock = 0;
+
+	auto openVolume = [&countBlocks](VolumeManager& volumeManager) {
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		volumeManager.setup(lowLevelFileAccess);
+		volumeManager.openVolume();
+		// The preallocation of the FAT blocks doesn't update the VolumeControlData on the storage.
+		volumeManager.setCountAllocatedFATBlocks(countBlocks);
+	};
+
+	auto isBlockCached = [](FATDataManager& fatDataManager, uint32_t blockIndex) {
+		return (blockIndex < fatDataManager.mFATBlocksCache.size()) && (fatDataManager.mFATBlocksCache[blockIndex] != nullptr);
+	};
+
+	// Initial creation of the Volume
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		VolumeManager volumeManager;
+		volumeManager.setup(lowLevelFileAccess);
+
+		volumeManager.createVolume();
+		EXPECT_TRUE(volumeManager.getVolumeDescriptor().isBlockControlDataSupported());
+		ErrorCode err = volumeManager.preallocateAllFATDataBlocks();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		countBlocks = volumeManager.getCountAllocatedFATBlocks();
+		ASSERT_GT(countBlocks, 2u);
+
+		clustersPerBlock = volumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		FATDataManager& fatDataManager = volumeManager.getFATDataManager();
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			for (uint32_t i = 0; i <= blockIndex % 7; ++i) {
+				err = fatDataManager.setValue(blockIndex * clustersPerBlock + i, FATCellValueType::singleElementClusterChainValue());
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			}
+		}
+		err = volumeManager.flush();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// The free space comes from the control data only.
+	{
+		VolumeManager volumeManager;
+		openVolume(volumeManager);
+		FATDataManager& fatDataManager = volumeManager.getFATDataManager();
+		ErrorCode err = fatDataManager.readAllBlockControlData();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			uint32_t countFreeClusters = 0;
+			err = fatDataManager.getCountFreeClusters(countFreeClusters, blockIndex);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(countFreeClusters, clustersPerBlock - (blockIndex % 7 + 1));
+			EXPECT_EQ(fatDataManager.mBlocksControlData[blockIndex].mFirstFreeClusterOffset, blockIndex % 7 + 1);
+			EXPECT_FALSE(isBlockCached(fatDataManager, blockIndex));
+		}
+	}
+
+	// Change the table of block #1 and the control data of block #2 directly in the file.
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		VolumeManager volumeManager;
+		volumeManager.setup(lowLevelFileAccess);
+		volumeManager.openVolume();
+
+		FileHandle file = lowLevelFileAccess->getFATDataFile(AccessMode::AM_WRITE);
+		ASSERT_TRUE(file.isOpen());
+		FATCellValueType usedCellValue = FATCellValueType::singleElementClusterChainValue();
+		FilePositionType position = volumeManager.getFATBlockStartPosition(1) + sizeof(BlockControlData) + 100 * sizeof(FATCellValueType);
+		size_t bytesWritten = 0;
+		ErrorCode err = file.writeAtPosition(&usedCellValue, sizeof(FATCellValueType), position, bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		uint32_t wrongCountFreeClusters = 5;
+		position = volumeManager.getFATBlockStartPosition(2) + offsetof(BlockControlData, mCountFreeClusters);
+		err = file.writeAtPosition(&wrongCountFreeClusters, sizeof(uint32_t), position, bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.flush();
+	}
+
+	{
+		VolumeManager volumeManager;
+		openVolume(volumeManager);
+		FATDataManager& fatDataManager = volumeManager.getFATDataManager();
+		ErrorCode err = fatDataManager.readAllBlockControlData();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The control data of block #2 is broken, so the block has to be loaded.
+		uint32_t countFreeClusters = 0;
+		err = fatDataManager.getCountFreeClusters(countFreeClusters, 2);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(countFreeClusters, clustersPerBlock - 3);
+		EXPECT_TRUE(isBlockCached(fatDataManager, 2));
+		EXPECT_FALSE(fatDataManager.mFATBlocksCache[2]->isBlockControlDataValid());
+
+		// The change of the table of block #1 is detected by the CRC, when the block gets loaded.
+		FATCellValueType value = FATCellValueType::freeCellValue();
+		err = fatDataManager.getValue(clustersPerBlock + 100, value);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(value.isFreeCluster());
+		EXPECT_FALSE(fatDataManager.mFATBlocksCache[1]->isBlockControlDataValid());
+		err = fatDataManager.getCountFreeClusters(countFreeClusters, 1);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(countFreeClusters, clustersPerBlock - 3);
+
+		// Only the control data gets updated.
+		EXPECT_TRUE(fatDataManager.mFATBlocksCache[1]->isCacheInSync());
+		err = volumeManager.flush();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_TRUE(fatDataManager.mFATBlocksCache[1]->isBlockControlDataValid());
+		EXPECT_TRUE(fatDataManager.mFATBlocksCache[2]->isBlockControlDataValid());
+	}
+
+	{
+		VolumeManager volumeManager;
+		openVolume(volumeManager);
+		FATDataManager& fatDataManager = volumeManager.getFATDataManager();
+		ErrorCode err = fatDataManager.readAllBlockControlData();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		uint32_t countFreeClusters = 0;
+		err = fatDataManager.getCountFreeClusters(countFreeClusters, 1);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(countFreeClusters, clustersPerBlock - 3);
+		err = fatDataManager.getCountFreeClusters(countFreeClusters, 2);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(countFreeClusters, clustersPerBlock - 3);
+		EXPECT_FALSE(isBlockCached(fatDataManager, 1));
+		EXPECT_FALSE(isBlockCached(fatDataManager, 2));
+
+		// The loaded blocks match their control data now.
+		err = fatDataManager.preloadAllFATDataBlocks();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (uint32_t blockIndex = 0; blockIndex < countBlocks; ++blockIndex) {
+			ASSERT_TRUE(isBlockCached(fatDataManager, blockIndex));
+			EXPECT_TRUE(fatDataManager.mFATBlocksCache[blockIndex]->isBlockControlDataValid());
+		}
+	}
+}
+
 /// Tests cluster read/write operations in the cluster-data storage.
 TEST_F(LowLevelUnitTest, ClusterWriteRead) {
 
@@ -0,0 +1,164 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include "SplitFAT/MemoryBudget.h"
+#include "SplitFAT/ClusterCache.h"
+#include "SplitFAT/VirtualFileSystem.h"
+#include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/FileManipulator.h"
+#include "SplitFAT/SplitFATFileSystem.h"
+#include "WindowsSplitFATConfiguration.h"
+#include <memory>
+#include <vector>
+
+using namespace SFAT;
+
+namespace {
+	const char* kVolumeControlAndFATDataFilePath = "SFATControl.dat";
+	const char* kClusterDataFilePath = "data.dat";
+	const char* kTransactionFilePath = "_SFATTransaction.dat";
+	const size_t kVolumeMaxBytes = 16 * 1024 * 1024;
+
+	class BudgetedSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		virtual MemoryBudgetSettings getMemoryBudgetSettings() const override {
+			MemoryBudgetSettings settings;
+			settings.mMaxBytes = kVolumeMaxBytes;
+			return settings;
+		}
+	};
+}
+
+// Tests that the cluster cache gets the memory left by the rest of the components, but not less than its minimal share.
+TEST(MemoryBudget, ClusterCacheGetsWhatIsLeft) {
+	const size_t kMaxBytes = 10 * 1024 * 1024;
+	std::shared_ptr<MemoryBudget> memoryBudget = std::make_shared<MemoryBudget>();
+	EXPECT_FALSE(memoryBudget->isEnabled());
+
+	size_t clusterCacheUsage = 1024;
+	size_t clusterCacheLimit = 0;
+	size_t bufferPoolUsage = 2 * kMaxBytes;
+	size_t bufferPoolLimit = 0;
+	memoryBudget->registerComponent(MemoryComponent::MC_CLUSTER_CACHE,
+		[&clusterCacheUsage]() { return clusterCacheUsage; },
+		[&clusterCacheLimit](size_t maxBytes) { clusterCacheLimit = maxBytes; });
+	memoryBudget->registerComponent(MemoryComponent::MC_BUFFER_POOL,
+		[&bufferPoolUsage]() { return bufferPoolUsage; },
+		[&bufferPoolLimit](size_t maxBytes) { bufferPoolLimit = maxBytes; });
+
+	MemoryBudgetSettings settings;
+	settings.mMaxBytes = kMaxBytes;
+	settings.mBufferPoolPercent = 5;
+	settings.mMinClusterCachePercent = 10;
+	memoryBudget->setup(settings);
+	EXPECT_TRUE(memoryBudget->isEnabled());
+
+	// The buffer pool is counted only up to its limit, the excess is expected to be released.
+	const size_t expectedBufferPoolLimit = kMaxBytes / 100 * 5;
+	EXPECT_EQ(bufferPoolLimit, expectedBufferPoolLimit);
+	EXPECT_EQ(memoryBudget->getLimit(MemoryComponent::MC_BUFFER_POOL), expectedBufferPoolLimit);
+	EXPECT_EQ(clusterCacheLimit, kMaxBytes - expectedBufferPoolLimit);
+	EXPECT_EQ(memoryBudget->getLimit(MemoryComponent::MC_CLUSTER_CACHE), clusterCacheLimit);
+	bufferPoolUsage = expectedBufferPoolLimit / 2;
+
+	// Small changes don't trigger rebalancing.
+	memoryBudget->addUsage(MemoryComponent::MC_FAT_CACHE, 1024);
+	memoryBudget->rebalanceIfNeeded();
+	EXPECT_EQ(clusterCacheLimit, kMaxBytes - expectedBufferPoolLimit);
+
+	const size_t kFATBytes = 4 * 1024 * 1024;
+	memoryBudget->addUsage(MemoryComponent::MC_FAT_CACHE, kFATBytes - 1024);
+	memoryBudget->rebalanceIfNeeded();
+	EXPECT_EQ(clusterCacheLimit, kMaxBytes - kFATBytes - bufferPoolUsage);
+	EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_FAT_CACHE), kFATBytes);
+	EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_BUFFER_POOL), bufferPoolUsage);
+	EXPECT_EQ(memoryBudget->getTotalUsage(), kFATBytes + bufferPoolUsage + clusterCacheUsage);
+
+	// The charges of the open files push the cluster cache down to its minimal share.
+	{
+		MemoryCharge fileBufferCharge;
+		fileBufferCharge.set(memoryBudget, MemoryComponent::MC_FILE_BUFFERS, kMaxBytes);
+		memoryBudget->rebalanceIfNeeded();
+		EXPECT_EQ(clusterCacheLimit, kMaxBytes / 100 * 10);
+		EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_FILE_BUFFERS), kMaxBytes);
+
+		MemoryCharge movedCharge(std::move(fileBufferCharge));
+		EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_FILE_BUFFERS), kMaxBytes);
+	}
+	EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_FILE_BUFFERS), 0u);
+	memoryBudget->rebalanceIfNeeded();
+	EXPECT_EQ(clusterCacheLimit, kMaxBytes - kFATBytes - bufferPoolUsage);
+
+	// A charge can outlive the budget.
+	MemoryCharge lateCharge;
+	lateCharge.set(memoryBudget, MemoryComponent::MC_FILE_BUFFERS, 1024);
+	memoryBudget->unregisterComponent(MemoryComponent::MC_CLUSTER_CACHE);
+	memoryBudget->unregisterComponent(MemoryComponent::MC_BUFFER_POOL);
+	memoryBudget.reset();
+	lateCharge.release();
+}
+
+// Tests that the memory of the volume components is accounted, and the cluster cache releases memory when the budget is reduced.
+TEST(MemoryBudget, VolumeStaysInBudget) {
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		SplitFATFileStorage fileStorage;
+		fileStorage.setup(lowLevelFileAccess);
+		fileStorage.cleanUp();
+	}
+
+	VirtualFileSystem vfs;
+	std::shared_ptr<BudgetedSplitFATConfiguration> lowLevelFileAccess = std::make_shared<BudgetedSplitFATConfiguration>();
+	ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	err = vfs.setup(lowLevelFileAccess);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	vfs.mVolumeManager.waitForFATPreloadCompletion();
+	const std::shared_ptr<MemoryBudget>& memoryBudget = vfs.mVolumeManager.getMemoryBudget();
+	ASSERT_TRUE(memoryBudget->isEnabled());
+	EXPECT_GT(memoryBudget->getUsage(MemoryComponent::MC_FAT_CACHE), 0u);
+
+	// Larger than the cluster cache, so it has to evict.
+	const size_t clusterSize = vfs.mVolumeManager.getClusterSize();
+	const size_t fileSize = kVolumeMaxBytes;
+	{
+		FileManipulator fileFM;
+		err = vfs.createFile("/data.bin", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> buffer(fileSize, 0x5A);
+		size_t bytesWritten = 0;
+		err = vfs.write(fileFM, buffer.data(), buffer.size(), bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.flush(fileFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		FileManipulator readFM;
+		err = vfs.createGenericFileManipulatorForFilePath("/data.bin", readFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		readFM.mAccessMode = AccessMode::AM_READ;
+		size_t bytesRead = 0;
+		err = vfs.read(readFM, buffer.data(), buffer.size(), bytesRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesRead, fileSize);
+		EXPECT_GE(memoryBudget->getUsage(MemoryComponent::MC_FILE_BUFFERS), clusterSize);
+	}
+	EXPECT_EQ(memoryBudget->getUsage(MemoryComponent::MC_FILE_BUFFERS), 0u);
+
+	// The memory is released in slabs, so every shard of the cache could have its last slab partially used.
+	const size_t clusterCacheLimit = memoryBudget->getLimit(MemoryComponent::MC_CLUSTER_CACHE);
+	const size_t slack = clusterCacheLimit / ClusterCache::kMinCountSlabs + 16 * ClusterCache::kSlabAlignment;
+	EXPECT_GT(memoryBudget->getUsage(MemoryComponent::MC_CLUSTER_CACHE), 0u);
+	EXPECT_LE(memoryBudget->getUsage(MemoryComponent::MC_CLUSTER_CACHE), clusterCacheLimit + slack);
+
+	// The memory taken by other components is released by the cluster cache.
+	MemoryCharge charge;
+	charge.set(memoryBudget, MemoryComponent::MC_FILE_BUFFERS, clusterCacheLimit / 2);
+	memoryBudget->rebalanceIfNeeded();
+	EXPECT_LT(memoryBudget->getLimit(MemoryComponent::MC_CLUSTER_CACHE), clusterCacheLimit);
+	EXPECT_LE(memoryBudget->getUsage(MemoryComponent::MC_CLUSTER_CACHE), memoryBudget->getLimit(MemoryComponent::MC_CLUSTER_CACHE) + slack);
+	charge.release();
+}
@@ -9,19 +9,25 @@
 #include "WindowsSplitFATConfiguration.h"
 #include "SplitFAT/FileDescriptorRecord.h"
 #include "SplitFAT/utils/SFATAssert.h"
+#include "SplitFAT/VirtualFileSystem.h"
+#include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/DataBlockManager.h"
+#include "SplitFAT/FileManipulator.h"
+#include "SplitFAT/FileSystemLocks.h"
 #include <memory>
 #include <random>
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <string>
+#include <string.h>
 
 #define SPLITFAT_PRINT_LOCAL_LOG_INFO	0
 #define SPLITFAT_ENABLE_COMMON_MULTITHREAD_TESTS	1
 
-// This should remain defined as 0.
-// The purpose of the test that this define enables is for future development.
-// Currently the test will fail.
-#define SPLITFAT_ENABLE_MULTITHREAD_WRITE_WITHOUT_TRANSACTION_TEST	0
+// The writers of different files and directories are synchronized by the locks of the VirtualFileSystem, so they don't need a transaction.
+#define SPLITFAT_ENABLE_MULTITHREAD_WRITE_WITHOUT_TRANSACTION_TEST	1
 
 using namespace SFAT;
 
@@ -284,11 +290,326 @@ TEST_F(MultithreadingTest, TestMultithreadReadingFiles) {
 		t[i].join();
 	}
 }
+
+/// Tests that the threads reading the same file concurrently read every cluster from the storage only once.
+TEST_F(MultithreadingTest, ConcurrentReadsShareStorageReads) {
+	const size_t kFileSize = 512 * 1024;
+	{
+		std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		createAndWriteFile("shared.bin", fileStorage, 91, kFileSize);
+	}
+
+	// Open the volume again, so nothing of the file is cached.
+	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+	DataBlockManager& dataBlockManager = volumeManager.getDataBlockManager();
+	const uint32_t countStorageReadsBefore = dataBlockManager.getCountStorageReads();
+	const size_t countCachedClustersBefore = dataBlockManager.getCountCachedClusters();
+
+	const int threadsCount = 8;
+	std::thread t[threadsCount];
+	for (int i = 0; i < threadsCount; ++i) {
+		t[i] = std::thread([&fileStorage, kFileSize]() {
+			readAndCompareFile("shared.bin", fileStorage, 91, kFileSize);
+		});
+	}
+	for (int i = 0; i < threadsCount; ++i) {
+		t[i].join();
+	}
+
+	// Every cluster read from the storage is cached, so none of them was read twice.
+	const size_t countNewCachedClusters = dataBlockManager.getCountCachedClusters() - countCachedClustersBefore;
+	EXPECT_EQ(dataBlockManager.getCacheStats().mCountEvictions, 0u);
+	EXPECT_EQ(dataBlockManager.getCountStorageReads() - countStorageReadsBefore, countNewCachedClusters);
+	EXPECT_GE(countNewCachedClusters, kFileSize / volumeManager.getClusterSize());
+}
+
+/// Tests that a file being written doesn't block the readers of the other files, and the readers of the same file wait for the writer.
+/// Opening the file being written waits as well, because its FileDescriptorRecord could be changing.
+TEST_F(MultithreadingTest, ReadsProceedWhileFileIsWritten) {
+	const size_t kFileSize = 64 * 1024;
+	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	createAndWriteFile("written.bin", fileStorage, 11, kFileSize);
+	createAndWriteFile("read.bin", fileStorage, 12, kFileSize);
+
+	VirtualFileSystem& vfs = fileStorage->getVirtualFileSystem();
+	FileManipulator writtenFM;
+	ErrorCode err = vfs.createGenericFileManipulatorForFilePath("written.bin", writtenFM);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	ASSERT_TRUE(writtenFM.isValid());
+
+	std::atomic<bool> isWrittenFileRead(false);
+	std::thread writtenFileReader;
+	{
+		// Holds the lock of the file, as a writer would.
+		FileSystemLock writerLock = vfs._lockEntity(writtenFM.getDescriptorLocation(), LockMode::LM_EXCLUSIVE);
+
+		writtenFileReader = std::thread([&fileStorage, &isWrittenFileRead, kFileSize]() {
+			readAndCompareFile("written.bin", fileStorage, 11, kFileSize);
+			isWrittenFileRead = true;
+		});
+
+		const int threadsCount = 4;
+		std::thread t[threadsCount];
+		for (int i = 0; i < threadsCount; ++i) {
+			t[i] = std::thread([&fileStorage, kFileSize]() {
+				readAndCompareFile("read.bin", fileStorage, 12, kFileSize);
+				EXPECT_TRUE(fileStorage->fileExists("read.bin"));
+			});
+		}
+		for (int i = 0; i < threadsCount; ++i) {
+			t[i].join();
+		}
+
+		EXPECT_FALSE(isWrittenFileRead);
+	}
+
+	writtenFileReader.join();
+	EXPECT_TRUE(isWrittenFileRead);
+	EXPECT_EQ(vfs.mLocks.getCountLockedEntities(), 0u);
+}
+
+/// Tests that the reading of files scales with the count of reading threads, while another thread writes files.
+TEST_F(MultithreadingTest, ReadsScaleWhileWriting) {
+	const size_t kFileSize = 256 * 1024;
+	const int kCountFiles = 8;
+	const int kCountRounds = 20;
+	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	fileStorage->createDirectory("read");
+	fileStorage->createDirectory("write");
+
+	std::vector<std::vector<uint8_t>> contents(kCountFiles);
+	for (int i = 0; i < kCountFiles; ++i) {
+		contents[i].resize(kFileSize);
+		std::mt19937 mt_rand(100 + i);
+		for (auto& value : contents[i]) {
+			value = static_cast<uint8_t>(mt_rand());
+		}
+
+		FileHandle file;
+		std::string filePath = "read/file" + std::to_string(i);
+		ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t bytesWritten = 0;
+		err = file.write(contents[i].data(), kFileSize, bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesWritten, kFileSize);
+		file.close();
+	}
+
+	// Every reader reads all files several times, and returns the count of bytes read per second.
+	auto runReaders = [&](int countReaders) -> double {
+		std::atomic<bool> areReadersDone(false);
+		std::atomic<int> countWriterIterations(0);
+		std::thread writer([&fileStorage, &areReadersDone, &countWriterIterations]() {
+			std::vector<uint8_t> buffer(32 * 1024, 0x5A);
+			while (!areReadersDone) {
+				std::string filePath = "write/file" + std::to_string(countWriterIterations % 4);
+				FileHandle file;
+				ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				size_t bytesWritten = 0;
+				err = file.write(buffer.data(), buffer.size(), bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				file.close();
+				if ((countWriterIterations % 2) == 1) {
+					err = fileStorage->deleteFile(filePath.c_str());
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				}
+				++countWriterIterations;
+			}
+		});
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		std::vector<std::thread> readers;
+		for (int r = 0; r < countReaders; ++r) {
+			readers.emplace_back([&fileStorage, &contents, r, kFileSize, kCountFiles, kCountRounds]() {
+				std::vector<uint8_t> buffer(kFileSize);
+				for (int k = 0; k < kCountRounds; ++k) {
+					const int fileIndex = (r + k) % kCountFiles;
+					std::string filePath = "read/file" + std::to_string(fileIndex);
+					FileHandle file;
+					ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "rb");
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+					size_t bytesRead = 0;
+					err = file.read(buffer.data(), kFileSize, bytesRead);
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+					EXPECT_EQ(bytesRead, kFileSize);
+					EXPECT_TRUE(buffer == contents[fileIndex]);
+					file.close();
+				}
+			});
+		}
+		for (auto& reader : readers) {
+			reader.join();
+		}
+		std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - startTime;
+
+		areReadersDone = true;
+		writer.join();
+		EXPECT_GT(countWriterIterations.load(), 0);
+
+		return (countReaders * kCountRounds * kFileSize) / diff.count();
+	};
+
+	// Warm up the cache, so both measurements read the cached clusters.
+	runReaders(1);
+	const double singleReaderThroughput = runReaders(1);
+	const int countReaders = 4;
+	const double multipleReadersThroughput = runReaders(countReaders);
+#if (SPLITFAT_PRINT_LOCAL_LOG_INFO == 1)
+	printf("Reading with 1 thread: %5.1fMB/s, with %d threads: %5.1fMB/s\n", singleReaderThroughput / (1 << 20), countReaders, multipleReadersThroughput / (1 << 20));
+#endif
+	if (std::thread::hardware_concurrency() >= static_cast<unsigned int>(countReaders + 1)) {
+		// Loose expectation. The readers don't block each other, but share the memory bandwidth and the cache shards.
+		EXPECT_GT(multipleReadersThroughput, 1.5 * singleReaderThroughput);
+	}
+}
+
+/// Tests that the threads writing different files take their clusters from the allocation windows of the files, so the files are not interleaved.
+TEST_F(MultithreadingTest, WritersOfDifferentFilesUseAllocationWindows) {
+	const int kCountWriters = 4;
+	const uint32_t kCountClustersPerFile = 64;
+	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	VirtualFileSystem& vfs = fileStorage->getVirtualFileSystem();
+	const uint32_t clusterSize = vfs.mVolumeManager.getClusterSize();
+
+	std::vector<std::thread> writers;
+	for (int w = 0; w < kCountWriters; ++w) {
+		writers.emplace_back([&fileStorage, w, clusterSize, kCountClustersPerFile]() {
+			std::string filePath = "chunk" + std::to_string(w) + ".bin";
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			std::vector<uint8_t> buffer(clusterSize);
+			for (uint32_t i = 0; i < kCountClustersPerFile; ++i) {
+				memset(buffer.data(), static_cast<int>(w * kCountClustersPerFile + i), buffer.size());
+				size_t bytesWritten = 0;
+				err = file.write(buffer.data(), buffer.size(), bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				EXPECT_EQ(bytesWritten, buffer.size());
+			}
+			file.close();
+		});
+	}
+	for (auto& writer : writers) {
+		writer.join();
+	}
+	EXPECT_EQ(vfs.mLocks.getCountLockedEntities(), 0u);
+
+	std::vector<uint8_t> buffer(clusterSize);
+	for (int w = 0; w < kCountWriters; ++w) {
+		std::string filePath = "chunk" + std::to_string(w) + ".bin";
+		FileHandle file;
+		ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (uint32_t i = 0; i < kCountClustersPerFile; ++i) {
+			size_t bytesRead = 0;
+			err = file.read(buffer.data(), buffer.size(), bytesRead);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(bytesRead, buffer.size());
+			EXPECT_EQ(buffer[0], static_cast<uint8_t>(w * kCountClustersPerFile + i));
+			EXPECT_EQ(buffer[clusterSize - 1], static_cast<uint8_t>(w * kCountClustersPerFile + i));
+		}
+		file.close();
+
+		// Every sequential window keeps at least 16 clusters together.
+		FileManipulator fileManipulator;
+		err = vfs.createGenericFileManipulatorForFilePath(filePath, fileManipulator);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ClusterChainVector clusterChain;
+		err = vfs._loadClusterChain(fileManipulator.getStartCluster(), clusterChain);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_EQ(clusterChain.size(), kCountClustersPerFile);
+		uint32_t countFragments = 1;
+		for (size_t i = 1; i < clusterChain.size(); ++i) {
+			if (clusterChain[i].mClusterIndex != clusterChain[i - 1].mClusterIndex + 1) {
+				++countFragments;
+			}
+		}
+		EXPECT_LE(countFragments, 2 + kCountClustersPerFile / 16);
+	}
+}
+
+/// Tests that two files growing at the same time in a transaction stay consistent.
+/// The CRCs of the written clusters are set in the FAT, while clusters are allocated for the other file.
+TEST_F(MultithreadingTest, ConcurrentlyGrowingFilesStayConsistent) {
+	const int kCountWriters = 2;
+	const uint32_t kCountChunksPerFile = 300;
+	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	const uint32_t clusterSize = fileStorage->getVirtualFileSystem().mVolumeManager.getClusterSize();
+	// Not aligned to the clusters, so most of the clusters are written more than once.
+	const size_t chunkSize = clusterSize / 3 + 1;
+
+	bool createdTransaction = false;
+	ErrorCode err = fileStorage->tryStartTransaction(createdTransaction);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_TRUE(createdTransaction);
+
+	std::atomic<bool> isStarted(false);
+	std::vector<std::thread> writers;
+	for (int w = 0; w < kCountWriters; ++w) {
+		writers.emplace_back([&fileStorage, &isStarted, w, chunkSize, kCountChunksPerFile]() {
+			std::string filePath = "growing" + std::to_string(w) + ".bin";
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, filePath.c_str(), "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			while (!isStarted) {
+				std::this_thread::yield();
+			}
+			std::vector<uint8_t> buffer(chunkSize);
+			for (uint32_t i = 0; i < kCountChunksPerFile; ++i) {
+				memset(buffer.data(), static_cast<int>(w * kCountChunksPerFile + i), buffer.size());
+				size_t bytesWritten = 0;
+				err = file.write(buffer.data(), buffer.size(), bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				EXPECT_EQ(bytesWritten, buffer.size());
+			}
+			file.close();
+		});
+	}
+	isStarted = true;
+	for (auto& writer : writers) {
+		writer.join();
+	}
+
+	err = fileStorage->endTransaction();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	std::vector<uint8_t> buffer(chunkSize);
+	for (int w = 0; w < kCountWriters; ++w) {
+		std::string filePath = "growing" + std::to_string(w) + ".bin";
+		EXPECT_TRUE(fileStorage->fileExists(filePath.c_str()));
+		FileHandle file;
+		err = fileStorage->openFile(file, filePath.c_str(), "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (uint32_t i = 0; i < kCountChunksPerFile; ++i) {
+			size_t bytesRead = 0;
+			err = file.read(buffer.data(), buffer.size(), bytesRead);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			ASSERT_EQ(bytesRead, buffer.size());
+			EXPECT_EQ(buffer[0], static_cast<uint8_t>(w * kCountChunksPerFile + i));
+			EXPECT_EQ(buffer[chunkSize - 1], static_cast<uint8_t>(w * kCountChunksPerFile + i));
+		}
+		file.close();
+	}
+
+	// Verifies the FAT chains of the files, and the CRCs of all allocated clusters.
+	err = fileStorage->executeDebugCommand("growing0.bin", "integrityTest");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	err = fileStorage->executeDebugCommand("growing0.bin", "dataConsistencyTest");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+}
 #endif
 
 #if (SPLITFAT_ENABLE_MULTITHREAD_WRITE_WITHOUT_TRANSACTION_TEST == 1)
-/// Tests writing multiple files in multithreading.
-/// Note! This is not supposed to pass currently. The multithreded writing is safe only with transaction!
+/// Tests writing multiple files in multithreading, without transaction.
 TEST_F(MultithreadingTest, TestMultithreadWritingFiles) {
 
 	std::shared_ptr<SplitFATFileStorage> fileStorage = std::make_shared<SplitFATFileStorage>();
@@ -0,0 +1,371 @@
+/********************************************************
+*  (c) Mojang.    All rights reserved.                  *
+*  (c) Microsoft. All rights reserved.                  *
+*********************************************************/
+
+#include <gtest/gtest.h>
+#include "SplitFAT/VirtualFileSystem.h"
+#include "SplitFAT/VolumeManager.h"
+#include "SplitFAT/FileManipulator.h"
+#include "SplitFAT/SizeClassDataPlacementStrategy.h"
+#include "WindowsSplitFATConfiguration.h"
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+using namespace SFAT;
+
+namespace {
+	const char* kVolumeControlAndFATDataFilePath = "SFATControl.dat";
+	const char* kClusterDataFilePath = "data.dat";
+	const char* kTransactionFilePath = "_SFATTransaction.dat";
+
+	class SizeClassSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		SizeClassSplitFATConfiguration(const SizeClassPlacementSettings& settings)
+			: mSettings(settings) {
+		}
+
+		virtual ErrorCode createDataPlacementStrategy(std::shared_ptr<DataPlacementStrategyBase>& dataPlacementStrategy,
+			VolumeManager& volumeManager, VirtualFileSystem& virtualFileSystem) override {
+			mStrategy = std::make_shared<SizeClassDataPlacementStrategy>(volumeManager, virtualFileSystem, mSettings);
+			dataPlacementStrategy = mStrategy;
+			return ErrorCode::RESULT_OK;
+		}
+
+		SizeClassPlacementSettings mSettings;
+		std::shared_ptr<SizeClassDataPlacementStrategy> mStrategy;
+	};
+
+	void removeVolume() {
+		VolumeManager volumeManager;
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = volumeManager.setup(lowLevelFileAccess);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		volumeManager.removeVolume();
+	}
+
+	// Returns the count of the intervals of consecutive clusters in the chain, and the set of blocks used.
+	uint32_t getCountFragments(VolumeManager& volumeManager, ClusterIndexType startClusterIndex, std::vector<uint32_t>& blockIndices) {
+		uint32_t countFragments = 0;
+		ClusterIndexType prevClusterIndex = ClusterValues::INVALID_VALUE;
+		ClusterIndexType clusterIndex = startClusterIndex;
+		while (isValidClusterIndex(clusterIndex)) {
+			if (clusterIndex != prevClusterIndex + 1) {
+				++countFragments;
+			}
+			uint32_t blockIndex = volumeManager.getBlockIndex(clusterIndex);
+			if (std::find(blockIndices.begin(), blockIndices.end(), blockIndex) == blockIndices.end()) {
+				blockIndices.push_back(blockIndex);
+			}
+
+			FATCellValueType cellValue = FATCellValueType::invalidCellValue();
+			ErrorCode err = volumeManager.getFATCell(clusterIndex, cellValue);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			if ((err != ErrorCode::RESULT_OK) || cellValue.isEndOfChain()) {
+				break;
+			}
+			prevClusterIndex = clusterIndex;
+			clusterIndex = cellValue.getNext();
+		}
+		return countFragments;
+	}
+
+	// Returns the size classes of the blocks along the chain, without repeating the consecutive ones.
+	std::vector<SizeClass> getChainSizeClasses(VolumeManager& volumeManager, const SizeClassDataPlacementStrategy& strategy, ClusterIndexType startClusterIndex) {
+		std::vector<SizeClass> sizeClasses;
+		ClusterIndexType clusterIndex = startClusterIndex;
+		while (isValidClusterIndex(clusterIndex)) {
+			SizeClass sizeClass = strategy.getBlockSizeClass(volumeManager.getBlockIndex(clusterIndex));
+			if (sizeClasses.empty() || (sizeClasses.back() != sizeClass)) {
+				sizeClasses.push_back(sizeClass);
+			}
+
+			FATCellValueType cellValue = FATCellValueType::invalidCellValue();
+			ErrorCode err = volumeManager.getFATCell(clusterIndex, cellValue);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			if ((err != ErrorCode::RESULT_OK) || cellValue.isEndOfChain()) {
+				break;
+			}
+			clusterIndex = cellValue.getNext();
+		}
+		return sizeClasses;
+	}
+
+} // namespace
+
+/// Writes small files between the chunks of a large file. The large file should stay contiguous, in a block different from the small files.
+TEST(SizeClassPlacement, SmallAndLargeFilesUseSeparateBlocks) {
+	removeVolume();
+
+	SizeClassPlacementSettings settings;
+	settings.mSmallFileMaxSize = 16 * 1024;
+	settings.mLargeFileMinSize = 256 * 1024;
+	std::shared_ptr<SizeClassSplitFATConfiguration> lowLevelFileAccess = std::make_shared<SizeClassSplitFATConfiguration>(settings);
+	ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	{
+		VirtualFileSystem vfs;
+		err = vfs.setup(lowLevelFileAccess);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_NE(lowLevelFileAccess->mStrategy, nullptr);
+		SizeClassDataPlacementStrategy& strategy = *lowLevelFileAccess->mStrategy;
+		VolumeManager& volumeManager = vfs.mVolumeManager;
+
+		EXPECT_EQ(strategy.getSizeClass(0), SizeClass::SC_MEDIUM); // Not known
+		EXPECT_EQ(strategy.getSizeClass(1), SizeClass::SC_SMALL);
+		EXPECT_EQ(strategy.getSizeClass(16 * 1024), SizeClass::SC_SMALL);
+		EXPECT_EQ(strategy.getSizeClass(16 * 1024 + 1), SizeClass::SC_MEDIUM);
+		EXPECT_EQ(strategy.getSizeClass(256 * 1024 - 1), SizeClass::SC_MEDIUM);
+		EXPECT_EQ(strategy.getSizeClass(256 * 1024), SizeClass::SC_LARGE);
+
+		const uint32_t countSmallFiles = 20;
+		const size_t smallFileSize = 4 * 1024;
+		const size_t largeFileChunkSize = 256 * 1024;
+		std::vector<uint8_t> buffer(largeFileChunkSize, 0x3C);
+
+		FileManipulator largeFM;
+		err = vfs.createFile("/region.bin", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, largeFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		std::vector<ClusterIndexType> smallFileStartClusters;
+		for (uint32_t i = 0; i < countSmallFiles; ++i) {
+			size_t bytesWritten = 0;
+			err = vfs.write(largeFM, buffer.data(), largeFileChunkSize, bytesWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(bytesWritten, largeFileChunkSize);
+
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "/small%02u.dat", i);
+			FileManipulator smallFM;
+			err = vfs.createFile(filePath, AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, smallFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = vfs.write(smallFM, buffer.data(), smallFileSize, bytesWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(bytesWritten, smallFileSize);
+			err = vfs.flush(smallFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			smallFileStartClusters.push_back(smallFM.getFileDescriptorRecord().mStartCluster);
+		}
+		err = vfs.flush(largeFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The large file is contiguous and doesn't share blocks with the small files.
+		std::vector<uint32_t> largeFileBlocks;
+		EXPECT_EQ(getCountFragments(volumeManager, largeFM.getFileDescriptorRecord().mStartCluster, largeFileBlocks), 1);
+		ASSERT_EQ(largeFileBlocks.size(), 1);
+		EXPECT_EQ(strategy.getBlockSizeClass(largeFileBlocks[0]), SizeClass::SC_LARGE);
+
+		std::vector<uint32_t> smallFileBlocks;
+		for (ClusterIndexType startClusterIndex : smallFileStartClusters) {
+			EXPECT_EQ(getCountFragments(volumeManager, startClusterIndex, smallFileBlocks), 1);
+		}
+		ASSERT_EQ(smallFileBlocks.size(), 1);
+		EXPECT_NE(smallFileBlocks[0], largeFileBlocks[0]);
+		EXPECT_EQ(strategy.getBlockSizeClass(smallFileBlocks[0]), SizeClass::SC_SMALL);
+
+		// Statistics
+		const uint32_t clustersPerSmallFile = static_cast<uint32_t>((smallFileSize + volumeManager.getClusterSize() - 1) / volumeManager.getClusterSize());
+		SizeClassPlacementStats stats = strategy.getPlacementStats();
+		EXPECT_EQ(stats.mCountAllocations[static_cast<uint32_t>(SizeClass::SC_SMALL)], countSmallFiles * clustersPerSmallFile);
+		EXPECT_EQ(stats.mCountAllocations[static_cast<uint32_t>(SizeClass::SC_MEDIUM)], 0);
+		EXPECT_GT(stats.mCountAllocations[static_cast<uint32_t>(SizeClass::SC_LARGE)], 0);
+		EXPECT_EQ(stats.mCountBlocks[static_cast<uint32_t>(SizeClass::SC_SMALL)], 1);
+		EXPECT_EQ(stats.mCountBlocks[static_cast<uint32_t>(SizeClass::SC_LARGE)], 1);
+		EXPECT_EQ(stats.mCountNonContiguousAllocations, 0);
+		EXPECT_EQ(stats.mCountSizeClassChanges, 0);
+		EXPECT_EQ(stats.mCountFallbackAllocations, 0);
+
+		// The small files are packed at the start of their block.
+		FragmentationStats fragmentationStats;
+		err = strategy.getFragmentationStats(fragmentationStats, SizeClass::SC_SMALL);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		const uint32_t clustersPerBlock = volumeManager.getVolumeDescriptor().getClustersPerFATBlock();
+		EXPECT_EQ(fragmentationStats.mCountBlocks, 1);
+		EXPECT_EQ(fragmentationStats.mCountFreeRuns, 1);
+		EXPECT_EQ(fragmentationStats.mCountFreeClusters, clustersPerBlock - countSmallFiles * clustersPerSmallFile);
+		EXPECT_EQ(fragmentationStats.mLongestFreeRun, fragmentationStats.mCountFreeClusters);
+	}
+}
+
+/// Grows large files in small writes, between writes of small files.
+/// With the expected size set, the file should be placed as large from its first cluster. Without it, it should never go back to a smaller class.
+TEST(SizeClassPlacement, LargeFileWrittenInSmallPieces) {
+	removeVolume();
+
+	SizeClassPlacementSettings settings;
+	settings.mSmallFileMaxSize = 16 * 1024;
+	settings.mLargeFileMinSize = 256 * 1024;
+	std::shared_ptr<SizeClassSplitFATConfiguration> lowLevelFileAccess = std::make_shared<SizeClassSplitFATConfiguration>(settings);
+	ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	{
+		VirtualFileSystem vfs;
+		err = vfs.setup(lowLevelFileAccess);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_NE(lowLevelFileAccess->mStrategy, nullptr);
+		SizeClassDataPlacementStrategy& strategy = *lowLevelFileAccess->mStrategy;
+		VolumeManager& volumeManager = vfs.mVolumeManager;
+
+		const size_t largeFileSize = 1024 * 1024;
+		const size_t smallFileSize = 4 * 1024;
+		const size_t smallFileInterval = 64 * 1024; // A small file is written after every 64KB of the large file.
+		std::vector<uint8_t> buffer(8 * 1024, 0x5E);
+		uint32_t countSmallFiles = 0;
+
+		auto writeLargeFile = [&](const char* szFilePath, size_t pieceSize, FileSizeType expectedFileSize, FileManipulator& largeFM) {
+			err = vfs.createFile(szFilePath, AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, largeFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			if (expectedFileSize > 0) {
+				err = vfs.setExpectedFileSize(largeFM, expectedFileSize);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			}
+			for (size_t totalWritten = 0; totalWritten < largeFileSize; totalWritten += pieceSize) {
+				size_t bytesWritten = 0;
+				err = vfs.write(largeFM, buffer.data(), pieceSize, bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				EXPECT_EQ(bytesWritten, pieceSize);
+
+				if ((totalWritten + pieceSize) % smallFileInterval == 0) {
+					char filePath[50];
+					snprintf(filePath, sizeof(filePath), "/small%02u.dat", countSmallFiles++);
+					FileManipulator smallFM;
+					err = vfs.createFile(filePath, AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, smallFM);
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+					err = vfs.write(smallFM, buffer.data(), smallFileSize, bytesWritten);
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+					err = vfs.flush(smallFM);
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				}
+			}
+			err = vfs.flush(largeFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		};
+
+		// 8KB writes with the expected size known. The file is contiguous in a block for the large files.
+		{
+			FileManipulator largeFM;
+			writeLargeFile("/region0.bin", 8 * 1024, largeFileSize, largeFM);
+			std::vector<uint32_t> largeFileBlocks;
+			EXPECT_EQ(getCountFragments(volumeManager, largeFM.getFileDescriptorRecord().mStartCluster, largeFileBlocks), 1);
+			ASSERT_EQ(largeFileBlocks.size(), 1);
+			EXPECT_EQ(strategy.getBlockSizeClass(largeFileBlocks[0]), SizeClass::SC_LARGE);
+
+			SizeClassPlacementStats stats = strategy.getPlacementStats();
+			EXPECT_EQ(stats.mCountSizeClassChanges, 0);
+			EXPECT_EQ(stats.mCountAllocations[static_cast<uint32_t>(SizeClass::SC_MEDIUM)], 0);
+			EXPECT_EQ(stats.mCountNonContiguousAllocations, 0);
+		}
+
+		// 4KB writes without the expected size. The file changes its class while growing, but never goes back to a smaller class.
+		{
+			strategy.resetPlacementStats();
+			FileManipulator largeFM;
+			writeLargeFile("/region1.bin", 4 * 1024, 0, largeFM);
+			std::vector<SizeClass> sizeClasses = getChainSizeClasses(volumeManager, strategy, largeFM.getFileDescriptorRecord().mStartCluster);
+			ASSERT_FALSE(sizeClasses.empty());
+			EXPECT_TRUE(std::is_sorted(sizeClasses.begin(), sizeClasses.end()));
+			EXPECT_EQ(sizeClasses.back(), SizeClass::SC_LARGE);
+
+			SizeClassPlacementStats stats = strategy.getPlacementStats();
+			EXPECT_EQ(stats.mCountSizeClassChanges, sizeClasses.size() - 1);
+		}
+
+		// Without the hint the next writes expect a small, then a medium file, but the new clusters are still for the large files.
+		{
+			strategy.resetPlacementStats();
+			FileManipulator largeFM;
+			err = vfs.createFile("/region2.bin", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, largeFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = vfs.setExpectedFileSize(largeFM, largeFileSize);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t bytesWritten = 0;
+			err = vfs.write(largeFM, buffer.data(), buffer.size(), bytesWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = vfs.setExpectedFileSize(largeFM, 0);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			for (uint32_t i = 0; i < 8; ++i) {
+				err = vfs.write(largeFM, buffer.data(), buffer.size(), bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			}
+			err = vfs.flush(largeFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+			std::vector<SizeClass> sizeClasses = getChainSizeClasses(volumeManager, strategy, largeFM.getFileDescriptorRecord().mStartCluster);
+			ASSERT_EQ(sizeClasses.size(), 1);
+			EXPECT_EQ(sizeClasses[0], SizeClass::SC_LARGE);
+			SizeClassPlacementStats stats = strategy.getPlacementStats();
+			EXPECT_EQ(stats.mCountSizeClassChanges, 0);
+			EXPECT_EQ(stats.mCountAllocations[static_cast<uint32_t>(SizeClass::SC_SMALL)], 0);
+		}
+	}
+}
+
+
+/// Writes files of all size classes from several threads. Every allocated cluster should be counted once in the statistics.
+TEST(SizeClassPlacement, ConcurrentAllocations) {
+	removeVolume();
+
+	SizeClassPlacementSettings settings;
+	settings.mSmallFileMaxSize = 16 * 1024;
+	settings.mLargeFileMinSize = 256 * 1024;
+	std::shared_ptr<SizeClassSplitFATConfiguration> lowLevelFileAccess = std::make_shared<SizeClassSplitFATConfiguration>(settings);
+	ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	{
+		VirtualFileSystem vfs;
+		err = vfs.setup(lowLevelFileAccess);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_NE(lowLevelFileAccess->mStrategy, nullptr);
+		SizeClassDataPlacementStrategy& strategy = *lowLevelFileAccess->mStrategy;
+		strategy.resetPlacementStats();
+
+		const uint32_t countThreads = 4;
+		const uint32_t countFilesPerThread = 8;
+		const size_t fileSizes[] = { 8 * 1024, 64 * 1024, 512 * 1024 };
+		const uint32_t clusterSize = vfs.mVolumeManager.getClusterSize();
+		uint32_t countClustersPerThread = 0;
+		for (uint32_t i = 0; i < countFilesPerThread; ++i) {
+			countClustersPerThread += static_cast<uint32_t>((fileSizes[i % 3] + clusterSize - 1) / clusterSize);
+		}
+
+		auto writeFiles = [&vfs, &fileSizes](uint32_t threadIndex) {
+			std::vector<uint8_t> buffer(8 * 1024, static_cast<uint8_t>(threadIndex));
+			for (uint32_t i = 0; i < countFilesPerThread; ++i) {
+				char filePath[50];
+				snprintf(filePath, sizeof(filePath), "/t%u_file%02u.dat", threadIndex, i);
+				FileManipulator fileFM;
+				ErrorCode err = vfs.createFile(filePath, AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				for (size_t totalWritten = 0; totalWritten < fileSizes[i % 3]; totalWritten += buffer.size()) {
+					size_t bytesWritten = 0;
+					err = vfs.write(fileFM, buffer.data(), buffer.size(), bytesWritten);
+					EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				}
+				err = vfs.flush(fileFM);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (uint32_t i = 0; i < countThreads; ++i) {
+			threads.emplace_back(writeFiles, i);
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+
+		SizeClassPlacementStats stats = strategy.getPlacementStats();
+		uint32_t countAllocations = 0;
+		for (uint32_t i = 0; i < static_cast<uint32_t>(SizeClass::SC_COUNT); ++i) {
+			countAllocations += stats.mCountAllocations[i];
+		}
+		EXPECT_EQ(countAllocations, countThreads * countClustersPerThread);
+		EXPECT_EQ(stats.mCountFallbackAllocations, 0);
+	}
+}
@@ -11,9 +11,14 @@
 #include "SplitFAT/VirtualFileSystem.h"
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/Transaction.h"
+#include "SplitFAT/DataBlockManager.h"
 #include <memory>
 #include <random>
 #include <chrono>
+#include <fstream>
+#include <iterator>
+#include <atomic>
+#include <thread>
 
 using namespace SFAT;
 
@@ -21,6 +26,42 @@ namespace {
 	const char* kVolumeControlAndFATDataFilePath = "SFATControl.dat";
 	const char* kClusterDataFilePath = "data.dat";
 	const char* kTransactionFilePath = "_SFATTransaction.dat";
+
+	class RedoLogSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		virtual TransactionLogMode getTransactionLogMode() const override {
+			return TransactionLogMode::TLM_REDO;
+		}
+	};
+
+	class CheckpointSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		virtual TransactionCheckpointThresholds getTransactionCheckpointThresholds() const override {
+			TransactionCheckpointThresholds thresholds;
+			thresholds.mMaxDirtyBytes = 4 * 8192;
+			thresholds.mMaxLoggedFATPages = 0;
+			thresholds.mMaxDurationMs = 0;
+			return thresholds;
+		}
+	};
+
+	// Gives access to the path of the finalized transaction file.
+	class TransactionFileSplitFATConfiguration : public WindowsSplitFATConfiguration {
+	public:
+		std::string getTransactionFinalFilePath() const {
+			return _getTransactionFinalFilePath();
+		}
+	};
+
+	std::vector<uint8_t> readWholeFile(const std::string& filePath) {
+		std::ifstream file(filePath, std::ios::binary);
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	void writeWholeFile(const std::string& filePath, const std::vector<uint8_t>& data) {
+		std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
 }
 
 class TransactionUnitTest : public testing::Test {
@@ -48,8 +89,14 @@ protected:  // You should make the members protected s.t. they can be
 	virtual void TearDown() override {
 	}
 
-	void createSplitFATFileStorage(SplitFATFileStorage& fileStorage) {
-		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+	void createSplitFATFileStorage(SplitFATFileStorage& fileStorage, bool useRedoLog = false) {
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess;
+		if (useRedoLog) {
+			lowLevelFileAccess = std::make_shared<RedoLogSplitFATConfiguration>();
+		}
+		else {
+			lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		}
 		ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
 		EXPECT_EQ(err, ErrorCode::RESULT_OK);
 		err = fileStorage.setup(lowLevelFileAccess);
@@ -550,3 +597,1086 @@ TEST_F(TransactionUnitTest, RestoreFromTransaction) {
 	}
 }
 
+
+/// Tests that the clusters freed in a transaction are released only at its end.
+TEST_F(TransactionUnitTest, ClustersAreFreedAtTheEndOfTransaction) {
+	std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+
+	const size_t kFileSize = 256 * 1024;
+	std::vector<uint8_t> buffer(kFileSize, 0x5A);
+	auto writeFile = [&fileStorage, &buffer](const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage->openFile(file, szFilePath, "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t sizeWritten = 0;
+		err = file.write(buffer.data(), buffer.size(), sizeWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(sizeWritten, buffer.size());
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	};
+
+	writeFile("file0.bin");
+	writeFile("file1.bin");
+	FileSizeType initialFreeSpace = 0;
+	ErrorCode err = fileStorage->getFreeSpace(initialFreeSpace);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	bool createdTransaction = false;
+	fileStorage->tryStartTransaction(createdTransaction);
+	EXPECT_TRUE(createdTransaction);
+
+	err = fileStorage->deleteFile("file0.bin");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_FALSE(fileStorage->fileExists("file0.bin"));
+	{
+		// Opening for writing truncates the file.
+		FileHandle file;
+		err = fileStorage->openFile(file, "file1.bin", "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.close();
+	}
+
+	// The clusters of the deleted/truncated files can't be used until the end of the transaction.
+	FileSizeType freeSpace = 0;
+	err = fileStorage->getFreeSpace(freeSpace);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(freeSpace, initialFreeSpace);
+	writeFile("file2.bin");
+	err = fileStorage->getFreeSpace(freeSpace);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(freeSpace + kFileSize, initialFreeSpace);
+
+	err = fileStorage->endTransaction();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	err = fileStorage->getFreeSpace(freeSpace);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(freeSpace, initialFreeSpace + kFileSize);
+
+	// The content of the file written in the transaction should not be affected.
+	FileHandle file;
+	err = fileStorage->openFile(file, "file2.bin", "rb");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	std::vector<uint8_t> readBuffer(kFileSize, 0);
+	size_t sizeRead = 0;
+	err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(sizeRead, kFileSize);
+	EXPECT_TRUE(readBuffer == buffer);
+	file.close();
+}
+
+
+/// Tests that only the changed pages of the FAT are logged, and that the transaction is restored from them.
+TEST_F(TransactionUnitTest, FATChangesAreLoggedByPages) {
+	const size_t kFileSize = 256 * 1024;
+	std::vector<uint8_t> buffer(kFileSize, 0x6B);
+	FileSizeType initialFreeSpace = 0;
+
+	// First stage
+	// Changes the FAT in a transaction, but does not delete the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		auto writeFile = [&fileStorage, &buffer](const char* szFilePath) {
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, szFilePath, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(sizeWritten, buffer.size());
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		};
+
+		writeFile("file0.bin");
+		ErrorCode err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		err = fileStorage->deleteFile("file0.bin");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		writeFile("file1.bin");
+
+		// The whole FAT block would be logged otherwise.
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+		err = volumeManager.mTransaction.flushLog();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		FileHandle transactionFile;
+		volumeManager.getLowLevelFileAccess().getTempTransactionFile(transactionFile);
+		ASSERT_TRUE(transactionFile.isOpen());
+		FilePositionType transactionFileSize = 0;
+		err = transactionFile.getPosition(transactionFileSize);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_GT(transactionFileSize, 0);
+		EXPECT_LT(transactionFileSize, volumeManager.getVolumeDescriptor().getByteSizeOfFATBlock());
+
+		// Flushes the cached data, but keeps the transaction file, so it will be restored on the next opening of the storage.
+		err = volumeManager.mTransaction._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(fileStorage->isInTransaction());
+	}
+
+	// Second stage
+	// Should reopen the storage and restore from the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		EXPECT_FALSE(fileStorage->fileExists("file1.bin"));
+		EXPECT_TRUE(fileStorage->fileExists("file0.bin"));
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace);
+
+		FileHandle file;
+		err = fileStorage->openFile(file, "file0.bin", "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> readBuffer(kFileSize, 0);
+		size_t sizeRead = 0;
+		err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(sizeRead, kFileSize);
+		EXPECT_TRUE(readBuffer == buffer);
+		file.close();
+	}
+}
+
+
+/// Tests that the events of many operations in a transaction are written into the transaction file together.
+TEST_F(TransactionUnitTest, LogIsWrittenInBatches) {
+	std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	const TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+
+	bool createdTransaction = false;
+	fileStorage->tryStartTransaction(createdTransaction);
+	EXPECT_TRUE(createdTransaction);
+
+	const int kCountDirectories = 8;
+	const int kCountFilesPerDirectory = 8;
+	std::vector<uint8_t> buffer(1000, 0x21);
+	for (int i = 0; i < kCountDirectories; ++i) {
+		char directoryPath[50];
+		snprintf(directoryPath, sizeof(directoryPath), "dir%d", i);
+		ErrorCode err = fileStorage->createDirectory(directoryPath);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (int j = 0; j < kCountFilesPerDirectory; ++j) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "dir%d/file%d.bin", i, j);
+			FileHandle file;
+			err = fileStorage->openFile(file, filePath, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+	}
+
+	// Nothing should be written so far, as the logged data is still not overwritten.
+	EXPECT_GT(transactionLog.getLogStats().mCountEvents, static_cast<uint32_t>(kCountDirectories));
+	EXPECT_EQ(transactionLog.getLogStats().mCountWrites, 0);
+
+	ErrorCode err = fileStorage->endTransaction();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(transactionLog.getLogStats().mCountWrites, 1);
+	EXPECT_GT(transactionLog.getLogStats().mCountBytes, 0);
+
+	for (int i = 0; i < kCountDirectories; ++i) {
+		for (int j = 0; j < kCountFilesPerDirectory; ++j) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "dir%d/file%d.bin", i, j);
+			EXPECT_TRUE(fileStorage->fileExists(filePath));
+		}
+	}
+}
+
+
+/// Tests that the logged payloads are compressed, and that the transaction is still restored exactly.
+TEST_F(TransactionUnitTest, LogPayloadsAreCompressed) {
+	const int kCountFiles = 32;
+	std::vector<uint8_t> buffer(20000, 0x44);
+	FileSizeType initialFreeSpace = 0;
+
+	// First stage
+	// Creates files in a transaction, but does not delete the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		ErrorCode err = fileStorage->createDirectory("dir");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "dir/file%d.bin", i);
+			FileHandle file;
+			err = fileStorage->openFile(file, filePath, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+		err = volumeManager.mTransaction._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The log should be much smaller than the logged data.
+		const TransactionLogStats& stats = volumeManager.mTransaction.getLogStats();
+		EXPECT_GT(stats.mCountPayloadBytes, 0);
+#if (SPLIT_FAT__ENABLE_TRANSACTION_LOG_COMPRESSION == 1)
+		EXPECT_LT(stats.mCountBytes * 4, stats.mCountPayloadBytes);
+#endif
+	}
+
+	// Second stage
+	// Should reopen the storage and restore from the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		EXPECT_TRUE(fileStorage->directoryExists("dir"));
+		int countEntities = 0;
+		fileStorage->iterateThroughDirectory("dir", DI_ALL, [&countEntities](bool& doQuit, const FileDescriptorRecord& record, const std::string& fullPath)->ErrorCode {
+			++countEntities;
+			return ErrorCode::RESULT_OK;
+		});
+		EXPECT_EQ(countEntities, 0);
+
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace);
+	}
+}
+
+
+/// Tests that in redo mode the committed transaction is restored from the log, if it wasn't written in place.
+TEST_F(TransactionUnitTest, RedoLogIsReplayedAfterCommit) {
+	const int kCountFiles = 16;
+	std::vector<uint8_t> buffer(10000, 0x73);
+	auto writeFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t sizeWritten = 0;
+		err = file.write(buffer.data(), buffer.size(), sizeWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	};
+	auto checkFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> readBuffer(buffer.size(), 0);
+		size_t sizeRead = 0;
+		err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(sizeRead, buffer.size());
+		EXPECT_TRUE(readBuffer == buffer);
+		file.close();
+	};
+
+	// First stage
+	// Commits a transaction in redo mode, but loses the changes that are not written in place yet.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage, true);
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		EXPECT_EQ(volumeManager.mTransaction.getLogMode(), TransactionLogMode::TLM_REDO);
+
+		ErrorCode err = fileStorage->createDirectory("redo");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "redo/file%d.bin", i);
+			writeFile(*fileStorage, filePath);
+		}
+
+		err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(fileStorage->isInTransaction());
+		EXPECT_TRUE(volumeManager.mTransaction.isCheckpointPending());
+
+		// The committed data is available before the checkpoint.
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "redo/file%d.bin", i);
+			checkFile(*fileStorage, filePath);
+		}
+
+		// Simulates a crash before the checkpoint.
+		err = volumeManager.discardFATCachedChanges();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = volumeManager.discardDirectoryCachedChanges();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		volumeManager.mTransaction.mIsCheckpointPending = false;
+	}
+
+	// Second stage
+	// The transaction should be restored from the redo log. Starts another transaction, but doesn't commit it.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage, true);
+
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "redo/file%d.bin", i);
+			EXPECT_TRUE(fileStorage->fileExists(filePath));
+			checkFile(*fileStorage, filePath);
+		}
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		writeFile(*fileStorage, "redo/notCommitted.bin");
+		EXPECT_TRUE(fileStorage->fileExists("redo/notCommitted.bin"));
+	}
+
+	// Third stage
+	// The transaction that was not committed should be missing. The checkpoint writes the committed changes in place.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage, true);
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+		EXPECT_FALSE(fileStorage->fileExists("redo/notCommitted.bin"));
+		EXPECT_TRUE(fileStorage->fileExists("redo/file0.bin"));
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		ErrorCode err = fileStorage->deleteFile("redo/file0.bin");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_TRUE(volumeManager.mTransaction.isCheckpointPending());
+
+		err = volumeManager.flush();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(volumeManager.mTransaction.isCheckpointPending());
+		EXPECT_FALSE(fileStorage->fileExists("redo/file0.bin"));
+		EXPECT_TRUE(fileStorage->fileExists("redo/file1.bin"));
+	}
+}
+
+/// Commits transactions in redo mode with writing the changes in place on a background thread.
+/// The committed data should be readable right after the commit, and the next transaction should wait for the background work.
+TEST_F(TransactionUnitTest, AsyncCommitCompletesInBackground) {
+	const int kCountFiles = 16;
+	std::vector<uint8_t> buffer(10000, 0x4D);
+	auto writeFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t sizeWritten = 0;
+		err = file.write(buffer.data(), buffer.size(), sizeWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	};
+	auto checkFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> readBuffer(buffer.size(), 0);
+		size_t sizeRead = 0;
+		err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(sizeRead, buffer.size());
+		EXPECT_TRUE(readBuffer == buffer);
+		file.close();
+	};
+
+	// First stage
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage, true);
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		ErrorCode err = fileStorage->createDirectory("async");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "async/file%d.bin", i);
+			writeFile(*fileStorage, filePath);
+		}
+
+		std::shared_future<ErrorCode> completion;
+		err = fileStorage->endTransactionAsync(completion);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(fileStorage->isInTransaction());
+		ASSERT_TRUE(completion.valid());
+
+		// The committed data is available while it is written in place.
+		for (int i = 0; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "async/file%d.bin", i);
+			checkFile(*fileStorage, filePath);
+		}
+
+		EXPECT_EQ(completion.get(), ErrorCode::RESULT_OK);
+		EXPECT_FALSE(volumeManager.mTransaction.isCheckpointPending());
+		EXPECT_EQ(volumeManager.waitForCheckpoint(), ErrorCode::RESULT_OK);
+
+		// The next transaction starts right after the asynchronous commit.
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		writeFile(*fileStorage, "async/second.bin");
+		err = fileStorage->endTransactionAsync(completion);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		EXPECT_FALSE(volumeManager.mTransaction.isCheckpointPending());
+		EXPECT_EQ(completion.get(), ErrorCode::RESULT_OK);
+		err = fileStorage->deleteFile("async/file0.bin");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->endTransactionAsync(completion);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(fileStorage->fileExists("async/file0.bin"));
+
+		// Without a transaction there is nothing to be committed.
+		std::shared_future<ErrorCode> noTransactionCompletion;
+		err = fileStorage->endTransactionAsync(noTransactionCompletion);
+		EXPECT_EQ(err, ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED);
+		ASSERT_TRUE(noTransactionCompletion.valid());
+		EXPECT_EQ(noTransactionCompletion.get(), ErrorCode::ERROR_NO_TRANSACTION_HAS_BEEN_STARTED);
+		// The storage is closed while the last checkpoint could be still running.
+	}
+
+	// Second stage
+	// All committed changes should be stored.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage, true);
+
+		EXPECT_FALSE(fileStorage->fileExists("async/file0.bin"));
+		for (int i = 1; i < kCountFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "async/file%d.bin", i);
+			checkFile(*fileStorage, filePath);
+		}
+		checkFile(*fileStorage, "async/second.bin");
+	}
+}
+
+/// Reopens the volume after an asynchronous commit, before its background checkpoint has run.
+/// In redo mode the transaction should be replayed from the redo log. In undo mode it should be committed synchronously.
+TEST_F(TransactionUnitTest, AsyncCommitIsDurableBeforeCheckpoint) {
+	std::vector<uint8_t> buffer(10000, 0x2B);
+	for (bool useRedoLog : { true, false }) {
+		const char* szFilePath = useRedoLog ? "redo.bin" : "undo.bin";
+
+		// First stage
+		// Commits while all workers of the I/O scheduler are busy, then loses the changes that are not written in place yet.
+		// In undo mode the workers are not blocked, as the synchronous commit flushes through the scheduler.
+		{
+			std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+			createSplitFATFileStorage(*fileStorage, useRedoLog);
+			VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+			bool createdTransaction = false;
+			fileStorage->tryStartTransaction(createdTransaction);
+			EXPECT_TRUE(createdTransaction);
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, szFilePath, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+			IOScheduler& scheduler = volumeManager.getIOScheduler();
+			const uint32_t countWorkers = useRedoLog ? scheduler.getCountThreads() : 0;
+			std::atomic<uint32_t> countBlockedWorkers(0);
+			std::atomic<bool> isReleased(false);
+			std::vector<std::shared_future<ErrorCode>> blockingCompletions(countWorkers);
+			for (auto& blockingCompletion : blockingCompletions) {
+				scheduler.submit(IOPriority::IOP_BACKGROUND, [&countBlockedWorkers, &isReleased]() {
+					++countBlockedWorkers;
+					while (!isReleased) {
+						std::this_thread::yield();
+					}
+					return ErrorCode::RESULT_OK;
+				}, blockingCompletion);
+			}
+			while (countBlockedWorkers < countWorkers) {
+				std::this_thread::yield();
+			}
+
+			std::shared_future<ErrorCode> completion;
+			err = fileStorage->endTransactionAsync(completion);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			ASSERT_TRUE(completion.valid());
+			EXPECT_EQ(volumeManager.mTransaction.isCheckpointPending(), useRedoLog);
+
+			// Simulates a crash before the checkpoint.
+			err = volumeManager.discardFATCachedChanges();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = volumeManager.discardDirectoryCachedChanges();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			volumeManager.mTransaction.mIsCheckpointPending = false;
+
+			isReleased = true;
+			for (auto& blockingCompletion : blockingCompletions) {
+				scheduler.wait(blockingCompletion);
+			}
+			EXPECT_EQ(completion.get(), ErrorCode::RESULT_OK);
+		}
+
+		// Second stage
+		// The committed file should be there.
+		{
+			std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+			createSplitFATFileStorage(*fileStorage, useRedoLog);
+
+			EXPECT_TRUE(fileStorage->fileExists(szFilePath));
+			FileHandle file;
+			ErrorCode err = fileStorage->openFile(file, szFilePath, "rb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			std::vector<uint8_t> readBuffer(buffer.size(), 0);
+			size_t sizeRead = 0;
+			err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			EXPECT_EQ(sizeRead, buffer.size());
+			EXPECT_TRUE(readBuffer == buffer);
+			file.close();
+		}
+	}
+}
+
+/// Writes a transaction bigger than the checkpoint thresholds. Its changes are written in place before the commit,
+/// but an interrupted transaction should still be reverted completely.
+TEST_F(TransactionUnitTest, LargeTransactionIsCheckpointed) {
+	const int kCountDirectories = 12;
+	std::vector<uint8_t> buffer(10000, 0x2B);
+	auto writeFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t sizeWritten = 0;
+		err = file.write(buffer.data(), buffer.size(), sizeWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	};
+	auto checkFile = [&buffer](SplitFATFileStorage& fileStorage, const char* szFilePath) {
+		FileHandle file;
+		ErrorCode err = fileStorage.openFile(file, szFilePath, "rb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> readBuffer(buffer.size(), 0);
+		size_t sizeRead = 0;
+		err = file.read(readBuffer.data(), readBuffer.size(), sizeRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(sizeRead, buffer.size());
+		EXPECT_TRUE(readBuffer == buffer);
+		file.close();
+	};
+	auto createSplitFATFileStorageWithCheckpoints = [](SplitFATFileStorage& fileStorage) {
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<CheckpointSplitFATConfiguration>();
+		ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage.setup(lowLevelFileAccess);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	};
+	auto createDirectories = [&writeFile](SplitFATFileStorage& fileStorage) {
+		for (int i = 0; i < kCountDirectories; ++i) {
+			char path[50];
+			snprintf(path, sizeof(path), "dir%d", i);
+			ErrorCode err = fileStorage.createDirectory(path);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			snprintf(path, sizeof(path), "dir%d/file.bin", i);
+			writeFile(fileStorage, path);
+		}
+	};
+
+	// First stage
+	// Commits a small transaction, then interrupts a large one after its automatic checkpoints.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorageWithCheckpoints(*fileStorage);
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		writeFile(*fileStorage, "base.bin");
+		ErrorCode err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		createDirectories(*fileStorage);
+		EXPECT_GT(volumeManager.mTransaction.getLogStats().mCountCheckpoints, 1u);
+		EXPECT_LE(volumeManager.getDataBlockManager().getDirtyBytes(), 5u * volumeManager.getClusterSize());
+		EXPECT_TRUE(fileStorage->directoryExists("dir0"));
+		// The transaction is not committed.
+	}
+
+	// Second stage
+	// The interrupted transaction should be reverted completely. Commits it again.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorageWithCheckpoints(*fileStorage);
+		VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+
+		checkFile(*fileStorage, "base.bin");
+		for (int i = 0; i < kCountDirectories; ++i) {
+			char path[50];
+			snprintf(path, sizeof(path), "dir%d", i);
+			EXPECT_FALSE(fileStorage->directoryExists(path));
+		}
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+		createDirectories(*fileStorage);
+		EXPECT_GT(volumeManager.mTransaction.getLogStats().mCountCheckpoints, 1u);
+		ErrorCode err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Third stage
+	// All changes of the committed transaction should be stored.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorageWithCheckpoints(*fileStorage);
+
+		checkFile(*fileStorage, "base.bin");
+		for (int i = 0; i < kCountDirectories; ++i) {
+			char path[50];
+			snprintf(path, sizeof(path), "dir%d/file.bin", i);
+			checkFile(*fileStorage, path);
+		}
+	}
+}
+
+
+/// Tests that the transaction file is restored correctly when read in small chunks,
+/// that a corrupted payload is detected before any of the events is applied, and that an incomplete last event is ignored.
+TEST_F(TransactionUnitTest, RestoreReadsLogInChunks) {
+	const int kCountDirectories = 32;
+	std::vector<uint8_t> buffer(3000, 0x5C);
+	FileSizeType initialFreeSpace = 0;
+	std::string transactionFilePath;
+	{
+		TransactionFileSplitFATConfiguration configuration;
+		configuration.setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		transactionFilePath = configuration.getTransactionFinalFilePath();
+	}
+
+	// First stage
+	// Creates directories and files in a transaction, but does not delete the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		ErrorCode err = fileStorage->createDirectory("dir");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		for (int i = 0; i < kCountDirectories; ++i) {
+			char path[50];
+			snprintf(path, sizeof(path), "dir/sub%d", i);
+			err = fileStorage->createDirectory(path);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			snprintf(path, sizeof(path), "dir/sub%d/file.bin", i);
+			FileHandle file;
+			err = fileStorage->openFile(file, path, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+		err = transactionLog._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_GT(transactionLog.getLogStats().mCountEvents, static_cast<uint32_t>(TransactionEventsLog::kMinEventsForParallelRestore));
+	}
+
+	// Take the transaction file away, so the storage can be opened without restoring.
+	std::vector<uint8_t> logData = readWholeFile(transactionFilePath);
+	ASSERT_GT(logData.size(), sizeof(TransactionFileHeader) + sizeof(TransactionEvent));
+	EXPECT_EQ(std::remove(transactionFilePath.c_str()), 0);
+
+	// Second stage
+	// Restores from the transaction file in chunks much smaller than the file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		EXPECT_TRUE(fileStorage->fileExists("dir/sub0/file.bin"));
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+		transactionLog.mRestoreReadChunkSize = 1024;
+
+		// Corrupt the payload of the first event.
+		const size_t firstEventPosition = sizeof(TransactionFileHeader);
+		TransactionEvent firstEvent;
+		memcpy(&firstEvent, logData.data() + firstEventPosition, sizeof(TransactionEvent));
+		ASSERT_GT(firstEvent.mPayloadSize, 0);
+		std::vector<uint8_t> corruptedLogData = logData;
+		corruptedLogData[firstEventPosition + sizeof(TransactionEvent) + firstEvent.mPayloadSize / 2] ^= 0xFF;
+		writeWholeFile(transactionFilePath, corruptedLogData);
+
+		ErrorCode err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR);
+		EXPECT_TRUE(fileStorage->fileExists("dir/sub0/file.bin"));
+
+		// The writing of the last event was interrupted.
+		std::vector<uint8_t> tornLogData = logData;
+		tornLogData.insert(tornLogData.end(), logData.begin() + firstEventPosition, logData.begin() + firstEventPosition + sizeof(TransactionEvent) + firstEvent.mPayloadSize / 2);
+		writeWholeFile(transactionFilePath, tornLogData);
+
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getVirtualFileSystem().mVolumeManager.getLowLevelFileAccess().cleanupTransactionFinalFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Third stage
+	// The transaction should be reverted.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		EXPECT_TRUE(fileStorage->directoryExists("dir"));
+		int countEntities = 0;
+		fileStorage->iterateThroughDirectory("dir", DI_ALL, [&countEntities](bool& doQuit, const FileDescriptorRecord& record, const std::string& fullPath)->ErrorCode {
+			++countEntities;
+			return ErrorCode::RESULT_OK;
+		});
+		EXPECT_EQ(countEntities, 0);
+
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace);
+	}
+}
+
+
+/// Tests that only the last event in the transaction file could be damaged, as its writing could be interrupted.
+/// A damaged event followed by more data fails the restore.
+TEST_F(TransactionUnitTest, DamagedLastEventIsIgnored) {
+	const int kCountDirectories = 8;
+	std::vector<uint8_t> buffer(3000, 0x6D);
+	FileSizeType initialFreeSpace = 0;
+	std::string transactionFilePath;
+	{
+		TransactionFileSplitFATConfiguration configuration;
+		configuration.setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		transactionFilePath = configuration.getTransactionFinalFilePath();
+	}
+
+	// First stage
+	// Creates directories and files in a transaction, but does not delete the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		ErrorCode err = fileStorage->createDirectory("dir");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		for (int i = 0; i < kCountDirectories; ++i) {
+			char path[50];
+			snprintf(path, sizeof(path), "dir/sub%d", i);
+			err = fileStorage->createDirectory(path);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			snprintf(path, sizeof(path), "dir/sub%d/file.bin", i);
+			FileHandle file;
+			err = fileStorage->openFile(file, path, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+		err = transactionLog._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Take the transaction file away, so the storage can be opened without restoring.
+	std::vector<uint8_t> logData = readWholeFile(transactionFilePath);
+	ASSERT_GT(logData.size(), sizeof(TransactionFileHeader) + sizeof(TransactionEvent));
+	EXPECT_EQ(std::remove(transactionFilePath.c_str()), 0);
+
+	// Find the last event with a payload.
+	const size_t firstEventPosition = sizeof(TransactionFileHeader);
+	size_t lastEventPosition = 0;
+	TransactionEvent lastEvent;
+	for (size_t position = firstEventPosition; position + sizeof(TransactionEvent) <= logData.size(); ) {
+		TransactionEvent transactionEvent;
+		memcpy(&transactionEvent, logData.data() + position, sizeof(TransactionEvent));
+		if (transactionEvent.mPayloadSize > 0) {
+			lastEventPosition = position;
+			lastEvent = transactionEvent;
+		}
+		position += sizeof(TransactionEvent) + transactionEvent.mPayloadSize;
+	}
+	ASSERT_GT(lastEventPosition, firstEventPosition);
+	// The events without payload after it are dropped.
+	logData.resize(lastEventPosition + sizeof(TransactionEvent) + lastEvent.mPayloadSize);
+
+	// Second stage
+	// Restores from the damaged transaction files, then from the intact one.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		EXPECT_TRUE(fileStorage->fileExists("dir/sub0/file.bin"));
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+
+		// The payload of the last event can't be decoded.
+		std::vector<uint8_t> damagedLogData = logData;
+		damagedLogData[lastEventPosition + sizeof(TransactionEvent) + lastEvent.mPayloadSize / 2] ^= 0xFF;
+		writeWholeFile(transactionFilePath, damagedLogData);
+		ErrorCode err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The same, but more data follows the damaged event.
+		damagedLogData.insert(damagedLogData.end(), logData.begin() + firstEventPosition, logData.begin() + firstEventPosition + sizeof(TransactionEvent));
+		writeWholeFile(transactionFilePath, damagedLogData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR);
+
+		// The size of the payload of the last event is garbage.
+		TransactionEvent damagedEvent = lastEvent;
+		damagedEvent.mPayloadSize = 0xFFFFFFF0;
+		damagedLogData = logData;
+		memcpy(damagedLogData.data() + lastEventPosition, &damagedEvent, sizeof(TransactionEvent));
+		writeWholeFile(transactionFilePath, damagedLogData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The same for the first event, followed by more data than any event could have.
+		TransactionEvent firstEvent;
+		memcpy(&firstEvent, logData.data() + firstEventPosition, sizeof(TransactionEvent));
+		firstEvent.mPayloadSize = 0xFFFFFFF0;
+		damagedLogData = logData;
+		memcpy(damagedLogData.data() + firstEventPosition, &firstEvent, sizeof(TransactionEvent));
+		const size_t maxEventEndPosition = firstEventPosition + sizeof(TransactionEvent) + transactionLog._getMaxPayloadSize();
+		if (damagedLogData.size() <= maxEventEndPosition) {
+			damagedLogData.resize(maxEventEndPosition + 1, 0);
+		}
+		writeWholeFile(transactionFilePath, damagedLogData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR);
+
+		writeWholeFile(transactionFilePath, logData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getVirtualFileSystem().mVolumeManager.getLowLevelFileAccess().cleanupTransactionFinalFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Third stage
+	// The transaction should be reverted.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		EXPECT_TRUE(fileStorage->directoryExists("dir"));
+		int countEntities = 0;
+		fileStorage->iterateThroughDirectory("dir", DI_ALL, [&countEntities](bool& doQuit, const FileDescriptorRecord& record, const std::string& fullPath)->ErrorCode {
+			++countEntities;
+			return ErrorCode::RESULT_OK;
+		});
+		EXPECT_EQ(countEntities, 0);
+
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace);
+	}
+}
+
+
+/// Tests that a transaction file without a header, as written by the older versions, or with an unknown version is rejected
+/// without changing the volume, and that the same events with the current header are restored.
+TEST_F(TransactionUnitTest, OldTransactionFileIsRejected) {
+	std::vector<uint8_t> buffer(3000, 0x3A);
+	FileSizeType initialFreeSpace = 0;
+	std::string transactionFilePath;
+	{
+		TransactionFileSplitFATConfiguration configuration;
+		configuration.setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		transactionFilePath = configuration.getTransactionFinalFilePath();
+	}
+
+	// First stage
+	// Creates a file in a transaction, but does not delete the transaction file.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		ErrorCode err = fileStorage->createDirectory("dir");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getFreeSpace(initialFreeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		FileHandle file;
+		err = fileStorage->openFile(file, "dir/file.bin", "wb");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		size_t sizeWritten = 0;
+		err = file.write(buffer.data(), buffer.size(), sizeWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = file.close();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+		err = transactionLog._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	std::vector<uint8_t> logData = readWholeFile(transactionFilePath);
+	ASSERT_GT(logData.size(), sizeof(TransactionFileHeader) + sizeof(TransactionEvent));
+	TransactionFileHeader header;
+	memcpy(&header, logData.data(), sizeof(TransactionFileHeader));
+	EXPECT_EQ(header.mSignature, static_cast<uint32_t>(TransactionFileHeader::SIGNATURE));
+	EXPECT_EQ(header.mVersion, static_cast<uint32_t>(TransactionFileHeader::CURRENT_VERSION));
+	EXPECT_EQ(std::remove(transactionFilePath.c_str()), 0);
+
+	// Second stage
+	// Only the file with the current header is restored.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+		EXPECT_TRUE(fileStorage->fileExists("dir/file.bin"));
+		TransactionEventsLog& transactionLog = fileStorage->getVirtualFileSystem().mVolumeManager.mTransaction;
+
+		// The older versions start the file directly with the first event.
+		std::vector<uint8_t> oldLogData(logData.begin() + sizeof(TransactionFileHeader), logData.end());
+		writeWholeFile(transactionFilePath, oldLogData);
+		ErrorCode err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR);
+		EXPECT_TRUE(fileStorage->fileExists("dir/file.bin"));
+
+		std::vector<uint8_t> newerLogData = logData;
+		TransactionFileHeader newerHeader = header;
+		newerHeader.mVersion = TransactionFileHeader::CURRENT_VERSION + 1;
+		memcpy(newerLogData.data(), &newerHeader, sizeof(TransactionFileHeader));
+		writeWholeFile(transactionFilePath, newerLogData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::ERROR_VOLUME_RESTORE_FROM_TRANSACTION_ERROR);
+		EXPECT_TRUE(fileStorage->fileExists("dir/file.bin"));
+
+		writeWholeFile(transactionFilePath, logData);
+		err = transactionLog._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = fileStorage->getVirtualFileSystem().mVolumeManager.getLowLevelFileAccess().cleanupTransactionFinalFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	}
+
+	// Third stage
+	// The transaction should be reverted.
+	{
+		std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+		createSplitFATFileStorage(*fileStorage);
+
+		EXPECT_TRUE(fileStorage->directoryExists("dir"));
+		EXPECT_FALSE(fileStorage->fileExists("dir/file.bin"));
+
+		FileSizeType freeSpace = 0;
+		ErrorCode err = fileStorage->getFreeSpace(freeSpace);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(freeSpace, initialFreeSpace);
+	}
+}
+
+
+/// Tests that a commit syncs the transaction file, the FAT-data file and the cluster-data file only once each,
+/// and that a flush without changes doesn't sync anything.
+TEST_F(TransactionUnitTest, CommitSyncsEveryFileOnce) {
+	std::unique_ptr<SplitFATFileStorage> fileStorage = std::make_unique<SplitFATFileStorage>();
+	createSplitFATFileStorage(*fileStorage);
+	VolumeManager& volumeManager = fileStorage->getVirtualFileSystem().mVolumeManager;
+	FlushStats& flushStats = volumeManager.getFlushStats();
+
+	ErrorCode err = fileStorage->createDirectory("dir");
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	err = volumeManager.flush();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+	// Nothing was written since the last flush.
+	flushStats.reset();
+	err = volumeManager.flush();
+	EXPECT_EQ(err, ErrorCode::RESULT_OK);
+	EXPECT_EQ(flushStats.getCountSyncs(), 0);
+	EXPECT_EQ(flushStats.mCountSkippedSyncs, 2);
+
+	for (int commitIndex = 0; commitIndex < 3; ++commitIndex) {
+		flushStats.reset();
+		bool createdTransaction = false;
+		fileStorage->tryStartTransaction(createdTransaction);
+		EXPECT_TRUE(createdTransaction);
+
+		std::vector<uint8_t> buffer(20000, static_cast<uint8_t>(0x30 + commitIndex));
+		for (int i = 0; i < 8; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "dir/file%d_%d.bin", commitIndex, i);
+			FileHandle file;
+			err = fileStorage->openFile(file, filePath, "wb");
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			size_t sizeWritten = 0;
+			err = file.write(buffer.data(), buffer.size(), sizeWritten);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			err = file.close();
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		err = fileStorage->endTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(flushStats.mCountLogSyncs, 1);
+		EXPECT_EQ(flushStats.mCountFATDataSyncs, 1);
+		EXPECT_EQ(flushStats.mCountClusterDataSyncs, 1);
+
+		// The commit left nothing to be synced.
+		flushStats.reset();
+		err = volumeManager.flush();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(flushStats.getCountSyncs(), 0);
+	}
+}
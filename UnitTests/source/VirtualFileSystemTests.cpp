@@ -8,6 +8,8 @@
 #include "SplitFAT/VolumeManager.h"
 #include "SplitFAT/FileDescriptorRecord.h"
 #include "SplitFAT/FileManipulator.h"
+#include "SplitFAT/DataBlockManager.h"
+#include "SplitFAT/WarmCacheManifest.h"
 #include "SplitFAT/utils/PathString.h"
 #include "WindowsSplitFATConfiguration.h"
 #include <memory>
@@ -867,6 +869,200 @@ TEST_F(VirtualFileSystemTests, FileOrDirectoryExists) {
 }
 
 
+/// Tests that a missing name is found in the negative-lookup cache the second time, and is forgotten when such entity is created or renamed.
+TEST_F(VirtualFileSystemTests, NegativeLookupsAreCached) {
+	removeVolume();
+
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		NegativeLookupCache& negativeLookupCache = vfs.mNegativeLookupCache;
+
+		{
+			FileManipulator dirFM;
+			ErrorCode err = vfs.createDirectory("/some_dir", dirFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			// The empty directories are not scanned anyway.
+			FileManipulator fileFM;
+			err = vfs.createFile("/some_dir/a_file.bin", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		EXPECT_FALSE(vfs.fileExists("/some_dir/optional.cfg"));
+		EXPECT_EQ(negativeLookupCache.getCountHits(), 0u);
+		EXPECT_FALSE(vfs.fileExists("/some_dir/Optional.CFG"));
+		EXPECT_EQ(negativeLookupCache.getCountHits(), 1u);
+
+		{
+			FileManipulator fileFM;
+			ErrorCode err = vfs.createFile("/some_dir/optional.cfg", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+		EXPECT_TRUE(vfs.fileExists("/some_dir/OPTIONAL.cfg"));
+
+		EXPECT_FALSE(vfs.fileExists("/some_dir/renamed.cfg"));
+		EXPECT_FALSE(vfs.fileExists("/some_dir/renamed.cfg"));
+		ErrorCode err = vfs.renameFile("/some_dir/optional.cfg", "renamed.cfg");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_TRUE(vfs.fileExists("/some_dir/renamed.cfg"));
+		EXPECT_FALSE(vfs.fileExists("/some_dir/optional.cfg"));
+
+		// Forgotten when the transaction is reverted, the same way as after a failed commit.
+		err = vfs.startTransaction();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.deleteFile("/some_dir/renamed.cfg");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(vfs.fileExists("/some_dir/renamed.cfg"));
+		EXPECT_GT(negativeLookupCache.getCountEntries(), 0u);
+		TransactionEventsLog& transaction = vfs.mVolumeManager.mTransaction;
+		err = transaction._finalizeTransacion();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = transaction._restoreFromTransactionFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.mVolumeManager.getLowLevelFileAccess().cleanupTransactionFinalFile();
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(negativeLookupCache.getCountEntries(), 0u);
+		EXPECT_TRUE(vfs.fileExists("/some_dir/renamed.cfg"));
+	}
+
+	// The oldest names are forgotten when the cache is full.
+	NegativeLookupCache cache(4);
+	for (uint32_t i = 0; i < 6; ++i) {
+		cache.add(10, std::to_string(i), cache.getGeneration());
+	}
+	EXPECT_EQ(cache.getCountEntries(), 4u);
+	EXPECT_FALSE(cache.contains(10, "1"));
+	EXPECT_TRUE(cache.contains(10, "5"));
+	EXPECT_FALSE(cache.contains(11, "5"));
+	// Not added, if anything was invalidated after the directory was scanned.
+	const uint32_t generation = cache.getGeneration();
+	cache.invalidate(10, "5");
+	cache.add(10, "7", generation);
+	EXPECT_FALSE(cache.contains(10, "5"));
+	EXPECT_FALSE(cache.contains(10, "7"));
+}
+
+TEST_F(VirtualFileSystemTests, WarmCacheIsPrefetchedOnMount) {
+	removeVolume();
+
+	const uint32_t countFileClusters = 8;
+	size_t fileSize = 0;
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		fileSize = countFileClusters * vfs.mVolumeManager.getClusterSize();
+
+		FileManipulator dirFM;
+		ErrorCode err = vfs.createDirectory("/levels", dirFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		FileManipulator fileFM;
+		err = vfs.createFile("/levels/level.dat", AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		std::vector<uint8_t> buffer(fileSize, 0x3C);
+		size_t bytesWritten = 0;
+		err = vfs.write(fileFM, buffer.data(), buffer.size(), bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.flush(fileFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		// The file data is cached on read.
+		FileManipulator readFM;
+		err = vfs.createGenericFileManipulatorForFilePath("/levels/level.dat", readFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		readFM.mAccessMode = AccessMode::AM_READ;
+		size_t bytesRead = 0;
+		err = vfs.read(readFM, buffer.data(), buffer.size(), bytesRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesRead, fileSize);
+	}
+
+	// The manifest is written on clean shutdown. Simulate a change of the first range since then.
+	uint32_t countManifestClusters = 0;
+	uint32_t countChangedClusters = 0;
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		WarmCacheManifest manifest;
+		FileHandle file;
+		err = lowLevelFileAccess->tryOpenWarmCacheManifest(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_TRUE(file.isOpen());
+		err = manifest.read(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.close();
+
+		ASSERT_FALSE(manifest.getRanges().empty());
+		for (const auto& range : manifest.getRanges()) {
+			countManifestClusters += range.mCountClusters;
+		}
+		EXPECT_GE(countManifestClusters, countFileClusters);
+		countChangedClusters = manifest.getRanges().front().mCountClusters;
+		manifest.getRanges().front().mFATChecksum ^= 1;
+
+		err = lowLevelFileAccess->createWarmCacheManifest(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = manifest.write(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.close();
+	}
+
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		VolumeManager& volumeManager = vfs.mVolumeManager;
+		EXPECT_EQ(volumeManager.waitForWarmCachePrefetch(), countManifestClusters - countChangedClusters);
+
+		// The manifest is used only once.
+		FileHandle file;
+		ErrorCode err = volumeManager.getLowLevelFileAccess().tryOpenWarmCacheManifest(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_FALSE(file.isOpen());
+
+		// Only the changed clusters are read from the storage.
+		uint32_t countStorageReads = volumeManager.getDataBlockManager().getCountStorageReads();
+		FileManipulator fileFM;
+		err = vfs.createGenericFileManipulatorForFilePath("/levels/level.dat", fileFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		fileFM.mAccessMode = AccessMode::AM_READ;
+		std::vector<uint8_t> buffer(fileSize);
+		size_t bytesRead = 0;
+		err = vfs.read(fileFM, buffer.data(), buffer.size(), bytesRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesRead, fileSize);
+		EXPECT_LE(volumeManager.getDataBlockManager().getCountStorageReads() - countStorageReads, countChangedClusters);
+	}
+
+	// Nothing is prefetched if the manifest was written for another state of the volume.
+	{
+		std::shared_ptr<WindowsSplitFATConfiguration> lowLevelFileAccess = std::make_shared<WindowsSplitFATConfiguration>();
+		ErrorCode err = lowLevelFileAccess->setup(kVolumeControlAndFATDataFilePath, kClusterDataFilePath, kTransactionFilePath);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+		WarmCacheManifest manifest;
+		FileHandle file;
+		err = lowLevelFileAccess->tryOpenWarmCacheManifest(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_TRUE(file.isOpen());
+		err = manifest.read(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.close();
+
+		manifest.setVolumeStamp(manifest.getVolumeStamp() + 1);
+		err = lowLevelFileAccess->createWarmCacheManifest(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = manifest.write(file);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		file.close();
+	}
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		EXPECT_EQ(vfs.mVolumeManager.waitForWarmCachePrefetch(), 0u);
+	}
+}
+
 TEST_F(VirtualFileSystemTests, isDirectoryEmpty) {
 	removeVolume();
 
@@ -1405,3 +1601,173 @@ TEST_F(VirtualFileSystemTests, MoveClusterNoTransaction) {
 	}
 
 }
+
+/// Tests that two files written at the same time don't fragment each other.
+TEST_F(VirtualFileSystemTests, InterleavedWritersKeepClustersContiguous) {
+	removeVolume();
+
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		VolumeManager &volumeManager = vfs.mVolumeManager;
+		const uint32_t clusterSize = volumeManager.getClusterSize();
+		const uint32_t countFiles = 2;
+		const uint32_t countClustersPerFile = 40;
+
+		std::vector<uint8_t> writeBuffer(clusterSize, 0x5A);
+		FileManipulator fileFM[countFiles];
+		for (uint32_t i = 0; i < countFiles; ++i) {
+			char filePath[50];
+			snprintf(filePath, sizeof(filePath), "/interleaved%u.bin", i);
+			ErrorCode err = vfs.createFile(filePath, AccessMode::AM_BINARY | AccessMode::AM_WRITE, true, fileFM[i]);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		}
+
+		// Write cluster by cluster, switching the file every time.
+		for (uint32_t clusterIndex = 0; clusterIndex < countClustersPerFile; ++clusterIndex) {
+			for (uint32_t i = 0; i < countFiles; ++i) {
+				size_t bytesWritten = 0;
+				ErrorCode err = vfs.write(fileFM[i], writeBuffer.data(), writeBuffer.size(), bytesWritten);
+				EXPECT_EQ(err, ErrorCode::RESULT_OK);
+				EXPECT_EQ(bytesWritten, writeBuffer.size());
+			}
+		}
+
+		for (uint32_t i = 0; i < countFiles; ++i) {
+			ErrorCode err = vfs.flush(fileFM[i]);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+
+			ClusterChainVector clusterChain;
+			err = vfs._loadClusterChain(fileFM[i].getFileDescriptorRecord().mStartCluster, clusterChain);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			ASSERT_EQ(clusterChain.size(), countClustersPerFile);
+
+			uint32_t countFragments = 1;
+			for (size_t j = 1; j < clusterChain.size(); ++j) {
+				if (clusterChain[j].mClusterIndex != clusterChain[j - 1].mClusterIndex + 1) {
+					++countFragments;
+				}
+			}
+			// Every reserved window keeps at least 16 clusters together.
+			EXPECT_LE(countFragments, (countClustersPerFile + 15) / 16);
+		}
+	}
+}
+
+/// Tests that the free clusters for a file are never taken from the allocation window of another file, whatever the allocation pattern.
+TEST_F(VirtualFileSystemTests, AllocationsSkipWindowsOfOtherFiles) {
+	removeVolume();
+
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		DataPlacementStrategyBase& strategy = *vfs.mDefragmentation;
+
+		// The first allocation of a sequentially written file reserves a window after the found cluster.
+		AllocationContext windowContext(ClusterValues::INVALID_VALUE, true);
+		windowContext.mDescriptorClusterIndex = 1;
+		windowContext.mRecordIndex = 0;
+		windowContext.mPattern = AllocationPattern::AP_SEQUENTIAL;
+		ClusterIndexType windowStartClusterIndex = ClusterValues::INVALID_VALUE;
+		ErrorCode err = strategy.findFreeCluster(windowStartClusterIndex, windowContext);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_TRUE(isValidClusterIndex(windowStartClusterIndex));
+		// Every sequential window has at least 16 clusters.
+		const ClusterIndexType windowEndClusterIndex = windowStartClusterIndex + 16;
+
+		const AllocationPattern patterns[] = { AllocationPattern::AP_UNKNOWN, AllocationPattern::AP_RANDOM, AllocationPattern::AP_SEQUENTIAL };
+		for (uint32_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+			AllocationContext otherContext(ClusterValues::INVALID_VALUE, true);
+			otherContext.mDescriptorClusterIndex = 1;
+			otherContext.mRecordIndex = 1 + i;
+			otherContext.mPattern = patterns[i];
+			ClusterIndexType clusterIndex = ClusterValues::INVALID_VALUE;
+			err = strategy.findFreeCluster(clusterIndex, otherContext);
+			EXPECT_EQ(err, ErrorCode::RESULT_OK);
+			ASSERT_TRUE(isValidClusterIndex(clusterIndex));
+			EXPECT_TRUE((clusterIndex < windowStartClusterIndex) || (clusterIndex >= windowEndClusterIndex));
+		}
+
+		// The window is still there for the file it was reserved for.
+		windowContext.mLastCluster = windowStartClusterIndex;
+		ClusterIndexType nextClusterIndex = ClusterValues::INVALID_VALUE;
+		err = strategy.findFreeCluster(nextClusterIndex, windowContext);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(nextClusterIndex, windowStartClusterIndex + 1);
+	}
+}
+
+/// Tests that the FileManipulators of the same file share its size, chain and name.
+TEST_F(VirtualFileSystemTests, HandlesOfSameFileShareState) {
+	removeVolume();
+
+	{
+		VirtualFileSystem vfs;
+		createVirtualFileSystem(vfs);
+		const uint32_t clusterSize = vfs.mVolumeManager.getClusterSize();
+
+		FileManipulator writerFM;
+		ErrorCode err = vfs.createFile("/shared.bin", AccessMode::AM_BINARY | AccessMode::AM_READ | AccessMode::AM_WRITE, true, writerFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		// Created before anything is written.
+		FileManipulator readerFM;
+		err = vfs.createGenericFileManipulatorForFilePath("/shared.bin", readerFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_TRUE(readerFM.isValid());
+		readerFM.mAccessMode = AccessMode::AM_BINARY | AccessMode::AM_READ | AccessMode::AM_WRITE;
+		EXPECT_EQ(readerFM.getFileSize(), 0u);
+
+		std::vector<uint8_t> writeBuffer(3 * clusterSize);
+		for (size_t i = 0; i < writeBuffer.size(); ++i) {
+			writeBuffer[i] = static_cast<uint8_t>(i * 7);
+		}
+		size_t bytesWritten = 0;
+		err = vfs.write(writerFM, writeBuffer.data(), writeBuffer.size(), bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesWritten, writeBuffer.size());
+		ASSERT_NE(writerFM.mOpenFileState, nullptr);
+
+		// The size written through the other file-manipulator is known on reading.
+		std::vector<uint8_t> readBuffer(writeBuffer.size());
+		size_t bytesRead = 0;
+		err = vfs.read(readerFM, readBuffer.data(), readBuffer.size(), bytesRead);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(bytesRead, writeBuffer.size());
+		EXPECT_TRUE(readBuffer == writeBuffer);
+		EXPECT_EQ(readerFM.mOpenFileState, writerFM.mOpenFileState);
+		EXPECT_EQ(vfs.mOpenFiles.getCountOpenFiles(), 1u);
+
+		// Truncated through one and appended through the other.
+		err = vfs.truncateFile(readerFM, clusterSize);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.seek(writerFM, 0, SeekMode::SM_END);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.write(writerFM, writeBuffer.data(), clusterSize, bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(writerFM.getFileSize(), 2 * clusterSize);
+
+		// Writing through a file-manipulator created before the renaming keeps the new name.
+		err = vfs.renameFile("/shared.bin", "renamed.bin");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		err = vfs.write(writerFM, writeBuffer.data(), clusterSize, bytesWritten);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_TRUE(vfs.fileExists("/renamed.bin"));
+		EXPECT_FALSE(vfs.fileExists("/shared.bin"));
+
+		FileManipulator checkFM;
+		err = vfs.createGenericFileManipulatorForFilePath("/renamed.bin", checkFM);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		ASSERT_TRUE(checkFM.isValid());
+		EXPECT_EQ(checkFM.getFileSize(), 3 * clusterSize);
+		ClusterChainVector clusterChain;
+		err = vfs._loadClusterChain(checkFM.getStartCluster(), clusterChain);
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_EQ(clusterChain.size(), 3u);
+
+		// A new file at the same location doesn't get the state of the deleted one.
+		err = vfs.deleteFile("/renamed.bin");
+		EXPECT_EQ(err, ErrorCode::RESULT_OK);
+		EXPECT_TRUE(writerFM.mOpenFileState->isRemoved());
+		EXPECT_EQ(vfs.mOpenFiles.getCountOpenFiles(), 0u);
+	}
+}